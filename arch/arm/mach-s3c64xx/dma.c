@@ -23,6 +23,8 @@
 #include <linux/clk.h>
 #include <linux/err.h>
 #include <linux/io.h>
+#include <linux/platform_device.h>
+#include <linux/dma-mapping.h>
 
 #include <mach/dma.h>
 #include <mach/map.h>
@@ -164,7 +166,14 @@ static void s3c64xx_dma_fill_lli(struct s3c2410_dma_chan *chan,
 		BUG();
 	}
 
-	/* note, we do not currently setup any of the burst controls */
+	/* note, we do not currently setup any of the burst controls for
+	 * peripherals, a memory to memory transfer is paced by the DMAC
+	 * itself so let it use bursts. */
+
+	if (chan->flags & S3C64XX_DMAF_M2M) {
+		control0 |= PL080_BSIZE_4 << PL080_CONTROL_SB_SIZE_SHIFT;
+		control0 |= PL080_BSIZE_4 << PL080_CONTROL_DB_SIZE_SHIFT;
+	}
 
 	control1 = size >> chan->hw_width;	/* size in no of xfers */
 	control0 |= PL080_CONTROL_PROT_SYS;	/* always in priv. mode */
@@ -327,6 +336,82 @@ int s3c2410_dma_ctrl(enum dma_ch channel, enum s3c2410_chan_op op)
 }
 EXPORT_SYMBOL(s3c2410_dma_ctrl);
 
+/* s3c64xx_dma_get_phys
+ *
+ * lend a free physical channel on controller dmac to the dmaengine
+ * driver, which takes the channel interrupts through irq_fn.
+*/
+
+struct s3c2410_dma_chan *s3c64xx_dma_get_phys(unsigned int dmac,
+	void (*irq_fn)(struct s3c2410_dma_chan *, enum s3c2410_dma_buffresult),
+	void *irq_data)
+{
+	struct s3c2410_dma_chan *chan;
+	unsigned long flags;
+	unsigned int offs;
+
+	local_irq_save(flags);
+
+	for (offs = 0; offs < 8; offs++) {
+		chan = &s3c2410_chans[dmac * 8 + offs];
+		if (!chan->in_use)
+			goto found;
+	}
+
+	local_irq_restore(flags);
+	return NULL;
+
+found:
+	chan->in_use = 1;
+	chan->irq_fn = irq_fn;
+	chan->irq_data = irq_data;
+
+	local_irq_restore(flags);
+
+	return chan;
+}
+EXPORT_SYMBOL(s3c64xx_dma_get_phys);
+
+void s3c64xx_dma_put_phys(struct s3c2410_dma_chan *chan)
+{
+	unsigned long flags;
+
+	s3c64xx_dma_abort_phys(chan);
+
+	local_irq_save(flags);
+	chan->irq_fn = NULL;
+	chan->irq_data = NULL;
+	chan->in_use = 0;
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(s3c64xx_dma_put_phys);
+
+void s3c64xx_dma_start_phys(struct s3c2410_dma_chan *chan)
+{
+	s3c64xx_dma_start(chan);
+}
+EXPORT_SYMBOL(s3c64xx_dma_start_phys);
+
+/* s3c64xx_dma_abort_phys
+ *
+ * disable the channel straight away, dropping whatever is still in the
+ * fifo, and clear any interrupt it has pending.
+*/
+
+void s3c64xx_dma_abort_phys(struct s3c2410_dma_chan *chan)
+{
+	struct s3c64xx_dmac *dmac = chan->dmac;
+	u32 config;
+
+	config = readl(chan->regs + PL080S_CH_CONFIG);
+	config &= ~PL080_CONFIG_ENABLE;
+	writel(config, chan->regs + PL080S_CH_CONFIG);
+
+	writel(chan->bit, dmac->regs + PL080_TC_CLEAR);
+	writel(chan->bit, dmac->regs + PL080_ERR_CLEAR);
+}
+EXPORT_SYMBOL(s3c64xx_dma_abort_phys);
+
 /* s3c2410_dma_enque
  *
  */
@@ -450,6 +535,13 @@ int s3c2410_dma_devconfig(enum dma_ch channel,
 		return -EINVAL;
 	}
 
+	/* memory to memory, the device address is not a peripheral FIFO
+	 * with a request line but something like a memory mapped buffer */
+	if (chan->flags & S3C64XX_DMAF_M2M)
+		config &= ~(PL080_CONFIG_FLOW_CONTROL_MASK |
+			    PL080_CONFIG_SRC_SEL_MASK |
+			    PL080_CONFIG_DST_SEL_MASK);
+
 	/* allow TC and ERR interrupts */
 	config |= PL080_CONFIG_TC_IRQ_MASK;
 	config |= PL080_CONFIG_ERR_IRQ_MASK;
@@ -593,6 +685,12 @@ static irqreturn_t s3c64xx_dma_irq(int irq, void *pw)
 		if (errstat & bit)
 			writel(bit, dmac->regs + PL080_ERR_CLEAR);
 
+		/* lent to the dmaengine driver, which has no buffer queue */
+		if (chan->irq_fn) {
+			chan->irq_fn(chan, res);
+			continue;
+		}
+
 		/* 'next' points to the buffer that is next to the
 		 * currently active buffer.
 		 * For CIRCULAR queues, 'next' will be same as 'curr'
@@ -631,6 +729,18 @@ static irqreturn_t s3c64xx_dma_irq(int irq, void *pw)
 	return IRQ_HANDLED;
 }
 
+/* device for the dmaengine driver to hang its channels and mappings on */
+static u64 s3c64xx_dma_dmamask = DMA_BIT_MASK(32);
+
+static struct platform_device s3c64xx_device_dma = {
+	.name		= "s3c64xx-dma",
+	.id		= -1,
+	.dev		= {
+		.dma_mask		= &s3c64xx_dma_dmamask,
+		.coherent_dma_mask	= DMA_BIT_MASK(32),
+	},
+};
+
 static struct sysdev_class dma_sysclass = {
 	.name		= "s3c64xx-dma",
 };
@@ -746,6 +856,11 @@ static int __init s3c64xx_dma_init(void)
 	s3c64xx_dma_init1(0, DMACH_UART0, IRQ_DMA0, 0x75000000);
 	s3c64xx_dma_init1(8, DMACH_PCM1_TX, IRQ_DMA1, 0x75100000);
 
+	ret = platform_device_register(&s3c64xx_device_dma);
+	if (ret)
+		printk(KERN_ERR "%s: failed to register dmaengine device\n",
+		       __func__);
+
 	return 0;
 }
 
@@ -55,6 +55,9 @@ enum dma_ch {
 	DMACH_RES2,
 	DMACH_SECURITY_RX,	/* SDMA1 only */
 	DMACH_SECURITY_TX,	/* SDMA1 only */
+
+	/* Memory to memory on DMA1, no request line */
+	DMACH_ONENAND,
 	DMACH_MAX		/* the end */
 };
 
@@ -64,6 +67,7 @@ static __inline__ bool s3c_dma_has_circular(void)
 }
 
 #define S3C2410_DMAF_CIRCULAR		(1 << 0)
+#define S3C64XX_DMAF_M2M		(1 << 1)	/* no request line */
 
 #include <plat/dma.h>
 
@@ -120,8 +124,31 @@ struct s3c2410_dma_chan {
 	 * and the last buffer hardware descriptor points back to the
 	 * first.
 	 */
+
+	/* set while the channel is lent out by s3c64xx_dma_get_phys() */
+	void			(*irq_fn)(struct s3c2410_dma_chan *,
+					  enum s3c2410_dma_buffresult);
+	void			*irq_data;
 };
 
+/* Raw access to the physical channels for the dmaengine driver, the
+ * channels come from the same pool as s3c2410_dma_request(). The
+ * caller programs the channel registers itself and gets irq_fn called
+ * from the controller interrupt with the status already cleared.
+ */
+extern struct s3c2410_dma_chan *s3c64xx_dma_get_phys(unsigned int dmac,
+	void (*irq_fn)(struct s3c2410_dma_chan *, enum s3c2410_dma_buffresult),
+	void *irq_data);
+extern void s3c64xx_dma_put_phys(struct s3c2410_dma_chan *chan);
+extern void s3c64xx_dma_start_phys(struct s3c2410_dma_chan *chan);
+extern void s3c64xx_dma_abort_phys(struct s3c2410_dma_chan *chan);
+
+/* dmaengine channels are picked by request line, pass the DMACH_ number
+ * as the filter parameter to dma_request_channel(). DMACH_ONENAND has no
+ * request line and is only good for memcpy. */
+struct dma_chan;
+extern bool s3c64xx_dma_filter(struct dma_chan *chan, void *param);
+
 #include <plat/dma-core.h>
 
 #endif /* __ASM_ARCH_IRQ_H */
@@ -37,6 +37,7 @@
 #include <linux/switch.h>
 #include <linux/fsa9480.h>
 #include <linux/clk.h>
+#include <linux/memblock.h>
 #include <linux/mmc/host.h>
 #include <linux/gpio_keys.h>
 #include <linux/mtd/mtd.h>
@@ -594,7 +595,14 @@ static struct i2c_board_info spica_touch_i2c_devs[] __initdata = {
 };
 
 /*
- * Reserved memory (FIXME: Throw this shit away!)
+ * Reserved memory
+ *
+ * The PMEM regions live in a pool at the top of DRAM that is lent to the
+ * page allocator for movable pages whenever it is not in use. pmem claims
+ * a region back, migrating those pages away, when a client allocates it,
+ * so each region keeps a fixed physical address without pinning memory
+ * while the camera, video or GPU are idle. Only the RAM console, which
+ * must survive a reboot, is still carved out.
  */
 
 #define	PHYS_SIZE			(SZ_128M + SZ_64M + SZ_16M)
@@ -602,26 +610,24 @@ static struct i2c_board_info spica_touch_i2c_devs[] __initdata = {
 #define DRAM_END_ADDR 			(PHYS_OFFSET + PHYS_SIZE)
 #define RESERVED_PMEM_END_ADDR 		(DRAM_END_ADDR)
 
-#define RESERVED_MEM_CMM		(SZ_2M + SZ_1M)
-#define RESERVED_MEM_MFC		(SZ_4M + SZ_2M)
 /* PMEM_PIC and MFC use share area */
 #define RESERVED_PMEM_PICTURE		(SZ_4M + SZ_2M)
 #define RESERVED_PMEM_JPEG		(SZ_2M + SZ_1M)
 #define RESERVED_PMEM_PREVIEW		(SZ_2M)
 #define RESERVED_PMEM_RENDER	  	(SZ_2M)
 #define RESERVED_PMEM_STREAM	  	(SZ_2M)
-/* G3D is shared with uppper memory areas */
 #define RAM_CONSOLE_SIZE		(SZ_2M)
+/* G3D is shared with PMEM_GPU1 */
 #define RESERVED_G3D			(SZ_16M + SZ_8M + SZ_4M + SZ_2M)
 #define RESERVED_PMEM_GPU1		(RESERVED_G3D)
 #define RESERVED_PMEM			(SZ_8M)
+/* all of the above but the RAM console, rounded up to whole pageblocks */
+#define RESERVED_PMEM_POOL		(SZ_32M + SZ_16M + SZ_8M)
 
-#define CMM_RESERVED_MEM_START		(RESERVED_PMEM_END_ADDR \
-					- RESERVED_MEM_CMM)
-#define MFC_RESERVED_MEM_START		(CMM_RESERVED_MEM_START \
-					- RESERVED_MEM_MFC)
-#define PICTURE_RESERVED_PMEM_START	(MFC_RESERVED_MEM_START)
-#define JPEG_RESERVED_PMEM_START	(MFC_RESERVED_MEM_START \
+#define PICTURE_RESERVED_PMEM_START	(RESERVED_PMEM_END_ADDR \
+					- RESERVED_PMEM_PICTURE)
+#define MFC_RESERVED_MEM_START		(PICTURE_RESERVED_PMEM_START)
+#define JPEG_RESERVED_PMEM_START	(PICTURE_RESERVED_PMEM_START \
 					- RESERVED_PMEM_JPEG)
 #define PREVIEW_RESERVED_PMEM_START	(JPEG_RESERVED_PMEM_START \
 					- RESERVED_PMEM_PREVIEW)
@@ -629,15 +635,15 @@ static struct i2c_board_info spica_touch_i2c_devs[] __initdata = {
 					- RESERVED_PMEM_RENDER)
 #define STREAM_RESERVED_PMEM_START	(RENDER_RESERVED_PMEM_START \
 					- RESERVED_PMEM_STREAM)
-/* G3D is shared with uppper memory areas */
-#define RAM_CONSOLE_START		(RESERVED_PMEM_END_ADDR \
-					- RAM_CONSOLE_SIZE)
-#define G3D_RESERVED_START		(RAM_CONSOLE_START \
+#define G3D_RESERVED_START		(STREAM_RESERVED_PMEM_START \
 					- RESERVED_G3D)
 #define GPU1_RESERVED_PMEM_START	(G3D_RESERVED_START)
 #define RESERVED_PMEM_START		(GPU1_RESERVED_PMEM_START \
 					- RESERVED_PMEM)
-#define PHYS_UNRESERVED_SIZE		(RESERVED_PMEM_START - PHYS_OFFSET)
+#define PMEM_POOL_START			(RESERVED_PMEM_END_ADDR \
+					- RESERVED_PMEM_POOL)
+#define RAM_CONSOLE_START		(PMEM_POOL_START \
+					- RAM_CONSOLE_SIZE)
 
 /*
  * Android PMEM
@@ -649,6 +655,7 @@ static struct android_pmem_platform_data pmem_pdata = {
 	.no_allocator	= 1,
 	.cached		= 1,
 	.buffered	= 1,
+	.movable	= 1,
 	.start		= RESERVED_PMEM_START,
 	.size		= RESERVED_PMEM,
 };
@@ -658,6 +665,7 @@ static struct android_pmem_platform_data pmem_gpu1_pdata = {
 	.no_allocator	= 0,
 	.cached		= 1,
 	.buffered	= 1,
+	.movable	= 1,
 	.start		= GPU1_RESERVED_PMEM_START,
 #ifndef USE_SAMSUNG_G3D
 	.size		= RESERVED_PMEM_GPU1,
@@ -668,6 +676,7 @@ static struct android_pmem_platform_data pmem_render_pdata = {
 	.name		= "pmem_render",
 	.no_allocator	= 1,
 	.cached		= 0,
+	.movable	= 1,
 	.start		= RENDER_RESERVED_PMEM_START,
 	.size		= RESERVED_PMEM_RENDER,
 };
@@ -676,6 +685,7 @@ static struct android_pmem_platform_data pmem_stream_pdata = {
 	.name		= "pmem_stream",
 	.no_allocator	= 1,
 	.cached		= 0,
+	.movable	= 1,
 	.start		= STREAM_RESERVED_PMEM_START,
 	.size		= RESERVED_PMEM_STREAM,
 };
@@ -684,6 +694,7 @@ static struct android_pmem_platform_data pmem_preview_pdata = {
 	.name		= "pmem_preview",
 	.no_allocator	= 1,
 	.cached		= 0,
+	.movable	= 1,
         .start		= PREVIEW_RESERVED_PMEM_START,
         .size		= RESERVED_PMEM_PREVIEW,
 };
@@ -692,6 +703,7 @@ static struct android_pmem_platform_data pmem_picture_pdata = {
 	.name		= "pmem_picture",
 	.no_allocator	= 1,
 	.cached		= 0,
+	.movable	= 1,
         .start		= PICTURE_RESERVED_PMEM_START,
         .size		= RESERVED_PMEM_PICTURE,
 };
@@ -700,6 +712,7 @@ static struct android_pmem_platform_data pmem_jpeg_pdata = {
 	.name		= "pmem_jpeg",
 	.no_allocator	= 1,
 	.cached		= 0,
+	.movable	= 1,
         .start		= JPEG_RESERVED_PMEM_START,
         .size		= RESERVED_PMEM_JPEG,
 };
@@ -759,6 +772,14 @@ static struct platform_device *pmem_devices[] = {
 static void __init spica_add_mem_devices(void)
 {
 	unsigned i;
+
+#ifdef CONFIG_CMA
+	/* Lend the pool to the page allocator until pmem claims it */
+	if (init_cma_reserved_range(__phys_to_pfn(PMEM_POOL_START),
+				RESERVED_PMEM_POOL >> PAGE_SHIFT))
+		printk(KERN_ERR "%s: unable to release PMEM pool\n", __func__);
+#endif
+
 	for (i = 0; i < ARRAY_SIZE(pmem_devices); ++i)
 		if (pmem_devices[i]->dev.platform_data) {
 			struct android_pmem_platform_data *pmem =
@@ -2121,13 +2142,25 @@ static struct s3c_pin_cfg_entry spica_slp_config[] __initdata = {
 static void __init spica_fixup(struct machine_desc *desc,
 		struct tag *tags, char **cmdline, struct meminfo *mi)
 {
-	mi->nr_banks = 2;
+	mi->nr_banks = 3;
 
 	mi->bank[0].start = PHYS_OFFSET;
 	mi->bank[0].size = SZ_128M;
 
 	mi->bank[1].start = PHYS_OFFSET + SZ_128M;
-	mi->bank[1].size = PHYS_UNRESERVED_SIZE - SZ_128M;
+	mi->bank[1].size = RAM_CONSOLE_START - PHYS_OFFSET - SZ_128M;
+
+	/* RAM console is left out */
+	mi->bank[2].start = PMEM_POOL_START;
+	mi->bank[2].size = RESERVED_PMEM_POOL;
+}
+
+static void __init spica_reserve(void)
+{
+#ifdef CONFIG_ANDROID_PMEM
+	/* Kept away from early allocations, see spica_add_mem_devices() */
+	memblock_reserve(PMEM_POOL_START, RESERVED_PMEM_POOL);
+#endif
 }
 
 static void __init spica_map_io(void)
@@ -2226,6 +2259,7 @@ MACHINE_START(GT_I5700, "Spica")
 	.boot_params	= S3C64XX_PA_SDRAM + 0x100,
 	.init_irq	= s3c6410_init_irq,
 	.fixup		= spica_fixup,
+	.reserve	= spica_reserve,
 	.map_io		= spica_map_io,
 	.init_machine	= spica_machine_init,
 	.timer		= &s3c64xx_timer,
@@ -0,0 +1,814 @@
+/* linux/drivers/dma/s3c64xx-dma.c
+ *
+ * S3C64XX PL080 DMA engine support
+ *
+ * The two PL080S controllers are shared with the buffer queue API in
+ * arch/arm/mach-s3c64xx/dma.c. A dmaengine channel exists for every
+ * request line and borrows a physical channel from the same pool while
+ * it is allocated. Each transfer is built as one linked list of LLIs:
+ * a scatterlist raises a single interrupt at its end and a cyclic
+ * transfer one per period.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+*/
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/interrupt.h>
+#include <linux/platform_device.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
+#include <linux/slab.h>
+#include <linux/io.h>
+
+#include <mach/dma.h>
+
+#include <asm/sizes.h>
+#include <asm/hardware/pl080.h>
+
+/* most bytes moved by one LLI, longer runs are split */
+#define S3C64XX_DMA_LLI_BYTES	SZ_1M
+
+struct s3c64xx_dma_desc {
+	struct dma_async_tx_descriptor	txd;
+	struct list_head		node;
+
+	struct pl080s_lli		*lli;
+	dma_addr_t			lli_phys;
+	unsigned int			lli_cnt;
+	unsigned int			lli_max;
+
+	size_t				len;
+	u32				config;
+	unsigned int			width;
+	bool				cyclic;
+	bool				dst_incr;
+};
+
+struct s3c64xx_dma_chan {
+	struct dma_chan			chan;
+	enum dma_ch			id;
+	struct s3c2410_dma_chan		*phys;
+
+	spinlock_t			lock;
+	struct list_head		queue;		/* submitted */
+	struct list_head		done;		/* callback pending */
+	struct s3c64xx_dma_desc		*active;
+	struct tasklet_struct		tasklet;
+	dma_cookie_t			completed;
+	unsigned int			periods;	/* not yet reported */
+
+	/* slave configuration */
+	dma_addr_t			src_addr;
+	dma_addr_t			dst_addr;
+	unsigned int			src_width;
+	unsigned int			dst_width;
+	u32				src_burst;
+	u32				dst_burst;
+};
+
+struct s3c64xx_dma {
+	struct dma_device		dma;
+	struct s3c64xx_dma_chan		chans[DMACH_MAX];
+};
+
+static struct platform_driver s3c64xx_dma_driver;
+
+static dma_cookie_t s3c64xx_dma_tx_submit(struct dma_async_tx_descriptor *txd);
+
+static inline struct s3c64xx_dma_chan *to_s3c64xx_chan(struct dma_chan *chan)
+{
+	return container_of(chan, struct s3c64xx_dma_chan, chan);
+}
+
+static inline struct s3c64xx_dma_desc *
+to_s3c64xx_desc(struct dma_async_tx_descriptor *txd)
+{
+	return container_of(txd, struct s3c64xx_dma_desc, txd);
+}
+
+static inline struct device *chan2dev(struct s3c64xx_dma_chan *c)
+{
+	return c->chan.device->dev;
+}
+
+bool s3c64xx_dma_filter(struct dma_chan *chan, void *param)
+{
+	if (chan->device->dev->driver != &s3c64xx_dma_driver.driver)
+		return false;
+
+	return to_s3c64xx_chan(chan)->id == (unsigned long)param;
+}
+EXPORT_SYMBOL(s3c64xx_dma_filter);
+
+/* descriptors */
+
+static struct s3c64xx_dma_desc *s3c64xx_dma_desc_get(struct s3c64xx_dma_chan *c,
+						     unsigned int lli_max)
+{
+	struct s3c64xx_dma_desc *desc;
+
+	desc = kzalloc(sizeof(struct s3c64xx_dma_desc), GFP_NOWAIT);
+	if (!desc)
+		return NULL;
+
+	desc->lli = kcalloc(lli_max, sizeof(struct pl080s_lli), GFP_NOWAIT);
+	if (!desc->lli) {
+		kfree(desc);
+		return NULL;
+	}
+
+	desc->lli_max = lli_max;
+	INIT_LIST_HEAD(&desc->node);
+
+	return desc;
+}
+
+static void s3c64xx_dma_desc_put(struct s3c64xx_dma_chan *c,
+				 struct s3c64xx_dma_desc *desc)
+{
+	if (desc->lli_phys)
+		dma_unmap_single(chan2dev(c), desc->lli_phys,
+				 desc->lli_max * sizeof(struct pl080s_lli),
+				 DMA_TO_DEVICE);
+	kfree(desc->lli);
+	kfree(desc);
+}
+
+static void s3c64xx_dma_desc_put_list(struct s3c64xx_dma_chan *c,
+				      struct list_head *list)
+{
+	struct s3c64xx_dma_desc *desc, *tmp;
+
+	list_for_each_entry_safe(desc, tmp, list, node) {
+		list_del(&desc->node);
+		s3c64xx_dma_desc_put(c, desc);
+	}
+}
+
+/* Append len bytes from src to dst, split into as many LLIs as needed.
+ * Only the last LLI of the run raises an interrupt, if irq is set. */
+static void s3c64xx_dma_add_run(struct s3c64xx_dma_desc *desc, u32 control,
+				dma_addr_t src, dma_addr_t dst, size_t len,
+				bool irq)
+{
+	struct pl080s_lli *lli = NULL;
+	size_t chunk;
+
+	while (len) {
+		BUG_ON(desc->lli_cnt >= desc->lli_max);
+
+		chunk = min_t(size_t, len, S3C64XX_DMA_LLI_BYTES);
+
+		lli = &desc->lli[desc->lli_cnt++];
+		lli->src_addr = src;
+		lli->dst_addr = dst;
+		lli->control0 = control;
+		lli->control1 = chunk >> desc->width;
+
+		if (control & PL080_CONTROL_SRC_INCR)
+			src += chunk;
+		if (control & PL080_CONTROL_DST_INCR)
+			dst += chunk;
+		len -= chunk;
+		desc->len += chunk;
+	}
+
+	if (lli && irq)
+		lli->control0 |= PL080_CONTROL_TC_IRQ_EN;
+}
+
+/* Map the LLIs for the controller and chain them, back to the first one
+ * for a cyclic transfer. */
+static int s3c64xx_dma_desc_link(struct s3c64xx_dma_chan *c,
+				 struct s3c64xx_dma_desc *desc)
+{
+	struct device *dev = chan2dev(c);
+	size_t size = desc->lli_max * sizeof(struct pl080s_lli);
+	dma_addr_t phys;
+	unsigned int i;
+
+	if (!desc->lli_cnt)
+		return -EINVAL;
+
+	phys = dma_map_single(dev, desc->lli, size, DMA_TO_DEVICE);
+	if (dma_mapping_error(dev, phys))
+		return -ENOMEM;
+
+	dma_sync_single_for_cpu(dev, phys, size, DMA_TO_DEVICE);
+
+	for (i = 0; i < desc->lli_cnt - 1; i++)
+		desc->lli[i].next_lli = phys + (i + 1) * sizeof(struct pl080s_lli);
+	desc->lli[i].next_lli = desc->cyclic ? phys : 0;
+
+	dma_sync_single_for_device(dev, phys, size, DMA_TO_DEVICE);
+
+	desc->lli_phys = phys;
+
+	dma_async_tx_descriptor_init(&desc->txd, &c->chan);
+	desc->txd.tx_submit = s3c64xx_dma_tx_submit;
+
+	return 0;
+}
+
+static u32 s3c64xx_dma_slave_config(struct s3c64xx_dma_chan *c,
+				    enum dma_data_direction dir)
+{
+	u32 config = PL080_CONFIG_TC_IRQ_MASK | PL080_CONFIG_ERR_IRQ_MASK;
+	u32 peripheral = c->id & 0xf;
+
+	if (dir == DMA_FROM_DEVICE) {
+		config |= PL080_FLOW_PER2MEM << PL080_CONFIG_FLOW_CONTROL_SHIFT;
+		config |= peripheral << PL080_CONFIG_SRC_SEL_SHIFT;
+	} else {
+		config |= PL080_FLOW_MEM2PER << PL080_CONFIG_FLOW_CONTROL_SHIFT;
+		config |= peripheral << PL080_CONFIG_DST_SEL_SHIFT;
+	}
+
+	return config;
+}
+
+/* peripherals sit on AHB master 2, memory on master 1, as for the
+ * buffer queue API */
+static u32 s3c64xx_dma_slave_control(struct s3c64xx_dma_chan *c,
+				     enum dma_data_direction dir,
+				     unsigned int *width)
+{
+	u32 control = PL080_CONTROL_PROT_SYS;
+
+	if (dir == DMA_FROM_DEVICE) {
+		*width = c->src_width;
+		control |= PL080_CONTROL_SRC_AHB2 | PL080_CONTROL_DST_INCR;
+		control |= c->src_burst << PL080_CONTROL_SB_SIZE_SHIFT;
+		control |= c->src_burst << PL080_CONTROL_DB_SIZE_SHIFT;
+	} else {
+		*width = c->dst_width;
+		control |= PL080_CONTROL_DST_AHB2 | PL080_CONTROL_SRC_INCR;
+		control |= c->dst_burst << PL080_CONTROL_SB_SIZE_SHIFT;
+		control |= c->dst_burst << PL080_CONTROL_DB_SIZE_SHIFT;
+	}
+
+	control |= *width << PL080_CONTROL_SWIDTH_SHIFT;
+	control |= *width << PL080_CONTROL_DWIDTH_SHIFT;
+
+	return control;
+}
+
+static inline unsigned int s3c64xx_dma_lli_count(size_t len)
+{
+	return DIV_ROUND_UP(len, S3C64XX_DMA_LLI_BYTES);
+}
+
+/* hardware control, called with the channel lock held */
+
+static void s3c64xx_dma_start(struct s3c64xx_dma_chan *c)
+{
+	void __iomem *regs = c->phys->regs;
+	struct s3c64xx_dma_desc *desc;
+	struct pl080s_lli *lli;
+
+	if (c->active || list_empty(&c->queue))
+		return;
+
+	desc = list_first_entry(&c->queue, struct s3c64xx_dma_desc, node);
+	list_del_init(&desc->node);
+	c->active = desc;
+
+	lli = &desc->lli[0];
+
+	writel(lli->src_addr, regs + PL080_CH_SRC_ADDR);
+	writel(lli->dst_addr, regs + PL080_CH_DST_ADDR);
+	writel(lli->next_lli, regs + PL080_CH_LLI);
+	writel(lli->control0, regs + PL080_CH_CONTROL);
+	writel(lli->control1, regs + PL080S_CH_CONTROL2);
+	writel(desc->config, regs + PL080S_CH_CONFIG);
+
+	s3c64xx_dma_start_phys(c->phys);
+}
+
+/* Bytes of desc still to move. The channel LLI register holds the
+ * next_lli of the LLI being worked on, which finds it in the chain. */
+static size_t s3c64xx_dma_residue(struct s3c64xx_dma_chan *c,
+				  struct s3c64xx_dma_desc *desc)
+{
+	void __iomem *regs = c->phys->regs;
+	u32 next, addr;
+	size_t done = 0, len;
+	unsigned int i;
+
+	do {
+		next = readl(regs + PL080_CH_LLI);
+		addr = readl(regs + (desc->dst_incr ? PL080_CH_DST_ADDR :
+						      PL080_CH_SRC_ADDR));
+	} while (next != readl(regs + PL080_CH_LLI));
+
+	for (i = 0; i < desc->lli_cnt; i++) {
+		struct pl080s_lli *lli = &desc->lli[i];
+
+		len = lli->control1 << desc->width;
+
+		if (lli->next_lli == next) {
+			addr -= desc->dst_incr ? lli->dst_addr : lli->src_addr;
+			return desc->len - done - min_t(size_t, addr, len);
+		}
+
+		done += len;
+	}
+
+	return desc->len;
+}
+
+/* called from the controller interrupt */
+static void s3c64xx_dma_irq(struct s3c2410_dma_chan *phys,
+			    enum s3c2410_dma_buffresult res)
+{
+	struct s3c64xx_dma_chan *c = phys->irq_data;
+	struct s3c64xx_dma_desc *desc;
+
+	spin_lock(&c->lock);
+
+	desc = c->active;
+	if (!desc)
+		goto out;
+
+	if (res != S3C2410_RES_OK)
+		dev_err(chan2dev(c), "DMA%d: transfer error on channel %d\n",
+			phys->number, c->id);
+
+	if (desc->cyclic && res == S3C2410_RES_OK) {
+		c->periods++;
+	} else {
+		c->active = NULL;
+		c->completed = desc->txd.cookie;
+		list_add_tail(&desc->node, &c->done);
+		s3c64xx_dma_start(c);
+	}
+
+	tasklet_schedule(&c->tasklet);
+out:
+	spin_unlock(&c->lock);
+}
+
+static void s3c64xx_dma_tasklet(unsigned long data)
+{
+	struct s3c64xx_dma_chan *c = (struct s3c64xx_dma_chan *)data;
+	struct s3c64xx_dma_desc *desc, *tmp;
+	dma_async_tx_callback callback = NULL;
+	void *param = NULL;
+	unsigned int periods;
+	unsigned long flags;
+	LIST_HEAD(done);
+
+	spin_lock_irqsave(&c->lock, flags);
+
+	list_splice_init(&c->done, &done);
+
+	periods = c->periods;
+	c->periods = 0;
+	if (periods && c->active) {
+		callback = c->active->txd.callback;
+		param = c->active->txd.callback_param;
+	}
+
+	spin_unlock_irqrestore(&c->lock, flags);
+
+	/* once per period, even if several went by before we got here */
+	while (callback && periods--)
+		callback(param);
+
+	list_for_each_entry_safe(desc, tmp, &done, node) {
+		list_del(&desc->node);
+		if (desc->txd.callback)
+			desc->txd.callback(desc->txd.callback_param);
+		s3c64xx_dma_desc_put(c, desc);
+	}
+}
+
+/* dmaengine interface */
+
+static dma_cookie_t s3c64xx_dma_tx_submit(struct dma_async_tx_descriptor *txd)
+{
+	struct s3c64xx_dma_chan *c = to_s3c64xx_chan(txd->chan);
+	struct s3c64xx_dma_desc *desc = to_s3c64xx_desc(txd);
+	dma_cookie_t cookie;
+	unsigned long flags;
+
+	spin_lock_irqsave(&c->lock, flags);
+
+	cookie = c->chan.cookie + 1;
+	if (cookie < 0)
+		cookie = 1;
+	c->chan.cookie = cookie;
+	txd->cookie = cookie;
+
+	list_add_tail(&desc->node, &c->queue);
+
+	spin_unlock_irqrestore(&c->lock, flags);
+
+	return cookie;
+}
+
+static struct dma_async_tx_descriptor *
+s3c64xx_dma_prep_slave_sg(struct dma_chan *chan, struct scatterlist *sgl,
+			  unsigned int sg_len, enum dma_data_direction direction,
+			  unsigned long flags)
+{
+	struct s3c64xx_dma_chan *c = to_s3c64xx_chan(chan);
+	struct s3c64xx_dma_desc *desc;
+	struct scatterlist *sg;
+	unsigned int i, lli_max = 0;
+	u32 control;
+
+	if (c->id >= DMACH_ONENAND || !sg_len)
+		return NULL;
+
+	for_each_sg(sgl, sg, sg_len, i)
+		lli_max += s3c64xx_dma_lli_count(sg_dma_len(sg));
+
+	desc = s3c64xx_dma_desc_get(c, lli_max);
+	if (!desc)
+		return NULL;
+
+	desc->config = s3c64xx_dma_slave_config(c, direction);
+	desc->dst_incr = direction == DMA_FROM_DEVICE;
+	control = s3c64xx_dma_slave_control(c, direction, &desc->width);
+
+	for_each_sg(sgl, sg, sg_len, i) {
+		if (direction == DMA_FROM_DEVICE)
+			s3c64xx_dma_add_run(desc, control, c->src_addr,
+					    sg_dma_address(sg), sg_dma_len(sg),
+					    i == sg_len - 1);
+		else
+			s3c64xx_dma_add_run(desc, control, sg_dma_address(sg),
+					    c->dst_addr, sg_dma_len(sg),
+					    i == sg_len - 1);
+	}
+
+	if (s3c64xx_dma_desc_link(c, desc)) {
+		s3c64xx_dma_desc_put(c, desc);
+		return NULL;
+	}
+
+	desc->txd.flags = flags;
+
+	return &desc->txd;
+}
+
+static struct dma_async_tx_descriptor *
+s3c64xx_dma_prep_dma_cyclic(struct dma_chan *chan, dma_addr_t buf_addr,
+			    size_t buf_len, size_t period_len,
+			    enum dma_data_direction direction)
+{
+	struct s3c64xx_dma_chan *c = to_s3c64xx_chan(chan);
+	struct s3c64xx_dma_desc *desc;
+	unsigned int periods;
+	size_t offs;
+	u32 control;
+
+	if (c->id >= DMACH_ONENAND || !period_len || buf_len % period_len)
+		return NULL;
+
+	periods = buf_len / period_len;
+
+	desc = s3c64xx_dma_desc_get(c, periods *
+				    s3c64xx_dma_lli_count(period_len));
+	if (!desc)
+		return NULL;
+
+	desc->cyclic = true;
+	desc->config = s3c64xx_dma_slave_config(c, direction);
+	desc->dst_incr = direction == DMA_FROM_DEVICE;
+	control = s3c64xx_dma_slave_control(c, direction, &desc->width);
+
+	for (offs = 0; offs < buf_len; offs += period_len) {
+		if (direction == DMA_FROM_DEVICE)
+			s3c64xx_dma_add_run(desc, control, c->src_addr,
+					    buf_addr + offs, period_len, true);
+		else
+			s3c64xx_dma_add_run(desc, control, buf_addr + offs,
+					    c->dst_addr, period_len, true);
+	}
+
+	if (s3c64xx_dma_desc_link(c, desc)) {
+		s3c64xx_dma_desc_put(c, desc);
+		return NULL;
+	}
+
+	return &desc->txd;
+}
+
+static struct dma_async_tx_descriptor *
+s3c64xx_dma_prep_dma_memcpy(struct dma_chan *chan, dma_addr_t dest,
+			    dma_addr_t src, size_t len, unsigned long flags)
+{
+	struct s3c64xx_dma_chan *c = to_s3c64xx_chan(chan);
+	struct s3c64xx_dma_desc *desc;
+	u32 control;
+
+	if (!len)
+		return NULL;
+
+	desc = s3c64xx_dma_desc_get(c, s3c64xx_dma_lli_count(len));
+	if (!desc)
+		return NULL;
+
+	/* paced by the controller itself, so use bursts and words when
+	 * everything is aligned for it */
+	desc->width = ((dest | src | len) & 3) ? PL080_WIDTH_8BIT :
+						 PL080_WIDTH_32BIT;
+	desc->config = PL080_CONFIG_TC_IRQ_MASK | PL080_CONFIG_ERR_IRQ_MASK;
+	desc->config |= PL080_FLOW_MEM2MEM << PL080_CONFIG_FLOW_CONTROL_SHIFT;
+	desc->dst_incr = true;
+
+	control = PL080_CONTROL_PROT_SYS;
+	control |= PL080_CONTROL_SRC_INCR | PL080_CONTROL_DST_INCR;
+	control |= PL080_BSIZE_4 << PL080_CONTROL_SB_SIZE_SHIFT;
+	control |= PL080_BSIZE_4 << PL080_CONTROL_DB_SIZE_SHIFT;
+	control |= desc->width << PL080_CONTROL_SWIDTH_SHIFT;
+	control |= desc->width << PL080_CONTROL_DWIDTH_SHIFT;
+
+	s3c64xx_dma_add_run(desc, control, src, dest, len, true);
+
+	if (s3c64xx_dma_desc_link(c, desc)) {
+		s3c64xx_dma_desc_put(c, desc);
+		return NULL;
+	}
+
+	desc->txd.flags = flags;
+
+	return &desc->txd;
+}
+
+static int s3c64xx_dma_width(enum dma_slave_buswidth width)
+{
+	switch (width) {
+	case DMA_SLAVE_BUSWIDTH_1_BYTE:
+		return PL080_WIDTH_8BIT;
+	case DMA_SLAVE_BUSWIDTH_2_BYTES:
+		return PL080_WIDTH_16BIT;
+	case DMA_SLAVE_BUSWIDTH_4_BYTES:
+		return PL080_WIDTH_32BIT;
+	default:
+		return -EINVAL;
+	}
+}
+
+static u32 s3c64xx_dma_burst(u32 maxburst)
+{
+	static const u32 bursts[] = { 1, 4, 8, 16, 32, 64, 128, 256 };
+	u32 burst = PL080_BSIZE_1;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(bursts); i++)
+		if (maxburst >= bursts[i])
+			burst = i;
+
+	return burst;
+}
+
+static int s3c64xx_dma_config(struct s3c64xx_dma_chan *c,
+			      struct dma_slave_config *config)
+{
+	int src_width, dst_width;
+
+	src_width = s3c64xx_dma_width(config->src_addr_width);
+	dst_width = s3c64xx_dma_width(config->dst_addr_width);
+
+	if (config->direction == DMA_FROM_DEVICE && src_width < 0)
+		return -EINVAL;
+	if (config->direction == DMA_TO_DEVICE && dst_width < 0)
+		return -EINVAL;
+
+	c->src_addr = config->src_addr;
+	c->dst_addr = config->dst_addr;
+	c->src_width = src_width < 0 ? PL080_WIDTH_8BIT : src_width;
+	c->dst_width = dst_width < 0 ? PL080_WIDTH_8BIT : dst_width;
+	c->src_burst = s3c64xx_dma_burst(config->src_maxburst);
+	c->dst_burst = s3c64xx_dma_burst(config->dst_maxburst);
+
+	return 0;
+}
+
+static void s3c64xx_dma_terminate(struct s3c64xx_dma_chan *c)
+{
+	unsigned long flags;
+	LIST_HEAD(list);
+
+	spin_lock_irqsave(&c->lock, flags);
+
+	s3c64xx_dma_abort_phys(c->phys);
+
+	if (c->active) {
+		list_add_tail(&c->active->node, &list);
+		c->active = NULL;
+	}
+	list_splice_init(&c->queue, &list);
+	list_splice_init(&c->done, &list);
+	c->periods = 0;
+
+	spin_unlock_irqrestore(&c->lock, flags);
+
+	s3c64xx_dma_desc_put_list(c, &list);
+}
+
+static int s3c64xx_dma_control(struct dma_chan *chan, enum dma_ctrl_cmd cmd,
+			       unsigned long arg)
+{
+	struct s3c64xx_dma_chan *c = to_s3c64xx_chan(chan);
+	void __iomem *regs = c->phys->regs;
+	unsigned long flags;
+	u32 config;
+
+	switch (cmd) {
+	case DMA_TERMINATE_ALL:
+		s3c64xx_dma_terminate(c);
+		return 0;
+
+	case DMA_PAUSE:
+	case DMA_RESUME:
+		spin_lock_irqsave(&c->lock, flags);
+		config = readl(regs + PL080S_CH_CONFIG);
+		if (cmd == DMA_PAUSE)
+			config |= PL080_CONFIG_HALT;
+		else
+			config &= ~PL080_CONFIG_HALT;
+		writel(config, regs + PL080S_CH_CONFIG);
+		spin_unlock_irqrestore(&c->lock, flags);
+		return 0;
+
+	case DMA_SLAVE_CONFIG:
+		return s3c64xx_dma_config(c, (struct dma_slave_config *)arg);
+
+	default:
+		return -ENXIO;
+	}
+}
+
+static enum dma_status s3c64xx_dma_tx_status(struct dma_chan *chan,
+					     dma_cookie_t cookie,
+					     struct dma_tx_state *txstate)
+{
+	struct s3c64xx_dma_chan *c = to_s3c64xx_chan(chan);
+	struct s3c64xx_dma_desc *desc;
+	dma_cookie_t last_used, last_complete;
+	enum dma_status ret;
+	unsigned long flags;
+	size_t residue = 0;
+
+	spin_lock_irqsave(&c->lock, flags);
+
+	last_used = chan->cookie;
+	last_complete = c->completed;
+
+	ret = dma_async_is_complete(cookie, last_complete, last_used);
+	if (ret != DMA_SUCCESS) {
+		if (c->active && c->active->txd.cookie == cookie) {
+			residue = s3c64xx_dma_residue(c, c->active);
+		} else {
+			list_for_each_entry(desc, &c->queue, node)
+				if (desc->txd.cookie == cookie)
+					residue = desc->len;
+		}
+	}
+
+	spin_unlock_irqrestore(&c->lock, flags);
+
+	dma_set_tx_state(txstate, last_complete, last_used, residue);
+
+	return ret;
+}
+
+static void s3c64xx_dma_issue_pending(struct dma_chan *chan)
+{
+	struct s3c64xx_dma_chan *c = to_s3c64xx_chan(chan);
+	unsigned long flags;
+
+	spin_lock_irqsave(&c->lock, flags);
+	s3c64xx_dma_start(c);
+	spin_unlock_irqrestore(&c->lock, flags);
+}
+
+static int s3c64xx_dma_alloc_chan_resources(struct dma_chan *chan)
+{
+	struct s3c64xx_dma_chan *c = to_s3c64xx_chan(chan);
+
+	c->phys = s3c64xx_dma_get_phys(c->id >= DMACH_PCM1_TX ? 1 : 0,
+				       s3c64xx_dma_irq, c);
+	if (!c->phys) {
+		dev_dbg(chan2dev(c), "no free channel for %d\n", c->id);
+		return -EBUSY;
+	}
+
+	c->completed = chan->cookie = 1;
+
+	/* single transfers of bytes until told otherwise */
+	c->src_width = c->dst_width = PL080_WIDTH_8BIT;
+	c->src_burst = c->dst_burst = PL080_BSIZE_1;
+
+	return 0;
+}
+
+static void s3c64xx_dma_free_chan_resources(struct dma_chan *chan)
+{
+	struct s3c64xx_dma_chan *c = to_s3c64xx_chan(chan);
+
+	s3c64xx_dma_terminate(c);
+	tasklet_kill(&c->tasklet);
+
+	s3c64xx_dma_put_phys(c->phys);
+	c->phys = NULL;
+}
+
+static int __devinit s3c64xx_dma_probe(struct platform_device *pdev)
+{
+	struct s3c64xx_dma *sdma;
+	struct dma_device *dma;
+	int ch, ret;
+
+	sdma = kzalloc(sizeof(struct s3c64xx_dma), GFP_KERNEL);
+	if (!sdma)
+		return -ENOMEM;
+
+	dma = &sdma->dma;
+	INIT_LIST_HEAD(&dma->channels);
+
+	for (ch = 0; ch < DMACH_MAX; ch++) {
+		struct s3c64xx_dma_chan *c = &sdma->chans[ch];
+
+		c->id = ch;
+		c->chan.device = dma;
+		spin_lock_init(&c->lock);
+		INIT_LIST_HEAD(&c->queue);
+		INIT_LIST_HEAD(&c->done);
+		tasklet_init(&c->tasklet, s3c64xx_dma_tasklet,
+			     (unsigned long)c);
+
+		list_add_tail(&c->chan.device_node, &dma->channels);
+	}
+
+	dma_cap_set(DMA_SLAVE, dma->cap_mask);
+	dma_cap_set(DMA_CYCLIC, dma->cap_mask);
+	dma_cap_set(DMA_MEMCPY, dma->cap_mask);
+	dma_cap_set(DMA_PRIVATE, dma->cap_mask);
+
+	dma->dev = &pdev->dev;
+	dma->device_alloc_chan_resources = s3c64xx_dma_alloc_chan_resources;
+	dma->device_free_chan_resources = s3c64xx_dma_free_chan_resources;
+	dma->device_prep_slave_sg = s3c64xx_dma_prep_slave_sg;
+	dma->device_prep_dma_cyclic = s3c64xx_dma_prep_dma_cyclic;
+	dma->device_prep_dma_memcpy = s3c64xx_dma_prep_dma_memcpy;
+	dma->device_control = s3c64xx_dma_control;
+	dma->device_tx_status = s3c64xx_dma_tx_status;
+	dma->device_issue_pending = s3c64xx_dma_issue_pending;
+
+	ret = dma_async_device_register(dma);
+	if (ret) {
+		dev_err(&pdev->dev, "failed to register dma device\n");
+		kfree(sdma);
+		return ret;
+	}
+
+	platform_set_drvdata(pdev, sdma);
+
+	dev_info(&pdev->dev, "%d channels\n", DMACH_MAX);
+
+	return 0;
+}
+
+static int __devexit s3c64xx_dma_remove(struct platform_device *pdev)
+{
+	struct s3c64xx_dma *sdma = platform_get_drvdata(pdev);
+
+	dma_async_device_unregister(&sdma->dma);
+	kfree(sdma);
+
+	return 0;
+}
+
+static struct platform_driver s3c64xx_dma_driver = {
+	.probe		= s3c64xx_dma_probe,
+	.remove		= __devexit_p(s3c64xx_dma_remove),
+	.driver		= {
+		.name	= "s3c64xx-dma",
+		.owner	= THIS_MODULE,
+	},
+};
+
+static int __init s3c64xx_dma_init(void)
+{
+	return platform_driver_register(&s3c64xx_dma_driver);
+}
+subsys_initcall(s3c64xx_dma_init);
+
+static void __exit s3c64xx_dma_exit(void)
+{
+	platform_driver_unregister(&s3c64xx_dma_driver);
+}
+module_exit(s3c64xx_dma_exit);
+
+MODULE_DESCRIPTION("S3C64XX PL080 DMA engine driver");
+MODULE_LICENSE("GPL");
+MODULE_ALIAS("platform:s3c64xx-dma");
@@ -24,6 +24,9 @@
 #include <linux/android_pmem.h>
 #include <linux/mempolicy.h>
 #include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
 #include <asm/io.h>
 #include <asm/uaccess.h>
 #include <asm/cacheflush.h>
@@ -127,6 +130,17 @@ struct pmem_info {
 	/* in no_allocator mode the first mapper gets the whole space and sets
 	 * this flag */
 	unsigned allocated;
+	/* the region is system RAM from the contiguous pool, allocations
+	 * claim their pages back from the page allocator if the pool was
+	 * lent to it */
+	unsigned movable;
+	unsigned lent;
+	/* claim statistics, protected by bitmap_sem */
+	unsigned long claims;
+	unsigned long claim_failures;
+	unsigned long pages_migrated;
+	u64 claim_time_us;
+	unsigned long claim_time_max_us;
 	/* for debugging, creates a list of pmem file structs, the
 	 * data_list_lock should be taken before pmem_data->sem if both are
 	 * needed */
@@ -233,6 +247,84 @@ static int is_master_owner(struct file *file)
 	return ret;
 }
 
+static void pmem_release_pages(int id, unsigned long start, unsigned long len)
+{
+	/* caller should hold the write lock on pmem_sem! */
+	if (!pmem[id].movable)
+		return;
+
+	if (!pmem[id].cached) {
+		vunmap(pmem[id].vbase);
+		pmem[id].vbase = NULL;
+	}
+#ifdef CONFIG_CMA
+	if (pmem[id].lent)
+		free_contig_range(start >> PAGE_SHIFT, len >> PAGE_SHIFT);
+#endif
+}
+
+/*
+ * Take [start, start + len) of a movable region back from the page
+ * allocator. Uncached regions get their own uncached kernel mapping, the
+ * linear one being cached.
+ */
+static int pmem_claim(int id, unsigned long start, unsigned long len)
+{
+	/* caller should hold the write lock on pmem_sem! */
+	if (!pmem[id].movable)
+		return 0;
+
+#ifdef CONFIG_CMA
+	if (pmem[id].lent) {
+		unsigned long migrated = 0;
+		ktime_t begin = ktime_get();
+		unsigned long us;
+		int ret;
+
+		ret = alloc_contig_range(start >> PAGE_SHIFT,
+					 (start + len) >> PAGE_SHIFT, &migrated);
+		us = ktime_us_delta(ktime_get(), begin);
+		pmem[id].pages_migrated += migrated;
+		if (ret) {
+			pmem[id].claim_failures++;
+			printk(KERN_WARNING "pmem: %s: unable to claim %lx-%lx "
+			       "(%d)\n", pmem[id].dev.name, start,
+			       start + len, ret);
+			return ret;
+		}
+		pmem[id].claims++;
+		pmem[id].claim_time_us += us;
+		if (us > pmem[id].claim_time_max_us)
+			pmem[id].claim_time_max_us = us;
+		DLOG("claimed %lx-%lx in %luus, %lu pages migrated\n",
+		     start, start + len, us, migrated);
+	}
+#endif
+
+	/* drop whatever the previous users left in the cache */
+	dmac_flush_range(__va(start), __va(start + len));
+	outer_flush_range(start, start + len);
+
+	if (!pmem[id].cached) {
+		unsigned long i, nr = len >> PAGE_SHIFT;
+		struct page **pages;
+
+		pages = kmalloc(nr * sizeof(*pages), GFP_KERNEL);
+		if (pages) {
+			for (i = 0; i < nr; i++)
+				pages[i] = pfn_to_page((start >> PAGE_SHIFT) + i);
+			pmem[id].vbase = vmap(pages, nr, VM_MAP,
+					      pgprot_noncached(PAGE_KERNEL));
+			kfree(pages);
+		}
+		if (!pmem[id].vbase) {
+			pmem_release_pages(id, start, len);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
 static int pmem_free(int id, int index)
 {
 	/* caller should hold the write lock on pmem_sem! */
@@ -240,9 +332,11 @@ static int pmem_free(int id, int index)
 	DLOG("index %d\n", index);
 
 	if (pmem[id].no_allocator) {
+		pmem_release_pages(id, pmem[id].base, PAGE_ALIGN(index));
 		pmem[id].allocated = 0;
 		return 0;
 	}
+	pmem_release_pages(id, PMEM_START_ADDR(id, index), PMEM_LEN(id, index));
 	/* clean up the bitmap, merging any buddies */
 	pmem[id].bitmap[curr].allocated = 0;
 	/* find a slots buddy Buddy# = Slot# ^ (1 << order)
@@ -390,6 +484,8 @@ static int pmem_allocate(int id, unsigned long len)
 		DLOG("no allocator");
 		if ((len > pmem[id].size) || pmem[id].allocated)
 			return -1;
+		if (pmem_claim(id, pmem[id].base, PAGE_ALIGN(len)))
+			return -1;
 		pmem[id].allocated = 1;
 		return len;
 	}
@@ -425,6 +521,10 @@ static int pmem_allocate(int id, unsigned long len)
 		return -1;
 	}
 
+	if (pmem_claim(id, PMEM_START_ADDR(id, best_fit),
+		       (1 << order) * PMEM_MIN_ALLOC))
+		return -1;
+
 	/* now partition the best fit:
 	 * 	split the slot into 2 buddies of order - 1
 	 * 	repeat until the slot is of the correct order
@@ -1221,6 +1321,47 @@ static struct file_operations debug_fops = {
 };
 #endif
 
+/*
+ * How long claiming movable regions back from the page allocator takes,
+ * and how many pages had to be migrated out of the way.
+ */
+static int pmem_stats_show(struct seq_file *m, void *unused)
+{
+	int id;
+
+	seq_printf(m, "%-16s %8s %8s %10s %10s %10s\n", "region", "claims",
+		   "failed", "migrated", "avg_us", "max_us");
+	for (id = 0; id < id_count; id++) {
+		u64 avg;
+
+		if (!pmem[id].movable)
+			continue;
+		down_read(&pmem[id].bitmap_sem);
+		avg = pmem[id].claim_time_us;
+		if (pmem[id].claims)
+			do_div(avg, pmem[id].claims);
+		seq_printf(m, "%-16s %8lu %8lu %10lu %10llu %10lu\n",
+			   pmem[id].dev.name, pmem[id].claims,
+			   pmem[id].claim_failures, pmem[id].pages_migrated,
+			   (unsigned long long)avg,
+			   pmem[id].claim_time_max_us);
+		up_read(&pmem[id].bitmap_sem);
+	}
+	return 0;
+}
+
+static int pmem_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pmem_stats_show, NULL);
+}
+
+static const struct file_operations pmem_stats_fops = {
+	.open = pmem_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 #if 0
 static struct miscdevice pmem_dev = {
 	.name = "pmem",
@@ -1240,6 +1381,7 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	pmem[id].no_allocator = pdata->no_allocator;
 	pmem[id].cached = pdata->cached;
 	pmem[id].buffered = pdata->buffered;
+	pmem[id].movable = pdata->movable;
 	pmem[id].base = pdata->start;
 	pmem[id].size = pdata->size;
 	pmem[id].ioctl = ioctl;
@@ -1274,7 +1416,23 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 		}
 	}
 
-	if (pmem[id].cached)
+	if (pmem[id].movable) {
+		/*
+		 * The region is in the linear mapping. Uncached regions are
+		 * mapped when they are claimed, which needs a single owner.
+		 */
+		if (!pmem[id].cached && !pmem[id].no_allocator) {
+			printk(KERN_ALERT "pmem: uncached movable regions need "
+			       "no_allocator\n");
+			goto error_cant_remap;
+		}
+		pmem[id].lent = is_migrate_cma(get_pageblock_migratetype(
+					pfn_to_page(pmem[id].base >> PAGE_SHIFT)));
+		if (pmem[id].cached)
+			pmem[id].vbase = __va(pmem[id].base);
+		else
+			pmem[id].vbase = NULL;
+	} else if (pmem[id].cached)
 		pmem[id].vbase = ioremap_cached(pmem[id].base,
 						pmem[id].size);
 #ifdef ioremap_ext_buffered
@@ -1285,7 +1443,7 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	else
 		pmem[id].vbase = ioremap(pmem[id].base, pmem[id].size);
 
-	if (pmem[id].vbase == 0)
+	if (pmem[id].vbase == 0 && !pmem[id].movable)
 		goto error_cant_remap;
 
 	pmem[id].garbage_pfn = page_to_pfn(alloc_page(GFP_KERNEL));
@@ -1335,6 +1493,8 @@ static struct platform_driver pmem_driver = {
 
 static int __init pmem_init(void)
 {
+	debugfs_create_file("pmem_stats", S_IFREG | S_IRUGO, NULL, NULL,
+			    &pmem_stats_fops);
 	return platform_driver_register(&pmem_driver);
 }
 
@@ -745,6 +745,78 @@ static int mmc_test_simple_transfer(struct mmc_test_card *test,
 	return mmc_test_check_result(test, &mrq);
 }
 
+struct mmc_test_async_req {
+	struct mmc_async_req	areq;
+	struct mmc_test_card	*test;
+	struct mmc_request	mrq;
+	struct mmc_command	cmd;
+	struct mmc_command	stop;
+	struct mmc_data		data;
+};
+
+static int mmc_test_check_result_async(struct mmc_card *card,
+	struct mmc_async_req *areq)
+{
+	struct mmc_test_async_req *tareq =
+		container_of(areq, struct mmc_test_async_req, areq);
+
+	mmc_test_wait_busy(tareq->test);
+
+	return mmc_test_check_result(tareq->test, areq->mrq);
+}
+
+static void mmc_test_prepare_async(struct mmc_test_async_req *tareq,
+	struct scatterlist *sg, unsigned sg_len, unsigned dev_addr,
+	unsigned blocks, unsigned blksz, int write)
+{
+	struct mmc_test_card *test = tareq->test;
+
+	memset(&tareq->mrq, 0, sizeof(tareq->mrq));
+	memset(&tareq->cmd, 0, sizeof(tareq->cmd));
+	memset(&tareq->stop, 0, sizeof(tareq->stop));
+	memset(&tareq->data, 0, sizeof(tareq->data));
+
+	tareq->mrq.cmd = &tareq->cmd;
+	tareq->mrq.data = &tareq->data;
+	tareq->mrq.stop = &tareq->stop;
+
+	mmc_test_prepare_mrq(test, &tareq->mrq, sg, sg_len, dev_addr,
+		blocks, blksz, write);
+
+	tareq->areq.mrq = &tareq->mrq;
+	tareq->areq.err_check = mmc_test_check_result_async;
+}
+
+/*
+ * Tests @count consecutive transfers using the non-blocking request
+ * interface, so that the host can prepare one request while the previous
+ * one is still on the bus.
+ */
+static int mmc_test_nonblock_transfer(struct mmc_test_card *test,
+	struct scatterlist *sg, unsigned sg_len, unsigned dev_addr,
+	unsigned blocks, unsigned blksz, int write, int count)
+{
+	struct mmc_test_async_req tareq[2];
+	struct mmc_host *host = test->card->host;
+	int i, ret = 0;
+
+	tareq[0].test = test;
+	tareq[1].test = test;
+
+	for (i = 0; i < count; i++) {
+		mmc_test_prepare_async(&tareq[i & 1], sg, sg_len, dev_addr,
+			blocks, blksz, write);
+		mmc_start_req(host, &tareq[i & 1].areq, &ret);
+		if (ret)
+			return ret;
+		dev_addr += blocks;
+	}
+
+	mmc_start_req(host, NULL, &ret);
+
+	return ret;
+}
+
 /*
  * Tests a transfer where the card will fail completely or partly
  */
@@ -1381,6 +1453,25 @@ static int mmc_test_area_io(struct mmc_test_card *test, unsigned long sz,
 	return 0;
 }
 
+/*
+ * Map sz bytes once and transfer them cnt times to consecutive addresses
+ * starting at dev_addr, with two requests in flight.
+ */
+static int mmc_test_area_io_nonblock(struct mmc_test_card *test,
+				     unsigned long sz, unsigned int dev_addr,
+				     int write, unsigned int cnt)
+{
+	struct mmc_test_area *t = &test->area;
+	int ret;
+
+	ret = mmc_test_area_map(test, sz, 0);
+	if (ret)
+		return ret;
+
+	return mmc_test_nonblock_transfer(test, t->sg, t->sg_len, dev_addr,
+					  t->blocks, 512, write, cnt);
+}
+
 /*
  * Write the test area entirely.
  */
@@ -1650,7 +1741,8 @@ static int mmc_test_profile_trim_perf(struct mmc_test_card *test)
 	return 0;
 }
 
-static int mmc_test_seq_read_perf(struct mmc_test_card *test, unsigned long sz)
+static int mmc_test_seq_read_perf(struct mmc_test_card *test, unsigned long sz,
+				  int nonblock)
 {
 	struct mmc_test_area *t = &test->area;
 	unsigned int dev_addr, i, cnt;
@@ -1660,36 +1752,56 @@ static int mmc_test_seq_read_perf(struct mmc_test_card *test, unsigned long sz)
 	cnt = t->max_sz / sz;
 	dev_addr = t->dev_addr;
 	getnstimeofday(&ts1);
-	for (i = 0; i < cnt; i++) {
-		ret = mmc_test_area_io(test, sz, dev_addr, 0, 0, 0);
+	if (nonblock) {
+		ret = mmc_test_area_io_nonblock(test, sz, dev_addr, 0, cnt);
 		if (ret)
 			return ret;
-		dev_addr += (sz >> 9);
+	} else {
+		for (i = 0; i < cnt; i++) {
+			ret = mmc_test_area_io(test, sz, dev_addr, 0, 0, 0);
+			if (ret)
+				return ret;
+			dev_addr += (sz >> 9);
+		}
 	}
 	getnstimeofday(&ts2);
 	mmc_test_print_avg_rate(test, sz, cnt, &ts1, &ts2);
 	return 0;
 }
 
-/*
- * Consecutive read performance by transfer size.
- */
-static int mmc_test_profile_seq_read_perf(struct mmc_test_card *test)
+static int mmc_test_seq_read_profile(struct mmc_test_card *test, int nonblock)
 {
 	struct mmc_test_area *t = &test->area;
 	unsigned long sz;
 	int ret;
 
 	for (sz = 512; sz < t->max_tfr; sz <<= 1) {
-		ret = mmc_test_seq_read_perf(test, sz);
+		ret = mmc_test_seq_read_perf(test, sz, nonblock);
 		if (ret)
 			return ret;
 	}
 	sz = t->max_tfr;
-	return mmc_test_seq_read_perf(test, sz);
+	return mmc_test_seq_read_perf(test, sz, nonblock);
+}
+
+/*
+ * Consecutive read performance by transfer size.
+ */
+static int mmc_test_profile_seq_read_perf(struct mmc_test_card *test)
+{
+	return mmc_test_seq_read_profile(test, 0);
+}
+
+/*
+ * Consecutive read performance by transfer size, non-blocking requests.
+ */
+static int mmc_test_profile_seq_read_nonblock_perf(struct mmc_test_card *test)
+{
+	return mmc_test_seq_read_profile(test, 1);
 }
 
-static int mmc_test_seq_write_perf(struct mmc_test_card *test, unsigned long sz)
+static int mmc_test_seq_write_perf(struct mmc_test_card *test, unsigned long sz,
+				   int nonblock)
 {
 	struct mmc_test_area *t = &test->area;
 	unsigned int dev_addr, i, cnt;
@@ -1702,33 +1814,52 @@ static int mmc_test_seq_write_perf(struct mmc_test_card *test, unsigned long sz)
 	cnt = t->max_sz / sz;
 	dev_addr = t->dev_addr;
 	getnstimeofday(&ts1);
-	for (i = 0; i < cnt; i++) {
-		ret = mmc_test_area_io(test, sz, dev_addr, 1, 0, 0);
+	if (nonblock) {
+		ret = mmc_test_area_io_nonblock(test, sz, dev_addr, 1, cnt);
 		if (ret)
 			return ret;
-		dev_addr += (sz >> 9);
+	} else {
+		for (i = 0; i < cnt; i++) {
+			ret = mmc_test_area_io(test, sz, dev_addr, 1, 0, 0);
+			if (ret)
+				return ret;
+			dev_addr += (sz >> 9);
+		}
 	}
 	getnstimeofday(&ts2);
 	mmc_test_print_avg_rate(test, sz, cnt, &ts1, &ts2);
 	return 0;
 }
 
-/*
- * Consecutive write performance by transfer size.
- */
-static int mmc_test_profile_seq_write_perf(struct mmc_test_card *test)
+static int mmc_test_seq_write_profile(struct mmc_test_card *test, int nonblock)
 {
 	struct mmc_test_area *t = &test->area;
 	unsigned long sz;
 	int ret;
 
 	for (sz = 512; sz < t->max_tfr; sz <<= 1) {
-		ret = mmc_test_seq_write_perf(test, sz);
+		ret = mmc_test_seq_write_perf(test, sz, nonblock);
 		if (ret)
 			return ret;
 	}
 	sz = t->max_tfr;
-	return mmc_test_seq_write_perf(test, sz);
+	return mmc_test_seq_write_perf(test, sz, nonblock);
+}
+
+/*
+ * Consecutive write performance by transfer size.
+ */
+static int mmc_test_profile_seq_write_perf(struct mmc_test_card *test)
+{
+	return mmc_test_seq_write_profile(test, 0);
+}
+
+/*
+ * Consecutive write performance by transfer size, non-blocking requests.
+ */
+static int mmc_test_profile_seq_write_nonblock_perf(struct mmc_test_card *test)
+{
+	return mmc_test_seq_write_profile(test, 1);
 }
 
 /*
@@ -1782,13 +1913,21 @@ static unsigned int mmc_test_rnd_num(unsigned int rnd_cnt)
 	return (r * rnd_cnt) >> 15;
 }
 
+/*
+ * Transfer sz bytes to random addresses for 10 seconds.  With nonblock the
+ * area is mapped once and the next request is started through the
+ * non-blocking interface while the previous one is still on the bus.
+ */
 static int mmc_test_rnd_perf(struct mmc_test_card *test, int write, int print,
-			     unsigned long sz)
+			     unsigned long sz, int nonblock)
 {
+	struct mmc_test_area *t = &test->area;
+	struct mmc_test_async_req tareq[2];
+	struct mmc_host *host = test->card->host;
 	unsigned int dev_addr, cnt, rnd_addr, range1, range2, last_ea = 0, ea;
 	unsigned int ssz;
 	struct timespec ts1, ts2, ts;
-	int ret;
+	int ret = 0;
 
 	ssz = sz >> 9;
 
@@ -1796,6 +1935,14 @@ static int mmc_test_rnd_perf(struct mmc_test_card *test, int write, int print,
 	range1 = rnd_addr / test->card->pref_erase;
 	range2 = range1 / ssz;
 
+	if (nonblock) {
+		ret = mmc_test_area_map(test, sz, 0);
+		if (ret)
+			return ret;
+		tareq[0].test = test;
+		tareq[1].test = test;
+	}
+
 	getnstimeofday(&ts1);
 	for (cnt = 0; cnt < UINT_MAX; cnt++) {
 		getnstimeofday(&ts2);
@@ -1808,16 +1955,30 @@ static int mmc_test_rnd_perf(struct mmc_test_card *test, int write, int print,
 		last_ea = ea;
 		dev_addr = rnd_addr + test->card->pref_erase * ea +
 			   ssz * mmc_test_rnd_num(range2);
-		ret = mmc_test_area_io(test, sz, dev_addr, write, 0, 0);
+		if (nonblock) {
+			mmc_test_prepare_async(&tareq[cnt & 1], t->sg,
+				t->sg_len, dev_addr, t->blocks, 512, write);
+			mmc_start_req(host, &tareq[cnt & 1].areq, &ret);
+		} else {
+			ret = mmc_test_area_io(test, sz, dev_addr, write, 0, 0);
+		}
+		if (ret)
+			return ret;
+	}
+	if (nonblock) {
+		/* Wait for the last request, it counts */
+		mmc_start_req(host, NULL, &ret);
 		if (ret)
 			return ret;
+		getnstimeofday(&ts2);
 	}
 	if (print)
 		mmc_test_print_avg_rate(test, sz, cnt, &ts1, &ts2);
 	return 0;
 }
 
-static int mmc_test_random_perf(struct mmc_test_card *test, int write)
+static int mmc_test_random_perf(struct mmc_test_card *test, int write,
+				int nonblock)
 {
 	struct mmc_test_area *t = &test->area;
 	unsigned int next;
@@ -1832,24 +1993,24 @@ static int mmc_test_random_perf(struct mmc_test_card *test, int write)
 		 */
 		if (write) {
 			next = rnd_next;
-			ret = mmc_test_rnd_perf(test, write, 0, sz);
+			ret = mmc_test_rnd_perf(test, write, 0, sz, nonblock);
 			if (ret)
 				return ret;
 			rnd_next = next;
 		}
-		ret = mmc_test_rnd_perf(test, write, 1, sz);
+		ret = mmc_test_rnd_perf(test, write, 1, sz, nonblock);
 		if (ret)
 			return ret;
 	}
 	sz = t->max_tfr;
 	if (write) {
 		next = rnd_next;
-		ret = mmc_test_rnd_perf(test, write, 0, sz);
+		ret = mmc_test_rnd_perf(test, write, 0, sz, nonblock);
 		if (ret)
 			return ret;
 		rnd_next = next;
 	}
-	return mmc_test_rnd_perf(test, write, 1, sz);
+	return mmc_test_rnd_perf(test, write, 1, sz, nonblock);
 }
 
 /*
@@ -1857,7 +2018,7 @@ static int mmc_test_random_perf(struct mmc_test_card *test, int write)
  */
 static int mmc_test_random_read_perf(struct mmc_test_card *test)
 {
-	return mmc_test_random_perf(test, 0);
+	return mmc_test_random_perf(test, 0, 0);
 }
 
 /*
@@ -1865,7 +2026,23 @@ static int mmc_test_random_read_perf(struct mmc_test_card *test)
  */
 static int mmc_test_random_write_perf(struct mmc_test_card *test)
 {
-	return mmc_test_random_perf(test, 1);
+	return mmc_test_random_perf(test, 1, 0);
+}
+
+/*
+ * Random read performance by transfer size, non-blocking requests.
+ */
+static int mmc_test_random_read_nonblock_perf(struct mmc_test_card *test)
+{
+	return mmc_test_random_perf(test, 0, 1);
+}
+
+/*
+ * Random write performance by transfer size, non-blocking requests.
+ */
+static int mmc_test_random_write_nonblock_perf(struct mmc_test_card *test)
+{
+	return mmc_test_random_perf(test, 1, 1);
 }
 
 static int mmc_test_seq_perf(struct mmc_test_card *test, int write,
@@ -2221,6 +2398,34 @@ static const struct mmc_test_case mmc_test_cases[] = {
 		.cleanup = mmc_test_area_cleanup,
 	},
 
+	{
+		.name = "Consecutive read performance by transfer size, non-blocking",
+		.prepare = mmc_test_area_prepare_fill,
+		.run = mmc_test_profile_seq_read_nonblock_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Consecutive write performance by transfer size, non-blocking",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_profile_seq_write_nonblock_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Random read performance by transfer size, non-blocking",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_random_read_nonblock_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Random write performance by transfer size, non-blocking",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_random_write_nonblock_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
 };
 
 static DEFINE_MUTEX(mmc_test_lock);
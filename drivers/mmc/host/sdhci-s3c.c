@@ -491,6 +491,13 @@ static int __devinit sdhci_s3c_probe(struct platform_device *pdev)
 	/* we currently see overruns on errors, so disable the SDMA
 	 * support as well. */
 	host->quirks |= SDHCI_QUIRK_BROKEN_DMA;
+	host->quirks |= SDHCI_QUIRK_BROKEN_ADMA;
+
+#else
+
+	/* The ADMA2 engine does not treat a zero length descriptor as
+	 * 64KiB, so keep scatterlist segments below that. */
+	host->quirks |= SDHCI_QUIRK_BROKEN_ADMA_ZEROLEN_DESC;
 
 #endif /* CONFIG_MMC_SDHCI_S3C_DMA */
 
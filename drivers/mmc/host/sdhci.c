@@ -419,6 +419,36 @@ static void sdhci_set_adma_desc(u8 *desc, u32 addr, int len, unsigned cmd)
 	dataddr[0] = cpu_to_le32(addr);
 }
 
+static int sdhci_dma_dir(struct mmc_data *data)
+{
+	return (data->flags & MMC_DATA_READ) ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+}
+
+/*
+ * Map the scatterlist of a request, unless sdhci_pre_req() did so already
+ * while the previous request was on the bus. Its host_cookie then holds
+ * the mapped entries until sdhci_post_req() unmaps it.
+ */
+static int sdhci_pre_dma_transfer(struct sdhci_host *host,
+	struct mmc_data *data)
+{
+	if (data->host_cookie)
+		return data->host_cookie;
+
+	return dma_map_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+		sdhci_dma_dir(data));
+}
+
+static void sdhci_post_dma_transfer(struct sdhci_host *host,
+	struct mmc_data *data)
+{
+	if (data->host_cookie)
+		return;
+
+	dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+		sdhci_dma_dir(data));
+}
+
 static int sdhci_adma_table_pre(struct sdhci_host *host,
 	struct mmc_data *data)
 {
@@ -456,8 +486,7 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 		goto fail;
 	BUG_ON(host->align_addr & 0x3);
 
-	host->sg_count = dma_map_sg(mmc_dev(host->mmc),
-		data->sg, data->sg_len, direction);
+	host->sg_count = sdhci_pre_dma_transfer(host, data);
 	if (host->sg_count == 0)
 		goto unmap_align;
 
@@ -547,8 +576,10 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 	return 0;
 
 unmap_entries:
+	/* The request goes PIO, so unmap it now even if it was premapped */
 	dma_unmap_sg(mmc_dev(host->mmc), data->sg,
 		data->sg_len, direction);
+	data->host_cookie = 0;
 unmap_align:
 	dma_unmap_single(mmc_dev(host->mmc), host->align_addr,
 		128 * 4, direction);
@@ -598,8 +629,7 @@ static void sdhci_adma_table_post(struct sdhci_host *host,
 		}
 	}
 
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-		data->sg_len, direction);
+	sdhci_post_dma_transfer(host, data);
 }
 
 static u8 sdhci_calc_timeout(struct sdhci_host *host, struct mmc_command *cmd)
@@ -781,11 +811,7 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_command *cmd)
 		} else {
 			int sg_cnt;
 
-			sg_cnt = dma_map_sg(mmc_dev(host->mmc),
-					data->sg, data->sg_len,
-					(data->flags & MMC_DATA_READ) ?
-						DMA_FROM_DEVICE :
-						DMA_TO_DEVICE);
+			sg_cnt = sdhci_pre_dma_transfer(host, data);
 			if (sg_cnt == 0) {
 				/*
 				 * This only happens when someone fed
@@ -883,11 +909,8 @@ static void sdhci_finish_data(struct sdhci_host *host)
 	if (host->flags & SDHCI_REQ_USE_DMA) {
 		if (host->flags & SDHCI_USE_ADMA)
 			sdhci_adma_table_post(host, data);
-		else {
-			dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-				data->sg_len, (data->flags & MMC_DATA_READ) ?
-					DMA_FROM_DEVICE : DMA_TO_DEVICE);
-		}
+		else
+			sdhci_post_dma_transfer(host, data);
 	}
 
 	/*
@@ -1799,7 +1822,44 @@ static void sdhci_enable_preset_value(struct mmc_host *mmc, bool enable)
 	spin_unlock_irqrestore(&host->lock, flags);
 }
 
+/*
+ * Map the next request's scatterlist, and so clean or invalidate it in
+ * the caches, while the current request is still on the bus. Only done
+ * for ADMA, which never falls back to PIO for a mapped request.
+ */
+static void sdhci_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+	bool is_first_req)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data || data->host_cookie)
+		return;
+
+	if (!(host->flags & SDHCI_USE_ADMA) ||
+	    (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE))
+		return;
+
+	data->host_cookie = dma_map_sg(mmc_dev(mmc), data->sg, data->sg_len,
+		sdhci_dma_dir(data));
+}
+
+static void sdhci_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+	int err)
+{
+	struct mmc_data *data = mrq->data;
+
+	if (!data || !data->host_cookie)
+		return;
+
+	dma_unmap_sg(mmc_dev(mmc), data->sg, data->sg_len,
+		sdhci_dma_dir(data));
+	data->host_cookie = 0;
+}
+
 static const struct mmc_host_ops sdhci_ops = {
+	.pre_req	= sdhci_pre_req,
+	.post_req	= sdhci_post_req,
 	.request	= sdhci_request,
 	.set_ios	= sdhci_set_ios,
 	.get_ro		= sdhci_get_ro,
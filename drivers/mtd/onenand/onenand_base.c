@@ -65,6 +65,13 @@ MODULE_PARM_DESC(otp,	"Corresponding behaviour of OneNAND in OTP"
 			"	   : 2 -> 1st Block lock"
 			"	   : 3 -> BOTH OTP Block and 1st Block lock");
 
+/* Pipelined multi-page reads, where the controller supports them */
+static int pipelined_read = 1;
+
+module_param(pipelined_read, bool, 0644);
+MODULE_PARM_DESC(pipelined_read, "Pipeline multi-page reads on controllers"
+				 " with read-ahead or emulated BufferRAMs");
+
 /*
  * flexonenand_oob_128 - oob info for Flex-Onenand with 4KB page
  * For now, we expose only 64 out of 80 ecc bytes
@@ -1204,6 +1211,37 @@ static int onenand_mlc_read_ops_nolock(struct mtd_info *mtd, loff_t from,
 	return mtd->ecc_stats.corrected - stats.corrected ? -EUCLEAN : 0;
 }
 
+/**
+ * onenand_read_ahead - Announce the pages a read is about to load
+ * @param mtd		MTD device structure
+ * @param from		offset of the next page load
+ * @param end		end of the read
+ *
+ * Lets the controller fetch the following pages of the block while the
+ * current one is copied out. Returns the offset the announced run ends at.
+ */
+static loff_t onenand_read_ahead(struct mtd_info *mtd, loff_t from, loff_t end)
+{
+	struct onenand_chip *this = mtd->priv;
+	loff_t block_end;
+	int pages;
+
+	/* Not for the OTP area */
+	if (!this->read_ahead || !pipelined_read || this->state != FL_READING)
+		return mtd->size;
+
+	from &= ~((loff_t) this->writesize - 1);
+	block_end = (from | (mtd->erasesize - 1)) + 1;
+	if (end > block_end)
+		end = block_end;
+
+	pages = (int) ((end - from + this->writesize - 1) >> this->page_shift);
+	if (pages > 1)
+		this->read_ahead(mtd, from, pages);
+
+	return end;
+}
+
 /**
  * onenand_read_ops_nolock - [OneNAND Interface] OneNAND read main and/or out-of-band
  * @param mtd		MTD device structure
@@ -1225,6 +1263,7 @@ static int onenand_read_ops_nolock(struct mtd_info *mtd, loff_t from,
 	int oobread = 0, oobcolumn, thisooblen, oobsize;
 	int ret = 0, boundary = 0;
 	int writesize = this->writesize;
+	loff_t end = from + len, ahead = 0;
 
 	DEBUG(MTD_DEBUG_LEVEL3, "%s: from = 0x%08x, len = %i\n",
 			__func__, (unsigned int) from, (int) len);
@@ -1252,6 +1291,7 @@ static int onenand_read_ops_nolock(struct mtd_info *mtd, loff_t from,
  	/* Do first load to bufferRAM */
  	if (read < len) {
  		if (!onenand_check_bufferram(mtd, from)) {
+			ahead = onenand_read_ahead(mtd, from, end);
 			this->command(mtd, ONENAND_CMD_READ, from, writesize);
  			ret = this->wait(mtd, FL_READING);
  			onenand_update_bufferram(mtd, from, !ret);
@@ -1269,6 +1309,8 @@ static int onenand_read_ops_nolock(struct mtd_info *mtd, loff_t from,
  		/* If there is more to load then start next load */
  		from += thislen;
  		if (read + thislen < len) {
+			if (from >= ahead)
+				ahead = onenand_read_ahead(mtd, from, end);
 			this->command(mtd, ONENAND_CMD_READ, from, writesize);
  			/*
  			 * Chip boundary handling in DDP
@@ -1336,6 +1378,29 @@ static int onenand_read_ops_nolock(struct mtd_info *mtd, loff_t from,
 	return mtd->ecc_stats.corrected - stats.corrected ? -EUCLEAN : 0;
 }
 
+/**
+ * onenand_read_data_nolock - Read main and/or out-of-band with the best method
+ * @param mtd		MTD device structure
+ * @param from		offset to read from
+ * @param ops:		oob operation description structure
+ *
+ * A 4KiB page chip has a single DataRAM, so read-while-load only works
+ * when the controller keeps its own pair of BufferRAMs. Flex-OneNAND
+ * always goes the MLC way for its LSB page recovery.
+ */
+static int onenand_read_data_nolock(struct mtd_info *mtd, loff_t from,
+				struct mtd_oob_ops *ops)
+{
+	struct onenand_chip *this = mtd->priv;
+
+	if (ONENAND_IS_4KB_PAGE(this) &&
+	    (!ONENAND_IS_PIPELINE_READ(this) || !pipelined_read ||
+	     FLEXONENAND(this)))
+		return onenand_mlc_read_ops_nolock(mtd, from, ops);
+
+	return onenand_read_ops_nolock(mtd, from, ops);
+}
+
 /**
  * onenand_read_oob_nolock - [MTD Interface] OneNAND read out-of-band
  * @param mtd		MTD device structure
@@ -1453,7 +1518,6 @@ static int onenand_read_oob_nolock(struct mtd_info *mtd, loff_t from,
 static int onenand_read(struct mtd_info *mtd, loff_t from, size_t len,
 	size_t *retlen, u_char *buf)
 {
-	struct onenand_chip *this = mtd->priv;
 	struct mtd_oob_ops ops = {
 		.len	= len,
 		.ooblen	= 0,
@@ -1463,9 +1527,7 @@ static int onenand_read(struct mtd_info *mtd, loff_t from, size_t len,
 	int ret;
 
 	onenand_get_device(mtd, FL_READING);
-	ret = ONENAND_IS_4KB_PAGE(this) ?
-		onenand_mlc_read_ops_nolock(mtd, from, &ops) :
-		onenand_read_ops_nolock(mtd, from, &ops);
+	ret = onenand_read_data_nolock(mtd, from, &ops);
 	onenand_release_device(mtd);
 
 	*retlen = ops.retlen;
@@ -1483,7 +1545,6 @@ static int onenand_read(struct mtd_info *mtd, loff_t from, size_t len,
 static int onenand_read_oob(struct mtd_info *mtd, loff_t from,
 			    struct mtd_oob_ops *ops)
 {
-	struct onenand_chip *this = mtd->priv;
 	int ret;
 
 	switch (ops->mode) {
@@ -1498,9 +1559,7 @@ static int onenand_read_oob(struct mtd_info *mtd, loff_t from,
 
 	onenand_get_device(mtd, FL_READING);
 	if (ops->datbuf)
-		ret = ONENAND_IS_4KB_PAGE(this) ?
-			onenand_mlc_read_ops_nolock(mtd, from, ops) :
-			onenand_read_ops_nolock(mtd, from, ops);
+		ret = onenand_read_data_nolock(mtd, from, ops);
 	else
 		ret = onenand_read_oob_nolock(mtd, from, ops);
 	onenand_release_device(mtd);
@@ -3078,9 +3137,7 @@ static int do_otp_read(struct mtd_info *mtd, loff_t from, size_t len,
 	this->command(mtd, ONENAND_CMD_OTP_ACCESS, 0, 0);
 	this->wait(mtd, FL_OTPING);
 
-	ret = ONENAND_IS_4KB_PAGE(this) ?
-		onenand_mlc_read_ops_nolock(mtd, from, &ops) :
-		onenand_read_ops_nolock(mtd, from, &ops);
+	ret = onenand_read_data_nolock(mtd, from, &ops);
 
 	/* Exit OTP access mode */
 	this->command(mtd, ONENAND_CMD_RESET, 0, 0);
@@ -22,9 +22,14 @@
 #include <linux/mtd/onenand.h>
 #include <linux/mtd/partitions.h>
 #include <linux/interrupt.h>
+#include <linux/completion.h>
+#include <linux/dma-mapping.h>
 
 #include <asm/mach/flash.h>
 #include <plat/regs-onenand.h>
+#ifdef CONFIG_MTD_ONENAND_S3C6410_DMA
+#include <mach/dma.h>
+#endif
 
 #include <linux/io.h>
 
@@ -117,6 +122,19 @@ struct s3c6410_onenand {
 	void		*page_buf;
 	void		*oob_buf;
 
+	/* Page transfer in flight, see s3c6410_onenand_dma_start() */
+	int			dma_ok;
+	int			dma_index;	/* BufferRAM in flight or -1 */
+	int			dma_result;
+	dma_addr_t		dma_addr;
+	size_t			dma_len;
+	enum dma_data_direction	dma_dir;
+	struct completion	dma_done;
+
+	/* Pipelined read in progress, see s3c6410_onenand_read_ahead() */
+	loff_t			ra_next;
+	int			ra_pages;
+
 	unsigned int	(*mem_addr)(int fba, int fpa, int fsa);
 	unsigned int	(*cmd_map)(unsigned int type, unsigned int val);
 
@@ -366,6 +384,189 @@ static inline void s3c6410_onenand_dummy_write(
 }
 #endif
 
+#ifdef CONFIG_MTD_ONENAND_S3C6410_DMA
+/*
+ * Page transfers by the PL080
+ *
+ * The controller stalls the bus until the page has been loaded into its
+ * DataRAM, so a whole page can be moved by a memory to memory transfer from
+ * or to the command mapped address. A read is started by the command and
+ * only waited for in this->wait(), which onenand_base calls after copying
+ * out the other BufferRAM. Loading page N+1 this way overlaps with the copy
+ * of page N and the CPU sleeps instead of spinning on the bus.
+ */
+static struct s3c2410_dma_client s3c6410_onenand_dma_client = {
+	.name = "s3c6410-onenand-dma",
+};
+
+static void s3c6410_onenand_dma_cb(struct s3c2410_dma_chan *chan,
+		void *buf_id, int size, enum s3c2410_dma_buffresult result)
+{
+	onenand->dma_result = (result == S3C2410_RES_OK) ? 0 : -EIO;
+	complete(&onenand->dma_done);
+}
+
+static int s3c6410_onenand_dma_start(unsigned int cmd_map, void *buf,
+			size_t len, enum dma_data_direction dir, int index)
+{
+	struct device *dev = &onenand->pdev->dev;
+	enum s3c2410_dmasrc source;
+	int err;
+
+	/* Panic writes cannot sleep on the completion */
+	if (!onenand->dma_ok || oops_in_progress)
+		return -ENODEV;
+
+	if (dir == DMA_FROM_DEVICE)
+		source = S3C2410_DMASRC_HW;
+	else
+		source = S3C2410_DMASRC_MEM;
+
+	onenand->dma_addr = dma_map_single(dev, buf, len, dir);
+	onenand->dma_len = len;
+	onenand->dma_dir = dir;
+	onenand->dma_result = 0;
+	INIT_COMPLETION(onenand->dma_done);
+
+	s3c2410_dma_devconfig(DMACH_ONENAND, source,
+					onenand->ahb_phys + cmd_map);
+	err = s3c2410_dma_enqueue(DMACH_ONENAND, onenand,
+					onenand->dma_addr, len);
+	if (err) {
+		dma_unmap_single(dev, onenand->dma_addr, len, dir);
+		return err;
+	}
+
+	onenand->dma_index = index;
+	s3c2410_dma_ctrl(DMACH_ONENAND, S3C2410_DMAOP_START);
+
+	return 0;
+}
+
+/* Waits for the transfer in flight, its result is left in dma_result */
+static void s3c6410_onenand_dma_wait(void)
+{
+	struct device *dev = &onenand->pdev->dev;
+
+	if (onenand->dma_index < 0)
+		return;
+
+	if (!wait_for_completion_timeout(&onenand->dma_done,
+						msecs_to_jiffies(20))) {
+		dev_err(dev, "%s: DMA timeout\n", __func__);
+		s3c2410_dma_ctrl(DMACH_ONENAND, S3C2410_DMAOP_FLUSH);
+		onenand->dma_result = -ETIMEDOUT;
+	}
+
+	dma_unmap_single(dev, onenand->dma_addr, onenand->dma_len,
+							onenand->dma_dir);
+	onenand->dma_index = -1;
+}
+
+static void s3c6410_onenand_dma_init(void)
+{
+	struct device *dev = &onenand->pdev->dev;
+
+	init_completion(&onenand->dma_done);
+	onenand->dma_index = -1;
+
+	if (s3c2410_dma_request(DMACH_ONENAND,
+				&s3c6410_onenand_dma_client, NULL) < 0) {
+		dev_warn(dev, "no DMA channel, using CPU transfers\n");
+		return;
+	}
+
+	s3c2410_dma_set_buffdone_fn(DMACH_ONENAND, s3c6410_onenand_dma_cb);
+	s3c2410_dma_setflags(DMACH_ONENAND, S3C64XX_DMAF_M2M);
+	s3c2410_dma_config(DMACH_ONENAND, 4);
+	onenand->dma_ok = 1;
+}
+
+static void s3c6410_onenand_dma_exit(void)
+{
+	if (!onenand->dma_ok)
+		return;
+
+	s3c6410_onenand_dma_wait();
+	s3c2410_dma_free(DMACH_ONENAND, &s3c6410_onenand_dma_client);
+	onenand->dma_ok = 0;
+}
+#else
+static inline int s3c6410_onenand_dma_start(unsigned int cmd_map, void *buf,
+			size_t len, enum dma_data_direction dir, int index)
+{
+	return -ENODEV;
+}
+
+static inline void s3c6410_onenand_dma_wait(void) {}
+
+static inline void s3c6410_onenand_dma_init(void)
+{
+	onenand->dma_index = -1;
+}
+
+static inline void s3c6410_onenand_dma_exit(void) {}
+#endif
+
+static unsigned int s3c6410_onenand_page_addr(struct onenand_chip *this,
+						loff_t addr)
+{
+	int fba, fpa;
+
+	fba = (int) (addr >> this->erase_shift);
+	fpa = (int) (addr >> this->page_shift);
+	fpa &= this->page_mask;
+
+	return onenand->mem_addr(fba, fpa, 0);
+}
+
+/*
+ * Pipelined read: once told how many pages of a block follow, the
+ * controller loads each next page from the array while the current one
+ * is still read out of MAP_01. The pages must then be read in order, so
+ * what is left of a run the core gives up on is read out and dropped
+ * before any other command goes to the chip.
+ */
+static void s3c6410_onenand_read_ahead_drain(struct mtd_info *mtd)
+{
+	struct onenand_chip *this = mtd->priv;
+	unsigned int cmd_map_01;
+	int i, stat, mcount = mtd->writesize >> 2;
+
+	if (!onenand->ra_pages)
+		return;
+
+	while (onenand->ra_pages) {
+		cmd_map_01 = CMD_MAP_01(onenand,
+			s3c6410_onenand_page_addr(this, onenand->ra_next));
+		for (i = 0; i < mcount; i++)
+			s3c6410_onenand_read_cmd(cmd_map_01);
+
+		onenand->ra_next += this->writesize;
+		onenand->ra_pages--;
+	}
+
+	stat = s3c6410_onenand_read_reg(INT_ERR_STAT_OFFSET);
+	s3c6410_onenand_write_reg(stat, INT_ERR_ACK_OFFSET);
+}
+
+static void s3c6410_onenand_read_ahead(struct mtd_info *mtd, loff_t from,
+				int pages)
+{
+	struct onenand_chip *this = mtd->priv;
+	unsigned int mem_addr;
+
+	s3c6410_onenand_dma_wait();
+	s3c6410_onenand_read_ahead_drain(mtd);
+
+	mem_addr = s3c6410_onenand_page_addr(this, from);
+	s3c6410_onenand_write_cmd(ONENAND_PIPELINE_READ | pages,
+					CMD_MAP_10(onenand, mem_addr));
+
+	onenand->ra_next = from;
+	onenand->ra_pages = pages;
+}
+
 static int s3c6410_onenand_command(struct mtd_info *mtd, int cmd, loff_t addr,
 			       size_t len)
 {
@@ -384,6 +585,18 @@ static int s3c6410_onenand_command(struct mtd_info *mtd, int cmd, loff_t addr,
 	cmd_map_01 = CMD_MAP_01(onenand, mem_addr);
 	cmd_map_10 = CMD_MAP_10(onenand, mem_addr);
 
+	/* One transfer at a time */
+	s3c6410_onenand_dma_wait();
+
+	/* Only the next page of a pipelined read may follow it */
+	if (onenand->ra_pages) {
+		if (cmd == ONENAND_CMD_READ && addr == onenand->ra_next) {
+			onenand->ra_next += this->writesize;
+			onenand->ra_pages--;
+		} else
+			s3c6410_onenand_read_ahead_drain(mtd);
+	}
+
 	switch (cmd) {
 	case ONENAND_CMD_READ:
 	case ONENAND_CMD_READOOB:
@@ -411,15 +624,21 @@ static int s3c6410_onenand_command(struct mtd_info *mtd, int cmd, loff_t addr,
 
 	switch (cmd) {
 	case ONENAND_CMD_READ:
-		/* Main */
-		s3c6410_onenand_read(onenand, cmd_map_01, mcount, m);
+		/* Main, waited for in s3c6410_onenand_wait() */
+		if (s3c6410_onenand_dma_start(cmd_map_01, m, mtd->writesize,
+						DMA_FROM_DEVICE, index))
+			s3c6410_onenand_read(onenand, cmd_map_01, mcount, m);
 		return 0;
 
 	case ONENAND_CMD_READOOB:
 		s3c6410_onenand_write_reg(TSRF, TRANS_SPARE_OFFSET);
 
 		/* Main */
-		s3c6410_onenand_read(onenand, cmd_map_01, mcount, m);
+		if (!s3c6410_onenand_dma_start(cmd_map_01, m, mtd->writesize,
+						DMA_FROM_DEVICE, index))
+			s3c6410_onenand_dma_wait();
+		else
+			s3c6410_onenand_read(onenand, cmd_map_01, mcount, m);
 		/* Spare */
 		s3c6410_onenand_read(onenand, cmd_map_01, scount, s);
 
@@ -427,8 +646,10 @@ static int s3c6410_onenand_command(struct mtd_info *mtd, int cmd, loff_t addr,
 		return 0;
 
 	case ONENAND_CMD_PROG:
-		/* Main */
-		s3c6410_onenand_write(onenand, cmd_map_01, mcount, m);
+		/* Main, waited for in s3c6410_onenand_wait() */
+		if (s3c6410_onenand_dma_start(cmd_map_01, m, mtd->writesize,
+						DMA_TO_DEVICE, index))
+			s3c6410_onenand_write(onenand, cmd_map_01, mcount, m);
 		return 0;
 
 	case ONENAND_CMD_PROGOOB:
@@ -463,6 +684,11 @@ static int s3c6410_onenand_wait(struct mtd_info *mtd, int state)
 	unsigned int flags = INT_ACT;
 	unsigned int stat, ecc;
 	unsigned long timeout;
+	int dma_err;
+
+	s3c6410_onenand_dma_wait();
+	dma_err = onenand->dma_result;
+	onenand->dma_result = 0;
 
 	switch (state) {
 	case FL_READING:
@@ -496,6 +722,11 @@ static int s3c6410_onenand_wait(struct mtd_info *mtd, int state)
 	stat = s3c6410_onenand_read_reg(INT_ERR_STAT_OFFSET);
 	s3c6410_onenand_write_reg(stat, INT_ERR_ACK_OFFSET);
 
+	if (dma_err) {
+		dev_info(dev, "%s: DMA error = %d\n", __func__, dma_err);
+		return -EIO;
+	}
+
 	/*
 	 * In the Spec. it checks the controller status first
 	 * However if you get the correct information in case of
@@ -529,6 +760,11 @@ static int s3c6410_onenand_bbt_wait(struct mtd_info *mtd, int state)
 	unsigned int flags = INT_ACT | LOAD_CMP;
 	unsigned int stat;
 	unsigned long timeout;
+	int dma_err;
+
+	s3c6410_onenand_dma_wait();
+	dma_err = onenand->dma_result;
+	onenand->dma_result = 0;
 
 	/* The 20 msec is enough */
 	timeout = jiffies + msecs_to_jiffies(20);
@@ -541,7 +777,7 @@ static int s3c6410_onenand_bbt_wait(struct mtd_info *mtd, int state)
 	stat = s3c6410_onenand_read_reg(INT_ERR_STAT_OFFSET);
 	s3c6410_onenand_write_reg(stat, INT_ERR_ACK_OFFSET);
 
-	if (stat & LD_FAIL_ECC_ERR) {
+	if (dma_err || (stat & LD_FAIL_ECC_ERR)) {
 		s3c6410_onenand_reset();
 		return ONENAND_BBT_READ_ERROR;
 	}
@@ -580,8 +816,12 @@ static int s3c6410_onenand_read_bufferram(struct mtd_info *mtd, int area,
 				  unsigned char *buffer, int offset,
 				  size_t count)
 {
+	struct onenand_chip *this = mtd->priv;
 	unsigned char *p;
 
+	if (ONENAND_CURRENT_BUFFERRAM(this) == onenand->dma_index)
+		s3c6410_onenand_dma_wait();
+
 	p = s3c6410_get_bufferram(mtd, area);
 	memcpy(buffer, p + offset, count);
 	return 0;
@@ -591,8 +831,12 @@ static int s3c6410_onenand_write_bufferram(struct mtd_info *mtd, int area,
 				   const unsigned char *buffer, int offset,
 				   size_t count)
 {
+	struct onenand_chip *this = mtd->priv;
 	unsigned char *p;
 
+	if (ONENAND_CURRENT_BUFFERRAM(this) == onenand->dma_index)
+		s3c6410_onenand_dma_wait();
+
 	p = s3c6410_get_bufferram(mtd, area);
 	memcpy(p + offset, buffer, count);
 	return 0;
@@ -694,6 +938,7 @@ static void s3c6410_onenand_setup(struct mtd_info *mtd)
 
 	this->read_bufferram = s3c6410_onenand_read_bufferram;
 	this->write_bufferram = s3c6410_onenand_write_bufferram;
+	this->read_ahead = s3c6410_onenand_read_ahead;
 }
 
 /*
@@ -757,6 +1002,8 @@ static int s3c6410_onenand_probe(struct platform_device *pdev)
 
 	/* Use runtime badblock check */
 	this->options |= ONENAND_SKIP_UNLOCK_CHECK;
+	/* BufferRAMs are emulated, so 4KiB pages can read-while-load too */
+	this->options |= ONENAND_HAS_PIPELINE_READ;
 
 	r = platform_get_resource(pdev, IORESOURCE_MEM, 1);
 	if (!r) {
@@ -781,20 +1028,22 @@ static int s3c6410_onenand_probe(struct platform_device *pdev)
 		goto ahb_ioremap_failed;
 	}
 
-	/* Allocate 4KiB BufferRAM */
-	onenand->page_buf = kzalloc(SZ_4K, GFP_KERNEL);
+	/* Allocate two 4KiB BufferRAMs */
+	onenand->page_buf = kzalloc(SZ_4K * 2, GFP_KERNEL);
 	if (!onenand->page_buf) {
 		err = -ENOMEM;
 		goto page_buf_fail;
 	}
 
-	/* Allocate 128 SpareRAM */
-	onenand->oob_buf = kzalloc(128, GFP_KERNEL);
+	/* Allocate two 128 SpareRAMs */
+	onenand->oob_buf = kzalloc(128 * 2, GFP_KERNEL);
 	if (!onenand->oob_buf) {
 		err = -ENOMEM;
 		goto oob_buf_fail;
 	}
 
+	s3c6410_onenand_dma_init();
+
 	/* S3C doesn't handle subpage write */
 	mtd->subpage_sft = 0;
 	this->subpagesize = mtd->writesize;
@@ -824,6 +1073,7 @@ static int s3c6410_onenand_probe(struct platform_device *pdev)
 	return 0;
 
 scan_failed:
+	s3c6410_onenand_dma_exit();
 	kfree(onenand->oob_buf);
 oob_buf_fail:
 	kfree(onenand->page_buf);
@@ -849,6 +1099,7 @@ static int __devexit s3c6410_onenand_remove(struct platform_device *pdev)
 	struct mtd_info *mtd = platform_get_drvdata(pdev);
 
 	onenand_release(mtd);
+	s3c6410_onenand_dma_exit();
 	iounmap(onenand->ahb_addr);
 	release_mem_region(onenand->ahb_res->start,
 					resource_size(onenand->ahb_res));
@@ -928,6 +1179,9 @@ static  int s3c6410_onenand_resume(struct device *dev)
 	struct mtd_info *mtd = platform_get_drvdata(pdev);
 	struct onenand_chip *this = mtd->priv;
 
+	/* A pipelined read did not survive the sleep */
+	onenand->ra_pages = 0;
+
 	s3c6410_onenand_restore(s3c6410_onenand_save_data,
 					ARRAY_SIZE(s3c6410_onenand_save_data));
 
@@ -0,0 +1,309 @@
+/*
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; see the file COPYING. If not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * Test concurrent file read and write speed of a flash file system, e.g.
+ * yaffs2 on nandsim.
+ *
+ * Each of the threads works on a file of its own in the given directory.
+ * The files are written by all threads at once, read back by all threads
+ * at once with their page cache dropped, and then read by all threads but
+ * one while that one writes its file again. The last run shows whether
+ * readers make progress while the file system is busy writing: besides the
+ * speed, the longest time a single read or write call took is reported.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/mount.h>
+#include <linux/namei.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+
+#define PRINT_PREF KERN_INFO "mtd_fsspeedtest: "
+
+#define MAX_THREADS	32
+#define BUF_SIZE	(16 * 1024)
+
+static char *dir;
+module_param(dir, charp, S_IRUGO);
+MODULE_PARM_DESC(dir, "Directory on the file system to test");
+
+static int threads = 4;
+module_param(threads, int, S_IRUGO);
+MODULE_PARM_DESC(threads, "Number of threads, each with its own file "
+			  "(default 4)");
+
+static int size = 1024;
+module_param(size, int, S_IRUGO);
+MODULE_PARM_DESC(size, "Size of each file in KiB (default 1024)");
+
+struct test_thread {
+	struct file *file;
+	unsigned char *buf;
+	int write;
+	int err;
+	u64 bytes;
+	u64 max_ns;		/* longest single read or write call */
+};
+
+static struct test_thread thr[MAX_THREADS];
+static atomic_t running;
+static struct completion done;
+
+static int file_io(struct test_thread *t)
+{
+	loff_t pos = 0, len = (loff_t)size * 1024;
+	mm_segment_t old_fs;
+	ssize_t ret = 0;
+	u64 start, ns;
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	while (pos < len) {
+		size_t n = min_t(loff_t, BUF_SIZE, len - pos);
+
+		start = local_clock();
+		if (t->write)
+			ret = vfs_write(t->file, (char __user *)t->buf, n,
+					&pos);
+		else
+			ret = vfs_read(t->file, (char __user *)t->buf, n,
+				       &pos);
+		ns = local_clock() - start;
+		if (ret <= 0)
+			break;
+
+		t->bytes += ret;
+		if (ns > t->max_ns)
+			t->max_ns = ns;
+		cond_resched();
+	}
+	set_fs(old_fs);
+
+	if (ret < 0)
+		return ret;
+	if (pos < len)
+		return -EIO;
+
+	/* Written data has to reach the flash to count */
+	if (t->write)
+		return vfs_fsync(t->file, 0);
+	return 0;
+}
+
+static int test_thread_fn(void *data)
+{
+	struct test_thread *t = data;
+
+	t->err = file_io(t);
+
+	if (atomic_dec_and_test(&running))
+		complete(&done);
+	return 0;
+}
+
+/* Run all threads at once, the first writers of them write */
+static int run_threads(const char *name, int writers)
+{
+	struct task_struct *task[MAX_THREADS];
+	u64 start, ns, max_rd_ns = 0, max_wr_ns = 0;
+	u64 rd_bytes = 0, wr_bytes = 0, rd_speed = 0, wr_speed = 0;
+	int i, err = 0;
+
+	for (i = 0; i < threads; i++) {
+		struct test_thread *t = &thr[i];
+
+		t->write = i < writers;
+		t->err = 0;
+		t->bytes = 0;
+		t->max_ns = 0;
+
+		/* Reads have to go to the flash */
+		if (!t->write)
+			invalidate_mapping_pages(t->file->f_mapping, 0, -1);
+	}
+
+	atomic_set(&running, 1);
+	init_completion(&done);
+
+	for (i = 0; i < threads; i++) {
+		task[i] = kthread_create(test_thread_fn, &thr[i],
+					 "mtd_fsspeedtest/%d", i);
+		if (IS_ERR(task[i])) {
+			err = PTR_ERR(task[i]);
+			printk(PRINT_PREF "error: cannot start thread\n");
+			break;
+		}
+		atomic_inc(&running);
+	}
+
+	/* Start those we have together */
+	start = local_clock();
+	while (i--)
+		wake_up_process(task[i]);
+
+	if (!atomic_dec_and_test(&running))
+		wait_for_completion(&done);
+	ns = local_clock() - start;
+
+	if (err)
+		return err;
+
+	for (i = 0; i < threads; i++) {
+		struct test_thread *t = &thr[i];
+
+		if (t->err) {
+			printk(PRINT_PREF "error %d in thread %d\n", t->err, i);
+			err = t->err;
+		}
+		if (t->write) {
+			wr_bytes += t->bytes;
+			max_wr_ns = max(max_wr_ns, t->max_ns);
+		} else {
+			rd_bytes += t->bytes;
+			max_rd_ns = max(max_rd_ns, t->max_ns);
+		}
+	}
+
+	ns = div_u64(ns, NSEC_PER_MSEC);
+	if (ns) {
+		rd_speed = div64_u64(rd_bytes * MSEC_PER_SEC, ns) >> 10;
+		wr_speed = div64_u64(wr_bytes * MSEC_PER_SEC, ns) >> 10;
+	}
+
+	printk(PRINT_PREF "%s: %d readers %llu KiB/s, longest read %llu ms; "
+	       "%d writers %llu KiB/s, longest write %llu ms\n", name,
+	       threads - writers, rd_speed,
+	       div_u64(max_rd_ns, NSEC_PER_MSEC), writers, wr_speed,
+	       div_u64(max_wr_ns, NSEC_PER_MSEC));
+
+	return err;
+}
+
+static void remove_file(struct file *file)
+{
+	struct dentry *dentry = file->f_path.dentry;
+	struct dentry *parent = dget_parent(dentry);
+	struct inode *dir_inode = parent->d_inode;
+	int err;
+
+	err = mnt_want_write(file->f_path.mnt);
+	if (!err) {
+		mutex_lock_nested(&dir_inode->i_mutex, I_MUTEX_PARENT);
+		err = vfs_unlink(dir_inode, dentry);
+		mutex_unlock(&dir_inode->i_mutex);
+		mnt_drop_write(file->f_path.mnt);
+	}
+	dput(parent);
+
+	if (err)
+		printk(PRINT_PREF "error %d while removing file\n", err);
+}
+
+static int __init mtd_fsspeedtest_init(void)
+{
+	char *name;
+	int err = 0, i;
+
+	printk(KERN_INFO "\n");
+	printk(KERN_INFO "=================================================\n");
+
+	if (!dir) {
+		printk(PRINT_PREF "error: no directory given, use dir=\n");
+		return -EINVAL;
+	}
+	if (threads < 1 || threads > MAX_THREADS || size < 1) {
+		printk(PRINT_PREF "error: bad threads or size\n");
+		return -EINVAL;
+	}
+
+	printk(PRINT_PREF "directory: %s    threads: %d    file size: %d KiB\n",
+	       dir, threads, size);
+
+	for (i = 0; i < threads; i++) {
+		struct test_thread *t = &thr[i];
+
+		t->buf = kmalloc(BUF_SIZE, GFP_KERNEL);
+		if (!t->buf) {
+			printk(PRINT_PREF "error: cannot allocate memory\n");
+			err = -ENOMEM;
+			goto out;
+		}
+		memset(t->buf, 0x5a + i, BUF_SIZE);
+
+		name = kasprintf(GFP_KERNEL, "%s/mtd_fsspeedtest.%d", dir, i);
+		if (!name) {
+			err = -ENOMEM;
+			goto out;
+		}
+		t->file = filp_open(name, O_RDWR | O_CREAT | O_TRUNC |
+				    O_LARGEFILE, 0600);
+		if (IS_ERR(t->file)) {
+			err = PTR_ERR(t->file);
+			t->file = NULL;
+			printk(PRINT_PREF "error %d: cannot create %s\n",
+			       err, name);
+			kfree(name);
+			goto out;
+		}
+		kfree(name);
+	}
+
+	err = run_threads("write", threads);
+	if (err)
+		goto out;
+
+	err = run_threads("read", 0);
+	if (err)
+		goto out;
+
+	if (threads > 1) {
+		err = run_threads("read while writing", 1);
+		if (err)
+			goto out;
+	}
+
+	printk(PRINT_PREF "finished\n");
+out:
+	for (i = 0; i < threads; i++) {
+		if (thr[i].file) {
+			remove_file(thr[i].file);
+			filp_close(thr[i].file, NULL);
+			thr[i].file = NULL;
+		}
+		kfree(thr[i].buf);
+		thr[i].buf = NULL;
+	}
+	if (err)
+		printk(PRINT_PREF "error %d occurred\n", err);
+	printk(KERN_INFO "=================================================\n");
+	return err;
+}
+module_init(mtd_fsspeedtest_init);
+
+static void __exit mtd_fsspeedtest_exit(void)
+{
+	return;
+}
+module_exit(mtd_fsspeedtest_exit);
+
+MODULE_DESCRIPTION("Concurrent file system speed test module");
+MODULE_LICENSE("GPL");
@@ -47,6 +47,7 @@ static int ebcnt;
 static int pgcnt;
 static int goodebcnt;
 static struct timeval start, finish;
+static u64 start_cpu, finish_cpu;
 static unsigned long next = 1;
 
 static inline unsigned int simple_rand(void)
@@ -305,11 +306,13 @@ static int is_block_bad(int ebnum)
 static inline void start_timing(void)
 {
 	do_gettimeofday(&start);
+	start_cpu = current->se.sum_exec_runtime;
 }
 
 static inline void stop_timing(void)
 {
 	do_gettimeofday(&finish);
+	finish_cpu = current->se.sum_exec_runtime;
 }
 
 static long calc_speed(void)
@@ -326,6 +329,26 @@ static long calc_speed(void)
 	return k;
 }
 
+/*
+ * Percentage of the elapsed time this thread was running, so how much of a
+ * CPU the transfers cost. Time the thread spends sleeping, e.g. waiting for
+ * DMA, is not counted. The run time is the scheduler's own nanosecond count
+ * for this thread, finer than the tick-sampled user and system times.
+ */
+static long calc_cpu(void)
+{
+	uint64_t cpu;
+	long ms;
+
+	ms = (finish.tv_sec - start.tv_sec) * 1000 +
+	     (finish.tv_usec - start.tv_usec) / 1000;
+	if (ms == 0)
+		return 0;
+	cpu = div_u64(finish_cpu - start_cpu, 10 * NSEC_PER_USEC);
+	do_div(cpu, ms);
+	return cpu;
+}
+
 static int scan_for_bad_eraseblocks(void)
 {
 	int i, bad = 0;
@@ -425,7 +448,8 @@ static int __init mtd_speedtest_init(void)
 	}
 	stop_timing();
 	speed = calc_speed();
-	printk(PRINT_PREF "eraseblock write speed is %ld KiB/s\n", speed);
+	printk(PRINT_PREF "eraseblock write speed is %ld KiB/s, cpu %ld%%\n",
+	       speed, calc_cpu());
 
 	/* Read all eraseblocks, 1 eraseblock at a time */
 	printk(PRINT_PREF "testing eraseblock read speed\n");
@@ -440,7 +464,8 @@ static int __init mtd_speedtest_init(void)
 	}
 	stop_timing();
 	speed = calc_speed();
-	printk(PRINT_PREF "eraseblock read speed is %ld KiB/s\n", speed);
+	printk(PRINT_PREF "eraseblock read speed is %ld KiB/s, cpu %ld%%\n",
+	       speed, calc_cpu());
 
 	err = erase_whole_device();
 	if (err)
@@ -459,7 +484,8 @@ static int __init mtd_speedtest_init(void)
 	}
 	stop_timing();
 	speed = calc_speed();
-	printk(PRINT_PREF "page write speed is %ld KiB/s\n", speed);
+	printk(PRINT_PREF "page write speed is %ld KiB/s, cpu %ld%%\n",
+	       speed, calc_cpu());
 
 	/* Read all eraseblocks, 1 page at a time */
 	printk(PRINT_PREF "testing page read speed\n");
@@ -474,7 +500,8 @@ static int __init mtd_speedtest_init(void)
 	}
 	stop_timing();
 	speed = calc_speed();
-	printk(PRINT_PREF "page read speed is %ld KiB/s\n", speed);
+	printk(PRINT_PREF "page read speed is %ld KiB/s, cpu %ld%%\n",
+	       speed, calc_cpu());
 
 	err = erase_whole_device();
 	if (err)
@@ -493,7 +520,8 @@ static int __init mtd_speedtest_init(void)
 	}
 	stop_timing();
 	speed = calc_speed();
-	printk(PRINT_PREF "2 page write speed is %ld KiB/s\n", speed);
+	printk(PRINT_PREF "2 page write speed is %ld KiB/s, cpu %ld%%\n",
+	       speed, calc_cpu());
 
 	/* Read all eraseblocks, 2 pages at a time */
 	printk(PRINT_PREF "testing 2 page read speed\n");
@@ -508,7 +536,8 @@ static int __init mtd_speedtest_init(void)
 	}
 	stop_timing();
 	speed = calc_speed();
-	printk(PRINT_PREF "2 page read speed is %ld KiB/s\n", speed);
+	printk(PRINT_PREF "2 page read speed is %ld KiB/s, cpu %ld%%\n",
+	       speed, calc_cpu());
 
 	/* Erase all eraseblocks */
 	printk(PRINT_PREF "Testing erase speed\n");
@@ -523,7 +552,8 @@ static int __init mtd_speedtest_init(void)
 	}
 	stop_timing();
 	speed = calc_speed();
-	printk(PRINT_PREF "erase speed is %ld KiB/s\n", speed);
+	printk(PRINT_PREF "erase speed is %ld KiB/s, cpu %ld%%\n",
+	       speed, calc_cpu());
 
 	/* Multi-block erase all eraseblocks */
 	for (k = 1; k < 7; k++) {
@@ -547,8 +577,8 @@ static int __init mtd_speedtest_init(void)
 		}
 		stop_timing();
 		speed = calc_speed();
-		printk(PRINT_PREF "%dx multi-block erase speed is %ld KiB/s\n",
-		       blocks, speed);
+		printk(PRINT_PREF "%dx multi-block erase speed is %ld KiB/s, cpu %ld%%\n",
+		       blocks, speed, calc_cpu());
 	}
 	printk(PRINT_PREF "finished\n");
 out:
@@ -28,9 +28,10 @@
  * specified, UBI does not attach any MTD device, but it is possible to do
  * later using the "UBI control device".
  *
- * At the moment we only attach UBI devices by scanning, which will become a
- * bottleneck when flashes reach certain large size. Then one may improve UBI
- * and add other methods, although it does not seem to be easy to do.
+ * UBI devices are attached by scanning, which becomes a bottleneck when
+ * flashes reach certain large size, or, with CONFIG_MTD_UBI_FASTMAP, from the
+ * fastmap written when the device was last detached (see fastmap.c). Scanning
+ * is the fall-back if there is no usable fastmap.
  */
 
 #include <linux/err.h>
@@ -44,6 +45,8 @@
 #include <linux/kthread.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/reboot.h>
 #include "ubi.h"
 
 /* Maximum length of the 'mtd=' parameter */
@@ -131,6 +134,12 @@ static struct device_attribute dev_bgt_enabled =
 	__ATTR(bgt_enabled, S_IRUGO, dev_attribute_show, NULL);
 static struct device_attribute dev_mtd_num =
 	__ATTR(mtd_num, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_attach_method =
+	__ATTR(attach_method, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_attach_time_us =
+	__ATTR(attach_time_us, S_IRUGO, dev_attribute_show, NULL);
+static struct device_attribute dev_attach_pebs_read =
+	__ATTR(attach_pebs_read, S_IRUGO, dev_attribute_show, NULL);
 
 /**
  * ubi_volume_notify - send a volume change notification.
@@ -355,6 +364,14 @@ static ssize_t dev_attribute_show(struct device *dev,
 		ret = sprintf(buf, "%d\n", ubi->thread_enabled);
 	else if (attr == &dev_mtd_num)
 		ret = sprintf(buf, "%d\n", ubi->mtd->index);
+	else if (attr == &dev_attach_method)
+		ret = sprintf(buf, "%s\n",
+			      ubi->attach_method == UBI_ATTACH_FASTMAP ?
+			      "fastmap" : "scan");
+	else if (attr == &dev_attach_time_us)
+		ret = sprintf(buf, "%u\n", ubi->attach_time);
+	else if (attr == &dev_attach_pebs_read)
+		ret = sprintf(buf, "%d\n", ubi->attach_pebs);
 	else
 		ret = -EINVAL;
 
@@ -422,6 +439,15 @@ static int ubi_sysfs_init(struct ubi_device *ubi, int *ref)
 	if (err)
 		return err;
 	err = device_create_file(&ubi->dev, &dev_mtd_num);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_attach_method);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_attach_time_us);
+	if (err)
+		return err;
+	err = device_create_file(&ubi->dev, &dev_attach_pebs_read);
 	return err;
 }
 
@@ -431,6 +457,9 @@ static int ubi_sysfs_init(struct ubi_device *ubi, int *ref)
  */
 static void ubi_sysfs_close(struct ubi_device *ubi)
 {
+	device_remove_file(&ubi->dev, &dev_attach_pebs_read);
+	device_remove_file(&ubi->dev, &dev_attach_time_us);
+	device_remove_file(&ubi->dev, &dev_attach_method);
 	device_remove_file(&ubi->dev, &dev_mtd_num);
 	device_remove_file(&ubi->dev, &dev_bgt_enabled);
 	device_remove_file(&ubi->dev, &dev_min_io_size);
@@ -565,29 +594,40 @@ static void free_internal_volumes(struct ubi_device *ubi)
 	     i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
 		kfree(ubi->volumes[i]->eba_tbl);
 		kfree(ubi->volumes[i]);
+		ubi->volumes[i] = NULL;
 	}
 }
 
 /**
- * attach_by_scanning - attach an MTD device using scanning method.
+ * free_user_volumes - free user volumes.
+ * @ubi: UBI device description object
+ *
+ * This function is used when attaching fails after the volume table was read.
+ */
+static void free_user_volumes(struct ubi_device *ubi)
+{
+	int i;
+
+	for (i = 0; i < ubi->vtbl_slots; i++) {
+		if (!ubi->volumes[i])
+			continue;
+		kfree(ubi->volumes[i]->eba_tbl);
+		kfree(ubi->volumes[i]);
+		ubi->volumes[i] = NULL;
+	}
+}
+
+/**
+ * attach_si - initialize the UBI device from scanning information.
  * @ubi: UBI device descriptor
+ * @si: scanning information, freed by this function
  *
  * This function returns zero in case of success and a negative error code in
  * case of failure.
- *
- * Note, currently this is the only method to attach UBI devices. Hopefully in
- * the future we'll have more scalable attaching methods and avoid full media
- * scanning. But even in this case scanning will be needed as a fall-back
- * attaching method if there are some on-flash table corruptions.
  */
-static int attach_by_scanning(struct ubi_device *ubi)
+static int attach_si(struct ubi_device *ubi, struct ubi_scan_info *si)
 {
 	int err;
-	struct ubi_scan_info *si;
-
-	si = ubi_scan(ubi);
-	if (IS_ERR(si))
-		return PTR_ERR(si);
 
 	ubi->bad_peb_count = si->bad_peb_count;
 	ubi->good_peb_count = ubi->peb_count - ubi->bad_peb_count;
@@ -614,13 +654,98 @@ static int attach_by_scanning(struct ubi_device *ubi)
 out_wl:
 	ubi_wl_close(ubi);
 out_vtbl:
+	free_user_volumes(ubi);
 	free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
+	ubi->vtbl = NULL;
 out_si:
 	ubi_scan_destroy_si(si);
 	return err;
 }
 
+/**
+ * attach_by_scanning - attach an MTD device using scanning method.
+ * @ubi: UBI device descriptor
+ *
+ * This function returns zero in case of success and a negative error code in
+ * case of failure.
+ */
+static int attach_by_scanning(struct ubi_device *ubi)
+{
+	struct ubi_scan_info *si;
+
+	si = ubi_scan(ubi);
+	if (IS_ERR(si))
+		return PTR_ERR(si);
+
+	ubi->attach_pebs += ubi->peb_count;
+	return attach_si(ubi, si);
+}
+
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * attach_by_fastmap - attach an MTD device using the fastmap.
+ * @ubi: UBI device descriptor
+ *
+ * This function returns zero in case of success, %-ENOENT if there is no
+ * usable fastmap, and another negative error code in case of failure. In any
+ * case of failure the device may still be attached by scanning.
+ */
+static int attach_by_fastmap(struct ubi_device *ubi)
+{
+	int err;
+	struct ubi_scan_info *si;
+
+	si = ubi_scan_fastmap(ubi);
+	if (!si)
+		return -ENOENT;
+
+	err = attach_si(ubi, si);
+	if (err) {
+		ubi_warn("cannot attach from fastmap, error %d", err);
+		ubi->vol_count = 0;
+		ubi->rsvd_pebs = ubi->avail_pebs = 0;
+		ubi->beb_rsvd_pebs = ubi->beb_rsvd_level = 0;
+		ubi->autoresize_vol_id = -1;
+	}
+
+	return err;
+}
+#else
+static inline int attach_by_fastmap(struct ubi_device *ubi)
+{
+	return -ENOENT;
+}
+#endif
+
+/**
+ * attach - attach an MTD device.
+ * @ubi: UBI device descriptor
+ *
+ * This function attaches the device from the fastmap if there is one, and by
+ * scanning otherwise, and records how long it took. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+static int attach(struct ubi_device *ubi)
+{
+	int err;
+	ktime_t start = ktime_get();
+
+	ubi->attach_method = UBI_ATTACH_FASTMAP;
+	err = attach_by_fastmap(ubi);
+	if (err) {
+		ubi->attach_method = UBI_ATTACH_SCAN;
+		err = attach_by_scanning(ubi);
+		if (err) {
+			dbg_err("failed to attach by scanning, error %d", err);
+			return err;
+		}
+	}
+
+	ubi->attach_time = ktime_us_delta(ktime_get(), start);
+	return 0;
+}
+
 /**
  * io_init - initialize I/O sub-system for a given UBI device.
  * @ubi: UBI device description object
@@ -934,6 +1059,10 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	mutex_init(&ubi->buf_mutex);
 	mutex_init(&ubi->ckvol_mutex);
 	mutex_init(&ubi->device_mutex);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	mutex_init(&ubi->fm_mutex);
+	init_rwsem(&ubi->fm_sem);
+#endif
 	spin_lock_init(&ubi->volumes_lock);
 
 	ubi_msg("attaching mtd%d to ubi%d", mtd->index, ubi_num);
@@ -953,11 +1082,9 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	if (!ubi->peb_buf2)
 		goto out_free;
 
-	err = attach_by_scanning(ubi);
-	if (err) {
-		dbg_err("failed to attach by scanning, error %d", err);
+	err = attach(ubi);
+	if (err)
 		goto out_free;
-	}
 
 	if (ubi->autoresize_vol_id != -1) {
 		err = autoresize(ubi, ubi->autoresize_vol_id);
@@ -994,6 +1121,9 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 		ubi->beb_rsvd_pebs);
 	ubi_msg("max/mean erase counter: %d/%d", ubi->max_ec, ubi->mean_ec);
 	ubi_msg("image sequence number:  %d", ubi->image_seq);
+	ubi_msg("attached by %s in %u us, %d PEBs read",
+		ubi->attach_method == UBI_ATTACH_FASTMAP ? "fastmap" : "scanning",
+		ubi->attach_time, ubi->attach_pebs);
 
 	/*
 	 * The below lock makes sure we do not race with 'ubi_thread()' which
@@ -1004,6 +1134,11 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	wake_up_process(ubi->bgt_thread);
 	spin_unlock(&ubi->wl_lock);
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	ubi->fm_nb.notifier_call = ubi_fastmap_reboot_notify;
+	register_reboot_notifier(&ubi->fm_nb);
+#endif
+
 	ubi_devices[ubi_num] = ubi;
 	ubi_notify_all(ubi, UBI_VOLUME_ADDED, NULL);
 	return ubi_num;
@@ -1067,6 +1202,10 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	ubi_notify_all(ubi, UBI_VOLUME_REMOVED, NULL);
 	dbg_msg("detaching mtd%d from ubi%d", ubi->mtd->index, ubi_num);
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	unregister_reboot_notifier(&ubi->fm_nb);
+#endif
+
 	/*
 	 * Before freeing anything, we have to stop the background thread to
 	 * prevent it from doing anything on this device while we are freeing.
@@ -1074,6 +1213,13 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	if (ubi->bgt_thread)
 		kthread_stop(ubi->bgt_thread);
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	/* Without a fastmap, the device is just scanned on the next attach */
+	if (ubi_update_fastmap(ubi))
+		ubi_warn("cannot write fastmap for %s", ubi->ubi_name);
+	ubi_fastmap_close(ubi);
+#endif
+
 	/*
 	 * Get a reference to the device in order to prevent 'dev_release()'
 	 * from freeing the @ubi object.
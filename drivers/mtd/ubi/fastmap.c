@@ -0,0 +1,1286 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * UBI fastmap.
+ *
+ * Attaching by scanning reads the EC and VID headers of every physical
+ * eraseblock, so it takes time proportional to the size of the flash. The
+ * fastmap avoids this. When the UBI device is detached, or the system goes
+ * down, UBI writes a snapshot of the EBA tables and of the state of each
+ * physical eraseblock to the flash (see &struct ubi_fm_sb). On the next
+ * attach, UBI looks for the fastmap super block among the first
+ * %UBI_FM_MAX_START physical eraseblocks and builds the scanning information
+ * from the fastmap instead of from the headers. The rest of the UBI
+ * initialization is then exactly the same as after scanning.
+ *
+ * A fastmap only describes the flash as long as nothing is written to it, so
+ * it lives for one attach cycle:
+ *   o once a fastmap is written, the first header write, erasure or bad
+ *     eraseblock marking by anybody but the fastmap writer erases the fastmap
+ *     super block before it goes ahead (see 'ubi_fastmap_check()');
+ *   o when UBI attaches from the fastmap, it erases the super block before
+ *     anything else is written, and schedules the fastmap data eraseblocks
+ *     for erasure like any other stale eraseblock.
+ *
+ * If there is no fastmap, or it is not consistent, UBI falls back to
+ * scanning. The fastmap volumes are "delete" compatible, so scanning, even by
+ * UBI implementations which do not support fastmap, just erases them.
+ *
+ * Physical eraseblocks which the WL sub-system considered used but which were
+ * not referred to by any EBA table when the fastmap was written (e.g., old
+ * copies of logical eraseblocks being replaced, or new ones being written) are
+ * recorded as such, and their headers are read at attach time, like scanning
+ * would do. The same logical eraseblock may then turn up twice, and the
+ * sequence numbers of the copies are compared as usual; the sequence numbers
+ * of physical eraseblocks which come from the fastmap are read lazily for
+ * this (see %UBI_SCAN_UNKNOWN_SQNUM).
+ */
+
+#include <linux/crc32.h>
+#include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/reboot.h>
+#include "ubi.h"
+
+/*
+ * Additional physical eraseblock states used while writing the fastmap, see
+ * 'ubi_wl_fm_snapshot()' for the others.
+ *
+ * FM_PEB_CORR: corrupted, neither bad nor known to the WL sub-system
+ * FM_PEB_FM: holds the fastmap being written
+ * FM_PEB_IN_EBA: flag - referred to by an EBA table
+ */
+#define FM_PEB_CORR   (UBI_FM_PEB_ERASE + 1)
+#define FM_PEB_FM     (UBI_FM_PEB_ERASE + 2)
+#define FM_PEB_IN_EBA 0x80
+
+/* The lists of physical eraseblocks in the fastmap data, in on-flash order */
+enum {
+	FM_LIST_FREE,
+	FM_LIST_USED,
+	FM_LIST_SCRUB,
+	FM_LIST_ERASE,
+	FM_LIST_SCAN,
+	FM_LIST_CORR,
+	FM_LIST_COUNT
+};
+
+/*
+ * States of physical eraseblocks while attaching from the fastmap.
+ *
+ * FM_SEEN_LISTED: found in one of the lists, or is a fastmap eraseblock
+ * FM_SEEN_USED: found in the "used" list, not yet in an EBA table
+ * FM_SEEN_SCRUB: found in the "scrub" list, not yet in an EBA table
+ * FM_SEEN_MAPPED: found in an EBA table
+ */
+enum {
+	FM_SEEN_NONE = 0,
+	FM_SEEN_LISTED,
+	FM_SEEN_USED,
+	FM_SEEN_SCRUB,
+	FM_SEEN_MAPPED,
+};
+
+/**
+ * fm_list - find out which fastmap list a physical eraseblock belongs to.
+ * @state: the state of the physical eraseblock
+ *
+ * Returns the list (%FM_LIST_FREE, etc) or %-1 if the physical eraseblock is
+ * not listed.
+ */
+static int fm_list(uint8_t state)
+{
+	int in_eba = state & FM_PEB_IN_EBA;
+
+	switch (state & ~FM_PEB_IN_EBA) {
+	case UBI_FM_PEB_FREE:
+		return FM_LIST_FREE;
+	case UBI_FM_PEB_USED:
+		return in_eba ? FM_LIST_USED : FM_LIST_SCAN;
+	case UBI_FM_PEB_SCRUB:
+		return in_eba ? FM_LIST_SCRUB : FM_LIST_SCAN;
+	case UBI_FM_PEB_ERASE:
+		return FM_LIST_ERASE;
+	case FM_PEB_CORR:
+		return FM_LIST_CORR;
+	}
+
+	return -1;
+}
+
+/**
+ * fm_data_size - calculate the maximum size of the fastmap data.
+ * @ubi: UBI device description object
+ */
+static int fm_data_size(const struct ubi_device *ubi)
+{
+	int i, size;
+
+	size = sizeof(struct ubi_fm_hdr);
+	size += ubi->peb_count * sizeof(struct ubi_fm_ec);
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
+		struct ubi_volume *vol = ubi->volumes[i];
+
+		if (!vol)
+			continue;
+		size += sizeof(struct ubi_fm_volhdr);
+		size += vol->reserved_pebs * sizeof(__be32);
+	}
+
+	return size;
+}
+
+/**
+ * fill_volumes - store the EBA tables in the fastmap data.
+ * @ubi: UBI device description object
+ * @buf: where to store them
+ * @state: the state of each physical eraseblock
+ *
+ * Only physical eraseblocks the WL sub-system considers used are stored,
+ * and they are flagged with %FM_PEB_IN_EBA in @state. Volumes without mapped
+ * logical eraseblocks are skipped. Returns the number of stored volumes and
+ * the size they take is added to @size.
+ */
+static int fill_volumes(struct ubi_device *ubi, void *buf, uint8_t *state,
+			int *size)
+{
+	int i, lnum, pnum, mapped, vol_count = 0;
+
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
+		struct ubi_volume *vol = ubi->volumes[i];
+		struct ubi_fm_volhdr *fmvhdr = buf + *size;
+		__be32 *eba = (void *)(fmvhdr + 1);
+
+		if (!vol)
+			continue;
+
+		mapped = 0;
+		for (lnum = 0; lnum < vol->reserved_pebs; lnum++) {
+			pnum = vol->eba_tbl[lnum];
+			if (pnum >= 0 && (state[pnum] == UBI_FM_PEB_USED ||
+					  state[pnum] == UBI_FM_PEB_SCRUB)) {
+				state[pnum] |= FM_PEB_IN_EBA;
+				eba[lnum] = cpu_to_be32(pnum);
+				mapped += 1;
+			} else
+				eba[lnum] = cpu_to_be32(UBI_FM_UNMAPPED);
+		}
+
+		if (!mapped)
+			continue;
+
+		fmvhdr->magic = cpu_to_be32(UBI_FM_VHDR_MAGIC);
+		fmvhdr->vol_id = cpu_to_be32(vol->vol_id);
+		fmvhdr->data_pad = cpu_to_be32(vol->data_pad);
+		fmvhdr->reserved_pebs = cpu_to_be32(vol->reserved_pebs);
+		if (vol->vol_id == UBI_LAYOUT_VOLUME_ID)
+			fmvhdr->compat = UBI_LAYOUT_VOLUME_COMPAT;
+		if (vol->vol_type == UBI_STATIC_VOLUME) {
+			fmvhdr->vol_type = UBI_VID_STATIC;
+			fmvhdr->used_ebs = cpu_to_be32(vol->used_ebs);
+			fmvhdr->last_eb_bytes = cpu_to_be32(vol->last_eb_bytes);
+		} else
+			fmvhdr->vol_type = UBI_VID_DYNAMIC;
+
+		*size += sizeof(struct ubi_fm_volhdr);
+		*size += vol->reserved_pebs * sizeof(__be32);
+		vol_count += 1;
+	}
+
+	return vol_count;
+}
+
+/**
+ * fill_data - prepare the fastmap data.
+ * @ubi: UBI device description object
+ * @buf: where to store the data, zeroed
+ * @state: the state of each physical eraseblock
+ * @ec: the erase counter of each physical eraseblock
+ *
+ * Returns the size of the data in case of success and a negative error code
+ * in case of failure.
+ */
+static int fill_data(struct ubi_device *ubi, void *buf, uint8_t *state,
+		     const int *ec)
+{
+	int err, pnum, list, listed = 0, bad = 0, size, vol_count;
+	int count[FM_LIST_COUNT] = { 0 }, next[FM_LIST_COUNT];
+	struct ubi_fm_hdr *fmh = buf;
+	struct ubi_fm_ec *fmec = buf + sizeof(struct ubi_fm_hdr);
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		if (state[pnum] == UBI_FM_PEB_NONE) {
+			err = ubi_io_is_bad(ubi, pnum);
+			if (err < 0)
+				return err;
+			if (err) {
+				bad += 1;
+				continue;
+			}
+			state[pnum] = FM_PEB_CORR;
+		}
+		if (state[pnum] != FM_PEB_FM)
+			listed += 1;
+	}
+
+	/*
+	 * The volumes go after the lists. How many physical eraseblocks are
+	 * listed is already known, but to which list the used ones go depends
+	 * on the EBA tables.
+	 */
+	size = sizeof(struct ubi_fm_hdr) + listed * sizeof(struct ubi_fm_ec);
+	vol_count = fill_volumes(ubi, buf, state, &size);
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		list = fm_list(state[pnum]);
+		if (list >= 0)
+			count[list] += 1;
+	}
+
+	next[0] = 0;
+	for (list = 1; list < FM_LIST_COUNT; list++)
+		next[list] = next[list - 1] + count[list - 1];
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		int i;
+
+		list = fm_list(state[pnum]);
+		if (list < 0)
+			continue;
+
+		i = next[list]++;
+		fmec[i].pnum = cpu_to_be32(pnum);
+		if (list == FM_LIST_CORR)
+			fmec[i].ec = cpu_to_be32(ubi->mean_ec);
+		else
+			fmec[i].ec = cpu_to_be32(ec[pnum]);
+	}
+
+	fmh->magic = cpu_to_be32(UBI_FM_HDR_MAGIC);
+	fmh->free_peb_count = cpu_to_be32(count[FM_LIST_FREE]);
+	fmh->used_peb_count = cpu_to_be32(count[FM_LIST_USED]);
+	fmh->scrub_peb_count = cpu_to_be32(count[FM_LIST_SCRUB]);
+	fmh->erase_peb_count = cpu_to_be32(count[FM_LIST_ERASE]);
+	fmh->scan_peb_count = cpu_to_be32(count[FM_LIST_SCAN]);
+	fmh->corr_peb_count = cpu_to_be32(count[FM_LIST_CORR]);
+	fmh->bad_peb_count = cpu_to_be32(bad);
+	fmh->vol_count = cpu_to_be32(vol_count);
+
+	dbg_gen("fastmap: %d free, %d used, %d scrub, %d erase, %d scan, "
+		"%d corrupted, %d bad PEBs, %d volumes", count[FM_LIST_FREE],
+		count[FM_LIST_USED], count[FM_LIST_SCRUB], count[FM_LIST_ERASE],
+		count[FM_LIST_SCAN], count[FM_LIST_CORR], bad, vol_count);
+	return size;
+}
+
+/**
+ * write_fm_peb - write one fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @vid_hdr: VID header buffer to use
+ * @pnum: the physical eraseblock to write to
+ * @vol_id: %UBI_FM_SB_VOLUME_ID or %UBI_FM_DATA_VOLUME_ID
+ * @lnum: logical eraseblock number within the fastmap volume
+ * @buf: data to write
+ * @len: how many bytes to write, may be zero
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int write_fm_peb(struct ubi_device *ubi, struct ubi_vid_hdr *vid_hdr,
+			int pnum, int vol_id, int lnum, const void *buf,
+			int len)
+{
+	int err;
+
+	memset(vid_hdr, 0, UBI_VID_HDR_SIZE);
+	vid_hdr->vol_type = UBI_VID_DYNAMIC;
+	vid_hdr->vol_id = cpu_to_be32(vol_id);
+	vid_hdr->lnum = cpu_to_be32(lnum);
+	vid_hdr->compat = UBI_FM_VOLUME_COMPAT;
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
+
+	err = ubi_io_write_vid_hdr(ubi, pnum, vid_hdr);
+	if (err || !len)
+		return err;
+
+	return ubi_io_write_data(ubi, buf, pnum, 0,
+				 ALIGN(len, ubi->min_io_size));
+}
+
+/**
+ * write_fastmap - write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * The caller has to hold @ubi->device_mutex, @ubi->work_sem and @ubi->fm_sem
+ * in write mode, and @ubi->fm_mutex, and be @ubi->fm_writer. Returns zero in
+ * case of success and a negative error code in case of failure.
+ */
+static int write_fastmap(struct ubi_device *ubi)
+{
+	int err = -ENOMEM, i, pnum, size, used_blocks, sb_len;
+	uint8_t *state = NULL;
+	int *ec = NULL;
+	void *data = NULL;
+	struct ubi_fm_sb *fmsb = NULL;
+	struct ubi_vid_hdr *vid_hdr = NULL;
+	struct ubi_fastmap *fm;
+
+	used_blocks = DIV_ROUND_UP(fm_data_size(ubi), ubi->leb_size);
+	if (used_blocks > UBI_FM_MAX_BLOCKS) {
+		ubi_warn("fastmap would take %d PEBs, only %d allowed",
+			 used_blocks, UBI_FM_MAX_BLOCKS);
+		return -ENOSPC;
+	}
+
+	fm = kzalloc(sizeof(struct ubi_fastmap), GFP_KERNEL);
+	if (!fm)
+		return err;
+
+	sb_len = ALIGN(sizeof(struct ubi_fm_sb), ubi->min_io_size);
+	state = vzalloc(ubi->peb_count);
+	ec = vzalloc(ubi->peb_count * sizeof(int));
+	data = vzalloc(used_blocks * ubi->leb_size);
+	fmsb = kzalloc(sb_len, GFP_KERNEL);
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!state || !ec || !data || !fmsb || !vid_hdr)
+		goto out_free;
+
+	/*
+	 * Take the physical eraseblocks for the fastmap before the snapshot,
+	 * so that they are not listed as free.
+	 */
+	fm->anchor = ubi_wl_get_fm_peb(ubi, UBI_FM_MAX_START);
+	if (fm->anchor < 0) {
+		ubi_msg("no free PEB among the first %d for the fastmap",
+			UBI_FM_MAX_START);
+		err = fm->anchor;
+		goto out_free;
+	}
+
+	for (i = 0; i < used_blocks; i++) {
+		pnum = ubi_wl_get_fm_peb(ubi, ubi->peb_count);
+		if (pnum < 0) {
+			err = pnum;
+			goto out_put;
+		}
+		fm->pnum[fm->used_blocks++] = pnum;
+	}
+
+	/*
+	 * From now on, anybody else changing the flash has to wait for us and
+	 * then erase the new fastmap.
+	 */
+	ubi->fm = fm;
+
+	ubi_wl_fm_snapshot(ubi, state, ec);
+	state[fm->anchor] = FM_PEB_FM;
+	for (i = 0; i < fm->used_blocks; i++)
+		state[fm->pnum[i]] = FM_PEB_FM;
+
+	size = fill_data(ubi, data, state, ec);
+	if (size < 0) {
+		err = size;
+		goto out_put;
+	}
+
+	for (i = 0; i < fm->used_blocks; i++) {
+		int len = min(size - i * ubi->leb_size, ubi->leb_size);
+
+		err = write_fm_peb(ubi, vid_hdr, fm->pnum[i],
+				   UBI_FM_DATA_VOLUME_ID, i,
+				   data + i * ubi->leb_size, max(len, 0));
+		if (err)
+			goto out_put;
+
+		fmsb->block_loc[i] = cpu_to_be32(fm->pnum[i]);
+		fmsb->block_ec[i] = cpu_to_be32(ec[fm->pnum[i]]);
+	}
+
+	/* The super block goes last, it makes the fastmap valid */
+	fmsb->magic = cpu_to_be32(UBI_FM_SB_MAGIC);
+	fmsb->version = UBI_FM_FMT_VERSION;
+	fmsb->data_size = cpu_to_be32(size);
+	fmsb->data_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, data, size));
+	fmsb->used_blocks = cpu_to_be32(fm->used_blocks);
+
+	memset(vid_hdr, 0, UBI_VID_HDR_SIZE);
+	vid_hdr->vol_type = UBI_VID_DYNAMIC;
+	vid_hdr->vol_id = cpu_to_be32(UBI_FM_SB_VOLUME_ID);
+	vid_hdr->compat = UBI_FM_VOLUME_COMPAT;
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
+	fmsb->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
+	fmsb->crc = cpu_to_be32(crc32(UBI_CRC32_INIT, fmsb,
+				      sizeof(struct ubi_fm_sb) - sizeof(__be32)));
+
+	err = ubi_io_write_vid_hdr(ubi, fm->anchor, vid_hdr);
+	if (err)
+		goto out_put;
+
+	err = ubi_io_write_data(ubi, fmsb, fm->anchor, 0, sb_len);
+	if (err)
+		goto out_put;
+
+	ubi_msg("fastmap written to PEB %d, %d bytes of data in %d PEBs",
+		fm->anchor, size, fm->used_blocks);
+	goto out_free_bufs;
+
+out_put:
+	ubi_err("cannot write fastmap, error %d", err);
+	ubi->fm = NULL;
+	ubi_wl_put_fm_peb(ubi, fm->anchor);
+	for (i = 0; i < fm->used_blocks; i++)
+		ubi_wl_put_fm_peb(ubi, fm->pnum[i]);
+out_free:
+	kfree(fm);
+out_free_bufs:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	kfree(fmsb);
+	vfree(data);
+	vfree(ec);
+	vfree(state);
+	return err;
+}
+
+/**
+ * ubi_update_fastmap - write the fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function writes a fastmap describing the current state of the UBI
+ * device, unless there already is one. It is called when the device is
+ * detached or the system goes down, when nothing is expected to be written
+ * anymore: the fastmap is erased again as soon as anything is. Returns zero
+ * in case of success and a negative error code in case of failure.
+ */
+int ubi_update_fastmap(struct ubi_device *ubi)
+{
+	int err;
+
+	if (ubi->ro_mode)
+		return 0;
+
+	/*
+	 * Finish the pending erasures first, there is no point in writing a
+	 * fastmap they would invalidate right away.
+	 */
+	err = ubi_wl_flush(ubi);
+	if (err)
+		return err;
+
+	/*
+	 * Taking @ubi->fm_sem waits for the header writes and erasures which
+	 * are in flight, and keeps new ones out until the fastmap is on the
+	 * flash. They then invalidate it.
+	 */
+	mutex_lock(&ubi->device_mutex);
+	down_write(&ubi->work_sem);
+	down_write(&ubi->fm_sem);
+	mutex_lock(&ubi->fm_mutex);
+	ubi->fm_writer = current;
+	if (!ubi->fm && !ubi->ro_mode)
+		err = write_fastmap(ubi);
+	ubi->fm_writer = NULL;
+	mutex_unlock(&ubi->fm_mutex);
+	up_write(&ubi->fm_sem);
+	up_write(&ubi->work_sem);
+	mutex_unlock(&ubi->device_mutex);
+
+	return err;
+}
+
+/**
+ * ubi_fastmap_invalidate - erase the fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function is called by 'ubi_fastmap_check()' before the flash is
+ * changed. It erases the fastmap super block and schedules the data
+ * physical eraseblocks for erasure. If the super block cannot be erased, the
+ * device is switched to read-only mode, so that it is not changed behind the
+ * back of the fastmap. Returns zero in case of success and a negative error
+ * code in case of failure.
+ */
+int ubi_fastmap_invalidate(struct ubi_device *ubi)
+{
+	int err = 0, i;
+	struct ubi_fastmap *fm;
+
+	mutex_lock(&ubi->fm_mutex);
+	fm = ubi->fm;
+	if (!fm)
+		goto out_unlock;
+
+	dbg_gen("erase fastmap super block at PEB %d", fm->anchor);
+	ubi->fm_writer = current;
+	err = ubi_io_sync_erase(ubi, fm->anchor, 0);
+	ubi->fm_writer = NULL;
+	ubi->fm = NULL;
+	if (err < 0) {
+		ubi_err("cannot erase fastmap PEB %d, error %d",
+			fm->anchor, err);
+		ubi_ro_mode(ubi);
+		err = -EROFS;
+	} else
+		err = 0;
+
+	ubi_wl_put_fm_peb(ubi, fm->anchor);
+	for (i = 0; i < fm->used_blocks; i++)
+		ubi_wl_put_fm_peb(ubi, fm->pnum[i]);
+	kfree(fm);
+
+out_unlock:
+	mutex_unlock(&ubi->fm_mutex);
+	return err;
+}
+
+/**
+ * ubi_fastmap_close - forget about the fastmap on detach.
+ * @ubi: UBI device description object
+ *
+ * The fastmap stays on the flash for the next attach.
+ */
+void ubi_fastmap_close(struct ubi_device *ubi)
+{
+	int i;
+	struct ubi_fastmap *fm = ubi->fm;
+
+	if (!fm)
+		return;
+
+	ubi->fm = NULL;
+	ubi_wl_drop_fm_peb(ubi, fm->anchor);
+	for (i = 0; i < fm->used_blocks; i++)
+		ubi_wl_drop_fm_peb(ubi, fm->pnum[i]);
+	kfree(fm);
+}
+
+/**
+ * ubi_fastmap_reboot_notify - write the fastmap when the system goes down.
+ * @nb: the reboot notifier of the UBI device
+ * @event: reboot event (not used)
+ * @unused: not used
+ */
+int ubi_fastmap_reboot_notify(struct notifier_block *nb, unsigned long event,
+			      void *unused)
+{
+	int err;
+	struct ubi_device *ubi = container_of(nb, struct ubi_device, fm_nb);
+
+	/*
+	 * Stop the background thread, it would only invalidate the fastmap.
+	 * If anything still has to be done, it is done synchronously.
+	 */
+	spin_lock(&ubi->wl_lock);
+	ubi->thread_enabled = 0;
+	spin_unlock(&ubi->wl_lock);
+
+	err = ubi_update_fastmap(ubi);
+	if (err)
+		ubi_warn("cannot write fastmap for %s, error %d",
+			 ubi->ubi_name, err);
+	return NOTIFY_DONE;
+}
+
+/**
+ * add_peb - add a physical eraseblock to a scanning information list.
+ * @si: scanning information
+ * @list: the list to add to
+ * @pnum: physical eraseblock number
+ * @ec: erase counter
+ *
+ * Returns zero in case of success and %-ENOMEM in case of failure.
+ */
+static int add_peb(struct ubi_scan_info *si, struct list_head *list, int pnum,
+		   int ec)
+{
+	struct ubi_scan_leb *seb;
+
+	seb = kmem_cache_alloc(si->scan_leb_slab, GFP_KERNEL);
+	if (!seb)
+		return -ENOMEM;
+
+	seb->pnum = pnum;
+	seb->ec = ec;
+	list_add_tail(&seb->u.list, list);
+	return 0;
+}
+
+/**
+ * add_vol - add a volume to the scanning information.
+ * @si: scanning information
+ * @fmvhdr: the fastmap volume header
+ *
+ * This is the fastmap counterpart of 'add_volume()' in scan.c. Returns the
+ * new scanning volume object in case of success and a negative error code in
+ * case of failure.
+ */
+static struct ubi_scan_volume *add_vol(struct ubi_scan_info *si,
+				       const struct ubi_fm_volhdr *fmvhdr)
+{
+	int vol_id = be32_to_cpu(fmvhdr->vol_id);
+	struct ubi_scan_volume *sv;
+	struct rb_node **p = &si->volumes.rb_node, *parent = NULL;
+
+	while (*p) {
+		parent = *p;
+		sv = rb_entry(parent, struct ubi_scan_volume, rb);
+
+		if (vol_id == sv->vol_id) {
+			ubi_err("volume %d is in the fastmap twice", vol_id);
+			return ERR_PTR(-EINVAL);
+		}
+
+		if (vol_id > sv->vol_id)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	sv = kmalloc(sizeof(struct ubi_scan_volume), GFP_KERNEL);
+	if (!sv)
+		return ERR_PTR(-ENOMEM);
+
+	sv->highest_lnum = sv->leb_count = 0;
+	sv->vol_id = vol_id;
+	sv->root = RB_ROOT;
+	sv->used_ebs = be32_to_cpu(fmvhdr->used_ebs);
+	sv->last_data_size = be32_to_cpu(fmvhdr->last_eb_bytes);
+	sv->data_pad = be32_to_cpu(fmvhdr->data_pad);
+	sv->compat = fmvhdr->compat;
+	sv->vol_type = fmvhdr->vol_type == UBI_VID_DYNAMIC ? UBI_DYNAMIC_VOLUME
+							   : UBI_STATIC_VOLUME;
+	if (vol_id > si->highest_vol_id)
+		si->highest_vol_id = vol_id;
+
+	rb_link_node(&sv->rb, parent, p);
+	rb_insert_color(&sv->rb, &si->volumes);
+	si->vols_found += 1;
+	return sv;
+}
+
+/**
+ * add_leb - add a logical eraseblock to a scanning volume.
+ * @si: scanning information
+ * @sv: the scanning volume
+ * @pnum: physical eraseblock number
+ * @lnum: logical eraseblock number
+ * @ec: erase counter
+ * @scrub: if the physical eraseblock has to be scrubbed
+ *
+ * Returns zero in case of success and %-ENOMEM in case of failure.
+ */
+static int add_leb(struct ubi_scan_info *si, struct ubi_scan_volume *sv,
+		   int pnum, int lnum, int ec, int scrub)
+{
+	struct ubi_scan_leb *seb;
+	struct rb_node **p = &sv->root.rb_node, *parent = NULL;
+
+	seb = kmem_cache_alloc(si->scan_leb_slab, GFP_KERNEL);
+	if (!seb)
+		return -ENOMEM;
+
+	seb->ec = ec;
+	seb->pnum = pnum;
+	seb->lnum = lnum;
+	seb->scrub = scrub;
+	seb->copy_flag = 0;
+	seb->sqnum = UBI_SCAN_UNKNOWN_SQNUM;
+
+	while (*p) {
+		struct ubi_scan_leb *tmp;
+
+		parent = *p;
+		tmp = rb_entry(parent, struct ubi_scan_leb, u.rb);
+		if (lnum < tmp->lnum)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	if (sv->highest_lnum <= lnum)
+		sv->highest_lnum = lnum;
+	sv->leb_count += 1;
+	rb_link_node(&seb->u.rb, parent, p);
+	rb_insert_color(&seb->u.rb, &sv->root);
+	return 0;
+}
+
+/**
+ * struct fm_attach - state of attaching from the fastmap.
+ * @si: the scanning information being built
+ * @seen: what is known of each physical eraseblock (%FM_SEEN_NONE, etc)
+ * @ec: erase counters of the used physical eraseblocks
+ * @scan: the physical eraseblocks which have to be scanned
+ * @scan_count: number of entries in @scan
+ * @seen_count: number of physical eraseblocks which are not %FM_SEEN_NONE
+ */
+struct fm_attach {
+	struct ubi_scan_info *si;
+	uint8_t *seen;
+	int *ec;
+	int *scan;
+	int scan_count;
+	int seen_count;
+};
+
+/**
+ * see_peb - account a physical eraseblock found in the fastmap.
+ * @ubi: UBI device description object
+ * @fma: attach state
+ * @pnum: physical eraseblock number
+ * @ec: erase counter, %UBI_SCAN_UNKNOWN_EC if it is not known
+ * @seen: new state of the physical eraseblock
+ *
+ * Returns zero if @pnum and @ec are valid and @pnum was not met before, and
+ * %-EINVAL otherwise.
+ */
+static int see_peb(const struct ubi_device *ubi, struct fm_attach *fma,
+		   int pnum, int ec, int seen)
+{
+	struct ubi_scan_info *si = fma->si;
+
+	if (pnum < 0 || pnum >= ubi->peb_count || fma->seen[pnum] ||
+	    (ec < 0 && ec != UBI_SCAN_UNKNOWN_EC) ||
+	    ec > UBI_MAX_ERASECOUNTER) {
+		ubi_err("bad PEB %d or EC %d in the fastmap", pnum, ec);
+		return -EINVAL;
+	}
+
+	fma->seen[pnum] = seen;
+	fma->seen_count += 1;
+	if (ec == UBI_SCAN_UNKNOWN_EC)
+		return 0;
+
+	si->ec_sum += ec;
+	si->ec_count += 1;
+	if (ec > si->max_ec)
+		si->max_ec = ec;
+	if (ec < si->min_ec)
+		si->min_ec = ec;
+	return 0;
+}
+
+/**
+ * process_lists - add the physical eraseblock lists to the scanning
+ * information.
+ * @ubi: UBI device description object
+ * @fma: attach state
+ * @fmec: the lists
+ * @count: number of physical eraseblocks in each list
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int process_lists(struct ubi_device *ubi, struct fm_attach *fma,
+			 const struct ubi_fm_ec *fmec, const int *count)
+{
+	int err, list, i, pnum, ec;
+	struct ubi_scan_info *si = fma->si;
+
+	for (list = 0; list < FM_LIST_COUNT; list++) {
+		for (i = 0; i < count[list]; i++, fmec++) {
+			pnum = be32_to_cpu(fmec->pnum);
+			ec = be32_to_cpu(fmec->ec);
+
+			switch (list) {
+			case FM_LIST_FREE:
+				err = see_peb(ubi, fma, pnum, ec,
+					      FM_SEEN_LISTED);
+				if (!err)
+					err = add_peb(si, &si->free, pnum, ec);
+				break;
+			case FM_LIST_USED:
+			case FM_LIST_SCRUB:
+				err = see_peb(ubi, fma, pnum, ec,
+					      list == FM_LIST_USED ?
+					      FM_SEEN_USED : FM_SEEN_SCRUB);
+				if (!err)
+					fma->ec[pnum] = ec;
+				break;
+			case FM_LIST_ERASE:
+				err = see_peb(ubi, fma, pnum, ec,
+					      FM_SEEN_LISTED);
+				if (!err)
+					err = add_peb(si, &si->erase, pnum, ec);
+				break;
+			case FM_LIST_SCAN:
+				/* The EC of these is read when they are scanned */
+				err = see_peb(ubi, fma, pnum, UBI_SCAN_UNKNOWN_EC,
+					      FM_SEEN_LISTED);
+				if (!err)
+					fma->scan[fma->scan_count++] = pnum;
+				break;
+			default:
+				err = see_peb(ubi, fma, pnum, ec,
+					      FM_SEEN_LISTED);
+				if (!err)
+					err = add_peb(si, &si->corr, pnum, ec);
+				si->corr_peb_count += 1;
+				break;
+			}
+			if (err)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * process_volumes - add the volumes to the scanning information.
+ * @ubi: UBI device description object
+ * @fma: attach state
+ * @buf: the fastmap data
+ * @offs: offset of the first volume in @buf
+ * @size: size of the fastmap data
+ * @vol_count: number of volumes
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int process_volumes(struct ubi_device *ubi, struct fm_attach *fma,
+			   const void *buf, int offs, int size, int vol_count)
+{
+	int err, i, vol_id, lnum, pnum, reserved_pebs;
+	const struct ubi_fm_volhdr *fmvhdr;
+	const __be32 *eba;
+	struct ubi_scan_volume *sv;
+
+	for (i = 0; i < vol_count; i++) {
+		if (offs + sizeof(struct ubi_fm_volhdr) > size)
+			goto out_bad;
+
+		fmvhdr = buf + offs;
+		eba = (const void *)(fmvhdr + 1);
+		vol_id = be32_to_cpu(fmvhdr->vol_id);
+		reserved_pebs = be32_to_cpu(fmvhdr->reserved_pebs);
+		offs += sizeof(struct ubi_fm_volhdr);
+
+		if (be32_to_cpu(fmvhdr->magic) != UBI_FM_VHDR_MAGIC ||
+		    ((vol_id < 0 || vol_id >= UBI_MAX_VOLUMES) &&
+		     vol_id != UBI_LAYOUT_VOLUME_ID) ||
+		    (fmvhdr->vol_type != UBI_VID_DYNAMIC &&
+		     fmvhdr->vol_type != UBI_VID_STATIC) ||
+		    reserved_pebs < 0 || reserved_pebs > ubi->peb_count ||
+		    offs + reserved_pebs * sizeof(__be32) > size)
+			goto out_bad;
+		offs += reserved_pebs * sizeof(__be32);
+
+		sv = add_vol(fma->si, fmvhdr);
+		if (IS_ERR(sv))
+			return PTR_ERR(sv);
+
+		for (lnum = 0; lnum < reserved_pebs; lnum++) {
+			int seen;
+
+			if (be32_to_cpu(eba[lnum]) == UBI_FM_UNMAPPED)
+				continue;
+
+			pnum = be32_to_cpu(eba[lnum]);
+			if (pnum < 0 || pnum >= ubi->peb_count)
+				goto out_bad;
+
+			seen = fma->seen[pnum];
+			if (seen != FM_SEEN_USED && seen != FM_SEEN_SCRUB) {
+				ubi_err("LEB %d:%d maps to unexpected PEB %d",
+					vol_id, lnum, pnum);
+				return -EINVAL;
+			}
+
+			err = add_leb(fma->si, sv, pnum, lnum, fma->ec[pnum],
+				      seen == FM_SEEN_SCRUB);
+			if (err)
+				return err;
+			fma->seen[pnum] = FM_SEEN_MAPPED;
+		}
+	}
+
+	if (offs != size)
+		goto out_bad;
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++)
+		if (fma->seen[pnum] == FM_SEEN_USED ||
+		    fma->seen[pnum] == FM_SEEN_SCRUB) {
+			ubi_err("used PEB %d is not mapped", pnum);
+			return -EINVAL;
+		}
+
+	return 0;
+
+out_bad:
+	ubi_err("bad volume record %d in the fastmap", i);
+	return -EINVAL;
+}
+
+/**
+ * process_data - build the scanning information from the fastmap data.
+ * @ubi: UBI device description object
+ * @fma: attach state
+ * @buf: the fastmap data
+ * @size: size of the fastmap data
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int process_data(struct ubi_device *ubi, struct fm_attach *fma,
+			const void *buf, int size)
+{
+	const struct ubi_fm_hdr *fmh = buf;
+	int err, list, listed = 0, bad, count[FM_LIST_COUNT];
+
+	if (size < sizeof(struct ubi_fm_hdr) ||
+	    be32_to_cpu(fmh->magic) != UBI_FM_HDR_MAGIC) {
+		ubi_err("bad fastmap header");
+		return -EINVAL;
+	}
+
+	count[FM_LIST_FREE] = be32_to_cpu(fmh->free_peb_count);
+	count[FM_LIST_USED] = be32_to_cpu(fmh->used_peb_count);
+	count[FM_LIST_SCRUB] = be32_to_cpu(fmh->scrub_peb_count);
+	count[FM_LIST_ERASE] = be32_to_cpu(fmh->erase_peb_count);
+	count[FM_LIST_SCAN] = be32_to_cpu(fmh->scan_peb_count);
+	count[FM_LIST_CORR] = be32_to_cpu(fmh->corr_peb_count);
+	bad = be32_to_cpu(fmh->bad_peb_count);
+
+	for (list = 0; list < FM_LIST_COUNT; list++) {
+		if (count[list] < 0 || count[list] > ubi->peb_count) {
+			ubi_err("bad PEB count in the fastmap header");
+			return -EINVAL;
+		}
+		listed += count[list];
+	}
+
+	if (listed + fma->seen_count > ubi->peb_count ||
+	    sizeof(struct ubi_fm_hdr) + listed * sizeof(struct ubi_fm_ec) >
+	    size) {
+		ubi_err("bad PEB count in the fastmap header");
+		return -EINVAL;
+	}
+
+	fma->scan = kmalloc(count[FM_LIST_SCAN] * sizeof(int) + 1, GFP_KERNEL);
+	if (!fma->scan)
+		return -ENOMEM;
+
+	err = process_lists(ubi, fma, buf + sizeof(struct ubi_fm_hdr), count);
+	if (err)
+		return err;
+
+	err = process_volumes(ubi, fma, buf, sizeof(struct ubi_fm_hdr) +
+			      listed * sizeof(struct ubi_fm_ec), size,
+			      be32_to_cpu(fmh->vol_count));
+	if (err)
+		return err;
+
+	/* All the physical eraseblocks which are not listed have to be bad */
+	if (fma->seen_count + bad != ubi->peb_count) {
+		ubi_err("fastmap describes %d PEBs, but there are %d",
+			fma->seen_count + bad, ubi->peb_count);
+		return -EINVAL;
+	}
+	fma->si->bad_peb_count = bad;
+
+	return 0;
+}
+
+/**
+ * find_sb - find the fastmap super block.
+ * @ubi: UBI device description object
+ * @vid_hdr: VID header buffer to use
+ *
+ * This function looks for the newest fastmap super block among the first
+ * %UBI_FM_MAX_START physical eraseblocks. Returns its physical eraseblock
+ * number, %-ENOENT if there is none, and a negative error code in case of
+ * failure.
+ */
+static int find_sb(struct ubi_device *ubi, struct ubi_vid_hdr *vid_hdr)
+{
+	int err, pnum, found = -ENOENT;
+	unsigned long long sqnum, max_sqnum = 0;
+
+	for (pnum = 0; pnum < min(ubi->peb_count, UBI_FM_MAX_START); pnum++) {
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			return err;
+		else if (err)
+			continue;
+
+		ubi->attach_pebs += 1;
+		err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+		if (err < 0)
+			return err;
+		else if (err && err != UBI_IO_BITFLIPS)
+			continue;
+
+		if (be32_to_cpu(vid_hdr->vol_id) != UBI_FM_SB_VOLUME_ID)
+			continue;
+
+		sqnum = be64_to_cpu(vid_hdr->sqnum);
+		if (found < 0 || sqnum > max_sqnum) {
+			found = pnum;
+			max_sqnum = sqnum;
+		}
+	}
+
+	return found;
+}
+
+/**
+ * read_sb - read and check the fastmap super block.
+ * @ubi: UBI device description object
+ * @pnum: physical eraseblock holding the super block
+ * @fmsb: where to read it to
+ * @ec: the erase counter of @pnum is returned here
+ *
+ * Returns zero in case of success, %-EINVAL if the super block is not valid,
+ * and another negative error code in case of failure.
+ */
+static int read_sb(struct ubi_device *ubi, int pnum, struct ubi_fm_sb *fmsb,
+		   int *ec)
+{
+	int err, image_seq, used_blocks, data_size;
+	uint32_t crc;
+	struct ubi_ec_hdr *ec_hdr;
+
+	ec_hdr = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ec_hdr)
+		return -ENOMEM;
+
+	err = ubi_io_read_ec_hdr(ubi, pnum, ec_hdr, 0);
+	if (err && err != UBI_IO_BITFLIPS) {
+		if (err > 0)
+			err = -EINVAL;
+		goto out_free;
+	}
+
+	err = -EINVAL;
+	if (ec_hdr->version != UBI_VERSION)
+		goto out_free;
+
+	*ec = be64_to_cpu(ec_hdr->ec);
+	image_seq = be32_to_cpu(ec_hdr->image_seq);
+	if (!ubi->image_seq)
+		ubi->image_seq = image_seq;
+	else if (image_seq && ubi->image_seq != image_seq) {
+		ubi_err("bad image sequence number %d in PEB %d, expected %d",
+			image_seq, pnum, ubi->image_seq);
+		goto out_free;
+	}
+
+	err = ubi_io_read_data(ubi, fmsb, pnum, 0, sizeof(struct ubi_fm_sb));
+	if (err && err != UBI_IO_BITFLIPS) {
+		if (err > 0 || err == -EBADMSG)
+			err = -EINVAL;
+		goto out_free;
+	}
+
+	err = -EINVAL;
+	crc = crc32(UBI_CRC32_INIT, fmsb,
+		    sizeof(struct ubi_fm_sb) - sizeof(__be32));
+	if (be32_to_cpu(fmsb->magic) != UBI_FM_SB_MAGIC ||
+	    crc != be32_to_cpu(fmsb->crc)) {
+		ubi_err("bad fastmap super block at PEB %d", pnum);
+		goto out_free;
+	}
+
+	if (fmsb->version != UBI_FM_FMT_VERSION) {
+		ubi_err("fastmap version is %d, only %d is supported",
+			fmsb->version, UBI_FM_FMT_VERSION);
+		goto out_free;
+	}
+
+	used_blocks = be32_to_cpu(fmsb->used_blocks);
+	data_size = be32_to_cpu(fmsb->data_size);
+	if (used_blocks < 1 || used_blocks > UBI_FM_MAX_BLOCKS ||
+	    data_size < sizeof(struct ubi_fm_hdr) ||
+	    data_size > used_blocks * ubi->leb_size) {
+		ubi_err("bad fastmap super block at PEB %d", pnum);
+		goto out_free;
+	}
+
+	err = 0;
+
+out_free:
+	kfree(ec_hdr);
+	return err;
+}
+
+/**
+ * read_data - read the fastmap data.
+ * @ubi: UBI device description object
+ * @fmsb: the fastmap super block
+ * @vid_hdr: VID header buffer to use
+ * @buf: where to read the data to
+ *
+ * Returns zero in case of success, %-EINVAL if the data are not valid, and
+ * another negative error code in case of failure.
+ */
+static int read_data(struct ubi_device *ubi, const struct ubi_fm_sb *fmsb,
+		     struct ubi_vid_hdr *vid_hdr, void *buf)
+{
+	int err, i, pnum, len, size = be32_to_cpu(fmsb->data_size);
+
+	for (i = 0; i < be32_to_cpu(fmsb->used_blocks); i++) {
+		pnum = be32_to_cpu(fmsb->block_loc[i]);
+		if (pnum < 0 || pnum >= ubi->peb_count)
+			return -EINVAL;
+
+		ubi->attach_pebs += 1;
+		err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+		if (err && err != UBI_IO_BITFLIPS)
+			return err < 0 ? err : -EINVAL;
+
+		if (be32_to_cpu(vid_hdr->vol_id) != UBI_FM_DATA_VOLUME_ID ||
+		    be32_to_cpu(vid_hdr->lnum) != i) {
+			ubi_err("PEB %d does not hold fastmap data block %d",
+				pnum, i);
+			return -EINVAL;
+		}
+
+		len = min(size - i * ubi->leb_size, ubi->leb_size);
+		if (len <= 0)
+			continue;
+
+		err = ubi_io_read_data(ubi, buf + i * ubi->leb_size, pnum, 0,
+				       len);
+		if (err && err != UBI_IO_BITFLIPS)
+			return err > 0 || err == -EBADMSG ? -EINVAL : err;
+	}
+
+	if (crc32(UBI_CRC32_INIT, buf, size) != be32_to_cpu(fmsb->data_crc)) {
+		ubi_err("fastmap data CRC error");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * ubi_scan_fastmap - build the scanning information from the fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function looks for a fastmap and, if there is a valid one, builds the
+ * scanning information from it, reading the headers of only those physical
+ * eraseblocks the fastmap does not describe. The fastmap super block is
+ * erased, so the fastmap cannot be used again. Returns the scanning
+ * information, or %NULL if there is no usable fastmap, in which case the
+ * device has to be scanned.
+ */
+struct ubi_scan_info *ubi_scan_fastmap(struct ubi_device *ubi)
+{
+	int err, i, pnum, anchor, anchor_ec, used_blocks;
+	struct ubi_vid_hdr *vid_hdr;
+	struct ubi_fm_sb *fmsb = NULL;
+	struct fm_attach fma;
+	void *buf = NULL;
+
+	if (ubi->ro_mode)
+		return NULL;
+
+	memset(&fma, 0, sizeof(struct fm_attach));
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vid_hdr)
+		return NULL;
+
+	anchor = find_sb(ubi, vid_hdr);
+	if (anchor < 0) {
+		err = anchor;
+		goto out_free;
+	}
+
+	fmsb = kmalloc(sizeof(struct ubi_fm_sb), GFP_KERNEL);
+	if (!fmsb) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	err = read_sb(ubi, anchor, fmsb, &anchor_ec);
+	if (err)
+		goto out_free;
+
+	used_blocks = be32_to_cpu(fmsb->used_blocks);
+	buf = vmalloc(used_blocks * ubi->leb_size);
+	if (!buf) {
+		err = -ENOMEM;
+		goto out_free;
+	}
+
+	err = read_data(ubi, fmsb, vid_hdr, buf);
+	if (err)
+		goto out_free;
+
+	err = -ENOMEM;
+	fma.si = ubi_scan_alloc_si();
+	fma.seen = vzalloc(ubi->peb_count);
+	fma.ec = vmalloc(ubi->peb_count * sizeof(int));
+	if (!fma.si || !fma.seen || !fma.ec)
+		goto out_free;
+
+	err = see_peb(ubi, &fma, anchor, anchor_ec, FM_SEEN_LISTED);
+	for (i = 0; i < used_blocks && !err; i++) {
+		pnum = be32_to_cpu(fmsb->block_loc[i]);
+		err = see_peb(ubi, &fma, pnum, be32_to_cpu(fmsb->block_ec[i]),
+			      FM_SEEN_LISTED);
+		if (!err)
+			err = add_peb(fma.si, &fma.si->erase, pnum,
+				      be32_to_cpu(fmsb->block_ec[i]));
+	}
+	if (err)
+		goto out_free;
+
+	err = process_data(ubi, &fma, buf, be32_to_cpu(fmsb->data_size));
+	if (err)
+		goto out_free;
+
+	err = ubi_scan_pebs(ubi, fma.si, fma.scan, fma.scan_count);
+	if (err)
+		goto out_free;
+	ubi->attach_pebs += fma.scan_count;
+
+	/*
+	 * The fastmap is consistent. Get rid of it before anything is written,
+	 * it would not describe the flash anymore.
+	 */
+	err = ubi_scan_erase_peb(ubi, fma.si, anchor, anchor_ec + 1);
+	if (err)
+		goto out_free;
+
+	err = add_peb(fma.si, &fma.si->free, anchor, anchor_ec + 1);
+	if (err)
+		goto out_free;
+
+	ubi_scan_set_mean_ec(fma.si);
+	if (fma.si->max_sqnum < be64_to_cpu(fmsb->sqnum))
+		fma.si->max_sqnum = be64_to_cpu(fmsb->sqnum);
+
+	ubi_msg("attaching from fastmap at PEB %d, %d PEBs to scan",
+		anchor, fma.scan_count);
+	goto out_bufs;
+
+out_free:
+	if (err != -ENOENT)
+		ubi_warn("cannot use fastmap, error %d", err);
+	if (fma.si)
+		ubi_scan_destroy_si(fma.si);
+	fma.si = NULL;
+out_bufs:
+	kfree(fma.scan);
+	vfree(fma.ec);
+	vfree(fma.seen);
+	vfree(buf);
+	kfree(fmsb);
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	return fma.si;
+}
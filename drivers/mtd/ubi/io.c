@@ -222,24 +222,18 @@ retry:
 }
 
 /**
- * ubi_io_write - write data to a physical eraseblock.
+ * io_write - write data to a physical eraseblock.
  * @ubi: UBI device description object
  * @buf: buffer with the data to write
  * @pnum: physical eraseblock number to write to
  * @offset: offset within the physical eraseblock where to write
  * @len: how many bytes to write
  *
- * This function writes @len bytes of data from buffer @buf to offset @offset
- * of physical eraseblock @pnum. If all the data were successfully written,
- * zero is returned. If an error occurred, this function returns a negative
- * error code. If %-EIO is returned, the physical eraseblock most probably went
- * bad.
- *
- * Note, in case of an error, it is possible that something was still written
- * to the flash media, but may be some garbage.
+ * This is 'ubi_io_write()' without the fastmap handling, for callers which
+ * already did 'ubi_fastmap_check()'.
  */
-int ubi_io_write(struct ubi_device *ubi, const void *buf, int pnum, int offset,
-		 int len)
+static int io_write(struct ubi_device *ubi, const void *buf, int pnum,
+		    int offset, int len)
 {
 	int err;
 	size_t written;
@@ -252,11 +246,6 @@ int ubi_io_write(struct ubi_device *ubi, const void *buf, int pnum, int offset,
 	ubi_assert(offset % ubi->hdrs_min_io_size == 0);
 	ubi_assert(len > 0 && len % ubi->hdrs_min_io_size == 0);
 
-	if (ubi->ro_mode) {
-		ubi_err("read-only mode");
-		return -EROFS;
-	}
-
 	/* The below has to be compiled out if paranoid checks are disabled */
 
 	err = paranoid_check_not_bad(ubi, pnum);
@@ -316,6 +305,47 @@ int ubi_io_write(struct ubi_device *ubi, const void *buf, int pnum, int offset,
 	return err;
 }
 
+/**
+ * ubi_io_write - write data to a physical eraseblock.
+ * @ubi: UBI device description object
+ * @buf: buffer with the data to write
+ * @pnum: physical eraseblock number to write to
+ * @offset: offset within the physical eraseblock where to write
+ * @len: how many bytes to write
+ *
+ * This function writes @len bytes of data from buffer @buf to offset @offset
+ * of physical eraseblock @pnum. If all the data were successfully written,
+ * zero is returned. If an error occurred, this function returns a negative
+ * error code. If %-EIO is returned, the physical eraseblock most probably went
+ * bad.
+ *
+ * Note, in case of an error, it is possible that something was still written
+ * to the flash media, but may be some garbage.
+ */
+int ubi_io_write(struct ubi_device *ubi, const void *buf, int pnum, int offset,
+		 int len)
+{
+	int err;
+
+	if (ubi->ro_mode) {
+		ubi_err("read-only mode");
+		return -EROFS;
+	}
+
+	/* Data writes do not change what the fastmap describes */
+	if (offset >= ubi->leb_start)
+		return io_write(ubi, buf, pnum, offset, len);
+
+	/* Writing a header does, so get rid of the fastmap first */
+	err = ubi_fastmap_check(ubi);
+	if (err)
+		return err;
+
+	err = io_write(ubi, buf, pnum, offset, len);
+	ubi_fastmap_check_done(ubi);
+	return err;
+}
+
 /**
  * erase_callback - MTD erasure call-back.
  * @ei: MTD erase information object.
@@ -415,6 +445,7 @@ static uint8_t patterns[] = {0xa5, 0x5a, 0x0};
  * This function returns %-EIO if the physical eraseblock did not pass the
  * test, a positive number of erase operations done if the test was
  * successfully passed, and other negative error codes in case of other errors.
+ * The caller has to have done 'ubi_fastmap_check()'.
  */
 static int torture_peb(struct ubi_device *ubi, int pnum)
 {
@@ -445,7 +476,7 @@ static int torture_peb(struct ubi_device *ubi, int pnum)
 
 		/* Write a pattern and check it */
 		memset(ubi->peb_buf1, patterns[i], ubi->peb_size);
-		err = ubi_io_write(ubi, ubi->peb_buf1, pnum, 0, ubi->peb_size);
+		err = io_write(ubi, ubi->peb_buf1, pnum, 0, ubi->peb_size);
 		if (err)
 			goto out;
 
@@ -599,19 +630,28 @@ int ubi_io_sync_erase(struct ubi_device *ubi, int pnum, int torture)
 		return -EROFS;
 	}
 
+	err = ubi_fastmap_check(ubi);
+	if (err)
+		return err;
+
 	if (ubi->nor_flash) {
 		err = nor_erase_prepare(ubi, pnum);
 		if (err)
-			return err;
+			goto out;
 	}
 
 	if (torture) {
 		ret = torture_peb(ubi, pnum);
-		if (ret < 0)
-			return ret;
+		if (ret < 0) {
+			err = ret;
+			goto out;
+		}
 	}
 
 	err = do_sync_erase(ubi, pnum);
+
+out:
+	ubi_fastmap_check_done(ubi);
 	if (err)
 		return err;
 
@@ -655,7 +695,7 @@ int ubi_io_is_bad(const struct ubi_device *ubi, int pnum)
  * This function returns zero in case of success and a negative error code in
  * case of failure.
  */
-int ubi_io_mark_bad(const struct ubi_device *ubi, int pnum)
+int ubi_io_mark_bad(struct ubi_device *ubi, int pnum)
 {
 	int err;
 	struct mtd_info *mtd = ubi->mtd;
@@ -670,7 +710,12 @@ int ubi_io_mark_bad(const struct ubi_device *ubi, int pnum)
 	if (!ubi->bad_allowed)
 		return 0;
 
+	err = ubi_fastmap_check(ubi);
+	if (err)
+		return err;
+
 	err = mtd->block_markbad(mtd, (loff_t)pnum * ubi->peb_size);
+	ubi_fastmap_check_done(ubi);
 	if (err)
 		ubi_err("cannot mark PEB %d bad, error %d", pnum, err);
 	return err;
@@ -428,6 +428,44 @@ out_free_vidh:
 	return err;
 }
 
+/**
+ * read_sqnum - read the sequence number of a physical eraseblock.
+ * @ubi: UBI device description object
+ * @seb: the physical eraseblock
+ *
+ * Physical eraseblocks added from the fastmap come without their sequence
+ * number and copy flag. This function reads them from the VID header when they
+ * are needed, which is when another copy of the same logical eraseblock is
+ * found. Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int read_sqnum(struct ubi_device *ubi, struct ubi_scan_leb *seb)
+{
+	int err;
+	struct ubi_vid_hdr *vh;
+
+	vh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vh)
+		return -ENOMEM;
+
+	err = ubi_io_read_vid_hdr(ubi, seb->pnum, vh, 0);
+	if (err && err != UBI_IO_BITFLIPS) {
+		ubi_err("cannot read VID header of PEB %d, error %d",
+			seb->pnum, err);
+		if (err > 0)
+			err = -EIO;
+		goto out_free;
+	}
+
+	seb->sqnum = be64_to_cpu(vh->sqnum);
+	seb->copy_flag = vh->copy_flag;
+	err = 0;
+
+out_free:
+	ubi_free_vid_hdr(ubi, vh);
+	return err;
+}
+
 /**
  * ubi_scan_add_used - add physical eraseblock to the scanning information.
  * @ubi: UBI device description object
@@ -491,6 +529,12 @@ int ubi_scan_add_used(struct ubi_device *ubi, struct ubi_scan_info *si,
 		 * logical eraseblock present.
 		 */
 
+		if (seb->sqnum == UBI_SCAN_UNKNOWN_SQNUM) {
+			err = read_sqnum(ubi, seb);
+			if (err)
+				return err;
+		}
+
 		dbg_bld("this LEB already exists: PEB %d, sqnum %llu, "
 			"EC %d", seb->pnum, seb->sqnum, seb->ec);
 
@@ -1141,23 +1185,17 @@ static int check_what_we_have(struct ubi_device *ubi, struct ubi_scan_info *si)
 }
 
 /**
- * ubi_scan - scan an MTD device.
- * @ubi: UBI device description object
+ * ubi_scan_alloc_si - allocate an empty scanning information object.
  *
- * This function does full scanning of an MTD device and returns complete
- * information about it. In case of failure, an error code is returned.
+ * Returns the new object in case of success and %NULL in case of failure.
  */
-struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+struct ubi_scan_info *ubi_scan_alloc_si(void)
 {
-	int err, pnum;
-	struct rb_node *rb1, *rb2;
-	struct ubi_scan_volume *sv;
-	struct ubi_scan_leb *seb;
 	struct ubi_scan_info *si;
 
 	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
 	if (!si)
-		return ERR_PTR(-ENOMEM);
+		return NULL;
 
 	INIT_LIST_HEAD(&si->corr);
 	INIT_LIST_HEAD(&si->free);
@@ -1165,40 +1203,77 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	INIT_LIST_HEAD(&si->alien);
 	si->volumes = RB_ROOT;
 
-	err = -ENOMEM;
 	si->scan_leb_slab = kmem_cache_create("ubi_scan_leb_slab",
 					      sizeof(struct ubi_scan_leb),
 					      0, 0, NULL);
-	if (!si->scan_leb_slab)
-		goto out_si;
+	if (!si->scan_leb_slab) {
+		kfree(si);
+		return NULL;
+	}
+
+	return si;
+}
+
+/**
+ * ubi_scan_pebs - scan physical eraseblocks.
+ * @ubi: UBI device description object
+ * @si: scanning information to add the results to
+ * @pebs: the physical eraseblocks to scan, or %NULL to scan physical
+ *        eraseblocks 0 to @count - 1
+ * @count: how many physical eraseblocks to scan
+ *
+ * This function reads the headers of the physical eraseblocks and adds them
+ * to @si. Returns zero in case of success and a negative error code in case
+ * of failure.
+ */
+int ubi_scan_pebs(struct ubi_device *ubi, struct ubi_scan_info *si,
+		  const int *pebs, int count)
+{
+	int err = -ENOMEM, i, pnum;
 
 	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
 	if (!ech)
-		goto out_slab;
+		return err;
 
 	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
 	if (!vidh)
 		goto out_ech;
 
-	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+	for (i = 0; i < count; i++) {
 		cond_resched();
 
+		pnum = pebs ? pebs[i] : i;
 		dbg_gen("process PEB %d", pnum);
 		err = process_eb(ubi, si, pnum);
 		if (err < 0)
 			goto out_vidh;
 	}
+	err = 0;
 
-	dbg_msg("scanning is finished");
+out_vidh:
+	ubi_free_vid_hdr(ubi, vidh);
+out_ech:
+	kfree(ech);
+	return err;
+}
+
+/**
+ * ubi_scan_set_mean_ec - calculate the mean erase counter.
+ * @si: scanning information
+ *
+ * This function calculates the mean erase counter of the physical
+ * eraseblocks found so far, and assigns it to those which erase counter is
+ * unknown.
+ */
+void ubi_scan_set_mean_ec(struct ubi_scan_info *si)
+{
+	struct rb_node *rb1, *rb2;
+	struct ubi_scan_volume *sv;
+	struct ubi_scan_leb *seb;
 
-	/* Calculate mean erase counter */
 	if (si->ec_count)
 		si->mean_ec = div_u64(si->ec_sum, si->ec_count);
 
-	err = check_what_we_have(ubi, si);
-	if (err)
-		goto out_vidh;
-
 	/*
 	 * In case of unknown erase counter we use the mean erase counter
 	 * value.
@@ -1221,22 +1296,42 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	list_for_each_entry(seb, &si->erase, u.list)
 		if (seb->ec == UBI_SCAN_UNKNOWN_EC)
 			seb->ec = si->mean_ec;
+}
 
-	err = paranoid_check_si(ubi, si);
+/**
+ * ubi_scan - scan an MTD device.
+ * @ubi: UBI device description object
+ *
+ * This function does full scanning of an MTD device and returns complete
+ * information about it. In case of failure, an error code is returned.
+ */
+struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+{
+	int err;
+	struct ubi_scan_info *si;
+
+	si = ubi_scan_alloc_si();
+	if (!si)
+		return ERR_PTR(-ENOMEM);
+
+	err = ubi_scan_pebs(ubi, si, NULL, ubi->peb_count);
 	if (err)
-		goto out_vidh;
+		goto out_si;
 
-	ubi_free_vid_hdr(ubi, vidh);
-	kfree(ech);
+	dbg_msg("scanning is finished");
+
+	err = check_what_we_have(ubi, si);
+	if (err)
+		goto out_si;
+
+	ubi_scan_set_mean_ec(si);
+
+	err = paranoid_check_si(ubi, si);
+	if (err)
+		goto out_si;
 
 	return si;
 
-out_vidh:
-	ubi_free_vid_hdr(ubi, vidh);
-out_ech:
-	kfree(ech);
-out_slab:
-	kmem_cache_destroy(si->scan_leb_slab);
 out_si:
 	ubi_scan_destroy_si(si);
 	return ERR_PTR(err);
@@ -24,6 +24,9 @@
 /* The erase counter value for this physical eraseblock is unknown */
 #define UBI_SCAN_UNKNOWN_EC (-1)
 
+/* The sequence number of this physical eraseblock has not been read yet */
+#define UBI_SCAN_UNKNOWN_SQNUM (~0ULL)
+
 /**
  * struct ubi_scan_leb - scanning information about a physical eraseblock.
  * @ec: erase counter (%UBI_SCAN_UNKNOWN_EC if it is unknown)
@@ -31,7 +34,8 @@
  * @lnum: logical eraseblock number
  * @scrub: if this physical eraseblock needs scrubbing
  * @copy_flag: this LEB is a copy (@copy_flag is set in VID header of this LEB)
- * @sqnum: sequence number
+ * @sqnum: sequence number (%UBI_SCAN_UNKNOWN_SQNUM if it has not been read
+ *         yet, in which case @copy_flag is not known either)
  * @u: unions RB-tree or @list links
  * @u.rb: link in the per-volume RB-tree of &struct ubi_scan_leb objects
  * @u.list: link in one of the eraseblock lists
@@ -169,6 +173,10 @@ struct ubi_scan_leb *ubi_scan_get_free_peb(struct ubi_device *ubi,
 int ubi_scan_erase_peb(struct ubi_device *ubi, const struct ubi_scan_info *si,
 		       int pnum, int ec);
 struct ubi_scan_info *ubi_scan(struct ubi_device *ubi);
+struct ubi_scan_info *ubi_scan_alloc_si(void);
+int ubi_scan_pebs(struct ubi_device *ubi, struct ubi_scan_info *si,
+		  const int *pebs, int count);
+void ubi_scan_set_mean_ec(struct ubi_scan_info *si);
 void ubi_scan_destroy_si(struct ubi_scan_info *si);
 
 #endif /* !__UBI_SCAN_H__ */
@@ -312,6 +312,16 @@ struct ubi_vid_hdr {
 #define UBI_LAYOUT_VOLUME_NAME   "layout volume"
 #define UBI_LAYOUT_VOLUME_COMPAT UBI_COMPAT_REJECT
 
+/*
+ * The fastmap volumes contain a snapshot of the EBA and wear-leveling state,
+ * see the comment at &struct ubi_fm_sb. They are "delete" compatible, so UBI
+ * implementations which do not support fastmap just erase them.
+ */
+
+#define UBI_FM_SB_VOLUME_ID      (UBI_INTERNAL_VOL_START + 1)
+#define UBI_FM_DATA_VOLUME_ID    (UBI_INTERNAL_VOL_START + 2)
+#define UBI_FM_VOLUME_COMPAT     UBI_COMPAT_DELETE
+
 /* The maximum number of volumes per one UBI device */
 #define UBI_MAX_VOLUMES 128
 
@@ -375,4 +385,135 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __packed;
 
+/* The version of the fastmap format supported by this implementation */
+#define UBI_FM_FMT_VERSION 1
+
+/* Fastmap magic numbers */
+#define UBI_FM_SB_MAGIC    0x46534d30
+#define UBI_FM_HDR_MAGIC   0x46484430
+#define UBI_FM_VHDR_MAGIC  0x46564830
+
+/* The maximum number of physical eraseblocks the fastmap data may take */
+#define UBI_FM_MAX_BLOCKS 32
+
+/*
+ * The fastmap super block is only looked for in the first %UBI_FM_MAX_START
+ * physical eraseblocks of the device.
+ */
+#define UBI_FM_MAX_START 64
+
+/* Marks an unmapped logical eraseblock in &struct ubi_fm_volhdr */
+#define UBI_FM_UNMAPPED 0xFFFFFFFFU
+
+/**
+ * struct ubi_fm_sb - fastmap super block.
+ * @magic: fastmap super block magic number (%UBI_FM_SB_MAGIC)
+ * @version: format version of this fastmap (%UBI_FM_FMT_VERSION)
+ * @padding1: reserved for future, zeroes
+ * @data_crc: CRC32 checksum of the fastmap data
+ * @data_size: size of the fastmap data in bytes
+ * @used_blocks: number of physical eraseblocks the fastmap data takes
+ * @block_loc: the physical eraseblocks holding the fastmap data, in order
+ * @block_ec: erase counters of the physical eraseblocks in @block_loc
+ * @sqnum: the global sequence number at the time the fastmap was written
+ * @padding2: reserved for future, zeroes
+ * @crc: CRC32 checksum of the super block, not including the @crc field
+ *
+ * The fastmap is a snapshot of the EBA tables and of the state the
+ * wear-leveling sub-system keeps for each physical eraseblock. UBI writes it
+ * when the device is detached or the system goes down, and attaches from it
+ * instead of scanning the whole device. The super block lives in logical
+ * eraseblock 0 of the %UBI_FM_SB_VOLUME_ID volume, in one of the first
+ * %UBI_FM_MAX_START physical eraseblocks. The data lives in logical
+ * eraseblocks of the %UBI_FM_DATA_VOLUME_ID volume and consists of a
+ * &struct ubi_fm_hdr, the lists of physical eraseblocks it announces, and
+ * a &struct ubi_fm_volhdr with its EBA table for each volume.
+ *
+ * A fastmap is only valid as long as nothing else has been written to the
+ * device, so UBI erases the super block before any header is written or any
+ * eraseblock is erased once a fastmap exists, and when it attaches from it.
+ */
+struct ubi_fm_sb {
+	__be32 magic;
+	__u8   version;
+	__u8   padding1[3];
+	__be32 data_crc;
+	__be32 data_size;
+	__be32 used_blocks;
+	__be32 block_loc[UBI_FM_MAX_BLOCKS];
+	__be32 block_ec[UBI_FM_MAX_BLOCKS];
+	__be64 sqnum;
+	__u8   padding2[28];
+	__be32 crc;
+} __packed;
+
+/**
+ * struct ubi_fm_hdr - header of the fastmap data.
+ * @magic: fastmap header magic number (%UBI_FM_HDR_MAGIC)
+ * @free_peb_count: number of free physical eraseblocks
+ * @used_peb_count: number of used physical eraseblocks
+ * @scrub_peb_count: number of used physical eraseblocks to be scrubbed
+ * @erase_peb_count: number of physical eraseblocks to be erased
+ * @scan_peb_count: number of physical eraseblocks which have to be scanned
+ * @corr_peb_count: number of corrupted physical eraseblocks
+ * @bad_peb_count: number of bad physical eraseblocks
+ * @vol_count: number of &struct ubi_fm_volhdr records
+ *
+ * The header is followed by arrays of &struct ubi_fm_ec, one per list, in
+ * the order the counters are listed above. "Scan" physical eraseblocks are
+ * those the wear-leveling sub-system considered used but which were not
+ * referred to by any EBA table when the fastmap was written (e.g., old copies
+ * of logical eraseblocks being replaced); their headers are read at attach
+ * time.
+ */
+struct ubi_fm_hdr {
+	__be32 magic;
+	__be32 free_peb_count;
+	__be32 used_peb_count;
+	__be32 scrub_peb_count;
+	__be32 erase_peb_count;
+	__be32 scan_peb_count;
+	__be32 corr_peb_count;
+	__be32 bad_peb_count;
+	__be32 vol_count;
+} __packed;
+
+/**
+ * struct ubi_fm_ec - a physical eraseblock and its erase counter.
+ * @pnum: physical eraseblock number
+ * @ec: erase counter
+ */
+struct ubi_fm_ec {
+	__be32 pnum;
+	__be32 ec;
+} __packed;
+
+/**
+ * struct ubi_fm_volhdr - fastmap volume header.
+ * @magic: fastmap volume header magic number (%UBI_FM_VHDR_MAGIC)
+ * @vol_id: volume ID
+ * @vol_type: volume type (%UBI_VID_DYNAMIC or %UBI_VID_STATIC)
+ * @compat: compatibility of this volume, as in &struct ubi_vid_hdr
+ * @padding: reserved for future, zeroes
+ * @data_pad: how many bytes at the end of logical eraseblocks are not used
+ * @used_ebs: number of used logical eraseblocks (static volumes only)
+ * @last_eb_bytes: bytes in the last used logical eraseblock (static volumes
+ *                 only)
+ * @reserved_pebs: number of entries in the EBA table which follows
+ *
+ * The header is followed by @reserved_pebs __be32 physical eraseblock
+ * numbers, %UBI_FM_UNMAPPED for unmapped logical eraseblocks.
+ */
+struct ubi_fm_volhdr {
+	__be32 magic;
+	__be32 vol_id;
+	__u8   vol_type;
+	__u8   compat;
+	__u8   padding[2];
+	__be32 data_pad;
+	__be32 used_ebs;
+	__be32 last_eb_bytes;
+	__be32 reserved_pebs;
+} __packed;
+
 #endif /* !__UBI_MEDIA_H__ */
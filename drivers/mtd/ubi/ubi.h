@@ -130,6 +130,36 @@ enum {
 	MOVE_CANCEL_BITFLIPS,
 };
 
+/*
+ * States of physical eraseblocks as seen by the WL sub-system, reported by
+ * 'ubi_wl_fm_snapshot()'.
+ *
+ * UBI_FM_PEB_NONE: not known to the WL sub-system (bad, corrupted, or taken
+ *                  by the fastmap)
+ * UBI_FM_PEB_FREE: free
+ * UBI_FM_PEB_USED: used
+ * UBI_FM_PEB_SCRUB: used, and has to be scrubbed
+ * UBI_FM_PEB_ERASE: waiting to be erased
+ */
+enum {
+	UBI_FM_PEB_NONE = 0,
+	UBI_FM_PEB_FREE,
+	UBI_FM_PEB_USED,
+	UBI_FM_PEB_SCRUB,
+	UBI_FM_PEB_ERASE,
+};
+
+/*
+ * Methods the UBI device was attached by.
+ *
+ * UBI_ATTACH_SCAN: by scanning all physical eraseblocks
+ * UBI_ATTACH_FASTMAP: from the fastmap
+ */
+enum {
+	UBI_ATTACH_SCAN = 0,
+	UBI_ATTACH_FASTMAP,
+};
+
 /**
  * struct ubi_wl_entry - wear-leveling entry.
  * @u.rb: link in the corresponding (free/used) RB-tree
@@ -193,6 +223,21 @@ struct ubi_rename_entry {
 	struct list_head list;
 };
 
+/**
+ * struct ubi_fastmap - the fastmap currently on flash.
+ * @anchor: physical eraseblock holding the fastmap super block
+ * @used_blocks: number of physical eraseblocks holding the fastmap data
+ * @pnum: the physical eraseblocks holding the fastmap data
+ *
+ * The physical eraseblocks of the fastmap are taken out of the WL sub-system
+ * trees while the fastmap exists, see 'ubi_wl_get_fm_peb()'.
+ */
+struct ubi_fastmap {
+	int anchor;
+	int used_blocks;
+	int pnum[UBI_FM_MAX_BLOCKS];
+};
+
 struct ubi_volume_desc;
 
 /**
@@ -390,6 +435,18 @@ struct ubi_wl_entry;
  * @peb_buf2: another buffer of PEB size used for different purposes
  * @buf_mutex: protects @peb_buf1 and @peb_buf2
  * @ckvol_mutex: serializes static volume checking when opening
+ *
+ * @fm: the fastmap currently on flash, %NULL if there is none
+ * @fm_writer: the task writing or erasing the fastmap
+ * @fm_mutex: protects @fm and serializes fastmap writing and invalidation
+ * @fm_sem: held in read mode by tasks changing the flash, from the
+ *          'ubi_fastmap_check()' until the change is done, and in write mode
+ *          while the fastmap is written, so no change can slip in between
+ * @fm_nb: reboot notifier which writes the fastmap when the system goes down
+ *
+ * @attach_method: how the device was attached (%UBI_ATTACH_SCAN, etc)
+ * @attach_time: how long attaching took, in microseconds
+ * @attach_pebs: how many physical eraseblocks were read while attaching
  */
 struct ubi_device {
 	struct cdev cdev;
@@ -472,6 +529,18 @@ struct ubi_device {
 	void *peb_buf2;
 	struct mutex buf_mutex;
 	struct mutex ckvol_mutex;
+
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	struct ubi_fastmap *fm;
+	struct task_struct *fm_writer;
+	struct mutex fm_mutex;
+	struct rw_semaphore fm_sem;
+	struct notifier_block fm_nb;
+#endif
+
+	int attach_method;
+	unsigned int attach_time;
+	int attach_pebs;
 };
 
 extern struct kmem_cache *ubi_wl_entry_slab;
@@ -529,6 +598,7 @@ int ubi_eba_atomic_leb_change(struct ubi_device *ubi, struct ubi_volume *vol,
 int ubi_eba_copy_leb(struct ubi_device *ubi, int from, int to,
 		     struct ubi_vid_hdr *vid_hdr);
 int ubi_eba_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi);
 
 /* wl.c */
 int ubi_wl_get_peb(struct ubi_device *ubi, int dtype);
@@ -538,6 +608,10 @@ int ubi_wl_scrub_peb(struct ubi_device *ubi, int pnum);
 int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
+int ubi_wl_get_fm_peb(struct ubi_device *ubi, int max_pnum);
+void ubi_wl_put_fm_peb(struct ubi_device *ubi, int pnum);
+void ubi_wl_drop_fm_peb(struct ubi_device *ubi, int pnum);
+void ubi_wl_fm_snapshot(struct ubi_device *ubi, uint8_t *state, int *ec);
 
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
@@ -546,7 +620,7 @@ int ubi_io_write(struct ubi_device *ubi, const void *buf, int pnum, int offset,
 		 int len);
 int ubi_io_sync_erase(struct ubi_device *ubi, int pnum, int torture);
 int ubi_io_is_bad(const struct ubi_device *ubi, int pnum);
-int ubi_io_mark_bad(const struct ubi_device *ubi, int pnum);
+int ubi_io_mark_bad(struct ubi_device *ubi, int pnum);
 int ubi_io_read_ec_hdr(struct ubi_device *ubi, int pnum,
 		       struct ubi_ec_hdr *ec_hdr, int verbose);
 int ubi_io_write_ec_hdr(struct ubi_device *ubi, int pnum,
@@ -569,6 +643,16 @@ int ubi_notify_all(struct ubi_device *ubi, int ntype,
 		   struct notifier_block *nb);
 int ubi_enumerate_volumes(struct notifier_block *nb);
 
+/* fastmap.c */
+#ifdef CONFIG_MTD_UBI_FASTMAP
+struct ubi_scan_info *ubi_scan_fastmap(struct ubi_device *ubi);
+int ubi_update_fastmap(struct ubi_device *ubi);
+void ubi_fastmap_close(struct ubi_device *ubi);
+int ubi_fastmap_invalidate(struct ubi_device *ubi);
+int ubi_fastmap_reboot_notify(struct notifier_block *nb, unsigned long event,
+			      void *unused);
+#endif
+
 /* kapi.c */
 void ubi_do_get_device_info(struct ubi_device *ubi, struct ubi_device_info *di);
 void ubi_do_get_volume_info(struct ubi_device *ubi, struct ubi_volume *vol,
@@ -653,6 +737,54 @@ static inline int ubi_io_write_data(struct ubi_device *ubi, const void *buf,
 	return ubi_io_write(ubi, buf, pnum, offset + ubi->leb_start, len);
 }
 
+/**
+ * ubi_fastmap_check - invalidate the fastmap before the flash is changed.
+ * @ubi: UBI device description object
+ *
+ * This function has to be called before a header is written to a physical
+ * eraseblock, or one is erased or marked bad. If there is a fastmap on the
+ * flash and the caller is not the task writing it, the fastmap is erased
+ * first, because it would not describe the flash contents anymore. Unless
+ * the caller is that task, @ubi->fm_sem is then held in read mode until
+ * 'ubi_fastmap_check_done()', so that no fastmap can be written before the
+ * change reaches the flash. Returns zero in case of success and a negative
+ * error code in case of failure, in which case the semaphore is released.
+ */
+static inline int ubi_fastmap_check(struct ubi_device *ubi)
+{
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	int err = 0;
+
+	if (ubi->fm_writer == current)
+		return 0;
+
+	down_read(&ubi->fm_sem);
+	if (ubi->fm)
+		err = ubi_fastmap_invalidate(ubi);
+	if (err)
+		up_read(&ubi->fm_sem);
+	return err;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * ubi_fastmap_check_done - the flash change is done.
+ * @ubi: UBI device description object
+ *
+ * This function has to be called after a successful 'ubi_fastmap_check()'
+ * once the header is written, or the physical eraseblock erased or marked
+ * bad.
+ */
+static inline void ubi_fastmap_check_done(struct ubi_device *ubi)
+{
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (ubi->fm_writer != current)
+		up_read(&ubi->fm_sem);
+#endif
+}
+
 /**
  * ubi_ro_mode - switch to read-only mode.
  * @ubi: UBI device description object
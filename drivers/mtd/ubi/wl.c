@@ -1309,6 +1309,139 @@ int ubi_wl_flush(struct ubi_device *ubi)
 	return 0;
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+
+/**
+ * ubi_wl_get_fm_peb - get a physical eraseblock for the fastmap.
+ * @ubi: UBI device description object
+ * @max_pnum: the physical eraseblock has to be below this number
+ *
+ * This function takes the least worn free physical eraseblock below
+ * @max_pnum out of the free tree. Unlike 'ubi_wl_get_peb()', it does not add
+ * it to the protection queue: the physical eraseblock is not known to the WL
+ * sub-system until it is given back by 'ubi_wl_put_fm_peb()' or
+ * 'ubi_wl_drop_fm_peb()'. The last free physical eraseblock is never taken.
+ * Returns the physical eraseblock number in case of success and %-ENOSPC if
+ * there is no suitable one.
+ */
+int ubi_wl_get_fm_peb(struct ubi_device *ubi, int max_pnum)
+{
+	struct rb_node *rb;
+	struct ubi_wl_entry *e;
+	int pnum = -ENOSPC;
+
+	spin_lock(&ubi->wl_lock);
+	rb = rb_first(&ubi->free);
+	if (!rb || rb == rb_last(&ubi->free))
+		goto out_unlock;
+
+	for (; rb; rb = rb_next(rb)) {
+		e = rb_entry(rb, struct ubi_wl_entry, u.rb);
+		if (e->pnum < max_pnum) {
+			rb_erase(&e->u.rb, &ubi->free);
+			pnum = e->pnum;
+			break;
+		}
+	}
+
+out_unlock:
+	spin_unlock(&ubi->wl_lock);
+	dbg_wl("PEB %d", pnum);
+	return pnum;
+}
+
+/**
+ * ubi_wl_put_fm_peb - return a fastmap physical eraseblock to the WL
+ * sub-system.
+ * @ubi: UBI device description object
+ * @pnum: the physical eraseblock, taken by 'ubi_wl_get_fm_peb()'
+ *
+ * The physical eraseblock is scheduled for erasure.
+ */
+void ubi_wl_put_fm_peb(struct ubi_device *ubi, int pnum)
+{
+	struct ubi_wl_entry *e;
+
+	dbg_wl("PEB %d", pnum);
+
+	spin_lock(&ubi->wl_lock);
+	e = ubi->lookuptbl[pnum];
+	spin_unlock(&ubi->wl_lock);
+
+	if (schedule_erase(ubi, e, 0)) {
+		ubi_err("cannot schedule erasure of fastmap PEB %d", pnum);
+		ubi_wl_drop_fm_peb(ubi, pnum);
+		ubi_ro_mode(ubi);
+	}
+}
+
+/**
+ * ubi_wl_drop_fm_peb - forget a fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @pnum: the physical eraseblock, taken by 'ubi_wl_get_fm_peb()'
+ *
+ * This function is used when the UBI device is detached while the fastmap is
+ * kept on the flash.
+ */
+void ubi_wl_drop_fm_peb(struct ubi_device *ubi, int pnum)
+{
+	struct ubi_wl_entry *e;
+
+	spin_lock(&ubi->wl_lock);
+	e = ubi->lookuptbl[pnum];
+	ubi->lookuptbl[pnum] = NULL;
+	spin_unlock(&ubi->wl_lock);
+
+	kmem_cache_free(ubi_wl_entry_slab, e);
+}
+
+/**
+ * ubi_wl_fm_snapshot - get the state of all physical eraseblocks.
+ * @ubi: UBI device description object
+ * @state: the state of each physical eraseblock is stored here
+ *         (%UBI_FM_PEB_FREE, etc)
+ * @ec: the erase counter of each physical eraseblock known to the WL
+ *      sub-system is stored here
+ *
+ * Both arrays have to have @ubi->peb_count elements, and @state has to be
+ * zeroed. The caller has to hold @ubi->work_sem in write mode, so that no
+ * physical eraseblock is being moved.
+ */
+void ubi_wl_fm_snapshot(struct ubi_device *ubi, uint8_t *state, int *ec)
+{
+	int i;
+	struct rb_node *rb;
+	struct ubi_wl_entry *e;
+	struct ubi_work *wrk;
+
+	spin_lock(&ubi->wl_lock);
+	for (i = 0; i < ubi->peb_count; i++)
+		if (ubi->lookuptbl[i])
+			ec[i] = ubi->lookuptbl[i]->ec;
+
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb)
+		state[e->pnum] = UBI_FM_PEB_FREE;
+	ubi_rb_for_each_entry(rb, e, &ubi->used, u.rb)
+		state[e->pnum] = UBI_FM_PEB_USED;
+	ubi_rb_for_each_entry(rb, e, &ubi->scrub, u.rb)
+		state[e->pnum] = UBI_FM_PEB_SCRUB;
+	ubi_rb_for_each_entry(rb, e, &ubi->erroneous, u.rb)
+		state[e->pnum] = UBI_FM_PEB_SCRUB;
+
+	for (i = 0; i < UBI_PROT_QUEUE_LEN; i++)
+		list_for_each_entry(e, &ubi->pq[i], u.list)
+			state[e->pnum] = UBI_FM_PEB_USED;
+
+	list_for_each_entry(wrk, &ubi->works, list)
+		if (wrk->func == &erase_worker)
+			state[wrk->e->pnum] = UBI_FM_PEB_ERASE;
+
+	ubi_assert(!ubi->move_from && !ubi->move_to);
+	spin_unlock(&ubi->wl_lock);
+}
+
+#endif /* CONFIG_MTD_UBI_FASTMAP */
+
 /**
  * tree_destroy - destroy an RB-tree.
  * @root: the root of the tree to destroy
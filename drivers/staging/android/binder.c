@@ -19,6 +19,7 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/hash.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -36,6 +37,21 @@
 
 #include "binder.h"
 
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
+
+/*
+ * binder_lock is still the one lock for the object graph: procs, threads,
+ * nodes, refs, transaction stacks and todo lists.  Only the buffer space is
+ * split out: each proc has its own proc->alloc_lock, so page allocation,
+ * mapping and the payload copy of a transaction run without holding
+ * binder_lock.  Everything else, including the translation of the objects
+ * in a transaction and the dequeueing in binder_thread_read(), serializes
+ * all binder users, related or not.  Lock order is binder_lock ->
+ * proc->alloc_lock -> mmap_sem, and binder_lock -> binder_deferred_lock.
+ * tools/testing/binder/binder_stress measures how throughput scales with
+ * independent client/server pairs under this scheme.
+ */
 static DEFINE_MUTEX(binder_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
 
@@ -105,6 +121,27 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+/*
+ * With cache_pages set, pages of freed buffers stay mapped on binder_lru and
+ * are reused by the next allocation that covers them.  binder_shrink() hands
+ * them back under memory pressure, but leaves up to page_pool of them mapped
+ * in every proc.  binder_lru_reclaimable counts the pages above page_pool,
+ * which is why page_pool cannot be changed at runtime.
+ *
+ * binder_lru_lock protects binder_lru, proc->lru_pages and proc->shrink_ref.
+ */
+static int binder_cache_pages;
+module_param_named(cache_pages, binder_cache_pages, bool, S_IWUSR | S_IRUGO);
+
+static unsigned int binder_page_pool = 8;
+module_param_named(page_pool, binder_page_pool, uint, S_IRUGO);
+
+static DEFINE_SPINLOCK(binder_lru_lock);
+static LIST_HEAD(binder_lru);
+static int binder_lru_count;
+static int binder_lru_reclaimable;
+static DECLARE_WAIT_QUEUE_HEAD(binder_shrink_wait);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -164,6 +201,119 @@ static inline void binder_stats_created(enum binder_stat_types type)
 	binder_stats.obj_created[type]++;
 }
 
+#define BINDER_LATENCY_BUCKETS 16
+
+struct binder_alloc_stats {
+	atomic_t alloc_latency[BINDER_LATENCY_BUCKETS];
+	atomic_t free_latency[BINDER_LATENCY_BUCKETS];
+	atomic_t pages_mapped;
+	atomic_t pages_reused;
+	atomic_t pages_cached;
+	atomic_t pages_reclaimed;
+};
+
+static struct binder_alloc_stats binder_alloc_stats;
+
+static inline int binder_latency_bucket(s64 us)
+{
+	int bucket = us > 0 ? fls64(us) : 0;
+
+	if (bucket >= BINDER_LATENCY_BUCKETS)
+		bucket = BINDER_LATENCY_BUCKETS - 1;
+	return bucket;
+}
+
+static inline void binder_latency_add(atomic_t *hist, ktime_t start)
+{
+	atomic_inc(&hist[binder_latency_bucket(
+		ktime_us_delta(ktime_get(), start))]);
+}
+
+/*
+ * Per (target node, code) latency of the transaction path, protected by
+ * binder_lock.  wait is BC_TRANSACTION until the target thread reads it,
+ * exec is from there until its BC_REPLY, and reply is the whole round trip
+ * until the caller reads BR_REPLY.  The entries of a node are freed when
+ * the node is, and writing to the call_stats debugfs file frees them all.
+ * Calls that still do not fit in the table are only counted as dropped.
+ * A transaction keeps the node id along with its entry, so an entry that
+ * was freed and reused meanwhile is not charged.
+ */
+struct binder_latency {
+	unsigned int hist[BINDER_LATENCY_BUCKETS];
+	u64 total_us;
+	u32 max_us;
+};
+
+struct binder_call_stats {
+	int node_id;
+	int pid;
+	unsigned int code;
+	unsigned int calls;
+	unsigned int async_calls;
+	struct binder_latency wait;
+	struct binder_latency exec;
+	struct binder_latency reply;
+};
+
+#define BINDER_CALL_STATS_BITS 7
+/* node_id of an entry that was freed, lookups go on past it */
+#define BINDER_CALL_STATS_FREED (-1)
+
+static struct binder_call_stats binder_call_stats[1 << BINDER_CALL_STATS_BITS];
+static unsigned int binder_call_stats_dropped;
+
+static struct binder_call_stats *binder_get_call_stats(int node_id, int pid,
+						       unsigned int code)
+{
+	unsigned int i, slot;
+	struct binder_call_stats *cs, *free = NULL;
+
+	slot = hash_long(node_id * 31 + code, BINDER_CALL_STATS_BITS);
+	for (i = 0; i < ARRAY_SIZE(binder_call_stats); i++) {
+		cs = &binder_call_stats[(slot + i) %
+					ARRAY_SIZE(binder_call_stats)];
+		if (cs->node_id == node_id && cs->code == code)
+			return cs;
+		if (cs->node_id == BINDER_CALL_STATS_FREED) {
+			if (!free)
+				free = cs;
+		} else if (cs->node_id == 0) {
+			if (!free)
+				free = cs;
+			break;
+		}
+	}
+	if (!free) {
+		binder_call_stats_dropped++;
+		return NULL;
+	}
+	memset(free, 0, sizeof(*free));
+	free->node_id = node_id;
+	free->pid = pid;
+	free->code = code;
+	return free;
+}
+
+static void binder_free_call_stats(int node_id)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(binder_call_stats); i++)
+		if (binder_call_stats[i].node_id == node_id)
+			binder_call_stats[i].node_id = BINDER_CALL_STATS_FREED;
+}
+
+static void binder_latency_record(struct binder_latency *lat, s64 us)
+{
+	if (us < 0)
+		us = 0;
+	lat->hist[binder_latency_bucket(us)]++;
+	lat->total_us += us;
+	if (us > lat->max_us)
+		lat->max_us = us;
+}
+
 struct binder_transaction_log_entry {
 	int debug_id;
 	int call_type;
@@ -256,6 +406,12 @@ struct binder_ref {
 	struct binder_ref_death *death;
 };
 
+struct binder_lru_page {
+	struct list_head lru;	/* on binder_lru while mapped but unused */
+	struct page *page_ptr;
+	struct binder_proc *proc;
+};
+
 struct binder_buffer {
 	struct list_head entry; /* free and allocated entries by addesss */
 	struct rb_node rb_node; /* free entry by size or allocated entry */
@@ -294,14 +450,19 @@ struct binder_proc {
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	struct mutex alloc_lock;
 	struct list_head buffers;
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
-	struct page **pages;
+	struct binder_lru_page *pages;
+	int lru_pages;
+	int shrink_ref;		/* held by binder_shrink() */
 	size_t buffer_size;
 	uint32_t buffer_free;
+	int tmp_ref;
+	int is_dead;
 	struct list_head todo;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
@@ -355,8 +516,20 @@ struct binder_transaction {
 	long	priority;
 	long	saved_priority;
 	uid_t	sender_euid;
+	struct binder_call_stats *call_stats;
+	int	call_node_id;	/* call_stats is only ours while it has it */
+	ktime_t	call_start;	/* BC_TRANSACTION, also for its reply */
+	ktime_t	deliver_time;
 };
 
+static struct binder_call_stats *
+binder_transaction_call_stats(struct binder_transaction *t)
+{
+	if (t->call_stats && t->call_stats->node_id == t->call_node_id)
+		return t->call_stats;
+	return NULL;
+}
+
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
 
@@ -586,13 +759,15 @@ static void binder_insert_allocated_buffer(struct binder_proc *proc,
 static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 						  void __user *user_ptr)
 {
-	struct rb_node *n = proc->allocated_buffers.rb_node;
+	struct rb_node *n;
 	struct binder_buffer *buffer;
 	struct binder_buffer *kern_ptr;
 
 	kern_ptr = user_ptr - proc->user_buffer_offset
 		- offsetof(struct binder_buffer, data);
 
+	mutex_lock(&proc->alloc_lock);
+	n = proc->allocated_buffers.rb_node;
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(buffer->free);
@@ -602,9 +777,40 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 		else if (kern_ptr > buffer)
 			n = n->rb_right;
 		else
-			return buffer;
+			break;
 	}
-	return NULL;
+	mutex_unlock(&proc->alloc_lock);
+	return n ? buffer : NULL;
+}
+
+static void binder_lru_add(struct binder_proc *proc,
+			   struct binder_lru_page *page)
+{
+	page->proc = proc;
+	spin_lock(&binder_lru_lock);
+	list_add_tail(&page->lru, &binder_lru);
+	binder_lru_count++;
+	if (++proc->lru_pages > binder_page_pool)
+		binder_lru_reclaimable++;
+	spin_unlock(&binder_lru_lock);
+}
+
+/* Caller must hold binder_lru_lock */
+static void __binder_lru_del(struct binder_proc *proc,
+			     struct binder_lru_page *page)
+{
+	list_del_init(&page->lru);
+	binder_lru_count--;
+	if (proc->lru_pages-- > binder_page_pool)
+		binder_lru_reclaimable--;
+}
+
+static void binder_lru_del(struct binder_proc *proc,
+			   struct binder_lru_page *page)
+{
+	spin_lock(&binder_lru_lock);
+	__binder_lru_del(proc, page);
+	spin_unlock(&binder_lru_lock);
 }
 
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
@@ -614,7 +820,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	void *page_addr;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
-	struct page **page;
+	struct binder_lru_page *page;
 	struct mm_struct *mm;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
@@ -624,6 +830,39 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	if (allocate == 0 && binder_cache_pages) {
+		for (page_addr = start; page_addr < end;
+		     page_addr += PAGE_SIZE) {
+			page = &proc->pages[(page_addr - proc->buffer) /
+					    PAGE_SIZE];
+			binder_lru_add(proc, page);
+			atomic_inc(&binder_alloc_stats.pages_cached);
+		}
+		return 0;
+	}
+
+	if (allocate) {
+		/* no need for mmap_sem if every page is still mapped */
+		for (page_addr = start; page_addr < end;
+		     page_addr += PAGE_SIZE) {
+			page = &proc->pages[(page_addr - proc->buffer) /
+					    PAGE_SIZE];
+			if (page->page_ptr == NULL)
+				break;
+		}
+		if (page_addr >= end) {
+			for (page_addr = start; page_addr < end;
+			     page_addr += PAGE_SIZE) {
+				page = &proc->pages[(page_addr - proc->buffer) /
+						    PAGE_SIZE];
+				BUG_ON(list_empty(&page->lru));
+				binder_lru_del(proc, page);
+				atomic_inc(&binder_alloc_stats.pages_reused);
+			}
+			return 0;
+		}
+	}
+
 	if (vma)
 		mm = NULL;
 	else
@@ -648,16 +887,22 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
+		if (page->page_ptr) {
+			/* still mapped from a freed buffer, take it back */
+			BUG_ON(list_empty(&page->lru));
+			binder_lru_del(proc, page);
+			atomic_inc(&binder_alloc_stats.pages_reused);
+			continue;
+		}
+		page->page_ptr = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (page->page_ptr == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "for page at %p\n", proc->pid, page_addr);
 			goto err_alloc_page_failed;
 		}
 		tmp_area.addr = page_addr;
 		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
+		page_array_ptr = &page->page_ptr;
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
@@ -667,13 +912,14 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		}
 		user_page_addr =
 			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
+		ret = vm_insert_page(vma, user_page_addr, page->page_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "to map page at %lx in userspace\n",
 			       proc->pid, user_page_addr);
 			goto err_vm_insert_page_failed;
 		}
+		atomic_inc(&binder_alloc_stats.pages_mapped);
 		/* vm_insert_page does not seem to increment the refcount */
 	}
 	if (mm) {
@@ -692,8 +938,8 @@ free_range:
 err_vm_insert_page_failed:
 		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
+		__free_page(page->page_ptr);
+		page->page_ptr = NULL;
 err_alloc_page_failed:
 		;
 	}
@@ -705,9 +951,139 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+/*
+ * Unmap and free a page taken off binder_lru.  Called with proc->alloc_lock
+ * held from the shrinker, so it only trylocks mmap_sem and returns -EBUSY
+ * when it would have to wait.
+ */
+static int binder_free_lru_page(struct binder_proc *proc,
+				struct binder_lru_page *page)
+{
+	void *page_addr = proc->buffer + (page - proc->pages) * PAGE_SIZE;
+	struct vm_area_struct *vma;
+	struct mm_struct *mm;
+
+	mm = get_task_mm(proc->tsk);
+	if (mm && !down_read_trylock(&mm->mmap_sem)) {
+		mmput(mm);
+		return -EBUSY;
+	}
+	vma = mm ? proc->vma : NULL;
+	if (vma)
+		zap_page_range(vma, (uintptr_t)page_addr +
+			       proc->user_buffer_offset, PAGE_SIZE, NULL);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	__free_page(page->page_ptr);
+	page->page_ptr = NULL;
+	if (mm) {
+		up_read(&mm->mmap_sem);
+		mmput(mm);
+	}
+	return 0;
+}
+
+/*
+ * Free up to nr of proc's cached pages above page_pool, oldest first.
+ * Called with proc->alloc_lock held, so that the pages taken off binder_lru
+ * cannot be reused or released under us.
+ */
+static int binder_shrink_proc(struct binder_proc *proc, int nr)
+{
+	struct binder_lru_page *page, *next;
+	LIST_HEAD(pages);
+	int freed = 0;
+
+	spin_lock(&binder_lru_lock);
+	list_for_each_entry_safe(page, next, &binder_lru, lru) {
+		if (nr <= 0 || proc->lru_pages <= binder_page_pool)
+			break;
+		if (page->proc != proc)
+			continue;
+		__binder_lru_del(proc, page);
+		list_add_tail(&page->lru, &pages);
+		nr--;
+	}
+	spin_unlock(&binder_lru_lock);
+
+	list_for_each_entry_safe(page, next, &pages, lru) {
+		list_del_init(&page->lru);
+		if (binder_free_lru_page(proc, page)) {
+			binder_lru_add(proc, page);
+			continue;
+		}
+		atomic_inc(&binder_alloc_stats.pages_reclaimed);
+		freed++;
+	}
+	return freed;
+}
+
+#define BINDER_SHRINK_BATCH	16
+
+/*
+ * binder_shrink - hand cached buffer pages back, called from shrink_slab
+ *
+ * Walks binder_lru oldest first under binder_lru_lock and picks the procs
+ * holding more than page_pool pages, pinning them with shrink_ref.  Their
+ * pages are then freed with only proc->alloc_lock held; procs that are busy
+ * in the allocator are skipped.  Returns the number of pages that could
+ * still be reclaimed.
+ */
+static int binder_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct binder_proc *procs[BINDER_SHRINK_BATCH];
+	struct binder_lru_page *page;
+	struct binder_proc *proc;
+	unsigned long scanned = 0;
+	int i, nr_procs = 0, freed = 0;
+
+	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
+		return -1;
+	if (!sc->nr_to_scan)
+		return binder_lru_reclaimable;
+
+	spin_lock(&binder_lru_lock);
+	while (scanned++ < sc->nr_to_scan && binder_lru_reclaimable &&
+	       nr_procs < BINDER_SHRINK_BATCH) {
+		page = list_first_entry(&binder_lru, struct binder_lru_page,
+					lru);
+		proc = page->proc;
+		list_move_tail(&page->lru, &binder_lru);
+		if (proc->lru_pages <= binder_page_pool)
+			continue;
+		for (i = 0; i < nr_procs && procs[i] != proc; i++)
+			;
+		if (i == nr_procs) {
+			proc->shrink_ref++;
+			procs[nr_procs++] = proc;
+		}
+	}
+	spin_unlock(&binder_lru_lock);
+
+	for (i = 0; i < nr_procs; i++) {
+		proc = procs[i];
+		if (freed < sc->nr_to_scan && mutex_trylock(&proc->alloc_lock)) {
+			freed += binder_shrink_proc(proc,
+						    sc->nr_to_scan - freed);
+			mutex_unlock(&proc->alloc_lock);
+		}
+		spin_lock(&binder_lru_lock);
+		if (!--proc->shrink_ref)
+			wake_up_all(&binder_shrink_wait);
+		spin_unlock(&binder_lru_lock);
+	}
+
+	return binder_lru_reclaimable;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
+						size_t data_size,
+						size_t offsets_size,
+						int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -811,6 +1187,20 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+	ktime_t start = ktime_get();
+
+	mutex_lock(&proc->alloc_lock);
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size, is_async);
+	mutex_unlock(&proc->alloc_lock);
+	binder_latency_add(binder_alloc_stats.alloc_latency, start);
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -868,8 +1258,8 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+static void __binder_free_buf(struct binder_proc *proc,
+			      struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
@@ -923,6 +1313,17 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	ktime_t start = ktime_get();
+
+	mutex_lock(&proc->alloc_lock);
+	__binder_free_buf(proc, buffer);
+	mutex_unlock(&proc->alloc_lock);
+	binder_latency_add(binder_alloc_stats.free_latency, start);
+}
+
 static struct binder_node *binder_get_node(struct binder_proc *proc,
 					   void __user *ptr)
 {
@@ -1052,6 +1453,7 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 					     "binder: dead node %d deleted\n",
 					     node->debug_id);
 			}
+			binder_free_call_stats(node->debug_id);
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		}
@@ -1300,6 +1702,14 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 	}
 }
 
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	BUG_ON(proc->tmp_ref <= 0);
+	proc->tmp_ref--;
+	if (proc->tmp_ref == 0 && proc->is_dead)
+		binder_defer_work(proc, BINDER_DEFERRED_RELEASE);
+}
+
 static void binder_transaction_buffer_release(struct binder_proc *proc,
 					      struct binder_buffer *buffer,
 					      size_t *failed_at)
@@ -1390,6 +1800,7 @@ static void binder_transaction(struct binder_proc *proc,
 	struct binder_transaction *in_reply_to = NULL;
 	struct binder_transaction_log_entry *e;
 	uint32_t return_error;
+	ktime_t start_time = ktime_get();
 
 	e = binder_transaction_log_add(&binder_transaction_log);
 	e->call_type = reply ? 2 : !!(tr->flags & TF_ONE_WAY);
@@ -1481,20 +1892,11 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
-			while (tmp) {
-				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
-				tmp = tmp->from_parent;
-			}
 		}
 	}
-	if (target_thread) {
-		e->to_thread = target_thread->pid;
-		target_list = &target_thread->todo;
-		target_wait = &target_thread->wait;
-	} else {
-		target_list = &target_proc->todo;
-		target_wait = &target_proc->wait;
+	if (target_proc->is_dead) {
+		return_error = BR_DEAD_REPLY;
+		goto err_dead_binder;
 	}
 	e->to_proc = target_proc->pid;
 
@@ -1539,37 +1941,100 @@ static void binder_transaction(struct binder_proc *proc,
 		t->from = NULL;
 	t->sender_euid = proc->tsk->cred->euid;
 	t->to_proc = target_proc;
-	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
+	if (target_node)
+		binder_inc_node(target_node, 1, 0, NULL);
+
+	/*
+	 * Allocating and filling the buffer only touches the target's buffer
+	 * space, so do it without binder_lock.  The tmp_ref keeps
+	 * binder_deferred_release() off target_proc in the meantime, and the
+	 * node reference taken above keeps target_node alive.
+	 */
+	target_proc->tmp_ref++;
+	mutex_unlock(&binder_lock);
+
+	return_error = BR_OK;
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+	if (t->buffer != NULL) {
+		t->buffer->allow_user_free = 0;
+		t->buffer->debug_id = t->debug_id;
+		t->buffer->transaction = t;
+		t->buffer->target_node = target_node;
+
+		if (copy_from_user(t->buffer->data, tr->data.ptr.buffer,
+				   tr->data_size)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid data ptr\n", proc->pid, thread->pid);
+			return_error = BR_FAILED_REPLY;
+		} else if (copy_from_user(t->buffer->data +
+					  ALIGN(tr->data_size, sizeof(void *)),
+					  tr->data.ptr.offsets,
+					  tr->offsets_size)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid offsets ptr\n", proc->pid,
+				thread->pid);
+			return_error = BR_FAILED_REPLY;
+		}
+	}
+
+	mutex_lock(&binder_lock);
 	if (t->buffer == NULL) {
+		if (target_node)
+			binder_dec_node(target_node, 1, 0);
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
-	t->buffer->debug_id = t->debug_id;
-	t->buffer->transaction = t;
-	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
-
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
-
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
+	if (return_error != BR_OK)
 		goto err_copy_data_failed;
+
+	/* Anything but our own transaction stack may have changed */
+	if (target_proc->is_dead) {
+		return_error = BR_DEAD_REPLY;
+		goto err_dead_target;
 	}
-	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"offsets ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
-		goto err_copy_data_failed;
+	if (reply) {
+		target_thread = in_reply_to->from;
+		if (target_thread == NULL) {
+			return_error = BR_DEAD_REPLY;
+			goto err_dead_target;
+		}
+		if (target_thread->transaction_stack != in_reply_to) {
+			binder_user_error("binder: %d:%d got reply transaction "
+				"with bad target transaction stack %d, "
+				"expected %d\n",
+				proc->pid, thread->pid,
+				target_thread->transaction_stack ?
+				target_thread->transaction_stack->debug_id : 0,
+				in_reply_to->debug_id);
+			return_error = BR_FAILED_REPLY;
+			in_reply_to = NULL;
+			target_thread = NULL;
+			goto err_dead_target;
+		}
+	} else if (!(t->flags & TF_ONE_WAY) && thread->transaction_stack) {
+		struct binder_transaction *tmp;
+		tmp = thread->transaction_stack;
+		while (tmp) {
+			if (tmp->from && tmp->from->proc == target_proc)
+				target_thread = tmp->from;
+			tmp = tmp->from_parent;
+		}
+	}
+	t->to_thread = target_thread;
+	if (target_thread) {
+		e->to_thread = target_thread->pid;
+		target_list = &target_thread->todo;
+		target_wait = &target_thread->wait;
+	} else {
+		target_list = &target_proc->todo;
+		target_wait = &target_proc->wait;
 	}
+
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
 			"invalid offsets size, %zd\n",
@@ -1716,7 +2181,17 @@ static void binder_transaction(struct binder_proc *proc,
 		}
 	}
 	if (reply) {
+		s64 exec_us = ktime_us_delta(ktime_get(),
+					     in_reply_to->deliver_time);
+
 		BUG_ON(t->buffer->async_transaction != 0);
+		t->call_stats = binder_transaction_call_stats(in_reply_to);
+		t->call_node_id = in_reply_to->call_node_id;
+		t->call_start = in_reply_to->call_start;
+		if (t->call_stats)
+			binder_latency_record(&t->call_stats->exec, exec_us);
+		trace_binder_transaction_exec(in_reply_to->debug_id,
+			t->call_node_id, in_reply_to->code, exec_us);
 		binder_pop_transaction(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
@@ -1732,12 +2207,31 @@ static void binder_transaction(struct binder_proc *proc,
 		} else
 			target_node->has_async_transaction = 1;
 	}
+	if (!reply) {
+		t->call_start = start_time;
+		t->call_node_id = target_node->debug_id;
+		t->call_stats = binder_get_call_stats(target_node->debug_id,
+						      target_proc->pid,
+						      t->code);
+		if (t->call_stats) {
+			if (t->flags & TF_ONE_WAY)
+				t->call_stats->async_calls++;
+			else
+				t->call_stats->calls++;
+		}
+	}
+	trace_binder_transaction(t->debug_id, reply,
+				 target_node ? target_node->debug_id : 0,
+				 target_proc->pid,
+				 target_thread ? target_thread->pid : 0,
+				 t->code, t->flags);
 	t->work.type = BINDER_WORK_TRANSACTION;
 	list_add_tail(&t->work.entry, target_list);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
 	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	binder_proc_dec_tmpref(target_proc);
 	return;
 
 err_get_unused_fd_failed:
@@ -1748,11 +2242,13 @@ err_binder_get_ref_failed:
 err_binder_new_node_failed:
 err_bad_object_type:
 err_bad_offset:
+err_dead_target:
 err_copy_data_failed:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
 	binder_free_buf(target_proc, t->buffer);
 err_binder_alloc_buf_failed:
+	binder_proc_dec_tmpref(target_proc);
 	kfree(tcomplete);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 err_alloc_tcomplete_failed:
@@ -1964,7 +2460,15 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
+			/*
+			 * The buffer is no longer reachable from the object
+			 * graph; clearing allow_user_free stops a racing
+			 * BC_FREE_BUFFER while binder_lock is dropped.
+			 */
+			buffer->allow_user_free = 0;
+			mutex_unlock(&binder_lock);
 			binder_free_buf(proc, buffer);
+			mutex_lock(&binder_lock);
 			break;
 		}
 
@@ -2269,6 +2773,8 @@ retry:
 		struct binder_transaction_data tr;
 		struct binder_work *w;
 		struct binder_transaction *t = NULL;
+		struct binder_call_stats *call_stats;
+		s64 latency_us;
 
 		if (!list_empty(&thread->todo))
 			w = list_first_entry(&thread->todo, struct binder_work, entry);
@@ -2352,6 +2858,7 @@ retry:
 						     proc->pid, thread->pid, node->debug_id,
 						     node->ptr, node->cookie);
 					rb_erase(&node->rb_node, &proc->nodes);
+					binder_free_call_stats(node->debug_id);
 					kfree(node);
 					binder_stats_deleted(BINDER_STAT_NODE);
 				} else {
@@ -2447,6 +2954,15 @@ retry:
 		ptr += sizeof(tr);
 
 		binder_stat_br(proc, thread, cmd);
+		t->deliver_time = ktime_get();
+		latency_us = ktime_us_delta(t->deliver_time, t->call_start);
+		call_stats = binder_transaction_call_stats(t);
+		if (call_stats)
+			binder_latency_record(cmd == BR_REPLY ?
+					      &call_stats->reply :
+					      &call_stats->wait, latency_us);
+		trace_binder_transaction_received(t->debug_id, cmd == BR_REPLY,
+						  latency_us);
 		binder_debug(BINDER_DEBUG_TRANSACTION,
 			     "binder: %d:%d %s %d %d:%d, cmd %d"
 			     "size %zd-%zd ptr %p-%p\n",
@@ -2781,7 +3297,7 @@ static struct vm_operations_struct binder_vm_ops = {
 
 static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-	int ret;
+	int ret, i;
 	struct vm_struct *area;
 	struct binder_proc *proc = filp->private_data;
 	const char *failure_string;
@@ -2833,6 +3349,8 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		goto err_alloc_pages_failed;
 	}
 	proc->buffer_size = vma->vm_end - vma->vm_start;
+	for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++)
+		INIT_LIST_HEAD(&proc->pages[i].lru);
 
 	vma->vm_ops = &binder_vm_ops;
 	vma->vm_private_data = proc;
@@ -2884,6 +3402,7 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
+	mutex_init(&proc->alloc_lock);
 	proc->default_priority = task_nice(current);
 	mutex_lock(&binder_lock);
 	binder_stats_created(BINDER_STAT_PROC);
@@ -2950,6 +3469,15 @@ static void binder_deferred_release(struct binder_proc *proc)
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
 
+	proc->is_dead = 1;
+	if (proc->tmp_ref) {
+		/* binder_proc_dec_tmpref() queues the release again */
+		binder_debug(BINDER_DEBUG_OPEN_CLOSE,
+			     "binder_release: %d delayed, %d transactions "
+			     "in flight\n", proc->pid, proc->tmp_ref);
+		return;
+	}
+
 	hlist_del(&proc->proc_node);
 	if (binder_context_mgr_node && binder_context_mgr_node->proc == proc) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
@@ -2974,6 +3502,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 		rb_erase(&node->rb_node, &proc->nodes);
 		list_del_init(&node->work.entry);
 		if (hlist_empty(&node->refs)) {
+			binder_free_call_stats(node->debug_id);
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		} else {
@@ -3034,20 +3563,32 @@ static void binder_deferred_release(struct binder_proc *proc)
 	page_count = 0;
 	if (proc->pages) {
 		int i;
+		mutex_lock(&proc->alloc_lock);
 		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
+			struct binder_lru_page *page = &proc->pages[i];
+
+			if (page->page_ptr) {
 				void *page_addr = proc->buffer + i * PAGE_SIZE;
-				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
-					     "binder_release: %d: "
-					     "page %d at %p not freed\n",
-					     proc->pid, i,
-					     page_addr);
+				if (!list_empty(&page->lru))
+					binder_lru_del(proc, page);
+				else
+					binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+						     "binder_release: %d: "
+						     "page %d at %p not freed\n",
+						     proc->pid, i,
+						     page_addr);
 				unmap_kernel_range((unsigned long)page_addr,
 					PAGE_SIZE);
-				__free_page(proc->pages[i]);
+				__free_page(page->page_ptr);
 				page_count++;
 			}
 		}
+		mutex_unlock(&proc->alloc_lock);
+		/*
+		 * None of its pages are on binder_lru any more, so no new
+		 * binder_shrink() can pick the proc; wait for those that did.
+		 */
+		wait_event(binder_shrink_wait, !proc->shrink_ref);
 		kfree(proc->pages);
 		vfree(proc->buffer);
 	}
@@ -3279,9 +3820,11 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	mutex_unlock(&proc->alloc_lock);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -3411,8 +3954,10 @@ static void print_binder_proc_stats(struct seq_file *m,
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
 	count = 0;
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
+	mutex_unlock(&proc->alloc_lock);
 	seq_printf(m, "  buffers: %d\n", count);
 
 	count = 0;
@@ -3506,6 +4051,93 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	return 0;
 }
 
+static void print_binder_latency(struct seq_file *m, const char *name,
+				 atomic_t *hist)
+{
+	int i;
+
+	seq_printf(m, "%s latency:\n", name);
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++) {
+		int count = atomic_read(&hist[i]);
+
+		if (!count)
+			continue;
+		if (i == BINDER_LATENCY_BUCKETS - 1)
+			seq_printf(m, "  >=%lu us: %d\n", 1UL << (i - 1), count);
+		else
+			seq_printf(m, "  <%lu us: %d\n", 1UL << i, count);
+	}
+}
+
+static void print_binder_call_latency(struct seq_file *m, const char *name,
+				      struct binder_latency *lat,
+				      unsigned int count)
+{
+	int i;
+
+	if (!count)
+		return;
+	seq_printf(m, "    %-5s avg %llu max %u us:", name,
+		   div_u64(lat->total_us, count), lat->max_us);
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++)
+		seq_printf(m, " %u", lat->hist[i]);
+	seq_puts(m, "\n");
+}
+
+static int binder_call_stats_show(struct seq_file *m, void *unused)
+{
+	int i;
+	int do_lock = !binder_debug_no_lock;
+
+	if (do_lock)
+		mutex_lock(&binder_lock);
+	seq_printf(m, "binder call stats (log2 us buckets), dropped %u:\n",
+		   binder_call_stats_dropped);
+	for (i = 0; i < ARRAY_SIZE(binder_call_stats); i++) {
+		struct binder_call_stats *cs = &binder_call_stats[i];
+		unsigned int received;
+		int j;
+
+		if (cs->node_id <= 0)
+			continue;
+		seq_printf(m, "  node %d proc %d code %u: calls %u async %u\n",
+			   cs->node_id, cs->pid, cs->code, cs->calls,
+			   cs->async_calls);
+		received = 0;
+		for (j = 0; j < BINDER_LATENCY_BUCKETS; j++)
+			received += cs->wait.hist[j];
+		print_binder_call_latency(m, "wait", &cs->wait, received);
+		received = 0;
+		for (j = 0; j < BINDER_LATENCY_BUCKETS; j++)
+			received += cs->exec.hist[j];
+		print_binder_call_latency(m, "exec", &cs->exec, received);
+		received = 0;
+		for (j = 0; j < BINDER_LATENCY_BUCKETS; j++)
+			received += cs->reply.hist[j];
+		print_binder_call_latency(m, "reply", &cs->reply, received);
+	}
+	if (do_lock)
+		mutex_unlock(&binder_lock);
+	return 0;
+}
+
+static int binder_buffer_stats_show(struct seq_file *m, void *unused)
+{
+	seq_puts(m, "binder buffer stats:\n");
+	seq_printf(m, "cache_pages: %d page_pool: %u cached pages: %d "
+		   "reclaimable: %d\n", binder_cache_pages, binder_page_pool,
+		   binder_lru_count, binder_lru_reclaimable);
+	seq_printf(m, "pages mapped: %d reused: %d cached: %d "
+		   "reclaimed: %d\n",
+		   atomic_read(&binder_alloc_stats.pages_mapped),
+		   atomic_read(&binder_alloc_stats.pages_reused),
+		   atomic_read(&binder_alloc_stats.pages_cached),
+		   atomic_read(&binder_alloc_stats.pages_reclaimed));
+	print_binder_latency(m, "alloc", binder_alloc_stats.alloc_latency);
+	print_binder_latency(m, "free", binder_alloc_stats.free_latency);
+	return 0;
+}
+
 static void print_binder_transaction_log_entry(struct seq_file *m,
 					struct binder_transaction_log_entry *e)
 {
@@ -3551,6 +4183,33 @@ BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
 BINDER_DEBUG_ENTRY(transaction_log);
+BINDER_DEBUG_ENTRY(buffer_stats);
+
+static int binder_call_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, binder_call_stats_show, inode->i_private);
+}
+
+/* Any write clears the call stats */
+static ssize_t binder_call_stats_write(struct file *file,
+				       const char __user *ubuf, size_t count,
+				       loff_t *ppos)
+{
+	mutex_lock(&binder_lock);
+	memset(binder_call_stats, 0, sizeof(binder_call_stats));
+	binder_call_stats_dropped = 0;
+	mutex_unlock(&binder_lock);
+	return count;
+}
+
+static const struct file_operations binder_call_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = binder_call_stats_open,
+	.read = seq_read,
+	.write = binder_call_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 
 static int __init binder_init(void)
 {
@@ -3591,7 +4250,18 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    &binder_transaction_log_failed,
 				    &binder_transaction_log_fops);
+		debugfs_create_file("buffer_stats",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_buffer_stats_fops);
+		debugfs_create_file("call_stats",
+				    S_IRUGO | S_IWUSR,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_call_stats_fops);
 	}
+	register_shrinker(&binder_shrinker);
 	return ret;
 }
 
@@ -0,0 +1,105 @@
+/* binder_trace.h
+ *
+ * Android IPC Subsystem tracepoints
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#if !defined(_BINDER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BINDER_TRACE_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+#define TRACE_INCLUDE_FILE binder_trace
+
+/* BC_TRANSACTION or BC_REPLY queued on the target */
+TRACE_EVENT(binder_transaction,
+	TP_PROTO(int debug_id, int reply, int target_node, int to_proc,
+		 int to_thread, unsigned int code, unsigned int flags),
+	TP_ARGS(debug_id, reply, target_node, to_proc, to_thread, code, flags),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, reply)
+		__field(int, target_node)
+		__field(int, to_proc)
+		__field(int, to_thread)
+		__field(unsigned int, code)
+		__field(unsigned int, flags)
+	),
+	TP_fast_assign(
+		__entry->debug_id = debug_id;
+		__entry->reply = reply;
+		__entry->target_node = target_node;
+		__entry->to_proc = to_proc;
+		__entry->to_thread = to_thread;
+		__entry->code = code;
+		__entry->flags = flags;
+	),
+	TP_printk("transaction=%d dest_node=%d dest_proc=%d dest_thread=%d "
+		  "reply=%d flags=0x%x code=0x%x",
+		  __entry->debug_id, __entry->target_node, __entry->to_proc,
+		  __entry->to_thread, __entry->reply, __entry->flags,
+		  __entry->code)
+);
+
+/*
+ * BR_TRANSACTION or BR_REPLY read by the receiving thread.  latency_us is the
+ * time since the originating BC_TRANSACTION: the wakeup latency for
+ * BR_TRANSACTION and the whole round trip for BR_REPLY.
+ */
+TRACE_EVENT(binder_transaction_received,
+	TP_PROTO(int debug_id, int reply, s64 latency_us),
+	TP_ARGS(debug_id, reply, latency_us),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, reply)
+		__field(s64, latency_us)
+	),
+	TP_fast_assign(
+		__entry->debug_id = debug_id;
+		__entry->reply = reply;
+		__entry->latency_us = latency_us;
+	),
+	TP_printk("transaction=%d reply=%d latency=%lldus",
+		  __entry->debug_id, __entry->reply, __entry->latency_us)
+);
+
+/* BC_REPLY sent: exec_us is the time the target spent on the call */
+TRACE_EVENT(binder_transaction_exec,
+	TP_PROTO(int debug_id, int target_node, unsigned int code,
+		 s64 exec_us),
+	TP_ARGS(debug_id, target_node, code, exec_us),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, target_node)
+		__field(unsigned int, code)
+		__field(s64, exec_us)
+	),
+	TP_fast_assign(
+		__entry->debug_id = debug_id;
+		__entry->target_node = target_node;
+		__entry->code = code;
+		__entry->exec_us = exec_us;
+	),
+	TP_printk("transaction=%d dest_node=%d code=0x%x exec=%lldus",
+		  __entry->debug_id, __entry->target_node, __entry->code,
+		  __entry->exec_us)
+);
+
+#endif /* _BINDER_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#include <trace/define_trace.h>
@@ -24,44 +24,117 @@
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/time.h>
+#include <linux/mm.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/kref.h>
+#include <linux/lzo.h>
 #include "logger.h"
 
+#include <asm/io.h>
 #include <asm/ioctls.h>
+#include <asm/shmparam.h>
 
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * 'w_off' and 'head' are logical offsets: they only ever grow, and the byte
+ * at logical offset n lives at logger_offset(n) in the ring.  Writers
+ * serialize on 'mutex' and publish new values of both through 'lock'.
+ * Readers never take 'mutex'; they copy out of the ring and then check that
+ * 'head' did not move past what they copied.
+ *
+ * With compression enabled, entries that fall off the head of the ring are
+ * kept on 'chunks' instead, so that history older than 'head' stays
+ * readable. The history and the live part of the ring share 'size': the
+ * more memory the history uses, the earlier entries are retired to it, and
+ * the history itself is held to half of 'size'. See struct logger_chunk.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
+	struct mutex		mutex;	/* mutex serializing writers */
+	seqlock_t		lock;	/* protects w_off and head */
 	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	size_t			head;	/* oldest entry in the ring */
 	size_t			size;	/* size of the log */
+	spinlock_t		chunk_lock;	/* protects the fields below */
+	struct list_head	chunks;	/* retired entries, oldest first */
+	struct logger_chunk	*open;	/* chunk being filled, or NULL */
+	size_t			chunk_bytes;	/* memory used by 'chunks' */
+	struct logger_chunk	*stage[2];	/* chunks the writer fills */
+	void			*lzo_wrkmem;	/* scratch for compress_work */
+	unsigned char		*lzo_dst;	/* output of compress_work */
+	struct work_struct	compress_work;	/* compresses sealed chunks */
 };
 
+/*
+ * struct logger_chunk - a run of whole entries retired from a ring
+ *
+ * The writer appends retired entries to the log's open chunk, growing 'len'
+ * under chunk_lock, and seals it once the next entry does not fit. The open
+ * chunk is one of the log's two staging chunks, which are allocated once,
+ * when compression is enabled, and hold a reference of their own. Sealed
+ * chunks are replaced on the list by compress_work with a copy sized to
+ * their contents, LZO-compressed if that makes it smaller; a chunk's data
+ * is never modified while it is sealed or on the list, so readers only need
+ * a reference to use it. The list's reference is dropped under chunk_lock,
+ * so a chunk is on the list iff !list_empty(&chunk->list), and a staging
+ * chunk can be refilled once it is off the list and its last reader let go.
+ */
+struct logger_chunk {
+	struct list_head	list;	/* entry in log->chunks */
+	struct kref		ref;	/* one for the list, one per user */
+	size_t			start;	/* logical offset of the first entry */
+	size_t			len;	/* uncompressed length */
+	size_t			clen;	/* compressed length, or 0 if raw */
+	int			state;	/* LOGGER_CHUNK_* */
+	unsigned char		data[0];
+};
+
+#define LOGGER_CHUNK_OPEN	0	/* the writer is still appending */
+#define LOGGER_CHUNK_SEALED	1	/* waiting to be compressed */
+#define LOGGER_CHUNK_DONE	2	/* compressed, or incompressible */
+
+/* a staging chunk, header included, is a single order-2 allocation */
+#define LOGGER_CHUNK_ALLOC	(16*1024)
+#define LOGGER_CHUNK_SIZE	(LOGGER_CHUNK_ALLOC - sizeof(struct logger_chunk))
+
+/* keep retired entries as compressed history, see set_compress() */
+static int compress;
+
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by reader->mutex.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
+	struct mutex		mutex;	/* mutex protecting r_off */
 	size_t			r_off;	/* current read head offset */
+	int			mode;	/* LOGGER_READ_ENTRY or _BATCH */
+	unsigned char		*chunk_buf;	/* decompressed chunk */
+	size_t			chunk_start;	/* its start, if valid */
+	int			chunk_valid;	/* chunk_buf holds a chunk */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+/* logger_before - is logical offset 'a' before 'b'? Safe across wrapping. */
+static inline int logger_before(size_t a, size_t b)
+{
+	return (ssize_t)(a - b) < 0;
+}
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -85,16 +158,43 @@ static inline struct logger_log *file_get_log(struct file *file)
 		return file->private_data;
 }
 
+/*
+ * get_log_state - snapshot the log's head and write offsets
+ */
+static void get_log_state(struct logger_log *log, size_t *head, size_t *w_off)
+{
+	unsigned seq;
+
+	do {
+		seq = read_seqbegin(&log->lock);
+		*head = log->head;
+		*w_off = log->w_off;
+	} while (read_seqretry(&log->lock, seq));
+}
+
+/*
+ * log_head - returns the log's current head offset
+ */
+static size_t log_head(struct logger_log *log)
+{
+	size_t head, w_off;
+
+	get_log_state(log, &head, &w_off);
+	return head;
+}
+
 /*
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->mutex, or to check afterwards that the entry was
+ * not overwritten.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
 	__u16 val;
 
+	off = logger_offset(off);
 	switch (log->size - off) {
 	case 1:
 		memcpy(&val, log->buffer + off, 1);
@@ -107,17 +207,205 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 	return sizeof(struct logger_entry) + val;
 }
 
+/*
+ * log_tail - returns the oldest logical offset still readable, which is
+ * before the head if there is compressed history
+ */
+static size_t log_tail(struct logger_log *log, size_t head)
+{
+	struct logger_chunk *chunk;
+
+	spin_lock(&log->chunk_lock);
+	if (!list_empty(&log->chunks)) {
+		chunk = list_first_entry(&log->chunks, struct logger_chunk,
+					 list);
+		if (logger_before(chunk->start, head))
+			head = chunk->start;
+	}
+	spin_unlock(&log->chunk_lock);
+
+	return head;
+}
+
+/*
+ * reader_catch_up - pull the reader forward to the oldest entry if the
+ * writer lapped it, and return the current write offset.
+ *
+ * Caller must hold reader->mutex.
+ */
+static size_t reader_catch_up(struct logger_reader *reader)
+{
+	size_t head, w_off;
+
+	get_log_state(reader->log, &head, &w_off);
+	if (logger_before(reader->r_off, head)) {
+		head = log_tail(reader->log, head);
+		if (logger_before(reader->r_off, head))
+			reader->r_off = head;
+	}
+
+	return w_off;
+}
+
+static void logger_chunk_release(struct kref *ref)
+{
+	kfree(container_of(ref, struct logger_chunk, ref));
+}
+
+static inline void logger_chunk_put(struct logger_chunk *chunk)
+{
+	kref_put(&chunk->ref, logger_chunk_release);
+}
+
+/* logger_chunk_size - memory charged to the history for 'chunk' */
+static inline size_t logger_chunk_size(struct logger_chunk *chunk)
+{
+	return ksize(chunk);
+}
+
+/*
+ * logger_get_chunk - find and pin the chunk holding logical offset '*off'
+ *
+ * If the entries at '*off' were dropped, '*off' is moved forward to the
+ * next chunk. Returns NULL if there is no history at or after '*off'. The
+ * number of valid bytes in the chunk is returned in '*len'.
+ */
+static struct logger_chunk *logger_get_chunk(struct logger_log *log,
+					     size_t *off, size_t *len)
+{
+	struct logger_chunk *chunk;
+
+	spin_lock(&log->chunk_lock);
+	list_for_each_entry(chunk, &log->chunks, list) {
+		if (!logger_before(*off, chunk->start + chunk->len))
+			continue;
+		if (logger_before(*off, chunk->start))
+			*off = chunk->start;
+		kref_get(&chunk->ref);
+		*len = chunk->len;
+		spin_unlock(&log->chunk_lock);
+		return chunk;
+	}
+	spin_unlock(&log->chunk_lock);
+
+	return NULL;
+}
+
+/*
+ * reader_chunk_data - return the uncompressed contents of 'chunk',
+ * decompressing it into the reader's buffer if needed
+ *
+ * Caller must hold reader->mutex and a reference on 'chunk'.
+ */
+static const unsigned char *reader_chunk_data(struct logger_reader *reader,
+					      struct logger_chunk *chunk)
+{
+	size_t len = LOGGER_CHUNK_SIZE;
+	int ret;
+
+	if (!chunk->clen)
+		return chunk->data;
+
+	if (reader->chunk_valid && reader->chunk_start == chunk->start)
+		return reader->chunk_buf;
+
+	if (!reader->chunk_buf) {
+		reader->chunk_buf = kmalloc(LOGGER_CHUNK_SIZE, GFP_KERNEL);
+		if (!reader->chunk_buf)
+			return ERR_PTR(-ENOMEM);
+	}
+
+	reader->chunk_valid = 0;
+	ret = lzo1x_decompress_safe(chunk->data, chunk->clen,
+				    reader->chunk_buf, &len);
+	if (unlikely(ret != LZO_E_OK || len != chunk->len)) {
+		printk(KERN_ERR "logger: failed to decompress chunk at %zu "
+		       "in log '%s' (%d)\n", chunk->start,
+		       reader->log->misc.name, ret);
+		return ERR_PTR(-EIO);
+	}
+	reader->chunk_valid = 1;
+	reader->chunk_start = chunk->start;
+
+	return reader->chunk_buf;
+}
+
+/*
+ * logger_read_history - read entries older than the ring's head from the
+ * log's compressed history
+ *
+ * Returns the number of bytes read, 0 if the reader has caught up with the
+ * ring again, or a negative error code.
+ *
+ * Caller must hold reader->mutex.
+ */
+static ssize_t logger_read_history(struct logger_reader *reader,
+				   char __user *buf, size_t count)
+{
+	struct logger_chunk *chunk;
+	const unsigned char *data;
+	size_t off, end, len, avail;
+	ssize_t ret;
+
+	off = reader->r_off;
+	chunk = logger_get_chunk(reader->log, &off, &avail);
+	if (!chunk) {
+		/* the history we were reading was dropped */
+		reader->r_off = log_head(reader->log);
+		return 0;
+	}
+
+	data = reader_chunk_data(reader, chunk);
+	if (IS_ERR(data)) {
+		ret = PTR_ERR(data);
+		goto out;
+	}
+
+	/* gather whole entries, just one unless in batch mode */
+	avail += chunk->start;
+	end = off;
+	len = 0;
+	do {
+		__u16 val;
+		size_t nr;
+
+		memcpy(&val, data + (end - chunk->start), sizeof(val));
+		nr = sizeof(struct logger_entry) + val;
+		if (len + nr > count || logger_before(avail, end + nr))
+			break;
+		len += nr;
+		end += nr;
+	} while (reader->mode == LOGGER_READ_BATCH && end != avail);
+
+	if (!len) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (copy_to_user(buf, data + (off - chunk->start), len)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	reader->r_off = end;
+	ret = len;
+out:
+	logger_chunk_put(chunk);
+	return ret;
+}
+
 /*
  * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
  * user-space buffer 'buf'. Returns 'count' on success.
  *
- * Caller must hold log->mutex.
+ * Caller must hold reader->mutex and check for overwrites afterwards.
  */
 static ssize_t do_read_log_to_user(struct logger_log *log,
 				   struct logger_reader *reader,
 				   char __user *buf,
 				   size_t count)
 {
+	size_t off = logger_offset(reader->r_off);
 	size_t len;
 
 	/*
@@ -125,8 +413,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the current read head offset up to 'count' bytes or to the end of
 	 * the log, whichever comes first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	len = min(count, log->size - off);
+	if (copy_to_user(buf, log->buffer + off, len))
 		return -EFAULT;
 
 	/*
@@ -137,8 +425,6 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off + count);
-
 	return count;
 }
 
@@ -149,16 +435,21 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or in LOGGER_READ_BATCH mode
+ * 	  as many whole entries as fit in 'count'
  *
  * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
+ *
+ * Writers are never blocked by readers: the entries are copied out without
+ * any lock and thrown away if the writer lapped us in the meantime.
  */
 static ssize_t logger_read(struct file *file, char __user *buf,
 			   size_t count, loff_t *pos)
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	size_t w_off, end, len;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -166,9 +457,9 @@ start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		mutex_lock(&reader->mutex);
+		ret = (reader_catch_up(reader) == reader->r_off);
+		mutex_unlock(&reader->mutex);
 		if (!ret)
 			break;
 
@@ -189,130 +480,300 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->mutex);
+
+retry:
+	w_off = reader_catch_up(reader);
 
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	if (unlikely(w_off == reader->r_off)) {
+		mutex_unlock(&reader->mutex);
 		goto start;
 	}
 
-	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
-	if (count < ret) {
-		ret = -EINVAL;
-		goto out;
+	/* entries older than the head come from the compressed history */
+	if (logger_before(reader->r_off, log_head(log))) {
+		ret = logger_read_history(reader, buf, count);
+		if (!ret)
+			goto retry;
+		mutex_unlock(&reader->mutex);
+		return ret;
 	}
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	/* gather whole entries, just one unless in batch mode */
+	end = reader->r_off;
+	len = 0;
+	do {
+		__u32 nr = get_entry_len(log, end);
 
-out:
-	mutex_unlock(&log->mutex);
+		if (len + nr > count || logger_before(w_off, end + nr))
+			break;
+		len += nr;
+		end += nr;
+	} while (reader->mode == LOGGER_READ_BATCH && end != w_off);
+
+	if (len)
+		ret = do_read_log_to_user(log, reader, buf, len);
+	else
+		ret = -EINVAL;
+
+	/* did the writer overwrite what we just read? */
+	smp_rmb();
+	if (ret != -EFAULT && logger_before(reader->r_off, log_head(log)))
+		goto retry;
+	if (ret > 0)
+		reader->r_off = end;
+
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * logger_compress_work - compress the log's sealed chunks
+ */
+static void logger_compress_work(struct work_struct *work)
+{
+	struct logger_log *log = container_of(work, struct logger_log,
+					      compress_work);
+	struct logger_chunk *chunk, *new;
+	const unsigned char *src;
+	size_t clen, len;
+	int ret;
+
+	while (1) {
+		spin_lock(&log->chunk_lock);
+		list_for_each_entry(chunk, &log->chunks, list)
+			if (chunk->state == LOGGER_CHUNK_SEALED)
+				goto found;
+		spin_unlock(&log->chunk_lock);
+		break;
+found:
+		kref_get(&chunk->ref);
+		spin_unlock(&log->chunk_lock);
+
+		ret = lzo1x_1_compress(chunk->data, chunk->len, log->lzo_dst,
+				       &clen, log->lzo_wrkmem);
+		if (ret == LZO_E_OK && clen < chunk->len) {
+			src = log->lzo_dst;
+			len = clen;
+		} else {
+			/* incompressible, keep a copy as it is */
+			src = chunk->data;
+			len = chunk->len;
+			clen = 0;
+		}
+		new = kmalloc(sizeof(*new) + len, GFP_KERNEL | __GFP_NOWARN);
+		if (new) {
+			kref_init(&new->ref);
+			new->start = chunk->start;
+			new->len = chunk->len;
+			new->clen = clen;
+			new->state = LOGGER_CHUNK_DONE;
+			memcpy(new->data, src, len);
+		}
+
+		spin_lock(&log->chunk_lock);
+		if (list_empty(&chunk->list)) {
+			/* dropped while we were compressing it */
+			spin_unlock(&log->chunk_lock);
+			kfree(new);
+		} else {
+			/* without a copy, lose the chunk to free the stage */
+			if (new)
+				list_replace_init(&chunk->list, &new->list);
+			else
+				list_del_init(&chunk->list);
+			log->chunk_bytes -= logger_chunk_size(chunk);
+			if (new)
+				log->chunk_bytes += logger_chunk_size(new);
+			spin_unlock(&log->chunk_lock);
+			logger_chunk_put(chunk);
+		}
+		logger_chunk_put(chunk);
+	}
+}
+
+/*
+ * retire_entry - copy the entry at logical offset 'off' out of the ring and
+ * into the log's compressed history, before the writer clobbers it
  *
- * Caller must hold log->mutex.
+ * The caller needs to hold log->mutex.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static void retire_entry(struct logger_log *log, size_t off, size_t len)
 {
-	size_t count = 0;
+	struct logger_chunk *chunk = log->open, *old;
+	size_t index, n;
+	int i;
+
+	if (chunk && (chunk->start + chunk->len != off ||
+		      chunk->len + len > LOGGER_CHUNK_SIZE)) {
+		spin_lock(&log->chunk_lock);
+		chunk->state = LOGGER_CHUNK_SEALED;
+		log->open = NULL;
+		spin_unlock(&log->chunk_lock);
+		queue_work(system_nrt_wq, &log->compress_work);
+		chunk = NULL;
+	}
 
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
+	if (!chunk) {
+		spin_lock(&log->chunk_lock);
+		/*
+		 * If compress_work still has both staging chunks, or readers
+		 * still use them, the entry is not kept and the history has
+		 * a gap. Readers skip over gaps.
+		 */
+		for (i = 0; i < ARRAY_SIZE(log->stage); i++) {
+			chunk = log->stage[i];
+			if (chunk && list_empty(&chunk->list) &&
+			    atomic_read(&chunk->ref.refcount) == 1)
+				break;
+		}
+		if (i == ARRAY_SIZE(log->stage)) {
+			spin_unlock(&log->chunk_lock);
+			return;
+		}
+		kref_get(&chunk->ref);
+		chunk->start = off;
+		chunk->len = 0;
+		chunk->clen = 0;
+		chunk->state = LOGGER_CHUNK_OPEN;
+		list_add_tail(&chunk->list, &log->chunks);
+		log->open = chunk;
+		log->chunk_bytes += logger_chunk_size(chunk);
+
+		/* hold the history to half of the log by dropping its oldest */
+		while (log->chunk_bytes > log->size / 2) {
+			old = list_first_entry(&log->chunks,
+					       struct logger_chunk, list);
+			if (old == chunk)
+				break;
+			list_del_init(&old->list);
+			log->chunk_bytes -= logger_chunk_size(old);
+			logger_chunk_put(old);
+		}
+		spin_unlock(&log->chunk_lock);
+	}
+
+	/* the entry may wrap around the end of the ring */
+	index = logger_offset(off);
+	n = min(len, log->size - index);
+	memcpy(chunk->data + chunk->len, log->buffer + index, n);
+	if (n != len)
+		memcpy(chunk->data + chunk->len + n, log->buffer, len - n);
 
-	return off;
+	spin_lock(&log->chunk_lock);
+	chunk->len += len;
+	spin_unlock(&log->chunk_lock);
 }
 
 /*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
+ * logger_drop_history - free the log's compressed history
  */
-static inline int clock_interval(size_t a, size_t b, size_t c)
+static void logger_drop_history(struct logger_log *log)
 {
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
+	struct logger_chunk *chunk;
+
+	spin_lock(&log->chunk_lock);
+	while (!list_empty(&log->chunks)) {
+		chunk = list_first_entry(&log->chunks, struct logger_chunk,
+					 list);
+		list_del_init(&chunk->list);
+		logger_chunk_put(chunk);
 	}
+	log->open = NULL;
+	log->chunk_bytes = 0;
+	spin_unlock(&log->chunk_lock);
+}
 
-	return 0;
+/*
+ * logger_window - how many bytes of the ring the live entries may use
+ *
+ * The memory used by the history comes out of the ring, so that the two
+ * together stay within the log's size. The history is held to half of it,
+ * which always leaves room for an entry.
+ */
+static inline size_t logger_window(struct logger_log *log)
+{
+	if (!compress)
+		return log->size;
+	return log->size - ACCESS_ONCE(log->chunk_bytes);
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * make_room - move the log's head past the entries that a write of 'len'
+ * bytes at the write offset is going to clobber, before it clobbers them.
+ * With compression enabled the entries are retired to the history first.
  *
  * The caller needs to hold log->mutex.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void make_room(struct logger_log *log, size_t len)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
+	size_t head = log->head;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	while (log->w_off + len - head > logger_window(log)) {
+		__u32 nr = get_entry_len(log, head);
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+		if (compress)
+			retire_entry(log, head, nr);
+		head += nr;
+	}
+
+	if (head != log->head) {
+		write_seqlock(&log->lock);
+		log->head = head;
+		write_sequnlock(&log->lock);
+		/*
+		 * Lockless readers copy entries and then check that head did
+		 * not pass them. Make the new head visible before the writer
+		 * starts clobbering the bytes behind it; pairs with the
+		 * smp_rmb() before the overwrite check in logger_read().
+		 */
+		smp_wmb();
+	}
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * do_write_log - writes 'len' bytes from 'buf' to 'log' at logical offset
+ * 'off'
  *
  * The caller needs to hold log->mutex.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void do_write_log(struct logger_log *log, size_t off, const void *buf,
+			 size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log->w_off + count);
-
 }
 
 /*
  * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * the log 'log' at logical offset 'off'
  *
  * The caller needs to hold log->mutex.
  *
  * Returns 'count' on success, negative error code on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
+static ssize_t do_write_log_from_user(struct logger_log *log, size_t off,
 				      const void __user *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	if (len && copy_from_user(log->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
 		if (copy_from_user(log->buffer, buf + len, count - len))
 			return -EFAULT;
 
-	log->w_off = logger_offset(log->w_off + count);
-
 	return count;
 }
 
@@ -325,9 +786,9 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
+	size_t off;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -345,14 +806,15 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	mutex_lock(&log->mutex);
 
 	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
+	 * Retire the entries we are about to overwrite first. We do this now
 	 * because if we partially fail, we can end up with clobbered log
 	 * entries that encroach on readable buffer.
 	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+	make_room(log, sizeof(struct logger_entry) + header.len);
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	off = log->w_off;
+	do_write_log(log, off, &header, sizeof(struct logger_entry));
+	off += sizeof(struct logger_entry);
 
 	while (nr_segs-- > 0) {
 		size_t len;
@@ -362,17 +824,22 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		nr = do_write_log_from_user(log, off, iov->iov_base, len);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
 			mutex_unlock(&log->mutex);
 			return nr;
 		}
 
 		iov++;
+		off += nr;
 		ret += nr;
 	}
 
+	/* publish the entry */
+	write_seqlock(&log->lock);
+	log->w_off = off;
+	write_sequnlock(&log->lock);
+
 	mutex_unlock(&log->mutex);
 
 	/* wake up any blocked readers */
@@ -409,12 +876,11 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		mutex_init(&reader->mutex);
+		reader->r_off = log_tail(log, log_head(log));
+		reader->mode = LOGGER_READ_ENTRY;
+		reader->chunk_buf = NULL;
+		reader->chunk_valid = 0;
 
 		file->private_data = reader;
 	} else
@@ -432,7 +898,7 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		list_del(&reader->list);
+		kfree(reader->chunk_buf);
 		kfree(reader);
 	}
 
@@ -462,10 +928,92 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	mutex_lock(&reader->mutex);
+	if (reader_catch_up(reader) != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
+
+	return ret;
+}
+
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the ring buffer read-only into the reader, which can then walk the
+ * entries between the offsets returned by LOGGER_GET_RING_STATE without
+ * copying them through read(). The reader is responsible for checking the
+ * ring state again afterwards to detect entries that were overwritten, and
+ * for passing the offset it got to with LOGGER_SET_READ_OFFSET, so that
+ * poll() only wakes it for newer entries.
+ *
+ * The mapping must be shared so that it is colour-aligned with the kernel's
+ * view of the buffer on aliasing caches.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+
+	if (vma->vm_pgoff || size > log->size)
+		return -EINVAL;
+
+	if ((vma->vm_flags & VM_WRITE) || !(vma->vm_flags & VM_SHARED))
+		return -EPERM;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTEXPAND | VM_RESERVED;
+
+	return remap_pfn_range(vma, vma->vm_start,
+			       virt_to_phys(log->buffer) >> PAGE_SHIFT,
+			       size, vma->vm_page_prot);
+}
+
+/*
+ * next_entry_len - returns the length of the reader's next entry, or 0 if
+ * there is none
+ *
+ * Caller must hold reader->mutex.
+ */
+static long next_entry_len(struct logger_reader *reader)
+{
+	struct logger_log *log = reader->log;
+	struct logger_chunk *chunk;
+	const unsigned char *data;
+	size_t w_off, off, avail;
+	__u16 val;
+	long ret;
+
+retry:
+	w_off = reader_catch_up(reader);
+	if (w_off == reader->r_off)
+		return 0;
+
+	if (!logger_before(reader->r_off, log_head(log))) {
+		mutex_lock(&log->mutex);
+		ret = get_entry_len(log, reader->r_off);
+		mutex_unlock(&log->mutex);
+		return ret;
+	}
+
+	off = reader->r_off;
+	chunk = logger_get_chunk(log, &off, &avail);
+	if (!chunk) {
+		reader->r_off = log_head(log);
+		goto retry;
+	}
+
+	reader->r_off = off;
+	data = reader_chunk_data(reader, chunk);
+	if (IS_ERR(data)) {
+		ret = PTR_ERR(data);
+	} else {
+		memcpy(&val, data + (off - chunk->start), sizeof(val));
+		ret = sizeof(struct logger_entry) + val;
+	}
+	logger_chunk_put(chunk);
 
 	return ret;
 }
@@ -474,10 +1022,11 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	struct logger_ring_state state;
+	struct logger_log_sizes sizes;
+	size_t head, w_off, tail;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
-
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
@@ -488,10 +1037,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		mutex_lock(&reader->mutex);
+		ret = reader_catch_up(reader) - reader->r_off;
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -499,25 +1047,88 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
-		else
-			ret = 0;
+		mutex_lock(&reader->mutex);
+		ret = next_entry_len(reader);
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
+		/* readers catch up with the new head on their next access */
+		mutex_lock(&log->mutex);
+		write_seqlock(&log->lock);
 		log->head = log->w_off;
+		write_sequnlock(&log->lock);
+		logger_drop_history(log);
+		mutex_unlock(&log->mutex);
 		ret = 0;
 		break;
+	case LOGGER_SET_READ_MODE:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		if (arg != LOGGER_READ_ENTRY && arg != LOGGER_READ_BATCH) {
+			ret = -EINVAL;
+			break;
+		}
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+		reader->mode = arg;
+		mutex_unlock(&reader->mutex);
+		ret = 0;
+		break;
+	case LOGGER_GET_RING_STATE:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		get_log_state(log, &head, &w_off);
+		state.head = head;
+		state.w_off = w_off;
+		if (copy_to_user((void __user *) arg, &state, sizeof(state)))
+			ret = -EFAULT;
+		else
+			ret = 0;
+		break;
+	case LOGGER_GET_LOG_SIZES:
+		get_log_state(log, &head, &w_off);
+		tail = log_tail(log, head);
+		sizes.ring_size = log->size;
+		sizes.logical_len = w_off - tail;
+		spin_lock(&log->chunk_lock);
+		sizes.physical_len = w_off - head + log->chunk_bytes;
+		spin_unlock(&log->chunk_lock);
+		if (copy_to_user((void __user *) arg, &sizes, sizeof(sizes)))
+			ret = -EFAULT;
+		else
+			ret = 0;
+		break;
+	case LOGGER_SET_READ_OFFSET:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		/*
+		 * The caller consumed the entries up to arg through its
+		 * mapping. It can only move forward, and not past w_off.
+		 */
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+		w_off = reader_catch_up(reader);
+		if (logger_before(w_off, arg)) {
+			ret = -EINVAL;
+		} else {
+			if (logger_before(reader->r_off, arg))
+				reader->r_off = arg;
+			ret = 0;
+		}
+		mutex_unlock(&reader->mutex);
+		break;
 	}
 
-	mutex_unlock(&log->mutex);
-
 	return ret;
 }
 
@@ -526,6 +1137,7 @@ static const struct file_operations logger_fops = {
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -538,7 +1150,7 @@ static const struct file_operations logger_fops = {
  * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __aligned(SHMLBA); \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -548,11 +1160,15 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
 	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SEQLOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
+	.chunk_lock = __SPIN_LOCK_UNLOCKED(VAR .chunk_lock), \
+	.chunks = LIST_HEAD_INIT(VAR .chunks), \
+	.compress_work = __WORK_INITIALIZER(VAR .compress_work, \
+					    logger_compress_work), \
 };
 
 DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 256*1024)
@@ -573,6 +1189,97 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+static struct logger_log *logger_logs[] = {
+	&log_main, &log_events, &log_radio, &log_system,
+};
+
+/* serializes set_compress(), and tells it whether the logs are up yet */
+static DEFINE_MUTEX(compress_mutex);
+static int compress_ready;
+
+/*
+ * logger_alloc_compress - allocate the staging chunks and the compressor
+ * buffers of 'log', the first time compression is enabled
+ */
+static int logger_alloc_compress(struct logger_log *log)
+{
+	struct logger_chunk *stage[2];
+	unsigned char *dst;
+	void *wrkmem;
+	int i;
+
+	if (log->stage[0])
+		return 0;
+
+	wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	dst = vmalloc(lzo1x_worst_compress(LOGGER_CHUNK_SIZE));
+	for (i = 0; i < ARRAY_SIZE(stage); i++)
+		stage[i] = kmalloc(LOGGER_CHUNK_ALLOC, GFP_KERNEL);
+	if (!wrkmem || !dst || !stage[0] || !stage[1]) {
+		kfree(stage[1]);
+		kfree(stage[0]);
+		vfree(dst);
+		vfree(wrkmem);
+		return -ENOMEM;
+	}
+
+	mutex_lock(&log->mutex);
+	log->lzo_wrkmem = wrkmem;
+	log->lzo_dst = dst;
+	for (i = 0; i < ARRAY_SIZE(stage); i++) {
+		INIT_LIST_HEAD(&stage[i]->list);
+		kref_init(&stage[i]->ref);
+		log->stage[i] = stage[i];
+	}
+	mutex_unlock(&log->mutex);
+
+	return 0;
+}
+
+/*
+ * set_compress - turn the compressed history on or off
+ *
+ * Turning it on allocates what each log needs, once, so the writer never
+ * allocates; turning it off frees the history. When set on the command
+ * line, the logs allocate at init.
+ */
+static int set_compress(const char *val, const struct kernel_param *kp)
+{
+	struct logger_log *log;
+	bool enable;
+	int i, ret = 0;
+
+	if (strtobool(val ? val : "1", &enable))
+		return -EINVAL;
+
+	mutex_lock(&compress_mutex);
+	for (i = 0; enable && compress_ready && i < ARRAY_SIZE(logger_logs);
+	     i++) {
+		ret = logger_alloc_compress(logger_logs[i]);
+		if (ret)
+			break;
+	}
+	if (!ret)
+		compress = enable;
+	for (i = 0; !enable && compress_ready && i < ARRAY_SIZE(logger_logs);
+	     i++) {
+		log = logger_logs[i];
+		mutex_lock(&log->mutex);
+		logger_drop_history(log);
+		mutex_unlock(&log->mutex);
+	}
+	mutex_unlock(&compress_mutex);
+
+	return ret;
+}
+
+static struct kernel_param_ops compress_ops = {
+	.set = set_compress,
+	.get = param_get_bool,
+};
+module_param_cb(compress, &compress_ops, &compress, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(compress, "Keep LZO-compressed history behind each log");
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
@@ -592,7 +1299,7 @@ static int __init init_log(struct logger_log *log)
 
 static int __init logger_init(void)
 {
-	int ret;
+	int i, ret;
 
 	ret = init_log(&log_main);
 	if (unlikely(ret))
@@ -610,6 +1317,17 @@ static int __init logger_init(void)
 	if (unlikely(ret))
 		goto out;
 
+	mutex_lock(&compress_mutex);
+	compress_ready = 1;
+	for (i = 0; compress && i < ARRAY_SIZE(logger_logs); i++) {
+		if (logger_alloc_compress(logger_logs[i])) {
+			printk(KERN_ERR "logger: no memory for compressed "
+			       "history\n");
+			compress = 0;
+		}
+	}
+	mutex_unlock(&compress_mutex);
+
 out:
 	return ret;
 }
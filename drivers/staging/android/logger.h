@@ -45,5 +45,32 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_READ_MODE		_IO(__LOGGERIO, 5) /* entry or batch */
+#define LOGGER_GET_RING_STATE		_IOR(__LOGGERIO, 6, struct logger_ring_state)
+#define LOGGER_GET_LOG_SIZES		_IOR(__LOGGERIO, 7, struct logger_log_sizes)
+#define LOGGER_SET_READ_OFFSET		_IO(__LOGGERIO, 8) /* mmap reads done */
+
+/* read modes for LOGGER_SET_READ_MODE */
+#define LOGGER_READ_ENTRY	0	/* one entry per read() */
+#define LOGGER_READ_BATCH	1	/* as many whole entries as fit */
+
+/*
+ * Offsets into a log mapped with mmap(). Both grow without bound and index
+ * the mapping modulo the log size; entries live in [head, w_off).
+ */
+struct logger_ring_state {
+	__u32		head;	/* oldest entry still in the log */
+	__u32		w_off;	/* end of the newest entry */
+};
+
+/*
+ * How much history a log holds, and how much memory it takes. The two
+ * lengths differ when older entries are kept compressed.
+ */
+struct logger_log_sizes {
+	__u32		ring_size;	/* size of the ring buffer */
+	__u32		logical_len;	/* bytes of entries readable */
+	__u32		physical_len;	/* bytes of memory they use */
+};
 
 #endif /* _LINUX_LOGGER_H */
@@ -16,6 +16,23 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Processes are kept in buckets by oom_adj, which are updated on fork, exit,
+ * exec and when oom_adj is written, so finding a victim only looks at the
+ * processes in the highest non-empty buckets rather than at every process.
+ *
+ * With /sys/module/lowmemorykiller/parameters/predict set, the driver also
+ * watches how well reclaim is doing. When most of the pages vmscan looks at
+ * cannot be reclaimed and tasks keep faulting pages back in, it kills one
+ * level earlier than the thresholds above say, before the page cache is
+ * thrashed. /sys/module/lowmemorykiller/parameters/kills lists the recent
+ * kills with the reason, the pages reaped and freed and how long the victim
+ * took to release its memory.
+ *
+ * A victim can take a while to exit, e.g. when it is blocked in the kernel,
+ * so its private memory is not left to exit_mmap(): a worker unmaps it right
+ * after the kill, as MADV_DONTNEED would, while the victim is on its way
+ * out.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -34,7 +51,16 @@
 #include <linux/mm.h>
 #include <linux/oom.h>
 #include <linux/sched.h>
-#include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/vmstat.h>
+#include <linux/swap.h>
+#include <linux/ktime.h>
+#include <linux/kthread.h>
+#include <linux/slab.h>
+
+#define CREATE_TRACE_POINTS
+#include "lowmemorykiller_trace.h"
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -52,8 +78,71 @@ static size_t lowmem_minfree[6] = {
 };
 static int lowmem_minfree_size = 4;
 
+static uint32_t lowmem_predict;
+static uint32_t lowmem_pressure_level = 90;
+static uint32_t lowmem_refault_rate = 100;
+
+/*
+ * The victim of the last kill, pinned until it released its memory or the
+ * timeout expired. Protected by lowmem_lock, as is lowmem_kills.
+ */
+static DEFINE_SPINLOCK(lowmem_lock);
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
+static bool lowmem_deathpending_reaped;
+
+static void lowmem_reap(struct work_struct *work);
+static DECLARE_DELAYED_WORK(lowmem_reap_work, lowmem_reap);
+
+enum lowmem_kill_reason {
+	LOWMEM_KILL_MINFREE,	/* free memory below lowmem_minfree[] */
+	LOWMEM_KILL_PRESSURE,	/* predicted from reclaim pressure */
+};
+
+static const char * const lowmem_kill_reasons[] = {
+	[LOWMEM_KILL_MINFREE]	= "minfree",
+	[LOWMEM_KILL_PRESSURE]	= "pressure",
+};
+
+#define LOWMEM_KILL_HISTORY	8
+
+struct lowmem_kill {
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	int oom_adj;
+	int reason;
+	int tasksize;		/* rss when selected */
+	int reaped;		/* pages unmapped by lowmem_reap_mm() */
+	int free_start;		/* free pages at the kill */
+	int freed;		/* rise in free pages until done, all causes */
+	ktime_t start;
+	s64 latency_us;		/* -1 while still pending */
+};
+
+static struct lowmem_kill lowmem_kills[LOWMEM_KILL_HISTORY];
+static unsigned int lowmem_kill_count;
+
+/*
+ * Reclaim efficiency over the last sampling window. Major faults stand in
+ * for refaults of recently reclaimed pages, which this kernel does not
+ * count.
+ */
+static struct {
+	unsigned long stamp;
+	unsigned long scanned;
+	unsigned long stolen;
+	unsigned long majflt;
+	unsigned int pressure;		/* % of scanned pages not reclaimed */
+	unsigned int refault_rate;	/* major faults per second */
+} lowmem_vmpressure;
+
+/*
+ * Thread group leaders by oom_adj, OOM_DISABLE first. These are hlists so
+ * that the index is usable as soon as the first process is forked, before
+ * our initcall runs. Protected by tasklist_lock.
+ */
+#define LOWMEM_ADJ_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+static struct hlist_head lowmem_adj_index[LOWMEM_ADJ_BUCKETS];
 
 #define lowmem_print(level, x...)			\
 	do {						\
@@ -61,34 +150,344 @@ static unsigned long lowmem_deathpending_timeout;
 			printk(x);			\
 	} while (0)
 
-static int
-task_notify_func(struct notifier_block *self, unsigned long val, void *data);
+static struct hlist_head *lowmem_adj_bucket(int oom_adj)
+{
+	if (oom_adj < OOM_DISABLE)
+		oom_adj = OOM_DISABLE;
+	if (oom_adj > OOM_ADJUST_MAX)
+		oom_adj = OOM_ADJUST_MAX;
+	return &lowmem_adj_index[oom_adj - OOM_DISABLE];
+}
+
+/* Called with tasklist_lock held for writing when 'p' becomes a leader */
+void lowmem_adj_add(struct task_struct *p)
+{
+	hlist_add_head(&p->lowmem_adj_node,
+		       lowmem_adj_bucket(p->signal->oom_adj));
+}
+
+/* Called with tasklist_lock held for writing when 'p' is unhashed */
+void lowmem_adj_del(struct task_struct *p)
+{
+	hlist_del_init(&p->lowmem_adj_node);
+}
+
+/* Called with tasklist_lock held for writing when 'new' takes over 'old' */
+void lowmem_adj_replace(struct task_struct *old, struct task_struct *new)
+{
+	if (hlist_unhashed(&old->lowmem_adj_node))
+		return;
+	hlist_del_init(&old->lowmem_adj_node);
+	lowmem_adj_add(new);
+}
+
+/* Called after p->signal->oom_adj was changed */
+void lowmem_adj_update(struct task_struct *p)
+{
+	struct task_struct *leader;
+
+	write_lock_irq(&tasklist_lock);
+	leader = p->group_leader;
+	if (!hlist_unhashed(&leader->lowmem_adj_node)) {
+		hlist_del(&leader->lowmem_adj_node);
+		lowmem_adj_add(leader);
+	}
+	write_unlock_irq(&tasklist_lock);
+}
+
+static unsigned long lowmem_sum_zone_events(unsigned long *events, int base)
+{
+	unsigned long sum = 0;
+	int i;
+
+	for (i = 0; i < MAX_NR_ZONES; i++)
+		sum += events[base + i];
+	return sum;
+}
+
+/*
+ * lowmem_update_vmpressure - sample the vmscan counters, at most every
+ * HZ / 10, and return true if reclaim is failing badly enough to kill early
+ */
+static bool lowmem_update_vmpressure(void)
+{
+	unsigned long events[NR_VM_EVENT_ITEMS];
+	unsigned long scanned, stolen, majflt, elapsed;
+
+	elapsed = jiffies - lowmem_vmpressure.stamp;
+	if (elapsed < HZ / 10)
+		goto out;
+
+	all_vm_events(events);
+	scanned = lowmem_sum_zone_events(events,
+				PGSCAN_KSWAPD_NORMAL - ZONE_NORMAL) +
+		  lowmem_sum_zone_events(events,
+				PGSCAN_DIRECT_NORMAL - ZONE_NORMAL);
+	stolen = lowmem_sum_zone_events(events, PGSTEAL_NORMAL - ZONE_NORMAL);
+	majflt = events[PGMAJFAULT];
+
+	if (lowmem_vmpressure.stamp) {
+		unsigned long dscan = scanned - lowmem_vmpressure.scanned;
+		unsigned long dsteal = stolen - lowmem_vmpressure.stolen;
+
+		/* too little scanning to tell anything */
+		if (dscan < SWAP_CLUSTER_MAX)
+			lowmem_vmpressure.pressure = 0;
+		else if (dsteal >= dscan)
+			lowmem_vmpressure.pressure = 0;
+		else
+			lowmem_vmpressure.pressure =
+				(dscan - dsteal) * 100 / dscan;
+		lowmem_vmpressure.refault_rate =
+			(majflt - lowmem_vmpressure.majflt) * HZ / elapsed;
+	}
+	lowmem_vmpressure.stamp = jiffies;
+	lowmem_vmpressure.scanned = scanned;
+	lowmem_vmpressure.stolen = stolen;
+	lowmem_vmpressure.majflt = majflt;
+out:
+	return lowmem_vmpressure.pressure >= lowmem_pressure_level &&
+	       lowmem_vmpressure.refault_rate >= lowmem_refault_rate;
+}
+
+/*
+ * lowmem_kill_done - the pending victim released its memory, or we gave up
+ * waiting. Called with lowmem_lock held.
+ */
+static void lowmem_kill_done(bool exited)
+{
+	struct lowmem_kill *kill;
+	int free = global_page_state(NR_FREE_PAGES);
 
-static struct notifier_block task_nb = {
-	.notifier_call	= task_notify_func,
+	kill = &lowmem_kills[(lowmem_kill_count - 1) % LOWMEM_KILL_HISTORY];
+	kill->latency_us = ktime_us_delta(ktime_get(), kill->start);
+	kill->freed = max(free - kill->free_start, 0);
+	trace_lowmem_kill(kill->pid, kill->comm, kill->oom_adj,
+			  lowmem_kill_reasons[kill->reason], kill->tasksize,
+			  kill->reaped, kill->freed, kill->latency_us);
+	lowmem_print(2, "%d (%s) %s after %lld us\n", kill->pid, kill->comm,
+		     exited ? "released its memory" : "still alive",
+		     kill->latency_us);
+}
+
+/*
+ * lowmem_mm_reapable - may the victim's mm be unmapped under it? Not while
+ * a core dump is being written from it, nor if a task outside the victim's
+ * thread group uses it, through CLONE_VM or use_mm(), and is not dying
+ * too: that task would lose its memory while still running.
+ *
+ * Caller must hold mm->mmap_sem, which keeps a core dump from starting.
+ */
+static bool lowmem_mm_reapable(struct task_struct *p, struct mm_struct *mm)
+{
+	struct task_struct *g, *t;
+	bool ret = true;
+
+	if (mm->core_state)
+		return false;
+
+	/* only the victim's threads and our own reference */
+	if (atomic_read(&mm->mm_users) <= get_nr_threads(p) + 1)
+		return true;
+
+	rcu_read_lock();
+	for_each_process(g) {
+		if (same_thread_group(g, p))
+			continue;
+		t = g;
+		do {
+			if (t->mm != mm)
+				continue;
+			if (!fatal_signal_pending(t) &&
+			    !(t->flags & PF_EXITING))
+				ret = false;
+			break;
+		} while_each_thread(g, t);
+		if (!ret)
+			break;
+	}
+	rcu_read_unlock();
+
+	return ret;
+}
+
+/*
+ * lowmem_reap_mm - unmap the private memory of a victim which still has its
+ * mm. Locked, shared and special mappings are left alone, like
+ * MADV_DONTNEED does, and so is an mm whose mmap_sem is held for writing
+ * or which lowmem_mm_reapable() refuses. Returns the number of pages
+ * unmapped, or -EAGAIN to try again later.
+ */
+static int lowmem_reap_mm(struct task_struct *p)
+{
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	int rss;
+
+	mm = get_task_mm(p);
+	if (!mm)
+		return 0;
+
+	if (!down_read_trylock(&mm->mmap_sem)) {
+		mmput(mm);
+		return -EAGAIN;
+	}
+
+	if (!lowmem_mm_reapable(p, mm)) {
+		lowmem_print(2, "not reaping %d (%s), its mm is in use\n",
+			     p->pid, p->comm);
+		rss = 0;
+		goto out;
+	}
+
+	rss = get_mm_rss(mm);
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (vma->vm_flags &
+		    (VM_LOCKED | VM_HUGETLB | VM_PFNMAP | VM_SHARED))
+			continue;
+		zap_page_range(vma, vma->vm_start,
+			       vma->vm_end - vma->vm_start, NULL);
+	}
+	rss -= get_mm_rss(mm);
+
+out:
+	up_read(&mm->mmap_sem);
+	mmput(mm);
+
+	return max(rss, 0);
+}
+
+/*
+ * lowmem_reap - free the private memory of the victim of the last kill,
+ * then watch it until its mm is gone, which is when its memory is back,
+ * rather than until its parent reaps it, so that the next kill can follow
+ * as soon as it is needed.
+ */
+static void lowmem_reap(struct work_struct *work)
+{
+	struct task_struct *p;
+	bool exited, expired;
+	int reaped;
+
+	spin_lock(&lowmem_lock);
+	p = lowmem_deathpending;
+	if (!p) {
+		spin_unlock(&lowmem_lock);
+		return;
+	}
+
+	/*
+	 * Only this work drops lowmem_deathpending, so p stays pinned while
+	 * the lock is dropped for the unmapping, which sleeps.
+	 */
+	if (!lowmem_deathpending_reaped) {
+		spin_unlock(&lowmem_lock);
+		reaped = lowmem_reap_mm(p);
+		spin_lock(&lowmem_lock);
+		if (reaped >= 0) {
+			lowmem_deathpending_reaped = true;
+			lowmem_kills[(lowmem_kill_count - 1) %
+				     LOWMEM_KILL_HISTORY].reaped = reaped;
+			lowmem_print(2, "reaped %d pages of %d (%s)\n", reaped,
+				     p->pid, p->comm);
+		}
+	}
+
+	task_lock(p);
+	exited = !p->mm;
+	task_unlock(p);
+	expired = time_after(jiffies, lowmem_deathpending_timeout);
+	if (!exited && !expired) {
+		spin_unlock(&lowmem_lock);
+		schedule_delayed_work(&lowmem_reap_work,
+				      msecs_to_jiffies(10) ?: 1);
+		return;
+	}
+
+	lowmem_kill_done(exited);
+	lowmem_deathpending = NULL;
+	spin_unlock(&lowmem_lock);
+
+	put_task_struct(p);
+}
+
+/* The best victim found so far, and how many tasks were looked at */
+struct lowmem_victim {
+	struct task_struct *p;
+	int tasksize;
+	int oom_adj;
+	int scanned;
 };
 
-static int
-task_notify_func(struct notifier_block *self, unsigned long val, void *data)
+/*
+ * Consider 'p' as a victim at 'min_adj': it has to have an mm and pages,
+ * and it beats the victim so far with a higher oom_adj, or the same one
+ * and more pages. Called with tasklist_lock held.
+ */
+static void lowmem_consider(struct lowmem_victim *v, struct task_struct *p,
+			    int min_adj)
 {
-	struct task_struct *task = data;
+	struct mm_struct *mm;
+	struct signal_struct *sig;
+	int oom_adj;
+	int tasksize;
 
-	if (task == lowmem_deathpending)
-		lowmem_deathpending = NULL;
+	v->scanned++;
+	task_lock(p);
+	mm = p->mm;
+	sig = p->signal;
+	if (!mm || !sig) {
+		task_unlock(p);
+		return;
+	}
+	oom_adj = sig->oom_adj;
+	if (oom_adj < min_adj) {
+		task_unlock(p);
+		return;
+	}
+	tasksize = get_mm_rss(mm);
+	task_unlock(p);
+	if (tasksize <= 0)
+		return;
+	if (v->p) {
+		if (oom_adj < v->oom_adj)
+			return;
+		if (oom_adj == v->oom_adj && tasksize <= v->tasksize)
+			return;
+	}
+	v->p = p;
+	v->tasksize = tasksize;
+	v->oom_adj = oom_adj;
+}
 
-	return NOTIFY_OK;
+/*
+ * Walk the buckets from the highest oom_adj down, stopping at the first one
+ * that yields a victim. oom_adj is rechecked because it may have changed
+ * since the task was filed. Called with tasklist_lock held.
+ */
+static void lowmem_select(struct lowmem_victim *v, int min_adj)
+{
+	struct task_struct *p;
+	struct hlist_node *node;
+	int i;
+
+	for (i = OOM_ADJUST_MAX; i >= max(min_adj, OOM_DISABLE) && !v->p; i--)
+		hlist_for_each_entry(p, node, lowmem_adj_bucket(i),
+				     lowmem_adj_node)
+			lowmem_consider(v, p, min_adj);
 }
 
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct task_struct *p;
-	struct task_struct *selected = NULL;
+	struct lowmem_victim victim = { .p = NULL };
+	struct task_struct *selected;
 	int rem = 0;
-	int tasksize;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
+	int reason = LOWMEM_KILL_MINFREE;
+	struct lowmem_kill *kill;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
@@ -101,8 +500,7 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	 * this pass.
 	 *
 	 */
-	if (lowmem_deathpending &&
-	    time_before_eq(jiffies, lowmem_deathpending_timeout))
+	if (lowmem_deathpending)
 		return 0;
 
 	if (lowmem_adj_size < array_size)
@@ -116,10 +514,26 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			break;
 		}
 	}
+	/*
+	 * If reclaim is mostly failing and tasks are faulting their pages
+	 * back in, act as if free memory had already dropped one more level.
+	 */
+	if (lowmem_predict && array_size && lowmem_update_vmpressure()) {
+		if (i == array_size)
+			i = array_size - 1;
+		else if (i > 0)
+			i--;
+		if (lowmem_adj[i] < min_adj) {
+			min_adj = lowmem_adj[i];
+			reason = LOWMEM_KILL_PRESSURE;
+		}
+	}
 	if (sc->nr_to_scan > 0)
-		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
+		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d, "
+			     "pressure %u%% %u/s\n",
 			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
-			     min_adj);
+			     min_adj, lowmem_vmpressure.pressure,
+			     lowmem_vmpressure.refault_rate);
 	rem = global_page_state(NR_ACTIVE_ANON) +
 		global_page_state(NR_ACTIVE_FILE) +
 		global_page_state(NR_INACTIVE_ANON) +
@@ -129,50 +543,49 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     sc->nr_to_scan, sc->gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
 
 	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
-	}
+	lowmem_select(&victim, min_adj);
+	lowmem_print(3, "lowmem_shrink scanned %d tasks\n", victim.scanned);
+	selected = victim.p;
 	if (selected) {
-		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
-			     selected->pid, selected->comm,
-			     selected_oom_adj, selected_tasksize);
+		selected_tasksize = victim.tasksize;
+		selected_oom_adj = victim.oom_adj;
+		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+			     selected->pid, selected->comm, selected_oom_adj,
+			     selected_tasksize);
+		spin_lock(&lowmem_lock);
+		if (lowmem_deathpending) {
+			/* lost the race with a concurrent shrinker call */
+			spin_unlock(&lowmem_lock);
+			read_unlock(&tasklist_lock);
+			return 0;
+		}
+		get_task_struct(selected);
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
+		lowmem_deathpending_reaped = false;
+		kill = &lowmem_kills[lowmem_kill_count++ % LOWMEM_KILL_HISTORY];
+		kill->pid = selected->pid;
+		get_task_comm(kill->comm, selected);
+		kill->oom_adj = selected_oom_adj;
+		kill->reason = reason;
+		kill->tasksize = selected_tasksize;
+		kill->reaped = 0;
+		kill->free_start = global_page_state(NR_FREE_PAGES);
+		kill->freed = 0;
+		kill->start = ktime_get();
+		kill->latency_us = -1;
+		spin_unlock(&lowmem_lock);
+
+		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d, "
+			     "%s\n", selected->pid, selected->comm,
+			     selected_oom_adj, selected_tasksize,
+			     lowmem_kill_reasons[reason]);
+		/* let it dip into the reserves to exit quickly */
+		set_tsk_thread_flag(selected, TIF_MEMDIE);
 		force_sig(SIGKILL, selected);
+		schedule_delayed_work(&lowmem_reap_work, 1);
 		rem -= selected_tasksize;
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
@@ -188,7 +601,6 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
-	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
@@ -196,15 +608,230 @@ static int __init lowmem_init(void)
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
-	task_free_unregister(&task_nb);
+	cancel_delayed_work_sync(&lowmem_reap_work);
+	if (lowmem_deathpending)
+		put_task_struct(lowmem_deathpending);
 }
 
+static int lowmem_kills_get(char *buffer, const struct kernel_param *kp)
+{
+	struct lowmem_kill *kill;
+	unsigned int i, n;
+	int len;
+
+	len = scnprintf(buffer, PAGE_SIZE,
+			"%-6s %-16s %4s %-8s %8s %8s %8s %10s\n", "pid",
+			"comm", "adj", "reason", "size", "reaped", "freed",
+			"latency_us");
+
+	spin_lock(&lowmem_lock);
+	n = min_t(unsigned int, lowmem_kill_count, LOWMEM_KILL_HISTORY);
+	for (i = lowmem_kill_count - n; i != lowmem_kill_count; i++) {
+		kill = &lowmem_kills[i % LOWMEM_KILL_HISTORY];
+		len += scnprintf(buffer + len, PAGE_SIZE - len,
+				 "%-6d %-16s %4d %-8s %8d %8d %8d %10lld\n",
+				 kill->pid, kill->comm, kill->oom_adj,
+				 lowmem_kill_reasons[kill->reason],
+				 kill->tasksize, kill->reaped, kill->freed,
+				 kill->latency_us);
+	}
+	spin_unlock(&lowmem_lock);
+
+	return len;
+}
+
+static int lowmem_kills_set(const char *val, const struct kernel_param *kp)
+{
+	return -EPERM;
+}
+
+static struct kernel_param_ops lowmem_kills_ops = {
+	.set = lowmem_kills_set,
+	.get = lowmem_kills_get,
+};
+
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER_BENCH
+/*
+ * Victim selection benchmark. Writing "<tasks> <loops>" to the bench
+ * parameter starts that many idle kernel threads, spread over all oom_adj
+ * values, and then times 'loops' calls each of: a shrinker query with
+ * nothing to scan, which is what most shrinker calls are; victim selection
+ * from the oom_adj index at the highest configured adj; and the same
+ * selection by walking every process, as it was done before the index.
+ * Nobody is killed. Reading gives the result of the last run, per call.
+ */
+#define LOWMEM_BENCH_TASKS	1024
+
+struct lowmem_bench_task {
+	struct task_struct *task;
+	int oom_adj;
+	struct completion ready;
+};
+
+static DEFINE_MUTEX(lowmem_bench_mutex);
+
+static struct lowmem_bench_result {
+	unsigned int tasks;
+	unsigned int loops;
+	int min_adj;
+	u64 query_ns;
+	u64 index_ns;
+	int index_scanned;
+	u64 scan_ns;
+	int scan_scanned;
+} lowmem_bench_result;
+
+static int lowmem_bench_fn(void *data)
+{
+	struct lowmem_bench_task *t = data;
+
+	current->signal->oom_adj = t->oom_adj;
+	lowmem_adj_update(current);
+	complete(&t->ready);
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+/* victim selection the way it was done before the oom_adj index */
+static void lowmem_bench_scan(struct lowmem_victim *v, int min_adj)
+{
+	struct task_struct *p;
+
+	for_each_process(p)
+		lowmem_consider(v, p, min_adj);
+}
+
+static u64 lowmem_bench_ns(ktime_t start, unsigned int loops)
+{
+	return div_u64(ktime_to_ns(ktime_sub(ktime_get(), start)), loops);
+}
+
+static int lowmem_bench_run(unsigned int tasks, unsigned int loops)
+{
+	struct lowmem_bench_task *t;
+	struct shrink_control sc = {
+		.gfp_mask = GFP_KERNEL,
+		.nr_to_scan = 0,
+	};
+	struct lowmem_bench_result res = {
+		.tasks = tasks,
+		.loops = loops,
+	};
+	struct lowmem_victim v;
+	ktime_t start;
+	unsigned int i, started = 0;
+	int n, ret = 0;
+
+	t = kcalloc(tasks, sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	for (i = 0; i < tasks; i++) {
+		t[i].oom_adj = i % (OOM_ADJUST_MAX + 1);
+		init_completion(&t[i].ready);
+		t[i].task = kthread_run(lowmem_bench_fn, &t[i],
+					"lmk_bench/%u", i);
+		if (IS_ERR(t[i].task)) {
+			ret = PTR_ERR(t[i].task);
+			break;
+		}
+		started++;
+	}
+	for (i = 0; i < started; i++)
+		wait_for_completion(&t[i].ready);
+	if (ret)
+		goto out;
+
+	n = min3(lowmem_adj_size, lowmem_minfree_size,
+		 (int)ARRAY_SIZE(lowmem_adj));
+	res.min_adj = n > 0 ? lowmem_adj[n - 1] : OOM_ADJUST_MAX;
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++)
+		lowmem_shrink(&lowmem_shrinker, &sc);
+	res.query_ns = lowmem_bench_ns(start, loops);
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++) {
+		memset(&v, 0, sizeof(v));
+		read_lock(&tasklist_lock);
+		lowmem_select(&v, res.min_adj);
+		read_unlock(&tasklist_lock);
+	}
+	res.index_ns = lowmem_bench_ns(start, loops);
+	res.index_scanned = v.scanned;
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++) {
+		memset(&v, 0, sizeof(v));
+		read_lock(&tasklist_lock);
+		lowmem_bench_scan(&v, res.min_adj);
+		read_unlock(&tasklist_lock);
+	}
+	res.scan_ns = lowmem_bench_ns(start, loops);
+	res.scan_scanned = v.scanned;
+
+	mutex_lock(&lowmem_bench_mutex);
+	lowmem_bench_result = res;
+	mutex_unlock(&lowmem_bench_mutex);
+out:
+	for (i = 0; i < started; i++)
+		kthread_stop(t[i].task);
+	kfree(t);
+	return ret;
+}
+
+static int lowmem_bench_set(const char *val, const struct kernel_param *kp)
+{
+	unsigned int tasks, loops;
+
+	if (sscanf(val, "%u %u", &tasks, &loops) != 2 || !tasks ||
+	    tasks > LOWMEM_BENCH_TASKS || !loops)
+		return -EINVAL;
+
+	return lowmem_bench_run(tasks, loops);
+}
+
+static int lowmem_bench_get(char *buffer, const struct kernel_param *kp)
+{
+	struct lowmem_bench_result res;
+
+	mutex_lock(&lowmem_bench_mutex);
+	res = lowmem_bench_result;
+	mutex_unlock(&lowmem_bench_mutex);
+
+	return sprintf(buffer, "tasks %u loops %u min_adj %d query_ns %llu "
+		       "index_ns %llu index_scanned %d scan_ns %llu "
+		       "scan_scanned %d\n", res.tasks, res.loops, res.min_adj,
+		       res.query_ns, res.index_ns, res.index_scanned,
+		       res.scan_ns, res.scan_scanned);
+}
+
+static struct kernel_param_ops lowmem_bench_ops = {
+	.set = lowmem_bench_set,
+	.get = lowmem_bench_get,
+};
+module_param_cb(bench, &lowmem_bench_ops, NULL, S_IRUGO | S_IWUSR);
+#endif /* CONFIG_ANDROID_LOW_MEMORY_KILLER_BENCH */
+
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
 module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 			 S_IRUGO | S_IWUSR);
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(predict, lowmem_predict, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_level, lowmem_pressure_level, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(refault_rate, lowmem_refault_rate, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_cb(kills, &lowmem_kills_ops, NULL, S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -0,0 +1,69 @@
+/* lowmemorykiller_trace.h
+ *
+ * Android low memory killer tracepoints
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#if !defined(_LOWMEMORYKILLER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LOWMEMORYKILLER_TRACE_H
+
+#include <linux/types.h>
+#include <linux/sched.h>
+#include <linux/tracepoint.h>
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+#define TRACE_INCLUDE_FILE lowmemorykiller_trace
+
+/*
+ * A victim released its memory, or the killer stopped waiting for it.
+ * latency_us is the time since the SIGKILL, reaped the pages unmapped from
+ * the victim before it exited, and freed the rise in free pages over that
+ * time, which other activity adds to or takes from.
+ */
+TRACE_EVENT(lowmem_kill,
+	TP_PROTO(pid_t pid, const char *comm, int oom_adj, const char *reason,
+		 int tasksize, int reaped, int freed, s64 latency_us),
+	TP_ARGS(pid, comm, oom_adj, reason, tasksize, reaped, freed,
+		latency_us),
+	TP_STRUCT__entry(
+		__field(pid_t, pid)
+		__array(char, comm, TASK_COMM_LEN)
+		__field(int, oom_adj)
+		__string(reason, reason)
+		__field(int, tasksize)
+		__field(int, reaped)
+		__field(int, freed)
+		__field(s64, latency_us)
+	),
+	TP_fast_assign(
+		__entry->pid = pid;
+		memcpy(__entry->comm, comm, TASK_COMM_LEN);
+		__entry->oom_adj = oom_adj;
+		__assign_str(reason, reason);
+		__entry->tasksize = tasksize;
+		__entry->reaped = reaped;
+		__entry->freed = freed;
+		__entry->latency_us = latency_us;
+	),
+	TP_printk("pid=%d comm=%s adj=%d reason=%s size=%d reaped=%d "
+		  "freed=%d latency_us=%lld",
+		  __entry->pid, __entry->comm, __entry->oom_adj,
+		  __get_str(reason), __entry->tasksize, __entry->reaped,
+		  __entry->freed, __entry->latency_us)
+);
+
+#endif /* _LOWMEMORYKILLER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#include <trace/define_trace.h>
@@ -6,7 +6,8 @@
  *
  * Zcache provides an in-kernel "host implementation" for transcendent memory
  * and, thus indirectly, for cleancache and frontswap.  Zcache includes two
- * page-accessible memory [1] interfaces, both utilizing lzo1x compression:
+ * page-accessible memory [1] interfaces, both utilizing the compressor
+ * selected at boot (lzo1x by default):
  * 1) "compression buddies" ("zbud") is used for ephemeral pages
  * 2) xvmalloc is used for persistent pages.
  * Xvmalloc (based on the TLSF allocator) has very low fragmentation
@@ -20,9 +21,9 @@
  */
 
 #include <linux/cpu.h>
+#include <linux/crypto.h>
 #include <linux/highmem.h>
 #include <linux/list.h>
-#include <linux/lzo.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
@@ -368,11 +369,14 @@ out:
 	return zh;
 }
 
+static int zcache_decompress(const void *src, unsigned int slen, void *dst,
+				unsigned int *dlen);
+
 static int zbud_decompress(struct page *page, struct zbud_hdr *zh)
 {
 	struct zbud_page *zbpg;
 	unsigned budnum = zbud_budnum(zh);
-	size_t out_len = PAGE_SIZE;
+	unsigned int out_len = PAGE_SIZE;
 	char *to_va, *from_va;
 	unsigned size;
 	int ret = 0;
@@ -389,8 +393,8 @@ static int zbud_decompress(struct page *page, struct zbud_hdr *zh)
 	to_va = kmap_atomic(page, KM_USER0);
 	size = zh->size;
 	from_va = zbud_data(zh, size);
-	ret = lzo1x_decompress_safe(from_va, size, to_va, &out_len);
-	BUG_ON(ret != LZO_E_OK);
+	ret = zcache_decompress(from_va, size, to_va, &out_len);
+	BUG_ON(ret);
 	BUG_ON(out_len != PAGE_SIZE);
 	kunmap_atomic(to_va, KM_USER0);
 out:
@@ -586,7 +590,7 @@ static int zbud_show_cumul_chunk_counts(char *buf)
 
 /**********
  * This "zv" PAM implementation combines the TLSF-based xvMalloc
- * with lzo1x compression to maximize the amount of data that can
+ * with compression to maximize the amount of data that can
  * be packed into a physical page.
  *
  * Zv represents a PAM page with the index and object (plus a "size" value
@@ -649,7 +653,7 @@ static void zv_free(struct xv_pool *xvpool, struct zv_hdr *zv)
 
 static void zv_decompress(struct page *page, struct zv_hdr *zv)
 {
-	size_t clen = PAGE_SIZE;
+	unsigned int clen = PAGE_SIZE;
 	char *to_va;
 	unsigned size;
 	int ret;
@@ -658,10 +662,10 @@ static void zv_decompress(struct page *page, struct zv_hdr *zv)
 	size = xv_get_object_size(zv) - sizeof(*zv);
 	BUG_ON(size == 0 || size > zv_max_page_size);
 	to_va = kmap_atomic(page, KM_USER0);
-	ret = lzo1x_decompress_safe((char *)zv + sizeof(*zv),
+	ret = zcache_decompress((char *)zv + sizeof(*zv),
 					size, to_va, &clen);
 	kunmap_atomic(to_va, KM_USER0);
-	BUG_ON(ret != LZO_E_OK);
+	BUG_ON(ret);
 	BUG_ON(clen != PAGE_SIZE);
 }
 
@@ -997,32 +1001,47 @@ static struct tmem_pamops zcache_pamops = {
  * zcache compression/decompression and related per-cpu stuff
  */
 
-#define LZO_WORKMEM_BYTES LZO1X_1_MEM_COMPRESS
-#define LZO_DSTMEM_PAGE_ORDER 1
-static DEFINE_PER_CPU(unsigned char *, zcache_workmem);
+#define ZCACHE_DSTMEM_PAGE_ORDER 1
+static DEFINE_PER_CPU(struct crypto_comp *, zcache_comp_tfm);
 static DEFINE_PER_CPU(unsigned char *, zcache_dstmem);
 
+/* Set with "zcache=<compressor>" on the command line */
+static char zcache_comp_name[CRYPTO_MAX_ALG_NAME] = "lzo";
+
 static int zcache_compress(struct page *from, void **out_va, size_t *out_len)
 {
 	int ret = 0;
 	unsigned char *dmem = __get_cpu_var(zcache_dstmem);
-	unsigned char *wmem = __get_cpu_var(zcache_workmem);
-	char *from_va;
+	struct crypto_comp *tfm = __get_cpu_var(zcache_comp_tfm);
+	unsigned int dlen = PAGE_SIZE << ZCACHE_DSTMEM_PAGE_ORDER;
+	u8 *from_va;
 
 	BUG_ON(!irqs_disabled());
-	if (unlikely(dmem == NULL || wmem == NULL))
+	if (unlikely(dmem == NULL || tfm == NULL))
 		goto out;  /* no buffer, so can't compress */
 	from_va = kmap_atomic(from, KM_USER0);
 	mb();
-	ret = lzo1x_1_compress(from_va, PAGE_SIZE, dmem, out_len, wmem);
-	BUG_ON(ret != LZO_E_OK);
+	ret = crypto_comp_compress(tfm, from_va, PAGE_SIZE, dmem, &dlen);
+	BUG_ON(ret);
 	*out_va = dmem;
+	*out_len = dlen;
 	kunmap_atomic(from_va, KM_USER0);
 	ret = 1;
 out:
 	return ret;
 }
 
+static int zcache_decompress(const void *src, unsigned int slen, void *dst,
+				unsigned int *dlen)
+{
+	int ret;
+
+	ret = crypto_comp_decompress(get_cpu_var(zcache_comp_tfm),
+					src, slen, dst, dlen);
+	put_cpu_var(zcache_comp_tfm);
+	return ret;
+}
+
 
 static int zcache_cpu_notifier(struct notifier_block *nb,
 				unsigned long action, void *pcpu)
@@ -1034,18 +1053,20 @@ static int zcache_cpu_notifier(struct notifier_block *nb,
 	case CPU_UP_PREPARE:
 		per_cpu(zcache_dstmem, cpu) = (void *)__get_free_pages(
 			GFP_KERNEL | __GFP_REPEAT,
-			LZO_DSTMEM_PAGE_ORDER),
-		per_cpu(zcache_workmem, cpu) =
-			kzalloc(LZO1X_MEM_COMPRESS,
-				GFP_KERNEL | __GFP_REPEAT);
+			ZCACHE_DSTMEM_PAGE_ORDER),
+		per_cpu(zcache_comp_tfm, cpu) =
+			crypto_alloc_comp(zcache_comp_name, 0, 0);
+		if (IS_ERR(per_cpu(zcache_comp_tfm, cpu)))
+			per_cpu(zcache_comp_tfm, cpu) = NULL;
 		break;
 	case CPU_DEAD:
 	case CPU_UP_CANCELED:
 		free_pages((unsigned long)per_cpu(zcache_dstmem, cpu),
-				LZO_DSTMEM_PAGE_ORDER);
+				ZCACHE_DSTMEM_PAGE_ORDER);
 		per_cpu(zcache_dstmem, cpu) = NULL;
-		kfree(per_cpu(zcache_workmem, cpu));
-		per_cpu(zcache_workmem, cpu) = NULL;
+		if (per_cpu(zcache_comp_tfm, cpu))
+			crypto_free_comp(per_cpu(zcache_comp_tfm, cpu));
+		per_cpu(zcache_comp_tfm, cpu) = NULL;
 		kp = &per_cpu(zcache_preloads, cpu);
 		while (kp->nr) {
 			kmem_cache_free(zcache_objnode_cache,
@@ -1131,6 +1152,12 @@ ZCACHE_SYSFS_RO_CUSTOM(zbud_unbuddied_list_counts,
 ZCACHE_SYSFS_RO_CUSTOM(zbud_cumul_chunk_counts,
 			zbud_show_cumul_chunk_counts);
 
+static int zcache_show_compressor(char *buf)
+{
+	return sprintf(buf, "%s\n", zcache_comp_name);
+}
+ZCACHE_SYSFS_RO_CUSTOM(compressor, zcache_show_compressor);
+
 static struct attribute *zcache_attrs[] = {
 	&zcache_curr_obj_count_attr.attr,
 	&zcache_curr_obj_count_max_attr.attr,
@@ -1160,6 +1187,7 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_aborted_shrink_attr.attr,
 	&zcache_zbud_unbuddied_list_counts_attr.attr,
 	&zcache_zbud_cumul_chunk_counts_attr.attr,
+	&zcache_compressor_attr.attr,
 	NULL,
 };
 
@@ -1566,6 +1594,8 @@ static int zcache_enabled;
 static int __init enable_zcache(char *s)
 {
 	zcache_enabled = 1;
+	if (*s == '=')
+		strlcpy(zcache_comp_name, s + 1, sizeof(zcache_comp_name));
 	return 1;
 }
 __setup("zcache", enable_zcache);
@@ -1607,6 +1637,13 @@ static int __init zcache_init(void)
 	if (zcache_enabled) {
 		unsigned int cpu;
 
+		if (!crypto_has_comp(zcache_comp_name, 0, 0)) {
+			pr_warning("zcache: %s compressor not available, "
+				"using lzo\n", zcache_comp_name);
+			strcpy(zcache_comp_name, "lzo");
+		}
+		pr_info("zcache: using %s compressor\n", zcache_comp_name);
+
 		tmem_register_hostops(&zcache_hostops);
 		tmem_register_pamops(&zcache_pamops);
 		ret = register_cpu_notifier(&zcache_cpu_notifier_block);
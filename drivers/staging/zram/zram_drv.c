@@ -23,14 +23,20 @@
 #include <linux/kernel.h>
 #include <linux/bio.h>
 #include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
+#include <linux/crypto.h>
 #include <linux/device.h>
+#include <linux/file.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/kthread.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
+#include <linux/ktime.h>
 #include <linux/vmalloc.h>
 
 #include "zram_drv.h"
@@ -38,18 +44,22 @@
 /* Globals */
 static int zram_major;
 struct zram *devices;
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* Waits for reads from the backing devices */
+static struct workqueue_struct *zram_bd_wq;
+#endif
 
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
+static void zram_stat_inc(atomic_t *v)
 {
-	*v = *v + 1;
+	atomic_inc(v);
 }
 
-static void zram_stat_dec(u32 *v)
+static void zram_stat_dec(atomic_t *v)
 {
-	*v = *v - 1;
+	atomic_dec(v);
 }
 
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
@@ -89,18 +99,275 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+/*
+ * Table entries are only ever held for short, non-sleeping sections:
+ * looking up or installing an object, and decompressing it on read.
+ */
+static void zram_slot_lock(struct zram *zram, u32 index)
+{
+	bit_spin_lock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+static void zram_slot_unlock(struct zram *zram, u32 index)
+{
+	bit_spin_unlock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* Reads and writes reset the idle clock of a slot */
+static void zram_accessed(struct zram *zram, u32 index)
+{
+	zram_slot_lock(zram, index);
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram->table[index].ac_time = jiffies;
+	zram_slot_unlock(zram, index);
+}
+
+/* Block 0 is never handed out, so that it can mean "none" */
+static unsigned long zram_alloc_block(struct zram *zram)
+{
+	unsigned long blk;
+
+	spin_lock(&zram->bitmap_lock);
+	blk = find_next_zero_bit(zram->bitmap, zram->nr_blocks, 1);
+	if (blk < zram->nr_blocks)
+		__set_bit(blk, zram->bitmap);
+	else
+		blk = 0;
+	spin_unlock(&zram->bitmap_lock);
+
+	if (blk)
+		zram_stat_inc(&zram->stats.bd_count);
+	return blk;
+}
+
+static void zram_free_block(struct zram *zram, unsigned long blk)
+{
+	spin_lock(&zram->bitmap_lock);
+	__clear_bit(blk, zram->bitmap);
+	spin_unlock(&zram->bitmap_lock);
+
+	zram_stat_dec(&zram->stats.bd_count);
+}
+
+/*
+ * Incompressible pages are moved out as soon as there is a place for them.
+ * The slot is queued in wb_huge, so the worker does not scan the table.
+ */
+static void zram_wb_kick(struct zram *zram, u32 index)
+{
+	if (zram->bdev) {
+		set_bit(index, zram->wb_huge);
+		schedule_work(&zram->wb_work);
+	}
+}
+
+/* Completion of a set of bios to the backing device */
+struct zram_bd_io {
+	atomic_t pending;
+	struct completion done;
+};
+
+static void zram_bd_io_init(struct zram_bd_io *io)
+{
+	/* The submitter holds one count until every bio is out */
+	atomic_set(&io->pending, 1);
+	init_completion(&io->done);
+}
+
+static void zram_bd_io_wait(struct zram_bd_io *io)
+{
+	if (!atomic_dec_and_test(&io->pending))
+		wait_for_completion(&io->done);
+}
+
+static void zram_bd_end_io(struct bio *bio, int err)
+{
+	struct zram_bd_io *io = bio->bi_private;
+
+	if (atomic_dec_and_test(&io->pending))
+		complete(&io->done);
+}
+
+static struct bio *zram_bd_bio(struct zram *zram, struct page *page,
+			unsigned long blk, struct zram_bd_io *io)
+{
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return NULL;
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = blk << SECTORS_PER_PAGE_SHIFT;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return NULL;
+	}
+	bio->bi_end_io = zram_bd_end_io;
+	bio->bi_private = io;
+	atomic_inc(&io->pending);
+
+	return bio;
+}
+
+struct zram_bd_read {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk;
+	int ret;
+};
+
+static void zram_bd_read_work(struct work_struct *work)
+{
+	struct zram_bd_read *rd = container_of(work, struct zram_bd_read, work);
+	struct zram_bd_io io;
+	struct bio *bio;
+
+	zram_bd_io_init(&io);
+	bio = zram_bd_bio(rd->zram, rd->page, rd->blk, &io);
+	if (!bio) {
+		rd->ret = -ENOMEM;
+		return;
+	}
+
+	submit_bio(READ_SYNC, bio);
+	zram_bd_io_wait(&io);
+
+	rd->ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+}
+
+/*
+ * Read a page back from the backing device. We are usually called from
+ * zram_make_request(), where a bio we submit is only issued after we
+ * return, so the I/O is waited for from a worker instead. Swap-in depends
+ * on it, so the workqueue has a rescuer for when no worker can be created.
+ */
+static int zram_bd_read(struct zram *zram, struct page *page,
+			unsigned long blk)
+{
+	struct zram_bd_read rd = {
+		.zram = zram,
+		.page = page,
+		.blk = blk,
+	};
+
+	INIT_WORK_ONSTACK(&rd.work, zram_bd_read_work);
+	queue_work(zram_bd_wq, &rd.work);
+	flush_work(&rd.work);
+	destroy_work_on_stack(&rd.work);
+
+	if (!rd.ret)
+		zram_stat64_inc(zram, &zram->stats.bd_reads);
+	return rd.ret;
+}
+#else
+static inline void zram_accessed(struct zram *zram, u32 index)
+{
+}
+
+static inline void zram_free_block(struct zram *zram, unsigned long blk)
+{
+}
+
+static inline void zram_wb_kick(struct zram *zram, u32 index)
+{
+}
+
+static inline int zram_bd_read(struct zram *zram, struct page *page,
+			unsigned long blk)
+{
+	return -EIO;
+}
+#endif
+
+/*
+ * Pages filled with one repeated word (zeros being the common case) are
+ * kept in the table entry itself rather than compressed.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
+	return 1;
+}
+
+static struct hlist_head *zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->dedup_hash[checksum & ((1 << ZRAM_DEDUP_HASH_BITS) - 1)];
+}
+
+/*
+ * Look up an object with the same compressed data. Compressor output
+ * depends only on its input, so identical pages give identical objects and we
+ * can compare those instead of decompressing. Returns the entry with a
+ * reference taken, or NULL.
+ */
+static struct zram_entry *zram_dedup_find(struct zram *zram, void *cdata,
+				size_t clen, u32 checksum)
+{
+	struct zram_entry *entry, *found = NULL;
+	struct hlist_node *pos;
+	unsigned char *cmem;
+
+	zram_stat64_inc(zram, &zram->stats.dedup_checks);
+
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(entry, pos, zram_dedup_bucket(zram, checksum),
+				node) {
+		if (entry->checksum != checksum || entry->clen != clen)
+			continue;
+
+		cmem = kmap_atomic(entry->page, KM_USER1) + entry->offset +
+				sizeof(struct zobj_header);
+		if (!memcmp(cmem, cdata, clen)) {
+			entry->refcount++;
+			found = entry;
+		}
+		kunmap_atomic(cmem, KM_USER1);
+
+		if (found)
+			break;
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return found;
+}
+
+static void zram_dedup_insert(struct zram *zram, struct zram_entry *entry)
+{
+	spin_lock(&zram->dedup_lock);
+	hlist_add_head(&entry->node, zram_dedup_bucket(zram, entry->checksum));
+	spin_unlock(&zram->dedup_lock);
+}
+
+/*
+ * Drop a slot's reference to a shared object. Returns 1 if that was the
+ * last one and the object has been freed.
+ */
+static int zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	spin_lock(&zram->dedup_lock);
+	if (--entry->refcount) {
+		spin_unlock(&zram->dedup_lock);
+		return 0;
+	}
+	hlist_del(&entry->node);
+	spin_unlock(&zram->dedup_lock);
+
+	xv_free(zram->mem_pool, entry->page, entry->offset);
+	kfree(entry);
 	return 1;
 }
 
@@ -133,6 +400,7 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+/* Called with the slot locked */
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	u32 clen;
@@ -141,6 +409,42 @@ static void zram_free_page(struct zram *zram, size_t index)
 	struct page *page = zram->table[index].page;
 	u32 offset = zram->table[index].offset;
 
+	/* A pending writeback of the old data must not be installed */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_free_block(zram, zram->table[index].element);
+		zram_stat_dec(&zram->stats.pages_stored);
+		zram->table[index].element = 0;
+		return;
+	}
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		zram_stat_dec(&zram->stats.pages_same);
+		zram->table[index].element = 0;
+		return;
+	}
+
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		struct zram_entry *entry = zram->table[index].entry;
+
+		clen = entry->clen;
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		/* Only the last reference gave back memory */
+		if (zram_dedup_put(zram, entry))
+			zram_stat64_sub(zram, &zram->stats.compr_size, clen);
+		else
+			zram_stat64_sub(zram, &zram->stats.dedup_saved, clen);
+		if (clen <= PAGE_SIZE / 2)
+			zram_stat_dec(&zram->stats.good_compress);
+		zram_stat_dec(&zram->stats.pages_stored);
+		zram->table[index].entry = NULL;
+		return;
+	}
+
 	if (unlikely(!page)) {
 		/*
 		 * No memory is allocated for zero filled pages.
@@ -188,6 +492,19 @@ static void handle_zero_page(struct page *page)
 	flush_dcache_page(page);
 }
 
+static void handle_same_page(struct page *page, unsigned long element)
+{
+	unsigned int pos;
+	unsigned long *user_mem;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	for (pos = 0; pos != PAGE_SIZE / sizeof(*user_mem); pos++)
+		user_mem[pos] = element;
+	kunmap_atomic(user_mem, KM_USER0);
+
+	flush_dcache_page(page);
+}
+
 static void handle_uncompressed_page(struct zram *zram,
 				struct page *page, u32 index)
 {
@@ -204,70 +521,112 @@ static void handle_uncompressed_page(struct zram *zram,
 	flush_dcache_page(page);
 }
 
-static void zram_read(struct zram *zram, struct bio *bio)
+static int zram_bvec_read(struct zram *zram, struct page *page, u32 index)
 {
+	int ret;
+	unsigned int clen;
+	u16 offset;
+	struct page *page_store;
+	struct zobj_header *zheader;
+	unsigned char *user_mem, *cmem;
 
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	zram_slot_lock(zram, index);
 
-	zram_stat64_inc(zram, &zram->stats.num_reads);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+		zram_slot_unlock(zram, index);
+		handle_zero_page(page);
+		return 0;
+	}
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		unsigned long element = zram->table[index].element;
 
-		page = bvec->bv_page;
+		zram_slot_unlock(zram, index);
+		handle_same_page(page, element);
+		return 0;
+	}
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		unsigned long blk = zram->table[index].element;
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
+		zram_slot_unlock(zram, index);
+		ret = zram_bd_read(zram, page, blk);
+		if (unlikely(ret)) {
+			pr_err("Backing device read failed! err=%d, "
+				"page=%u\n", ret, index);
+			zram_stat64_inc(zram, &zram->stats.failed_reads);
+			return ret;
 		}
+		flush_dcache_page(page);
+		return 0;
+	}
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
-		}
+	/* Requested page is not present in compressed area */
+	if (unlikely(!zram->table[index].page)) {
+		zram_slot_unlock(zram, index);
+		pr_debug("Read before write: page=%u\n", index);
+		handle_zero_page(page);
+		return 0;
+	}
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		handle_uncompressed_page(zram, page, index);
+		zram_slot_unlock(zram, index);
+		return 0;
+	}
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	/* Our reference keeps a shared object alive while the slot is locked */
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		page_store = zram->table[index].entry->page;
+		offset = zram->table[index].entry->offset;
+	} else {
+		page_store = zram->table[index].page;
+		offset = zram->table[index].offset;
+	}
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+	user_mem = kmap_atomic(page, KM_USER0);
+	clen = PAGE_SIZE;
 
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+	cmem = kmap_atomic(page_store, KM_USER1) + offset;
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
-			zram_stat64_inc(zram, &zram->stats.failed_reads);
-			goto out;
-		}
+	/* Preemption is off under the slot lock, this CPU's tfm is ours */
+	ret = crypto_comp_decompress(this_cpu_ptr(zram->cstrm)->tfm,
+		cmem + sizeof(*zheader),
+		xv_get_object_size(cmem) - sizeof(*zheader),
+		user_mem, &clen);
 
-		flush_dcache_page(page);
+	kunmap_atomic(user_mem, KM_USER0);
+	kunmap_atomic(cmem, KM_USER1);
+
+	zram_slot_unlock(zram, index);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret || clen != PAGE_SIZE)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return -EIO;
+	}
+
+	flush_dcache_page(page);
+	return 0;
+}
+
+static void zram_read(struct zram *zram, struct bio *bio)
+{
+
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
+
+	zram_stat64_inc(zram, &zram->stats.num_reads);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (zram_bvec_read(zram, bvec->bv_page, index))
+			goto out;
+		zram_accessed(zram, index);
 		index++;
 	}
 
@@ -279,121 +638,224 @@ out:
 	bio_io_error(bio);
 }
 
-static void zram_write(struct zram *zram, struct bio *bio)
+/*
+ * Replace whatever the slot held by the new object, and account for it.
+ */
+static void zram_install_page(struct zram *zram, u32 index,
+			struct page *page_store, u32 offset, size_t clen)
 {
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	zram_slot_lock(zram, index);
 
-	zram_stat64_inc(zram, &zram->stats.num_writes);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	zram_free_page(zram, index);
+	zram->table[index].page = page_store;
+	zram->table[index].offset = offset;
+	if (unlikely(clen == PAGE_SIZE))
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	zram_slot_unlock(zram, index);
+
+	/* Update stats */
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	zram_stat_inc(&zram->stats.pages_stored);
+	if (unlikely(clen == PAGE_SIZE))
+		zram_stat_inc(&zram->stats.pages_expand);
+	else if (clen <= PAGE_SIZE / 2)
+		zram_stat_inc(&zram->stats.good_compress);
+}
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+/*
+ * Point the slot at an object of the dedup index. @shared is set when the
+ * slot took another reference to an existing object instead of storing
+ * a new one.
+ */
+static void zram_install_entry(struct zram *zram, u32 index,
+			struct zram_entry *entry, int shared)
+{
+	zram_slot_lock(zram, index);
 
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+	zram_free_page(zram, index);
+	zram->table[index].entry = entry;
+	zram_set_flag(zram, index, ZRAM_DEDUP);
 
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
+	zram_slot_unlock(zram, index);
 
-		mutex_lock(&zram->lock);
+	/* Update stats */
+	if (shared) {
+		zram_stat64_inc(zram, &zram->stats.dedup_hits);
+		zram_stat64_add(zram, &zram->stats.dedup_saved, entry->clen);
+	} else {
+		zram_stat64_add(zram, &zram->stats.compr_size, entry->clen);
+	}
+	zram_stat_inc(&zram->stats.pages_stored);
+	if (entry->clen <= PAGE_SIZE / 2)
+		zram_stat_inc(&zram->stats.good_compress);
+}
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
+static int zram_bvec_write(struct zram *zram, struct page *page, u32 index)
+{
+	int ret;
+	u32 offset, checksum = 0;
+	unsigned int clen, alloc_len = 0;
+	unsigned long element;
+	struct zobj_header *zheader;
+	struct zram_cstrm *cstrm;
+	struct zram_entry *entry;
+	struct page *page_store = NULL;
+	unsigned char *user_mem, *cmem;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_same_filled(user_mem, &element)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		zram_slot_lock(zram, index);
+		zram_free_page(zram, index);
+		if (!element) {
 			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
-			continue;
+		} else {
+			zram->table[index].element = element;
+			zram_set_flag(zram, index, ZRAM_SAME);
 		}
+		zram_slot_unlock(zram, index);
+		zram_stat_inc(element ? &zram->stats.pages_same :
+					&zram->stats.pages_zero);
+		return 0;
+	}
+	kunmap_atomic(user_mem, KM_USER0);
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+compress_again:
+	/* The buffers of this CPU are ours until put_cpu_ptr() */
+	cstrm = get_cpu_ptr(zram->cstrm);
 
-		kunmap_atomic(user_mem, KM_USER0);
+	user_mem = kmap_atomic(page, KM_USER0);
+	clen = 2 * PAGE_SIZE;
+	ret = crypto_comp_compress(cstrm->tfm, user_mem, PAGE_SIZE,
+				cstrm->buffer, &clen);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	if (unlikely(ret)) {
+		put_cpu_ptr(zram->cstrm);
+		pr_err("Compression failed! err=%d\n", ret);
+		goto out_free;
+	}
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size)) {
+		put_cpu_ptr(zram->cstrm);
+		if (page_store)
+			xv_free(zram->mem_pool, page_store, offset);
+
+		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!page_store)) {
+			pr_info("Error allocating memory for "
+				"incompressible page: %u\n", index);
 			goto out;
 		}
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
+		user_mem = kmap_atomic(page, KM_USER0);
+		cmem = kmap_atomic(page_store, KM_USER1);
+		memcpy(cmem, user_mem, PAGE_SIZE);
+		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(user_mem, KM_USER0);
+
+		zram_install_page(zram, index, page_store, 0, PAGE_SIZE);
+		zram_wb_kick(zram, index);
+		return 0;
+	}
 
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
+	/* Incompressible pages are never shared, only look up the rest */
+	if (zram->dedup) {
+		checksum = jhash(cstrm->buffer, clen, 0);
+		entry = zram_dedup_find(zram, cstrm->buffer, clen, checksum);
+		if (entry) {
+			put_cpu_ptr(zram->cstrm);
+			if (page_store)
+				xv_free(zram->mem_pool, page_store, offset);
+			zram_install_entry(zram, index, entry, 1);
+			return 0;
 		}
+	}
+
+	/* A page can change under I/O; an object of the wrong size won't do */
+	if (page_store && alloc_len != clen) {
+		xv_free(zram->mem_pool, page_store, offset);
+		page_store = NULL;
+	}
 
+	/*
+	 * We cannot sleep while holding this CPU's buffers. Try an atomic
+	 * allocation first; if that fails, allocate with the buffers
+	 * released and compress again.
+	 */
+	if (!page_store && xv_malloc(zram->mem_pool,
+				clen + sizeof(*zheader), &page_store, &offset,
+				GFP_NOWAIT | __GFP_NOWARN | __GFP_HIGHMEM)) {
+		put_cpu_ptr(zram->cstrm);
+		page_store = NULL;
 		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
+				&page_store, &offset,
 				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
 			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
+				"page: %u, size=%u\n", index, clen);
 			goto out;
 		}
+		alloc_len = clen;
+		goto compress_again;
+	}
 
-memstore:
-		zram->table[index].offset = offset;
-
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	cmem = kmap_atomic(page_store, KM_USER1) + offset;
 
 #if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
+	/* Back-reference needed for memory defragmentation */
+	zheader = (struct zobj_header *)cmem;
+	zheader->table_idx = index;
+	cmem += sizeof(*zheader);
 #endif
 
-		memcpy(cmem, src, clen);
+	memcpy(cmem, cstrm->buffer, clen);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+	kunmap_atomic(cmem, KM_USER1);
+	put_cpu_ptr(zram->cstrm);
+
+	/* Without an index entry the object is simply not shared */
+	entry = zram->dedup ? kmalloc(sizeof(*entry), GFP_NOIO) : NULL;
+	if (entry) {
+		entry->page = page_store;
+		entry->offset = offset;
+		entry->clen = clen;
+		entry->checksum = checksum;
+		entry->refcount = 1;
+		zram_dedup_insert(zram, entry);
+		zram_install_entry(zram, index, entry, 0);
+		return 0;
+	}
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+	zram_install_page(zram, index, page_store, offset, clen);
+	return 0;
+
+out_free:
+	if (page_store)
+		xv_free(zram->mem_pool, page_store, offset);
+out:
+	zram_stat64_inc(zram, &zram->stats.failed_writes);
+	return -ENOMEM;
+}
+
+static void zram_write(struct zram *zram, struct bio *bio)
+{
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
+
+	zram_stat64_inc(zram, &zram->stats.num_writes);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-		mutex_unlock(&zram->lock);
+	bio_for_each_segment(bvec, bio, i) {
+		if (zram_bvec_write(zram, bvec->bv_page, index))
+			goto out;
+		zram_accessed(zram, index);
 		index++;
 	}
 
@@ -405,6 +867,261 @@ out:
 	bio_io_error(bio);
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* Claim a slot for writeback if it holds data of the kind asked for */
+static int zram_wb_candidate(struct zram *zram, u32 index, int mode)
+{
+	int ret = 0;
+
+	zram_slot_lock(zram, index);
+
+	if (!zram->table[index].page ||
+	    zram_test_flag(zram, index, ZRAM_SAME) ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		goto out;
+
+	if (mode == ZRAM_WB_HUGE ?
+	    !zram_test_flag(zram, index, ZRAM_UNCOMPRESSED) :
+	    !zram_test_flag(zram, index, ZRAM_IDLE))
+		goto out;
+
+	zram_set_flag(zram, index, ZRAM_UNDER_WB);
+	ret = 1;
+out:
+	zram_slot_unlock(zram, index);
+	return ret;
+}
+
+/*
+ * Move the page to the backing device unless the slot was written or
+ * freed while the copy was in flight.
+ */
+static void zram_wb_finish(struct zram *zram, u32 index, unsigned long blk,
+			int ok)
+{
+	zram_slot_lock(zram, index);
+	if (ok && zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+		zram_free_page(zram, index);
+		zram->table[index].element = blk;
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram_stat_inc(&zram->stats.pages_stored);
+	} else {
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		ok = 0;
+	}
+	zram_slot_unlock(zram, index);
+
+	if (ok)
+		zram_stat64_inc(zram, &zram->stats.bd_writes);
+	else if (blk)
+		zram_free_block(zram, blk);
+}
+
+/*
+ * Next slot to look at from index on. Incompressible pages are only looked
+ * for among the slots queued by zram_wb_kick(), the rest of the table holds
+ * none.
+ */
+static size_t zram_wb_next(struct zram *zram, size_t index, int mode)
+{
+	size_t nr_pages = zram->disksize >> PAGE_SHIFT;
+
+	if (mode != ZRAM_WB_HUGE)
+		return index;
+
+	index = find_next_bit(zram->wb_huge, nr_pages, index);
+	if (index < nr_pages)
+		clear_bit(index, zram->wb_huge);
+	return index;
+}
+
+/*
+ * Write pages of the given kind back to the backing device, ZRAM_WB_BATCH
+ * at a time. Each page is copied out first, so its slot can still be read
+ * and written while the bio is in flight.
+ */
+int zram_writeback(struct zram *zram, int mode)
+{
+	struct {
+		u32 index;
+		unsigned long blk;
+		struct page *page;
+		struct bio *bio;
+	} *batch;
+	struct zram_bd_io io;
+	size_t index, nr_pages = zram->disksize >> PAGE_SHIFT;
+	int i, n, ret = 0;
+
+	if (!zram->bdev)
+		return -ENODEV;
+
+	batch = kcalloc(ZRAM_WB_BATCH, sizeof(*batch), GFP_KERNEL);
+	if (!batch)
+		return -ENOMEM;
+
+	mutex_lock(&zram->wb_lock);
+
+	index = zram_wb_next(zram, 0, mode);
+	while (index < nr_pages && !ret) {
+		zram_bd_io_init(&io);
+
+		for (n = 0; n < ZRAM_WB_BATCH && index < nr_pages;
+				index = zram_wb_next(zram, index + 1, mode)) {
+			if (!zram_wb_candidate(zram, index, mode))
+				continue;
+
+			batch[n].index = index;
+			batch[n].page = alloc_page(GFP_KERNEL);
+			batch[n].blk = batch[n].page ? zram_alloc_block(zram) : 0;
+			if (!batch[n].blk) {
+				ret = batch[n].page ? -ENOSPC : -ENOMEM;
+				goto abort;
+			}
+
+			if (zram_bvec_read(zram, batch[n].page, index)) {
+				ret = -EIO;
+				goto abort;
+			}
+
+			batch[n].bio = zram_bd_bio(zram, batch[n].page,
+						batch[n].blk, &io);
+			if (!batch[n].bio) {
+				ret = -ENOMEM;
+				goto abort;
+			}
+			n++;
+			continue;
+abort:
+			zram_wb_finish(zram, index, batch[n].blk, 0);
+			if (batch[n].page)
+				__free_page(batch[n].page);
+			/* Left for the next pass */
+			if (mode == ZRAM_WB_HUGE)
+				set_bit(index, zram->wb_huge);
+			break;
+		}
+
+		for (i = 0; i < n; i++)
+			submit_bio(WRITE, batch[i].bio);
+		zram_bd_io_wait(&io);
+
+		for (i = 0; i < n; i++) {
+			int ok = test_bit(BIO_UPTODATE, &batch[i].bio->bi_flags);
+
+			if (!ok)
+				ret = -EIO;
+			zram_wb_finish(zram, batch[i].index, batch[i].blk, ok);
+			bio_put(batch[i].bio);
+			__free_page(batch[i].page);
+		}
+	}
+
+	mutex_unlock(&zram->wb_lock);
+	kfree(batch);
+	return ret;
+}
+
+static void zram_wb_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, wb_work);
+	int ret;
+
+	ret = zram_writeback(zram, ZRAM_WB_HUGE);
+	if (ret && ret != -ENOSPC)
+		pr_warning("Writeback of incompressible pages failed: "
+			"err=%d\n", ret);
+}
+
+/*
+ * Mark pages idle that were not accessed for age jiffies, or all stored
+ * pages if age is 0. A later read or write clears the mark.
+ */
+void zram_mark_idle(struct zram *zram, unsigned long age)
+{
+	size_t index;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		zram_slot_lock(zram, index);
+		if (zram->table[index].page &&
+		    !zram_test_flag(zram, index, ZRAM_SAME) &&
+		    !zram_test_flag(zram, index, ZRAM_WB) &&
+		    (!age || time_after(jiffies,
+					zram->table[index].ac_time + age)))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		zram_slot_unlock(zram, index);
+	}
+}
+
+static void zram_reset_backing_dev(struct zram *zram)
+{
+	if (!zram->backing_dev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	filp_close(zram->backing_dev, NULL);
+	vfree(zram->bitmap);
+	vfree(zram->wb_huge);
+
+	zram->backing_dev = NULL;
+	zram->bdev = NULL;
+	zram->bitmap = NULL;
+	zram->wb_huge = NULL;
+	zram->nr_blocks = 0;
+}
+
+/* Called with init_lock held, on a device not yet initialized */
+int zram_set_backing_dev(struct zram *zram, const char *name)
+{
+	struct file *backing_dev;
+	struct block_device *bdev;
+	struct inode *inode;
+	unsigned long nr_blocks, *bitmap;
+	int ret;
+
+	backing_dev = filp_open(name, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(backing_dev))
+		return PTR_ERR(backing_dev);
+
+	inode = backing_dev->f_mapping->host;
+	if (!S_ISBLK(inode->i_mode)) {
+		ret = -ENOTBLK;
+		goto out_close;
+	}
+
+	bdev = bdgrab(I_BDEV(inode));
+	ret = blkdev_get(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+	if (ret < 0)
+		goto out_close;
+
+	nr_blocks = i_size_read(inode) >> PAGE_SHIFT;
+	bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (!bitmap) {
+		ret = -ENOMEM;
+		goto out_put;
+	}
+
+	zram_reset_backing_dev(zram);
+	zram->backing_dev = backing_dev;
+	zram->bdev = bdev;
+	zram->nr_blocks = nr_blocks;
+	zram->bitmap = bitmap;
+
+	pr_info("Using %s as backing device, %lu pages\n", name, nr_blocks);
+	return 0;
+
+out_put:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+out_close:
+	filp_close(backing_dev, NULL);
+	return ret;
+}
+#else
+static inline void zram_reset_backing_dev(struct zram *zram)
+{
+}
+#endif
+
 /*
  * Check if request is within bounds and page aligned.
  */
@@ -453,6 +1170,339 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	return 0;
 }
 
+static void zram_free_cstrm(struct zram *zram)
+{
+	int cpu;
+
+	if (!zram->cstrm)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_cstrm *cstrm = per_cpu_ptr(zram->cstrm, cpu);
+
+		if (cstrm->tfm)
+			crypto_free_comp(cstrm->tfm);
+		free_pages((unsigned long)cstrm->buffer, 1);
+	}
+	free_percpu(zram->cstrm);
+	zram->cstrm = NULL;
+}
+
+static int zram_alloc_cstrm(struct zram *zram)
+{
+	int cpu;
+
+	zram->cstrm = alloc_percpu(struct zram_cstrm);
+	if (!zram->cstrm) {
+		pr_err("Error allocating compression streams\n");
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct zram_cstrm *cstrm = per_cpu_ptr(zram->cstrm, cpu);
+
+		cstrm->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+		if (IS_ERR(cstrm->tfm)) {
+			pr_err("Error allocating %s compressor\n",
+				zram->compressor);
+			cstrm->tfm = NULL;
+			return -ENOMEM;
+		}
+
+		cstrm->buffer = (void *)__get_free_pages(GFP_KERNEL |
+							__GFP_ZERO, 1);
+		if (!cstrm->buffer) {
+			pr_err("Error allocating compressor buffer space\n");
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Compress and decompress a sample of the pages stored on the device with
+ * each of the compressors we offer, so that one can be picked for the
+ * data actually being swapped. Called with init_lock held.
+ */
+int zram_comp_bench(struct zram *zram)
+{
+	int i, nr_pages = 0, ret = 0;
+	size_t index;
+	struct page **pages;
+	void *dst = NULL, *out = NULL;
+
+	pages = kcalloc(ZRAM_BENCH_PAGES, sizeof(*pages), GFP_KERNEL);
+	dst = (void *)__get_free_pages(GFP_KERNEL, 1);
+	out = (void *)__get_free_page(GFP_KERNEL);
+	if (!pages || !dst || !out) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* Take the first pages that really went through a compressor */
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT &&
+			nr_pages < ZRAM_BENCH_PAGES; index++) {
+		if (!zram->table[index].page ||
+		    zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_WB))
+			continue;
+
+		pages[nr_pages] = alloc_page(GFP_KERNEL);
+		if (!pages[nr_pages]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		if (zram_bvec_read(zram, pages[nr_pages++], index)) {
+			ret = -EIO;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < ZRAM_NR_COMPRESSORS; i++) {
+		struct zram_bench *bench = &zram->bench[i];
+		struct crypto_comp *tfm;
+		int n;
+
+		memset(bench, 0, sizeof(*bench));
+		if (!crypto_has_comp(zram_compressors[i], 0, 0))
+			continue;
+
+		tfm = crypto_alloc_comp(zram_compressors[i], 0, 0);
+		if (IS_ERR(tfm))
+			continue;
+
+		for (n = 0; n < nr_pages; n++) {
+			void *src = page_address(pages[n]);
+			unsigned int clen = 2 * PAGE_SIZE;
+			unsigned int olen = PAGE_SIZE;
+			ktime_t start, mid, end;
+
+			start = ktime_get();
+			ret = crypto_comp_compress(tfm, src, PAGE_SIZE,
+						dst, &clen);
+			mid = ktime_get();
+			if (!ret)
+				ret = crypto_comp_decompress(tfm, dst, clen,
+							out, &olen);
+			end = ktime_get();
+
+			if (ret || olen != PAGE_SIZE ||
+			    memcmp(src, out, PAGE_SIZE)) {
+				pr_err("%s failed on sample page %d\n",
+					zram_compressors[i], n);
+				ret = -EIO;
+				break;
+			}
+
+			bench->pages++;
+			bench->orig_size += PAGE_SIZE;
+			bench->compr_size += clen;
+			bench->comp_ns += ktime_to_ns(ktime_sub(mid, start));
+			bench->decomp_ns += ktime_to_ns(ktime_sub(end, mid));
+		}
+
+		crypto_free_comp(tfm);
+		if (ret)
+			goto out;
+	}
+
+out:
+	while (nr_pages--)
+		__free_page(pages[nr_pages]);
+	free_page((unsigned long)out);
+	free_pages((unsigned long)dst, 1);
+	kfree(pages);
+	return ret;
+}
+
+struct zram_rw_bench_thread {
+	struct zram *zram;
+	struct block_device *bdev;
+	u32 first;		/* first page of the thread's range */
+	u32 pages;
+	int rw;
+	struct page *page;
+	void *expect;
+	int err;
+	struct completion done;
+};
+
+/*
+ * Contents of benchmark page 'index': half of it repeats and half of it
+ * does not, so it compresses about 2:1, like typical anonymous memory.
+ */
+static void zram_rw_bench_fill(void *buf, u32 index)
+{
+	u32 *p = buf, seed = index;
+	int i, n = PAGE_SIZE / sizeof(*p);
+
+	for (i = 0; i < n / 2; i++)
+		p[i] = index;
+	for (; i < n; i++) {
+		seed = seed * 1103515245 + 12345;
+		p[i] = seed;
+	}
+}
+
+static void zram_rw_bench_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+static int zram_rw_bench_io(struct block_device *bdev, struct page *page,
+			u32 index, int rw)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct bio *bio;
+	int ret;
+
+	bio = bio_alloc(GFP_KERNEL, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = bdev;
+	bio->bi_sector = (sector_t)index << SECTORS_PER_PAGE_SHIFT;
+	bio_add_page(bio, page, PAGE_SIZE, 0);
+	bio->bi_end_io = zram_rw_bench_end_io;
+	bio->bi_private = &done;
+
+	submit_bio(rw, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+	return ret;
+}
+
+static int zram_rw_bench_fn(void *data)
+{
+	struct zram_rw_bench_thread *t = data;
+	void *buf = page_address(t->page);
+	u32 index;
+	int ret = 0;
+
+	for (index = t->first; index < t->first + t->pages && !ret; index++) {
+		if (t->rw == WRITE)
+			zram_rw_bench_fill(buf, index);
+		ret = zram_rw_bench_io(t->bdev, t->page, index, t->rw);
+		if (!ret && t->rw == READ) {
+			zram_rw_bench_fill(t->expect, index);
+			if (memcmp(buf, t->expect, PAGE_SIZE))
+				ret = -EIO;
+		}
+	}
+
+	t->err = ret;
+	complete(&t->done);
+	return 0;
+}
+
+/* Run one phase of the benchmark, returning how long it took in 'ns' */
+static int zram_rw_bench_phase(struct zram_rw_bench_thread *thr,
+			u32 threads, int rw, u64 *ns)
+{
+	struct task_struct *task;
+	ktime_t start;
+	u32 i, started = 0;
+	int ret = 0;
+
+	start = ktime_get();
+	for (i = 0; i < threads; i++) {
+		thr[i].rw = rw;
+		init_completion(&thr[i].done);
+		task = kthread_run(zram_rw_bench_fn, &thr[i], "zram_bench/%u",
+				i);
+		if (IS_ERR(task)) {
+			ret = PTR_ERR(task);
+			break;
+		}
+		started++;
+	}
+	for (i = 0; i < started; i++) {
+		wait_for_completion(&thr[i].done);
+		if (thr[i].err)
+			ret = thr[i].err;
+	}
+	*ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	return ret;
+}
+
+/*
+ * Write 'pages' pages from each of 'threads' threads at once, each on a
+ * range of its own at the start of the device, then read them all back
+ * the same way and check them. This goes through the block layer like
+ * swap does, so comparing runs with one thread and with several shows
+ * how reads and writes scale across CPUs. The data on the device is
+ * lost, so it must not be in use: it is claimed exclusively, which fails
+ * while it is used as swap or mounted. Called with init_lock held.
+ */
+int zram_rw_bench(struct zram *zram, u32 threads, u32 pages)
+{
+	struct zram_rw_bench_thread *thr;
+	struct zram_rw_bench res = {
+		.threads = threads,
+		.pages = pages,
+	};
+	struct block_device *bdev;
+	fmode_t mode = FMODE_READ | FMODE_WRITE | FMODE_EXCL;
+	u32 i, index;
+	int ret;
+
+	if ((u64)threads * pages > zram->disksize >> PAGE_SHIFT)
+		return -EINVAL;
+
+	bdev = bdget_disk(zram->disk, 0);
+	if (!bdev)
+		return -ENOMEM;
+	ret = blkdev_get(bdev, mode, zram_rw_bench);
+	if (ret)
+		return ret;
+
+	thr = kcalloc(threads, sizeof(*thr), GFP_KERNEL);
+	if (!thr) {
+		ret = -ENOMEM;
+		goto out_put;
+	}
+	for (i = 0; i < threads; i++) {
+		thr[i].zram = zram;
+		thr[i].bdev = bdev;
+		thr[i].first = i * pages;
+		thr[i].pages = pages;
+		thr[i].page = alloc_page(GFP_KERNEL);
+		thr[i].expect = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!thr[i].page || !thr[i].expect) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+	}
+
+	ret = zram_rw_bench_phase(thr, threads, WRITE, &res.write_ns);
+	if (!ret)
+		ret = zram_rw_bench_phase(thr, threads, READ, &res.read_ns);
+	if (!ret)
+		zram->rw_bench = res;
+
+	/* Do not keep the benchmark's pages around */
+	for (index = 0; index < threads * pages; index++) {
+		zram_slot_lock(zram, index);
+		zram_free_page(zram, index);
+		zram_slot_unlock(zram, index);
+	}
+
+out_free:
+	for (i = 0; i < threads; i++) {
+		if (thr[i].page)
+			__free_page(thr[i].page);
+		kfree(thr[i].expect);
+	}
+	kfree(thr);
+out_put:
+	blkdev_put(bdev, mode);
+	return ret;
+}
+
 void zram_reset_device(struct zram *zram)
 {
 	size_t index;
@@ -460,18 +1510,28 @@ void zram_reset_device(struct zram *zram)
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	cancel_work_sync(&zram->wb_work);
+#endif
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free various per-device buffers */
+	zram_free_cstrm(zram);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
 		struct page *page;
 		u16 offset;
 
+		if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+			zram_dedup_put(zram, zram->table[index].entry);
+			continue;
+		}
+
+		/* Blocks of the backing device go with its bitmap */
+		if (zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_WB))
+			continue;
+
 		page = zram->table[index].page;
 		offset = zram->table[index].offset;
 
@@ -487,6 +1547,11 @@ void zram_reset_device(struct zram *zram)
 	vfree(zram->table);
 	zram->table = NULL;
 
+	kfree(zram->dedup_hash);
+	zram->dedup_hash = NULL;
+
+	zram_reset_backing_dev(zram);
+
 	xv_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
@@ -511,19 +1576,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_alloc_cstrm(zram);
+	if (ret)
 		goto fail;
-	}
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
 	zram->table = vzalloc(num_pages * sizeof(*zram->table));
@@ -535,6 +1590,27 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram->bdev) {
+		zram->wb_huge = vzalloc(BITS_TO_LONGS(num_pages) * sizeof(long));
+		if (!zram->wb_huge) {
+			pr_err("Error allocating writeback queue\n");
+			ret = -ENOMEM;
+			goto fail;
+		}
+	}
+#endif
+
+	if (zram->dedup) {
+		zram->dedup_hash = kcalloc(1 << ZRAM_DEDUP_HASH_BITS,
+					sizeof(*zram->dedup_hash), GFP_KERNEL);
+		if (!zram->dedup_hash) {
+			pr_err("Error allocating dedup index\n");
+			ret = -ENOMEM;
+			goto fail;
+		}
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
@@ -566,7 +1642,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_slot_lock(zram, index);
 	zram_free_page(zram, index);
+	zram_slot_unlock(zram, index);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1657,15 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	spin_lock_init(&zram->dedup_lock);
+	strcpy(zram->compressor, ZRAM_DEFAULT_COMPRESSOR);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bitmap_lock);
+	mutex_init(&zram->wb_lock);
+	INIT_WORK(&zram->wb_work, zram_wb_work);
+#endif
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -664,11 +1748,19 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram_bd_wq = alloc_workqueue("zram_bd", WQ_MEM_RECLAIM, 0);
+	if (!zram_bd_wq) {
+		ret = -ENOMEM;
+		goto out;
+	}
+#endif
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto free_wq;
 	}
 
 	if (!num_devices) {
@@ -698,6 +1790,10 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+free_wq:
+#ifdef CONFIG_ZRAM_WRITEBACK
+	destroy_workqueue(zram_bd_wq);
+#endif
 out:
 	return ret;
 }
@@ -713,9 +1809,13 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		zram_reset_backing_dev(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
+#ifdef CONFIG_ZRAM_WRITEBACK
+	destroy_workqueue(zram_bd_wq);
+#endif
 
 	kfree(devices);
 	pr_debug("Cleanup done!\n");
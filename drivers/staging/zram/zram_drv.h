@@ -17,6 +17,9 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/crypto.h>
+#include <linux/workqueue.h>
 
 #include "xvmalloc.h"
 
@@ -43,6 +46,23 @@ struct zobj_header {
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/*
+ * Compressors that can be selected per device through sysfs, fastest
+ * first. Any of them that is not built in is simply not offered.
+ */
+static const char * const zram_compressors[] = { "lz4", "lzo", "deflate" };
+#define ZRAM_NR_COMPRESSORS	ARRAY_SIZE(zram_compressors)
+#define ZRAM_DEFAULT_COMPRESSOR	"lzo"
+
+/* Pages of the device sampled by the compressor benchmark */
+#define ZRAM_BENCH_PAGES	64
+
+/* Most threads the read/write benchmark runs at once */
+#define ZRAM_RW_BENCH_THREADS	32
+
+/* Pages written back to the backing device per batch of bios */
+#define ZRAM_WB_BATCH		32
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -63,6 +83,9 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 #define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
 #define ZRAM_LOGICAL_BLOCK_SIZE	4096
 
+/* Buckets in the index of objects shared by dedup */
+#define ZRAM_DEDUP_HASH_BITS	12
+
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
 	/* Page is stored uncompressed */
@@ -71,17 +94,58 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page consists of one repeated word, kept in table.element */
+	ZRAM_SAME,
+
+	/* Page data is a shared object, table.entry points to it */
+	ZRAM_DEDUP,
+
+	/* Page is on the backing device, table.element is its block */
+	ZRAM_WB,
+
+	/* Page is being copied to the backing device */
+	ZRAM_UNDER_WB,
+
+	/* Page was not accessed since it was last marked idle */
+	ZRAM_IDLE,
+
+	/* Bit spinlock protecting the table entry */
+	ZRAM_ACCESS,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
-/* Allocated for each disk page */
-struct table {
+/*
+ * A compressed object in the dedup index, shared by every slot that
+ * stores the same data.
+ */
+struct zram_entry {
+	struct hlist_node node;
 	struct page *page;
 	u16 offset;
+	u16 clen;
+	u32 checksum;	/* jhash of the compressed data */
+	int refcount;	/* protected by zram->dedup_lock */
+};
+
+/*
+ * Allocated for each disk page. Everything but the ZRAM_ACCESS bit is
+ * protected by that bit, see zram_slot_lock().
+ */
+struct table {
+	union {
+		struct page *page;
+		struct zram_entry *entry;	/* ZRAM_DEDUP */
+		unsigned long element;		/* ZRAM_SAME, ZRAM_WB */
+	};
+	u16 offset;
 	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
+	unsigned long flags;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	unsigned long ac_time;	/* jiffies of the last read or write */
+#endif
 } __attribute__((aligned(4)));
 
 struct zram_stats {
@@ -92,20 +156,71 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	u64 dedup_checks;	/* pages looked up in the dedup index */
+	u64 dedup_hits;		/* --do-- and found there */
+	u64 dedup_saved;	/* compressed bytes shared, not stored */
+	u64 bd_reads;		/* pages read from the backing device */
+	u64 bd_writes;		/* pages written to it */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_same;	/* no. of pattern filled pages */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+	atomic_t bd_count;	/* no. of pages on the backing device */
+};
+
+/*
+ * Compression buffers. Each CPU has its own, so writers only serialize
+ * on the table entry they update.
+ */
+struct zram_cstrm {
+	struct crypto_comp *tfm;
+	void *buffer;	/* two pages, compressed data may expand */
+};
+
+/* Results of the last benchmark run, one per zram_compressors[] entry */
+struct zram_bench {
+	u32 pages;		/* 0 if the compressor is not available */
+	u64 orig_size;		/* bytes fed to the compressor */
+	u64 compr_size;		/* bytes it produced, before any clamping */
+	u64 comp_ns;
+	u64 decomp_ns;
+};
+
+/* Result of the last read/write benchmark run */
+struct zram_rw_bench {
+	u32 threads;
+	u32 pages;		/* per thread */
+	u64 write_ns;
+	u64 read_ns;
 };
 
 struct zram {
 	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zram_cstrm __percpu *cstrm;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	/* Share identical objects, can only be set before init */
+	int dedup;
+	struct hlist_head *dedup_hash;
+	spinlock_t dedup_lock;	/* protect the index and refcounts */
+	/* Compressor name, can only be set before init */
+	char compressor[CRYPTO_MAX_ALG_NAME];
+	struct zram_bench bench[ZRAM_NR_COMPRESSORS];
+	struct zram_rw_bench rw_bench;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Backing device, can only be set before init */
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned long nr_blocks;	/* pages the backing device holds */
+	unsigned long *bitmap;		/* blocks in use */
+	spinlock_t bitmap_lock;
+	/* One writeback pass at a time */
+	struct mutex wb_lock;
+	/* Writes incompressible pages back as they are stored */
+	struct work_struct wb_work;
+	unsigned long *wb_huge;		/* slots queued for wb_work */
+#endif
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -128,5 +243,17 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern int zram_comp_bench(struct zram *zram);
+extern int zram_rw_bench(struct zram *zram, u32 threads, u32 pages);
+
+/* Writeback modes */
+#define ZRAM_WB_HUGE	0	/* pages stored uncompressed */
+#define ZRAM_WB_IDLE	1	/* pages marked idle */
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *name);
+extern void zram_mark_idle(struct zram *zram, unsigned long age);
+extern int zram_writeback(struct zram *zram, int mode);
+#endif
 
 #endif
@@ -13,8 +13,10 @@
  */
 
 #include <linux/device.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
 #include <linux/mm.h>
+#include <linux/math64.h>
 
 #include "zram_drv.h"
 
@@ -72,6 +74,300 @@ static ssize_t disksize_store(struct device *dev,
 	return len;
 }
 
+static ssize_t dedup_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->dedup);
+}
+
+static ssize_t dedup_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (zram->init_done) {
+		pr_info("Cannot change dedup for initialized device\n");
+		return -EBUSY;
+	}
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	zram->dedup = !!val;
+
+	return len;
+}
+
+static ssize_t comp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	int i;
+	ssize_t sz = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	for (i = 0; i < ZRAM_NR_COMPRESSORS; i++) {
+		if (!crypto_has_comp(zram_compressors[i], 0, 0))
+			continue;
+		if (!strcmp(zram->compressor, zram_compressors[i]))
+			sz += sprintf(buf + sz, "[%s] ", zram_compressors[i]);
+		else
+			sz += sprintf(buf + sz, "%s ", zram_compressors[i]);
+	}
+	if (sz)
+		buf[sz - 1] = '\n';
+
+	return sz;
+}
+
+static ssize_t comp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int i;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (zram->init_done) {
+		pr_info("Cannot change compressor for initialized device\n");
+		return -EBUSY;
+	}
+
+	for (i = 0; i < ZRAM_NR_COMPRESSORS; i++) {
+		if (sysfs_streq(buf, zram_compressors[i]))
+			break;
+	}
+	if (i == ZRAM_NR_COMPRESSORS ||
+	    !crypto_has_comp(zram_compressors[i], 0, 0))
+		return -EINVAL;
+
+	strcpy(zram->compressor, zram_compressors[i]);
+
+	return len;
+}
+
+/* MB/s for size bytes processed in ns nanoseconds */
+static u64 zram_bench_rate(u64 size, u64 ns)
+{
+	return ns ? div64_u64(size * NSEC_PER_SEC, ns) >> 20 : 0;
+}
+
+static ssize_t comp_bench_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	int i;
+	ssize_t sz = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	sz += sprintf(buf, "algorithm pages ratio comp_MB/s decomp_MB/s\n");
+	for (i = 0; i < ZRAM_NR_COMPRESSORS; i++) {
+		struct zram_bench *bench = &zram->bench[i];
+		u64 ratio;
+
+		if (!bench->pages || !bench->compr_size)
+			continue;
+
+		/* uncompressed over compressed bytes, in hundredths */
+		ratio = div64_u64(bench->orig_size * 100, bench->compr_size);
+		sz += sprintf(buf + sz, "%s %u %llu.%02llu %llu %llu\n",
+			zram_compressors[i], bench->pages,
+			div_u64(ratio, 100), ratio - div_u64(ratio, 100) * 100,
+			zram_bench_rate(bench->orig_size, bench->comp_ns),
+			zram_bench_rate(bench->orig_size, bench->decomp_ns));
+	}
+
+	return sz;
+}
+
+static ssize_t comp_bench_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long do_bench;
+	struct zram *zram = dev_to_zram(dev);
+
+	ret = strict_strtoul(buf, 10, &do_bench);
+	if (ret)
+		return ret;
+
+	if (!do_bench)
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		ret = zram_comp_bench(zram);
+	else
+		ret = -ENODEV;
+	mutex_unlock(&zram->init_lock);
+
+	return ret ? ret : len;
+}
+
+static ssize_t rw_bench_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zram_rw_bench *bench = &zram->rw_bench;
+	u64 size = ((u64)bench->threads * bench->pages) << PAGE_SHIFT;
+
+	return sprintf(buf, "threads pages write_MB/s read_MB/s\n"
+		"%u %u %llu %llu\n", bench->threads, bench->pages,
+		zram_bench_rate(size, bench->write_ns),
+		zram_bench_rate(size, bench->read_ns));
+}
+
+static ssize_t rw_bench_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned int threads, pages;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (sscanf(buf, "%u %u", &threads, &pages) != 2 || !threads ||
+	    threads > ZRAM_RW_BENCH_THREADS || !pages)
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		ret = zram_rw_bench(zram, threads, pages);
+	else
+		ret = -ENODEV;
+	mutex_unlock(&zram->init_lock);
+
+	return ret ? ret : len;
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	char *p;
+	ssize_t ret;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->backing_dev) {
+		ret = sprintf(buf, "none\n");
+		goto out;
+	}
+
+	p = d_path(&zram->backing_dev->f_path, buf, PAGE_SIZE - 1);
+	if (IS_ERR(p)) {
+		ret = PTR_ERR(p);
+		goto out;
+	}
+	ret = strlen(p);
+	memmove(buf, p, ret);
+	buf[ret++] = '\n';
+out:
+	mutex_unlock(&zram->init_lock);
+	return ret;
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	char *name;
+	struct zram *zram = dev_to_zram(dev);
+
+	name = kstrndup(buf, len, GFP_KERNEL);
+	if (!name)
+		return -ENOMEM;
+	strim(name);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		pr_info("Cannot change backing device for initialized "
+			"device\n");
+		ret = -EBUSY;
+	} else {
+		ret = zram_set_backing_dev(zram, name);
+	}
+	mutex_unlock(&zram->init_lock);
+
+	kfree(name);
+	return ret ? ret : len;
+}
+
+/* "all", or the number of seconds a page must have gone unaccessed */
+static ssize_t idle_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret = 0;
+	unsigned long secs = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (!sysfs_streq(buf, "all")) {
+		ret = strict_strtoul(buf, 10, &secs);
+		if (ret)
+			return ret;
+		if (!secs)
+			return -EINVAL;
+	}
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		zram_mark_idle(zram, secs * HZ);
+	else
+		ret = -ENODEV;
+	mutex_unlock(&zram->init_lock);
+
+	return ret ? ret : len;
+}
+
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret, mode;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (sysfs_streq(buf, "huge"))
+		mode = ZRAM_WB_HUGE;
+	else if (sysfs_streq(buf, "idle"))
+		mode = ZRAM_WB_IDLE;
+	else
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		ret = zram_writeback(zram, mode);
+	else
+		ret = -ENODEV;
+	mutex_unlock(&zram->init_lock);
+
+	return ret ? ret : len;
+}
+
+static ssize_t bd_count_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", atomic_read(&zram->stats.bd_count));
+}
+
+static ssize_t bd_reads_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.bd_reads));
+}
+
+static ssize_t bd_writes_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.bd_writes));
+}
+#endif
+
 static ssize_t initstate_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -153,7 +449,42 @@ static ssize_t zero_pages_show(struct device *dev,
 {
 	struct zram *zram = dev_to_zram(dev);
 
-	return sprintf(buf, "%u\n", zram->stats.pages_zero);
+	return sprintf(buf, "%u\n", atomic_read(&zram->stats.pages_zero));
+}
+
+static ssize_t same_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%u\n", atomic_read(&zram->stats.pages_same));
+}
+
+static ssize_t dedup_checks_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dedup_checks));
+}
+
+static ssize_t dedup_hits_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dedup_hits));
+}
+
+static ssize_t dedup_saved_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dedup_saved));
 }
 
 static ssize_t orig_data_size_show(struct device *dev,
@@ -162,7 +493,7 @@ static ssize_t orig_data_size_show(struct device *dev,
 	struct zram *zram = dev_to_zram(dev);
 
 	return sprintf(buf, "%llu\n",
-		(u64)(zram->stats.pages_stored) << PAGE_SHIFT);
+		(u64)atomic_read(&zram->stats.pages_stored) << PAGE_SHIFT);
 }
 
 static ssize_t compr_data_size_show(struct device *dev,
@@ -182,7 +513,7 @@ static ssize_t mem_used_total_show(struct device *dev,
 
 	if (zram->init_done) {
 		val = xv_get_total_size_bytes(zram->mem_pool) +
-			((u64)(zram->stats.pages_expand) << PAGE_SHIFT);
+			((u64)atomic_read(&zram->stats.pages_expand) << PAGE_SHIFT);
 	}
 
 	return sprintf(buf, "%llu\n", val);
@@ -190,6 +521,22 @@ static ssize_t mem_used_total_show(struct device *dev,
 
 static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR,
 		disksize_show, disksize_store);
+static DEVICE_ATTR(dedup, S_IRUGO | S_IWUSR, dedup_show, dedup_store);
+static DEVICE_ATTR(comp_algorithm, S_IRUGO | S_IWUSR,
+		comp_algorithm_show, comp_algorithm_store);
+static DEVICE_ATTR(comp_bench, S_IRUGO | S_IWUSR,
+		comp_bench_show, comp_bench_store);
+static DEVICE_ATTR(rw_bench, S_IRUGO | S_IWUSR,
+		rw_bench_show, rw_bench_store);
+#ifdef CONFIG_ZRAM_WRITEBACK
+static DEVICE_ATTR(backing_dev, S_IRUGO | S_IWUSR,
+		backing_dev_show, backing_dev_store);
+static DEVICE_ATTR(idle, S_IWUSR, NULL, idle_store);
+static DEVICE_ATTR(writeback, S_IWUSR, NULL, writeback_store);
+static DEVICE_ATTR(bd_count, S_IRUGO, bd_count_show, NULL);
+static DEVICE_ATTR(bd_reads, S_IRUGO, bd_reads_show, NULL);
+static DEVICE_ATTR(bd_writes, S_IRUGO, bd_writes_show, NULL);
+#endif
 static DEVICE_ATTR(initstate, S_IRUGO, initstate_show, NULL);
 static DEVICE_ATTR(reset, S_IWUSR, NULL, reset_store);
 static DEVICE_ATTR(num_reads, S_IRUGO, num_reads_show, NULL);
@@ -197,12 +544,20 @@ static DEVICE_ATTR(num_writes, S_IRUGO, num_writes_show, NULL);
 static DEVICE_ATTR(invalid_io, S_IRUGO, invalid_io_show, NULL);
 static DEVICE_ATTR(notify_free, S_IRUGO, notify_free_show, NULL);
 static DEVICE_ATTR(zero_pages, S_IRUGO, zero_pages_show, NULL);
+static DEVICE_ATTR(same_pages, S_IRUGO, same_pages_show, NULL);
+static DEVICE_ATTR(dedup_checks, S_IRUGO, dedup_checks_show, NULL);
+static DEVICE_ATTR(dedup_hits, S_IRUGO, dedup_hits_show, NULL);
+static DEVICE_ATTR(dedup_saved, S_IRUGO, dedup_saved_show, NULL);
 static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
 static DEVICE_ATTR(compr_data_size, S_IRUGO, compr_data_size_show, NULL);
 static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
 
 static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_disksize.attr,
+	&dev_attr_dedup.attr,
+	&dev_attr_comp_algorithm.attr,
+	&dev_attr_comp_bench.attr,
+	&dev_attr_rw_bench.attr,
 	&dev_attr_initstate.attr,
 	&dev_attr_reset.attr,
 	&dev_attr_num_reads.attr,
@@ -210,9 +565,21 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_invalid_io.attr,
 	&dev_attr_notify_free.attr,
 	&dev_attr_zero_pages.attr,
+	&dev_attr_same_pages.attr,
+	&dev_attr_dedup_checks.attr,
+	&dev_attr_dedup_hits.attr,
+	&dev_attr_dedup_saved.attr,
 	&dev_attr_orig_data_size.attr,
 	&dev_attr_compr_data_size.attr,
 	&dev_attr_mem_used_total.attr,
+#ifdef CONFIG_ZRAM_WRITEBACK
+	&dev_attr_backing_dev.attr,
+	&dev_attr_idle.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_bd_count.attr,
+	&dev_attr_bd_reads.attr,
+	&dev_attr_bd_writes.attr,
+#endif
 	NULL,
 };
 
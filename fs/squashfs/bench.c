@@ -0,0 +1,386 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * bench.c
+ */
+
+/*
+ * This file implements a benchmark of concurrent cold reads, to measure
+ * how reads scale with the number of decompressor streams.
+ *
+ * Each mounted filesystem gets a debugfs file, squashfs/<dev>/bench.
+ * Writing a number of threads to it drops the cached data of the
+ * filesystem and has that many threads read every regular file in it,
+ * taking inodes in turn.  Reading the file gives the result of the last
+ * run.  Inodes are found through the inode lookup table, so the
+ * filesystem must be exportable (the mksquashfs default).
+ *
+ * The debugfs file can still be open when the filesystem is unmounted, so
+ * the benchmark state is reference counted, and the superblock pointer is
+ * cleared under the lock at umount.
+ */
+
+#include <linux/fs.h>
+#include <linux/vfs.h>
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/pagemap.h>
+#include <linux/debugfs.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/uaccess.h>
+#include <linux/sched.h>
+#include <linux/kref.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs.h"
+#include "decompressor.h"
+
+#define SQUASHFS_BENCH_MAX_THREADS	32
+
+struct squashfs_bench {
+	struct kref		ref;	/* the mount and each open file */
+	struct super_block	*sb;	/* NULL once unmounted, under lock */
+	struct dentry		*dir;
+	struct mutex		lock;	/* one run at a time */
+
+	/* State of the run in progress */
+	atomic_t		next_ino;
+	atomic_t		running;
+	atomic_t		files;
+	atomic_t		errors;
+	atomic64_t		bytes;
+	struct completion	done;
+
+	/* Result of the last run */
+	int			threads;
+	int			streams;
+	u64			ns;
+	unsigned long		waits;
+	u64			wait_ns;
+};
+
+static struct dentry *squashfs_debugfs_root;
+
+
+static void squashfs_bench_read_inode(struct squashfs_bench *bench,
+	unsigned int ino_num)
+{
+	struct super_block *sb = bench->sb;
+	struct address_space *mapping;
+	struct inode *inode;
+	struct page *page;
+	long long ino;
+	pgoff_t index, pages;
+	loff_t size;
+
+	ino = squashfs_inode_lookup(sb, ino_num);
+	if (ino < 0)
+		goto failed;
+
+	inode = squashfs_iget(sb, ino, ino_num);
+	if (IS_ERR(inode))
+		goto failed;
+
+	if (!S_ISREG(inode->i_mode))
+		goto out;
+
+	mapping = inode->i_mapping;
+	size = i_size_read(inode);
+	pages = (size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+
+	invalidate_mapping_pages(mapping, 0, -1);
+
+	for (index = 0; index < pages; index++) {
+		page = read_mapping_page(mapping, index, NULL);
+		if (IS_ERR(page)) {
+			atomic_inc(&bench->errors);
+			break;
+		}
+		page_cache_release(page);
+	}
+
+	atomic_inc(&bench->files);
+	atomic64_add(size, &bench->bytes);
+
+out:
+	iput(inode);
+	return;
+
+failed:
+	atomic_inc(&bench->errors);
+}
+
+
+static int squashfs_bench_thread(void *data)
+{
+	struct squashfs_bench *bench = data;
+	struct squashfs_sb_info *msblk = bench->sb->s_fs_info;
+	unsigned int ino_num;
+
+	while ((ino_num = atomic_inc_return(&bench->next_ino)) <=
+							msblk->inodes)
+		squashfs_bench_read_inode(bench, ino_num);
+
+	if (atomic_dec_and_test(&bench->running))
+		complete(&bench->done);
+
+	return 0;
+}
+
+
+static void squashfs_bench_pool_stats(struct squashfs_sb_info *msblk,
+	unsigned long *waits, u64 *wait_ns)
+{
+	struct squashfs_stream_pool *pool = msblk->streams;
+
+	spin_lock(&pool->lock);
+	*waits = pool->waits;
+	*wait_ns = pool->wait_ns;
+	spin_unlock(&pool->lock);
+}
+
+
+static int squashfs_bench_run(struct squashfs_bench *bench, int threads)
+{
+	struct super_block *sb = bench->sb;
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	struct task_struct *task;
+	unsigned long waits;
+	u64 start, wait_ns;
+	int i;
+
+	if (msblk->inode_lookup_table == NULL)
+		return -EOPNOTSUPP;
+
+	atomic_set(&bench->next_ino, 0);
+	atomic_set(&bench->running, 1);
+	atomic_set(&bench->files, 0);
+	atomic_set(&bench->errors, 0);
+	atomic64_set(&bench->bytes, 0);
+	init_completion(&bench->done);
+
+	/* Make the reads cold, the compressed data too */
+	invalidate_bdev(sb->s_bdev);
+
+	squashfs_bench_pool_stats(msblk, &waits, &wait_ns);
+	start = local_clock();
+
+	for (i = 0; i < threads; i++) {
+		atomic_inc(&bench->running);
+		task = kthread_run(squashfs_bench_thread, bench,
+			"squashfs_bench/%d", i);
+		if (IS_ERR(task)) {
+			atomic_dec(&bench->running);
+			break;
+		}
+	}
+
+	/* Drop the reference held while starting the threads */
+	if (!atomic_dec_and_test(&bench->running))
+		wait_for_completion(&bench->done);
+
+	bench->ns = local_clock() - start;
+	bench->threads = i;
+	bench->streams = msblk->streams->max;
+
+	squashfs_bench_pool_stats(msblk, &bench->waits, &bench->wait_ns);
+	bench->waits -= waits;
+	bench->wait_ns -= wait_ns;
+
+	return i ? 0 : -ENOMEM;
+}
+
+
+static ssize_t squashfs_bench_write(struct file *file,
+	const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct squashfs_bench *bench = file->private_data;
+	char kbuf[16];
+	unsigned long threads;
+	int err;
+
+	if (count >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, buf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+
+	err = strict_strtoul(strstrip(kbuf), 10, &threads);
+	if (err)
+		return err;
+	if (threads == 0 || threads > SQUASHFS_BENCH_MAX_THREADS)
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&bench->lock))
+		return -ERESTARTSYS;
+	if (bench->sb == NULL) {
+		err = -ENODEV;
+		goto out;
+	}
+	/*
+	 * Hold off umount while the threads use the filesystem.  Umount
+	 * takes bench->lock with s_umount held, so do not wait for it.
+	 */
+	if (!down_read_trylock(&bench->sb->s_umount)) {
+		err = -EBUSY;
+		goto out;
+	}
+	err = squashfs_bench_run(bench, threads);
+	up_read(&bench->sb->s_umount);
+out:
+	mutex_unlock(&bench->lock);
+
+	return err ? err : count;
+}
+
+
+static ssize_t squashfs_bench_read(struct file *file, char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct squashfs_bench *bench = file->private_data;
+	u64 bytes, us, kbps = 0;
+	char kbuf[256];
+	int len;
+
+	mutex_lock(&bench->lock);
+	bytes = atomic64_read(&bench->bytes);
+	us = div_u64(bench->ns, NSEC_PER_USEC);
+	if (us)
+		kbps = div64_u64(bytes * USEC_PER_SEC, us) >> 10;
+
+	len = scnprintf(kbuf, sizeof(kbuf),
+		"threads:     %d\n"
+		"streams:     %d\n"
+		"files:       %d\n"
+		"errors:      %d\n"
+		"bytes:       %llu\n"
+		"time_us:     %llu\n"
+		"KiB/s:       %llu\n"
+		"waits:       %lu\n"
+		"wait_us:     %llu\n",
+		bench->threads, bench->streams,
+		atomic_read(&bench->files), atomic_read(&bench->errors),
+		bytes, us, kbps, bench->waits,
+		div_u64(bench->wait_ns, NSEC_PER_USEC));
+	mutex_unlock(&bench->lock);
+
+	return simple_read_from_buffer(buf, count, ppos, kbuf, len);
+}
+
+
+static void squashfs_bench_free(struct kref *ref)
+{
+	kfree(container_of(ref, struct squashfs_bench, ref));
+}
+
+
+static int squashfs_bench_open(struct inode *inode, struct file *file)
+{
+	struct squashfs_bench *bench = inode->i_private;
+
+	kref_get(&bench->ref);
+	file->private_data = bench;
+	return 0;
+}
+
+
+static int squashfs_bench_release(struct inode *inode, struct file *file)
+{
+	struct squashfs_bench *bench = file->private_data;
+
+	kref_put(&bench->ref, squashfs_bench_free);
+	return 0;
+}
+
+
+static const struct file_operations squashfs_bench_fops = {
+	.owner = THIS_MODULE,
+	.open = squashfs_bench_open,
+	.release = squashfs_bench_release,
+	.read = squashfs_bench_read,
+	.write = squashfs_bench_write,
+	.llseek = default_llseek,
+};
+
+
+void squashfs_bench_add(struct super_block *sb)
+{
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	struct squashfs_bench *bench;
+
+	if (squashfs_debugfs_root == NULL)
+		return;
+
+	bench = kzalloc(sizeof(*bench), GFP_KERNEL);
+	if (bench == NULL)
+		return;
+
+	kref_init(&bench->ref);
+	bench->sb = sb;
+	mutex_init(&bench->lock);
+
+	bench->dir = debugfs_create_dir(sb->s_id, squashfs_debugfs_root);
+	if (IS_ERR_OR_NULL(bench->dir) ||
+			debugfs_create_file("bench", S_IRUSR | S_IWUSR,
+			bench->dir, bench, &squashfs_bench_fops) == NULL) {
+		if (!IS_ERR_OR_NULL(bench->dir))
+			debugfs_remove_recursive(bench->dir);
+		kfree(bench);
+		return;
+	}
+
+	msblk->bench = bench;
+}
+
+
+void squashfs_bench_remove(struct super_block *sb)
+{
+	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	struct squashfs_bench *bench = msblk->bench;
+
+	if (bench == NULL)
+		return;
+
+	debugfs_remove_recursive(bench->dir);
+
+	/* Files still open see -ENODEV from now on */
+	mutex_lock(&bench->lock);
+	bench->sb = NULL;
+	mutex_unlock(&bench->lock);
+
+	kref_put(&bench->ref, squashfs_bench_free);
+	msblk->bench = NULL;
+}
+
+
+int __init squashfs_bench_init(void)
+{
+	squashfs_debugfs_root = debugfs_create_dir("squashfs", NULL);
+	if (IS_ERR(squashfs_debugfs_root))
+		squashfs_debugfs_root = NULL;
+
+	return 0;
+}
+
+
+void squashfs_bench_exit(void)
+{
+	debugfs_remove_recursive(squashfs_debugfs_root);
+}
@@ -22,8 +22,11 @@
  */
 
 #include <linux/types.h>
-#include <linux/mutex.h>
+#include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/seq_file.h>
 #include <linux/buffer_head.h>
 
 #include "squashfs_fs.h"
@@ -77,11 +80,143 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 }
 
 
-void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
+/*
+ * Number of streams a superblock may use, so that many blocks can be
+ * decompressed at once. 0 means one per online CPU. Even a single CPU
+ * gains from a second stream, a reader waiting on its buffers no longer
+ * stalls readers whose data is already in memory.
+ */
+static int decomp_streams = CONFIG_SQUASHFS_DECOMP_STREAMS;
+module_param(decomp_streams, int, 0644);
+MODULE_PARM_DESC(decomp_streams,
+	"Decompressor streams per mount (0 = one per CPU)");
+
+struct squashfs_stream {
+	void			*stream;
+	struct list_head	list;
+};
+
+
+static struct squashfs_stream *squashfs_stream_create(
+	struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = msblk->streams;
+	struct squashfs_stream *s = kmalloc(sizeof(*s), GFP_KERNEL);
+
+	if (s == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	s->stream = msblk->decompressor->init(msblk, pool->comp_opts,
+		pool->comp_opts_len);
+	if (IS_ERR(s->stream)) {
+		int err = PTR_ERR(s->stream);
+
+		kfree(s);
+		return ERR_PTR(err);
+	}
+
+	return s;
+}
+
+
+/*
+ * Get an idle stream, creating one if the pool has not grown to its
+ * maximum yet, else wait for one to be put back.
+ */
+static struct squashfs_stream *squashfs_stream_get(
+	struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = msblk->streams;
+	struct squashfs_stream *s;
+	u64 start = 0;
+
+	spin_lock(&pool->lock);
+	pool->reads++;
+
+	while (list_empty(&pool->idle)) {
+		if (pool->created < pool->max) {
+			pool->created++;
+			spin_unlock(&pool->lock);
+
+			s = squashfs_stream_create(msblk);
+
+			spin_lock(&pool->lock);
+			if (!IS_ERR(s))
+				goto got_stream;
+
+			/*
+			 * Out of memory, make do with the streams there are.
+			 * There is always at least one, created at mount.
+			 */
+			pool->created--;
+			pool->max = pool->created;
+			WARNING("decompressor stream allocation failed, "
+				"limited to %d streams\n", pool->max);
+			continue;
+		}
+
+		if (start == 0) {
+			start = local_clock();
+			pool->waits++;
+		}
+		spin_unlock(&pool->lock);
+
+		wait_event(pool->wait, !list_empty(&pool->idle));
+
+		spin_lock(&pool->lock);
+	}
+
+	s = list_entry(pool->idle.next, struct squashfs_stream, list);
+	list_del(&s->list);
+
+got_stream:
+	if (start)
+		pool->wait_ns += local_clock() - start;
+	if (++pool->busy > pool->peak)
+		pool->peak = pool->busy;
+	spin_unlock(&pool->lock);
+
+	return s;
+}
+
+
+static void squashfs_stream_put(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *s)
+{
+	struct squashfs_stream_pool *pool = msblk->streams;
+
+	spin_lock(&pool->lock);
+	list_add(&s->list, &pool->idle);
+	pool->busy--;
+	spin_unlock(&pool->lock);
+
+	wake_up(&pool->wait);
+}
+
+
+int squashfs_decompress(struct squashfs_sb_info *msblk, void **buffer,
+	struct buffer_head **bh, int b, int offset, int length, int srclength,
+	int pages)
+{
+	struct squashfs_stream *s = squashfs_stream_get(msblk);
+	int res;
+
+	res = msblk->decompressor->decompress(msblk, s->stream, buffer, bh, b,
+		offset, length, srclength, pages);
+
+	squashfs_stream_put(msblk, s);
+
+	return res;
+}
+
+
+int squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
 {
 	struct squashfs_sb_info *msblk = sb->s_fs_info;
-	void *strm, *buffer = NULL;
-	int length = 0;
+	struct squashfs_stream_pool *pool;
+	struct squashfs_stream *s;
+	void *buffer = NULL;
+	int length = 0, err;
 
 	/*
 	 * Read decompressor specific options from file system if present
@@ -89,22 +224,100 @@ void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
 	if (SQUASHFS_COMP_OPTS(flags)) {
 		buffer = kmalloc(PAGE_CACHE_SIZE, GFP_KERNEL);
 		if (buffer == NULL)
-			return ERR_PTR(-ENOMEM);
+			return -ENOMEM;
 
 		length = squashfs_read_data(sb, &buffer,
 			sizeof(struct squashfs_super_block), 0, NULL,
 			PAGE_CACHE_SIZE, 1);
 
 		if (length < 0) {
-			strm = ERR_PTR(length);
-			goto finished;
+			err = length;
+			goto failed;
 		}
 	}
 
-	strm = msblk->decompressor->init(msblk, buffer, length);
+	err = -ENOMEM;
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (pool == NULL)
+		goto failed;
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->idle);
+	init_waitqueue_head(&pool->wait);
+	pool->max = decomp_streams > 0 ? decomp_streams : num_online_cpus();
+	pool->comp_opts = buffer;
+	pool->comp_opts_len = length;
+	msblk->streams = pool;
+
+	/*
+	 * Create the first stream now, so that bad compression options
+	 * fail the mount
+	 */
+	s = squashfs_stream_create(msblk);
+	if (IS_ERR(s)) {
+		err = PTR_ERR(s);
+		msblk->streams = NULL;
+		kfree(pool);
+		goto failed;
+	}
+
+	list_add(&s->list, &pool->idle);
+	pool->created = 1;
 
-finished:
+	return 0;
+
+failed:
 	kfree(buffer);
+	return err;
+}
+
+
+void squashfs_decompressor_free(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = msblk->streams;
+	struct squashfs_stream *s, *next;
+
+	if (pool == NULL)
+		return;
+
+	list_for_each_entry_safe(s, next, &pool->idle, list) {
+		msblk->decompressor->free(s->stream);
+		kfree(s);
+	}
+
+	kfree(pool->comp_opts);
+	kfree(pool);
+	msblk->streams = NULL;
+}
+
+
+/*
+ * Report how much readers contend for the streams, in
+ * /proc/self/mountstats
+ */
+int squashfs_decompressor_stats(struct seq_file *m,
+	struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = msblk->streams;
+	unsigned long reads, waits;
+	int created, max, peak;
+	u64 wait_ns;
+
+	spin_lock(&pool->lock);
+	created = pool->created;
+	max = pool->max;
+	peak = pool->peak;
+	reads = pool->reads;
+	waits = pool->waits;
+	wait_ns = pool->wait_ns;
+	spin_unlock(&pool->lock);
+
+	seq_printf(m, "\n\tdecompressor: %s\n", msblk->decompressor->name);
+	seq_printf(m, "\tstreams: %d created, %d max, %d peak busy\n",
+		created, max, peak);
+	seq_printf(m, "\tdecompressions: %lu, %lu waited for a stream, "
+		"%llu us waiting\n", reads, waits,
+		(unsigned long long)div_u64(wait_ns, NSEC_PER_USEC));
 
-	return strm;
+	return 0;
 }
@@ -23,30 +23,39 @@
  * decompressor.h
  */
 
+/*
+ * A decompressor stream is only ever used by one reader at a time, the
+ * pool in decompressor.c hands them out.
+ */
 struct squashfs_decompressor {
 	void	*(*init)(struct squashfs_sb_info *, void *, int);
 	void	(*free)(void *);
-	int	(*decompress)(struct squashfs_sb_info *, void **,
+	int	(*decompress)(struct squashfs_sb_info *, void *, void **,
 		struct buffer_head **, int, int, int, int, int);
 	int	id;
 	char	*name;
 	int	supported;
 };
 
-static inline void squashfs_decompressor_free(struct squashfs_sb_info *msblk,
-	void *s)
-{
-	if (msblk->decompressor)
-		msblk->decompressor->free(s);
-}
-
-static inline int squashfs_decompress(struct squashfs_sb_info *msblk,
-	void **buffer, struct buffer_head **bh, int b, int offset, int length,
-	int srclength, int pages)
-{
-	return msblk->decompressor->decompress(msblk, buffer, bh, b, offset,
-		length, srclength, pages);
-}
+/*
+ * The streams of a superblock. Streams beyond the first are created when
+ * readers would otherwise have to wait, up to max.
+ */
+struct squashfs_stream_pool {
+	spinlock_t		lock;
+	struct list_head	idle;
+	wait_queue_head_t	wait;
+	int			created;
+	int			max;
+	void			*comp_opts;	/* to create more streams */
+	int			comp_opts_len;
+	/* Contention statistics, protected by lock */
+	int			busy;
+	int			peak;		/* most streams busy at once */
+	unsigned long		reads;
+	unsigned long		waits;		/* reads that had to wait */
+	u64			wait_ns;	/* total time they waited */
+};
 
 #ifdef CONFIG_SQUASHFS_XZ
 extern const struct squashfs_decompressor squashfs_xz_comp_ops;
@@ -410,8 +410,15 @@ static int squashfs_readpage(struct file *file, struct page *page)
 			sparse = 1;
 		} else {
 			/*
-			 * Read and decompress datablock.
+			 * Read and decompress datablock straight into the
+			 * page cache if possible, else through the cache.
 			 */
+			int res = squashfs_readpage_block(page, block, bsize);
+			if (res == 0)
+				return 0;
+			if (res != -ENOMEM)
+				goto error_out;
+
 			buffer = squashfs_get_datablock(inode->i_sb,
 								block, bsize);
 			if (buffer->error) {
@@ -461,8 +468,10 @@ static int squashfs_readpage(struct file *file, struct page *page)
 		if (!push_page)
 			continue;
 
-		if (PageUptodate(push_page))
+		if (PageUptodate(push_page)) {
+			atomic_long_inc(&msblk->cached_pages);
 			goto skip_page;
+		}
 
 		pageaddr = kmap_atomic(push_page, KM_USER0);
 		squashfs_copy_data(pageaddr, buffer, offset, avail);
@@ -470,6 +479,8 @@ static int squashfs_readpage(struct file *file, struct page *page)
 		kunmap_atomic(pageaddr, KM_USER0);
 		flush_dcache_page(push_page);
 		SetPageUptodate(push_page);
+		if (!sparse)
+			atomic_long_inc(&msblk->copied_pages);
 skip_page:
 		unlock_page(push_page);
 		if (i != page->index)
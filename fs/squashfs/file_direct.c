@@ -0,0 +1,159 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * file_direct.c
+ */
+
+/*
+ * This file implements reading a datablock straight into the page cache.
+ *
+ * A datablock (by default 128 KiB) covers many pages.  Rather than
+ * decompressing it into the read_page cache and copying it from there
+ * into each page, the pages of the block are grabbed from the page cache
+ * and the block is decompressed into them.  Pages that are already up to
+ * date, or cannot be grabbed because someone else has them locked, are
+ * decompressed into a scratch page and dropped.
+ *
+ * Fragments are shared between files, so they still go through the
+ * fragment cache.
+ */
+
+#include <linux/fs.h>
+#include <linux/vfs.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "squashfs.h"
+
+/*
+ * Read the datablock containing target_page.  Returns -ENOMEM, with
+ * target_page untouched and still locked, if the caller should read
+ * the block through the cache instead.  Otherwise target_page has been
+ * filled and unlocked, or an error is returned for the caller to
+ * mark it.
+ */
+int squashfs_readpage_block(struct page *target_page, u64 block, int bsize)
+{
+	struct inode *inode = target_page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	pgoff_t start_index = target_page->index & ~mask;
+	pgoff_t end_index = start_index | mask;
+	pgoff_t file_end = (i_size_read(inode) - 1) >> PAGE_CACHE_SHIFT;
+	struct page **page, *scratch = NULL;
+	void **buffer;
+	int i, pages, missing = 0, cached = 0, bytes, res = -ENOMEM;
+
+	if (end_index > file_end)
+		end_index = file_end;
+	pages = end_index - start_index + 1;
+
+	page = kmalloc(pages * sizeof(*page), GFP_KERNEL);
+	buffer = kmalloc(pages * sizeof(*buffer), GFP_KERNEL);
+	if (page == NULL || buffer == NULL)
+		goto out;
+
+	/*
+	 * Grab the other pages of the block, without waiting for ones
+	 * locked by someone else (possibly reading this block too).
+	 */
+	for (i = 0; i < pages; i++) {
+		pgoff_t index = start_index + i;
+
+		if (index == target_page->index) {
+			page[i] = target_page;
+			continue;
+		}
+
+		page[i] = grab_cache_page_nowait(target_page->mapping, index);
+		if (page[i] && PageUptodate(page[i])) {
+			unlock_page(page[i]);
+			page_cache_release(page[i]);
+			page[i] = NULL;
+			cached++;
+		}
+		if (page[i] == NULL)
+			missing++;
+	}
+
+	if (missing) {
+		scratch = alloc_page(GFP_KERNEL);
+		if (scratch == NULL)
+			goto release_pages;
+	}
+
+	for (i = 0; i < pages; i++)
+		buffer[i] = page[i] ? kmap(page[i]) : page_address(scratch);
+
+	res = squashfs_read_data(inode->i_sb, buffer, block, bsize, NULL,
+		msblk->block_size, pages);
+
+	/* Zero the rest of the block past the data, as the cache path does */
+	for (bytes = res, i = 0; i < pages; i++, bytes -= PAGE_CACHE_SIZE) {
+		if (page[i] == NULL)
+			continue;
+		if (res >= 0 && bytes < (int) PAGE_CACHE_SIZE)
+			memset(buffer[i] + max(bytes, 0), 0,
+				PAGE_CACHE_SIZE - max(bytes, 0));
+		kunmap(page[i]);
+	}
+
+	if (res < 0) {
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+		goto release_pages;
+	}
+
+	for (i = 0; i < pages; i++) {
+		if (page[i] == NULL)
+			continue;
+		flush_dcache_page(page[i]);
+		SetPageUptodate(page[i]);
+		unlock_page(page[i]);
+		if (page[i] != target_page)
+			page_cache_release(page[i]);
+	}
+
+	atomic_long_inc(&msblk->direct_blocks);
+	atomic_long_add(pages - missing, &msblk->direct_pages);
+	atomic_long_add(cached, &msblk->cached_pages);
+	atomic_long_add(missing - cached, &msblk->discarded_pages);
+	res = 0;
+	goto out;
+
+release_pages:
+	/* Leave target_page to the caller, the others are read again later */
+	for (i = 0; i < pages; i++) {
+		if (page[i] == NULL || page[i] == target_page)
+			continue;
+		unlock_page(page[i]);
+		page_cache_release(page[i]);
+	}
+
+out:
+	if (scratch)
+		__free_page(scratch);
+	kfree(buffer);
+	kfree(page);
+	return res;
+}
@@ -48,12 +48,34 @@ extern void *squashfs_read_table(struct super_block *, u64, int);
 
 /* decompressor.c */
 extern const struct squashfs_decompressor *squashfs_lookup_decompressor(int);
-extern void *squashfs_decompressor_init(struct super_block *, unsigned short);
+extern int squashfs_decompressor_init(struct super_block *, unsigned short);
+extern void squashfs_decompressor_free(struct squashfs_sb_info *);
+extern int squashfs_decompress(struct squashfs_sb_info *, void **,
+				struct buffer_head **, int, int, int, int, int);
+extern int squashfs_decompressor_stats(struct seq_file *,
+				struct squashfs_sb_info *);
+
+/* bench.c */
+#ifdef CONFIG_SQUASHFS_BENCH
+extern int squashfs_bench_init(void);
+extern void squashfs_bench_exit(void);
+extern void squashfs_bench_add(struct super_block *);
+extern void squashfs_bench_remove(struct super_block *);
+#else
+static inline int squashfs_bench_init(void) { return 0; }
+static inline void squashfs_bench_exit(void) { }
+static inline void squashfs_bench_add(struct super_block *sb) { }
+static inline void squashfs_bench_remove(struct super_block *sb) { }
+#endif
 
 /* export.c */
+extern long long squashfs_inode_lookup(struct super_block *, int);
 extern __le64 *squashfs_read_inode_lookup_table(struct super_block *, u64, u64,
 				unsigned int);
 
+/* file_direct.c */
+extern int squashfs_readpage_block(struct page *, u64, int);
+
 /* fragment.c */
 extern int squashfs_frag_lookup(struct super_block *, unsigned int, u64 *);
 extern __le64 *squashfs_read_fragment_index_table(struct super_block *,
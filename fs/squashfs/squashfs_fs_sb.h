@@ -62,10 +62,9 @@ struct squashfs_sb_info {
 	__le64					*id_table;
 	__le64					*fragment_index;
 	__le64					*xattr_id_table;
-	struct mutex				read_data_mutex;
 	struct mutex				meta_index_mutex;
 	struct meta_index			*meta_index;
-	void					*stream;
+	struct squashfs_stream_pool		*streams;
 	__le64					*inode_lookup_table;
 	u64					inode_table;
 	u64					directory_table;
@@ -75,5 +74,14 @@ struct squashfs_sb_info {
 	long long				bytes_used;
 	unsigned int				inodes;
 	int					xattr_ids;
+	/* How file pages were filled, shown in /proc/self/mountstats */
+	atomic_long_t				direct_blocks;
+	atomic_long_t				direct_pages;
+	atomic_long_t				cached_pages;
+	atomic_long_t				discarded_pages;
+	atomic_long_t				copied_pages;
+#ifdef CONFIG_SQUASHFS_BENCH
+	struct squashfs_bench			*bench;
+#endif
 };
 #endif
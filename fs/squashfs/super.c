@@ -36,6 +36,8 @@
 #include <linux/module.h>
 #include <linux/magic.h>
 #include <linux/xattr.h>
+#include <linux/mount.h>
+#include <linux/seq_file.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -98,7 +100,6 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	msblk->devblksize = sb_min_blocksize(sb, BLOCK_SIZE);
 	msblk->devblksize_log2 = ffz(~msblk->devblksize);
 
-	mutex_init(&msblk->read_data_mutex);
 	mutex_init(&msblk->meta_index_mutex);
 
 	/*
@@ -200,20 +201,22 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	if (msblk->block_cache == NULL)
 		goto failed_mount;
 
-	/* Allocate read_page block */
+	err = squashfs_decompressor_init(sb, flags);
+	if (err)
+		goto failed_mount;
+
+	/*
+	 * Allocate read_page block.  Datablocks are normally decompressed
+	 * straight into the page cache (file_direct.c), this is only used
+	 * when that cannot allocate its pages, so one entry is enough
+	 */
+	err = -ENOMEM;
 	msblk->read_page = squashfs_cache_init("data", 1, msblk->block_size);
 	if (msblk->read_page == NULL) {
 		ERROR("Failed to allocate read_page block\n");
 		goto failed_mount;
 	}
 
-	msblk->stream = squashfs_decompressor_init(sb, flags);
-	if (IS_ERR(msblk->stream)) {
-		err = PTR_ERR(msblk->stream);
-		msblk->stream = NULL;
-		goto failed_mount;
-	}
-
 	/* Handle xattrs */
 	sb->s_xattr = squashfs_xattr_handlers;
 	xattr_id_table_start = le64_to_cpu(sblk->xattr_id_table_start);
@@ -324,6 +327,8 @@ check_directory_table:
 		goto failed_mount;
 	}
 
+	squashfs_bench_add(sb);
+
 	TRACE("Leaving squashfs_fill_super\n");
 	kfree(sblk);
 	return 0;
@@ -332,7 +337,7 @@ failed_mount:
 	squashfs_cache_delete(msblk->block_cache);
 	squashfs_cache_delete(msblk->fragment_cache);
 	squashfs_cache_delete(msblk->read_page);
-	squashfs_decompressor_free(msblk, msblk->stream);
+	squashfs_decompressor_free(msblk);
 	kfree(msblk->inode_lookup_table);
 	kfree(msblk->fragment_index);
 	kfree(msblk->id_table);
@@ -372,14 +377,38 @@ static int squashfs_remount(struct super_block *sb, int *flags, char *data)
 }
 
 
+static int squashfs_show_stats(struct seq_file *m, struct vfsmount *mnt)
+{
+	struct squashfs_sb_info *msblk = mnt->mnt_sb->s_fs_info;
+
+	squashfs_decompressor_stats(m, msblk);
+
+	/*
+	 * Data pages decompressed straight into the page cache, found
+	 * there already, decompressed but dropped because someone else had
+	 * them, and copied from the squashfs cache (fragments mostly)
+	 */
+	seq_printf(m, "\tdirect: %ld blocks, %ld pages\n",
+		atomic_long_read(&msblk->direct_blocks),
+		atomic_long_read(&msblk->direct_pages));
+	seq_printf(m, "\tpages: %ld cached, %ld discarded, %ld copied\n",
+		atomic_long_read(&msblk->cached_pages),
+		atomic_long_read(&msblk->discarded_pages),
+		atomic_long_read(&msblk->copied_pages));
+
+	return 0;
+}
+
+
 static void squashfs_put_super(struct super_block *sb)
 {
 	if (sb->s_fs_info) {
 		struct squashfs_sb_info *sbi = sb->s_fs_info;
+		squashfs_bench_remove(sb);
 		squashfs_cache_delete(sbi->block_cache);
 		squashfs_cache_delete(sbi->fragment_cache);
 		squashfs_cache_delete(sbi->read_page);
-		squashfs_decompressor_free(sbi, sbi->stream);
+		squashfs_decompressor_free(sbi);
 		kfree(sbi->id_table);
 		kfree(sbi->fragment_index);
 		kfree(sbi->meta_index);
@@ -438,6 +467,8 @@ static int __init init_squashfs_fs(void)
 		return err;
 	}
 
+	squashfs_bench_init();
+
 	printk(KERN_INFO "squashfs: version 4.0 (2009/01/31) "
 		"Phillip Lougher\n");
 
@@ -447,6 +478,7 @@ static int __init init_squashfs_fs(void)
 
 static void __exit exit_squashfs_fs(void)
 {
+	squashfs_bench_exit();
 	unregister_filesystem(&squashfs_fs_type);
 	destroy_inodecache();
 }
@@ -487,6 +519,7 @@ static const struct super_operations squashfs_super_ops = {
 	.destroy_inode = squashfs_destroy_inode,
 	.statfs = squashfs_statfs,
 	.put_super = squashfs_put_super,
+	.show_stats = squashfs_show_stats,
 	.remount_fs = squashfs_remount
 };
 
@@ -25,9 +25,15 @@
 /*
  * This file provides a single place to access to compression and
  * decompression.
+ *
+ * Every compressor has a crypto API transform per CPU, so that compression
+ * and decompression do not serialize on one shared context. The transform of
+ * the current CPU is used with preemption disabled, which is fine because the
+ * LZO and zlib transforms work in pre-allocated memory and never sleep.
  */
 
 #include <linux/crypto.h>
+#include <linux/percpu.h>
 #include "ubifs.h"
 
 /* Fake description object for the "none" compressor */
@@ -38,11 +44,8 @@ static struct ubifs_compressor none_compr = {
 };
 
 #ifdef CONFIG_UBIFS_FS_LZO
-static DEFINE_MUTEX(lzo_mutex);
-
 static struct ubifs_compressor lzo_compr = {
 	.compr_type = UBIFS_COMPR_LZO,
-	.comp_mutex = &lzo_mutex,
 	.name = "lzo",
 	.capi_name = "lzo",
 };
@@ -54,13 +57,8 @@ static struct ubifs_compressor lzo_compr = {
 #endif
 
 #ifdef CONFIG_UBIFS_FS_ZLIB
-static DEFINE_MUTEX(deflate_mutex);
-static DEFINE_MUTEX(inflate_mutex);
-
 static struct ubifs_compressor zlib_compr = {
 	.compr_type = UBIFS_COMPR_ZLIB,
-	.comp_mutex = &deflate_mutex,
-	.decomp_mutex = &inflate_mutex,
 	.name = "zlib",
 	.capi_name = "deflate",
 };
@@ -97,6 +95,7 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 {
 	int err;
 	struct ubifs_compressor *compr = ubifs_compressors[*compr_type];
+	struct crypto_comp **cc;
 
 	if (*compr_type == UBIFS_COMPR_NONE)
 		goto no_compr;
@@ -105,12 +104,10 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 	if (in_len < UBIFS_MIN_COMPR_LEN)
 		goto no_compr;
 
-	if (compr->comp_mutex)
-		mutex_lock(compr->comp_mutex);
-	err = crypto_comp_compress(compr->cc, in_buf, in_len, out_buf,
+	cc = get_cpu_ptr(compr->cc);
+	err = crypto_comp_compress(*cc, in_buf, in_len, out_buf,
 				   (unsigned int *)out_len);
-	if (compr->comp_mutex)
-		mutex_unlock(compr->comp_mutex);
+	put_cpu_ptr(compr->cc);
 	if (unlikely(err)) {
 		ubifs_warn("cannot compress %d bytes, compressor %s, "
 			   "error %d, leave data uncompressed",
@@ -150,6 +147,7 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 {
 	int err;
 	struct ubifs_compressor *compr;
+	struct crypto_comp **cc;
 
 	if (unlikely(compr_type < 0 || compr_type >= UBIFS_COMPR_TYPES_CNT)) {
 		ubifs_err("invalid compression type %d", compr_type);
@@ -169,12 +167,10 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 		return 0;
 	}
 
-	if (compr->decomp_mutex)
-		mutex_lock(compr->decomp_mutex);
-	err = crypto_comp_decompress(compr->cc, in_buf, in_len, out_buf,
+	cc = get_cpu_ptr(compr->cc);
+	err = crypto_comp_decompress(*cc, in_buf, in_len, out_buf,
 				     (unsigned int *)out_len);
-	if (compr->decomp_mutex)
-		mutex_unlock(compr->decomp_mutex);
+	put_cpu_ptr(compr->cc);
 	if (err)
 		ubifs_err("cannot decompress %d bytes, compressor %s, "
 			  "error %d", in_len, compr->name, err);
@@ -182,6 +178,23 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 	return err;
 }
 
+/**
+ * free_cc - free the per-CPU transforms of a compressor.
+ * @compr: compressor description object
+ */
+static void free_cc(struct ubifs_compressor *compr)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct crypto_comp *cc = *per_cpu_ptr(compr->cc, cpu);
+
+		if (cc)
+			crypto_free_comp(cc);
+	}
+	free_percpu(compr->cc);
+}
+
 /**
  * compr_init - initialize a compressor.
  * @compr: compressor description object
@@ -191,12 +204,25 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
  */
 static int __init compr_init(struct ubifs_compressor *compr)
 {
+	int cpu;
+
 	if (compr->capi_name) {
-		compr->cc = crypto_alloc_comp(compr->capi_name, 0, 0);
-		if (IS_ERR(compr->cc)) {
-			ubifs_err("cannot initialize compressor %s, error %ld",
-				  compr->name, PTR_ERR(compr->cc));
-			return PTR_ERR(compr->cc);
+		compr->cc = alloc_percpu(struct crypto_comp *);
+		if (!compr->cc)
+			return -ENOMEM;
+
+		for_each_possible_cpu(cpu) {
+			struct crypto_comp *cc;
+
+			cc = crypto_alloc_comp(compr->capi_name, 0, 0);
+			if (IS_ERR(cc)) {
+				ubifs_err("cannot initialize compressor %s, "
+					  "error %ld", compr->name,
+					  PTR_ERR(cc));
+				free_cc(compr);
+				return PTR_ERR(cc);
+			}
+			*per_cpu_ptr(compr->cc, cpu) = cc;
 		}
 	}
 
@@ -211,7 +237,7 @@ static int __init compr_init(struct ubifs_compressor *compr)
 static void compr_exit(struct ubifs_compressor *compr)
 {
 	if (compr->capi_name)
-		crypto_free_comp(compr->cc);
+		free_cc(compr);
 	return;
 }
 
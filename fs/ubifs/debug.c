@@ -34,6 +34,9 @@
 #include <linux/moduleparam.h>
 #include <linux/debugfs.h>
 #include <linux/math64.h>
+#include <linux/pagemap.h>
+#include <linux/uaccess.h>
+#include <linux/kref.h>
 
 #ifdef CONFIG_UBIFS_FS_DEBUG
 
@@ -2866,6 +2869,205 @@ static const struct file_operations dfs_fops = {
 	.llseek = no_llseek,
 };
 
+/**
+ * struct ubifs_bench - sequential read benchmark state.
+ * @ref: held by the mount and by each open "bench_read" file
+ * @mutex: serializes benchmark runs and protects the fields below
+ * @c: the file-system, %NULL once it is unmounted
+ * @inum: inode read by the last benchmark run
+ * @err: error code of the last benchmark run
+ * @bulk_read: whether bulk-read was enabled for the last benchmark run
+ * @bytes: how many bytes the last benchmark run read
+ * @ns: how long the last benchmark run took
+ *
+ * The "bench_read" file may still be open when the file-system is unmounted
+ * and its debugfs files are removed, so this is kept apart from @c.
+ */
+struct ubifs_bench {
+	struct kref ref;
+	struct mutex mutex;
+	struct ubifs_info *c;
+	ino_t inum;
+	int err;
+	int bulk_read;
+	long long bytes;
+	u64 ns;
+};
+
+/**
+ * bench_read - read a file sequentially and measure how long it takes.
+ * @bench: benchmark state, with @bench->c set
+ * @inum: inode number of the file to read
+ *
+ * The cached pages of the file are dropped first, so all the data are read
+ * from the flash and decompressed, through bulk-read if it is enabled.
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int bench_read(struct ubifs_bench *bench, ino_t inum)
+{
+	int err = 0;
+	struct ubifs_info *c = bench->c;
+	struct inode *inode;
+	struct page *page;
+	pgoff_t index, pages;
+	loff_t size;
+	u64 start;
+
+	inode = ubifs_iget(c->vfs_sb, inum);
+	if (IS_ERR(inode))
+		return PTR_ERR(inode);
+
+	if (!S_ISREG(inode->i_mode)) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	size = i_size_read(inode);
+	pages = (size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+	invalidate_mapping_pages(inode->i_mapping, 0, -1);
+
+	bench->bulk_read = c->bulk_read;
+	start = local_clock();
+	for (index = 0; index < pages; index++) {
+		page = read_mapping_page(inode->i_mapping, index, NULL);
+		if (IS_ERR(page)) {
+			err = PTR_ERR(page);
+			break;
+		}
+		page_cache_release(page);
+	}
+
+	bench->ns = local_clock() - start;
+	bench->bytes = min_t(loff_t, (loff_t)index << PAGE_CACHE_SHIFT, size);
+
+out:
+	iput(inode);
+	return err;
+}
+
+static void free_bench(struct kref *ref)
+{
+	kfree(container_of(ref, struct ubifs_bench, ref));
+}
+
+static int open_bench_file(struct inode *inode, struct file *file)
+{
+	struct ubifs_bench *bench = inode->i_private;
+
+	kref_get(&bench->ref);
+	file->private_data = bench;
+	return nonseekable_open(inode, file);
+}
+
+static int release_bench_file(struct inode *inode, struct file *file)
+{
+	struct ubifs_bench *bench = file->private_data;
+
+	kref_put(&bench->ref, free_bench);
+	return 0;
+}
+
+static ssize_t read_bench_file(struct file *file, char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct ubifs_bench *bench = file->private_data;
+	u64 us, kbps = 0;
+	char kbuf[128];
+	int len;
+
+	mutex_lock(&bench->mutex);
+	us = div_u64(bench->ns, NSEC_PER_USEC);
+	if (us)
+		kbps = div64_u64(bench->bytes * USEC_PER_SEC, us) >> 10;
+	len = scnprintf(kbuf, sizeof(kbuf),
+			"inode:     %lu\n"
+			"error:     %d\n"
+			"bulk_read: %d\n"
+			"bytes:     %lld\n"
+			"time_us:   %llu\n"
+			"KiB/s:     %llu\n",
+			(unsigned long)bench->inum, bench->err,
+			bench->bulk_read, bench->bytes, us, kbps);
+	mutex_unlock(&bench->mutex);
+
+	return simple_read_from_buffer(buf, count, ppos, kbuf, len);
+}
+
+static ssize_t write_bench_file(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct ubifs_bench *bench = file->private_data;
+	struct super_block *sb;
+	unsigned long inum;
+	char kbuf[24];
+	int err;
+
+	if (count >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, buf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+
+	err = strict_strtoul(strstrip(kbuf), 10, &inum);
+	if (err)
+		return err;
+
+	mutex_lock(&bench->mutex);
+	if (!bench->c) {
+		err = -ENODEV;
+		goto out;
+	}
+	/*
+	 * Do not let the file-system go away under our feet. Umount takes
+	 * @bench->mutex with @s_umount held, so do not wait for it.
+	 */
+	sb = bench->c->vfs_sb;
+	if (!down_read_trylock(&sb->s_umount)) {
+		err = -EBUSY;
+		goto out;
+	}
+	bench->inum = inum;
+	bench->bytes = bench->ns = 0;
+	bench->err = bench_read(bench, inum);
+	up_read(&sb->s_umount);
+	err = bench->err;
+out:
+	mutex_unlock(&bench->mutex);
+
+	return err ? err : count;
+}
+
+static const struct file_operations dfs_bench_fops = {
+	.open = open_bench_file,
+	.release = release_bench_file,
+	.read = read_bench_file,
+	.write = write_bench_file,
+	.owner = THIS_MODULE,
+	.llseek = no_llseek,
+};
+
+/**
+ * put_bench - detach the read benchmark from a file-system going away.
+ * @c: UBIFS file-system description object
+ *
+ * "bench_read" files still open return -ENODEV from now on.
+ */
+static void put_bench(struct ubifs_info *c)
+{
+	struct ubifs_bench *bench = c->dbg->bench;
+
+	if (!bench)
+		return;
+
+	mutex_lock(&bench->mutex);
+	bench->c = NULL;
+	mutex_unlock(&bench->mutex);
+
+	kref_put(&bench->ref, free_bench);
+	c->dbg->bench = NULL;
+}
+
 /**
  * dbg_debugfs_init_fs - initialize debugfs for UBIFS instance.
  * @c: UBIFS file-system description object
@@ -2910,10 +3112,26 @@ int dbg_debugfs_init_fs(struct ubifs_info *c)
 		goto out_remove;
 	d->dfs_dump_tnc = dent;
 
+	fname = "bench_read";
+	d->bench = kzalloc(sizeof(struct ubifs_bench), GFP_KERNEL);
+	if (!d->bench) {
+		dent = ERR_PTR(-ENOMEM);
+		goto out_remove;
+	}
+	kref_init(&d->bench->ref);
+	mutex_init(&d->bench->mutex);
+	d->bench->c = c;
+	dent = debugfs_create_file(fname, S_IRUSR | S_IWUSR, d->dfs_dir,
+				   d->bench, &dfs_bench_fops);
+	if (IS_ERR_OR_NULL(dent))
+		goto out_remove;
+	d->dfs_bench_read = dent;
+
 	return 0;
 
 out_remove:
 	debugfs_remove_recursive(d->dfs_dir);
+	put_bench(c);
 out:
 	err = dent ? PTR_ERR(dent) : -ENODEV;
 	ubifs_err("cannot create \"%s\" debugfs directory, error %d\n",
@@ -2928,6 +3146,7 @@ out:
 void dbg_debugfs_exit_fs(struct ubifs_info *c)
 {
 	debugfs_remove_recursive(c->dbg->dfs_dir);
+	put_bench(c);
 }
 
 #endif /* CONFIG_UBIFS_FS_DEBUG */
@@ -61,6 +61,8 @@ typedef int (*dbg_znode_callback)(struct ubifs_info *c,
  * @dfs_dump_lprops: "dump lprops" debugfs knob
  * @dfs_dump_budg: "dump budgeting information" debugfs knob
  * @dfs_dump_tnc: "dump TNC" debugfs knob
+ * @dfs_bench_read: "sequential read benchmark" debugfs knob
+ * @bench: state of the read benchmark, which may outlive this file-system
  */
 struct ubifs_debug_info {
 	struct ubifs_zbranch old_zroot;
@@ -89,6 +91,8 @@ struct ubifs_debug_info {
 	struct dentry *dfs_dump_lprops;
 	struct dentry *dfs_dump_budg;
 	struct dentry *dfs_dump_tnc;
+	struct dentry *dfs_bench_read;
+	struct ubifs_bench *bench;
 };
 
 #define ubifs_assert(expr) do {                                                \
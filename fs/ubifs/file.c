@@ -53,6 +53,21 @@
 #include <linux/mount.h>
 #include <linux/namei.h>
 #include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/workqueue.h>
+
+/*
+ * Maximum number of CPUs a bulk-read decompresses its pages on, %0 means all
+ * online CPUs.
+ */
+static unsigned int bulk_read_workers;
+module_param(bulk_read_workers, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(bulk_read_workers, "maximum number of CPUs decompressing "
+		 "a bulk-read (default: 0, all online CPUs)");
+
+/* Minimum number of pages worth handing over to another CPU in bulk-read */
+#define BU_WORKER_MIN_PAGES 4
 
 static int read_block(struct inode *inode, void *addr, unsigned int block,
 		      struct ubifs_data_node *dn)
@@ -701,6 +716,116 @@ out_err:
 	return -EINVAL;
 }
 
+/**
+ * populate_pages - populate a range of bulk-read pages.
+ * @c: UBIFS file-system description object
+ * @bu: bulk-read information
+ * @first: index of the first page in @bu->pages
+ * @last: index of the page after the last one
+ *
+ * The pages are unlocked and released, except for the first bulk-read page,
+ * which belongs to the caller of 'ubifs_do_bulk_read()'. This function
+ * returns the result of populating the first bulk-read page if it is in the
+ * range, and %0 otherwise.
+ */
+static int populate_pages(struct ubifs_info *c, struct bu_info *bu, int first,
+			  int last)
+{
+	int i, n, ret = 0;
+
+	for (i = first; i < last; i++) {
+		struct page *page = bu->pages[i];
+
+		n = bu->page_zbr[i];
+		if (i == 0) {
+			ret = populate_page(c, page, bu, &n);
+			continue;
+		}
+
+		/* On error the page is left not up to date, to be read again */
+		if (!PageUptodate(page))
+			populate_page(c, page, bu, &n);
+		unlock_page(page);
+		page_cache_release(page);
+	}
+
+	return ret;
+}
+
+/**
+ * struct bu_worker - a share of the pages of a bulk-read.
+ * @work: work which populates the pages
+ * @c: UBIFS file-system description object
+ * @bu: bulk-read information
+ * @first: index of the first page in @bu->pages
+ * @last: index of the page after the last one
+ */
+struct bu_worker {
+	struct work_struct work;
+	struct ubifs_info *c;
+	struct bu_info *bu;
+	int first;
+	int last;
+};
+
+static void bu_worker_fn(struct work_struct *work)
+{
+	struct bu_worker *w = container_of(work, struct bu_worker, work);
+
+	populate_pages(w->c, w->bu, w->first, w->last);
+}
+
+/**
+ * populate_all_pages - populate the pages of a bulk-read.
+ * @c: UBIFS file-system description object
+ * @bu: bulk-read information
+ * @page_cnt: number of pages in @bu->pages
+ *
+ * Decompressing the data nodes takes most of the time of a bulk-read, so it is
+ * split between the current CPU and, if there are enough pages, workers on
+ * other CPUs. Every CPU has its own decompressor (see compress.c), so they do
+ * not wait for each other. This function returns the result of populating the
+ * first page.
+ */
+static int populate_all_pages(struct ubifs_info *c, struct bu_info *bu,
+			      int page_cnt)
+{
+	int i, err, workers, per_worker;
+	struct bu_worker *w = NULL;
+
+	workers = bulk_read_workers ? bulk_read_workers : num_online_cpus();
+	workers = min_t(int, workers,
+			DIV_ROUND_UP(page_cnt, BU_WORKER_MIN_PAGES));
+	if (workers > 1) {
+		w = kcalloc(workers - 1, sizeof(struct bu_worker),
+			    GFP_NOFS | __GFP_NOWARN);
+		if (!w)
+			workers = 1;
+	}
+
+	per_worker = DIV_ROUND_UP(page_cnt, workers);
+	workers = DIV_ROUND_UP(page_cnt, per_worker);
+
+	for (i = 1; i < workers; i++) {
+		struct bu_worker *wi = &w[i - 1];
+
+		wi->c = c;
+		wi->bu = bu;
+		wi->first = i * per_worker;
+		wi->last = min(wi->first + per_worker, page_cnt);
+		INIT_WORK(&wi->work, bu_worker_fn);
+		queue_work(ubifs_bu_wq, &wi->work);
+	}
+
+	err = populate_pages(c, bu, 0, min(per_worker, page_cnt));
+
+	for (i = 1; i < workers; i++)
+		flush_work(&w[i - 1].work);
+	kfree(w);
+
+	return err;
+}
+
 /**
  * ubifs_do_bulk_read - do bulk-read.
  * @c: UBIFS file-system description object
@@ -716,7 +841,7 @@ static int ubifs_do_bulk_read(struct ubifs_info *c, struct bu_info *bu,
 	struct address_space *mapping = page1->mapping;
 	struct inode *inode = mapping->host;
 	struct ubifs_inode *ui = ubifs_inode(inode);
-	int err, page_idx, page_cnt, ret = 0, n = 0;
+	int err, page_idx, page_cnt, ret = 0, n;
 	int allocate = bu->buf ? 0 : 1;
 	loff_t isize;
 
@@ -762,18 +887,11 @@ static int ubifs_do_bulk_read(struct ubifs_info *c, struct bu_info *bu,
 			goto out_warn;
 	}
 
-	err = populate_page(c, page1, bu, &n);
-	if (err)
-		goto out_warn;
-
-	unlock_page(page1);
-	ret = 1;
-
+	/* Lock all the pages first, then populate them in parallel */
+	page_cnt = min(page_cnt, UBIFS_MAX_BULK_READ);
+	bu->pages[0] = page1;
 	isize = i_size_read(inode);
-	if (isize == 0)
-		goto out_free;
-	end_index = ((isize - 1) >> PAGE_CACHE_SHIFT);
-
+	end_index = isize ? ((isize - 1) >> PAGE_CACHE_SHIFT) : 0;
 	for (page_idx = 1; page_idx < page_cnt; page_idx++) {
 		pgoff_t page_offset = offset + page_idx;
 		struct page *page;
@@ -784,15 +902,27 @@ static int ubifs_do_bulk_read(struct ubifs_info *c, struct bu_info *bu,
 					   GFP_NOFS | __GFP_COLD);
 		if (!page)
 			break;
-		if (!PageUptodate(page))
-			err = populate_page(c, page, bu, &n);
-		unlock_page(page);
-		page_cache_release(page);
-		if (err)
-			break;
+		bu->pages[page_idx] = page;
 	}
+	page_cnt = page_idx;
 
-	ui->last_page_read = offset + page_idx - 1;
+	/* Find where the data nodes of each page start */
+	for (page_idx = 0, n = 0; page_idx < page_cnt; page_idx++) {
+		unsigned int block = (offset + page_idx) <<
+				     UBIFS_BLOCKS_PER_PAGE_SHIFT;
+
+		while (n < bu->cnt && key_block(c, &bu->zbranch[n].key) < block)
+			n += 1;
+		bu->page_zbr[page_idx] = n;
+	}
+
+	err = populate_all_pages(c, bu, page_cnt);
+	ui->last_page_read = offset + page_cnt - 1;
+	if (err)
+		goto out_warn;
+
+	unlock_page(page1);
+	ret = 1;
 
 out_free:
 	if (allocate)
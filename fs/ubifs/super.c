@@ -36,6 +36,7 @@
 #include <linux/mount.h>
 #include <linux/math64.h>
 #include <linux/writeback.h>
+#include <linux/workqueue.h>
 #include "ubifs.h"
 
 /*
@@ -47,6 +48,12 @@
 /* Slab cache for UBIFS inodes */
 struct kmem_cache *ubifs_inode_slab;
 
+/*
+ * Bulk-read decompression workers. They are waited for from readpage, so
+ * they need a rescuer to make progress under memory pressure.
+ */
+struct workqueue_struct *ubifs_bu_wq;
+
 /* UBIFS TNC shrinker description */
 static struct shrinker ubifs_shrinker_info = {
 	.shrink = ubifs_shrinker,
@@ -2278,6 +2285,11 @@ static int __init ubifs_init(void)
 	if (!ubifs_inode_slab)
 		goto out_reg;
 
+	ubifs_bu_wq = alloc_workqueue("ubifs_bu", WQ_MEM_RECLAIM | WQ_UNBOUND,
+				      0);
+	if (!ubifs_bu_wq)
+		goto out_slab;
+
 	register_shrinker(&ubifs_shrinker_info);
 
 	err = ubifs_compressors_init();
@@ -2294,6 +2306,8 @@ out_compr:
 	ubifs_compressors_exit();
 out_shrinker:
 	unregister_shrinker(&ubifs_shrinker_info);
+	destroy_workqueue(ubifs_bu_wq);
+out_slab:
 	kmem_cache_destroy(ubifs_inode_slab);
 out_reg:
 	unregister_filesystem(&ubifs_fs_type);
@@ -2310,6 +2324,7 @@ static void __exit ubifs_exit(void)
 	dbg_debugfs_exit();
 	ubifs_compressors_exit();
 	unregister_shrinker(&ubifs_shrinker_info);
+	destroy_workqueue(ubifs_bu_wq);
 	kmem_cache_destroy(ubifs_inode_slab);
 	unregister_filesystem(&ubifs_fs_type);
 }
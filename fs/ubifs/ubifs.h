@@ -791,6 +791,8 @@ struct ubifs_znode {
  * @cnt: number of data nodes for bulk read
  * @blk_cnt: number of data blocks including holes
  * @oef: end of file reached
+ * @pages: locked pages to populate
+ * @page_zbr: index of the first zbranch to look at for each page in @pages
  */
 struct bu_info {
 	union ubifs_key key;
@@ -801,6 +803,8 @@ struct bu_info {
 	int cnt;
 	int blk_cnt;
 	int eof;
+	struct page *pages[UBIFS_MAX_BULK_READ];
+	int page_zbr[UBIFS_MAX_BULK_READ];
 };
 
 /**
@@ -822,17 +826,13 @@ struct ubifs_node_range {
 /**
  * struct ubifs_compressor - UBIFS compressor description structure.
  * @compr_type: compressor type (%UBIFS_COMPR_LZO, etc)
- * @cc: cryptoapi compressor handle
- * @comp_mutex: mutex used during compression
- * @decomp_mutex: mutex used during decompression
+ * @cc: per-CPU cryptoapi compressor handles
  * @name: compressor name
  * @capi_name: cryptoapi compressor name
  */
 struct ubifs_compressor {
 	int compr_type;
-	struct crypto_comp *cc;
-	struct mutex *comp_mutex;
-	struct mutex *decomp_mutex;
+	struct crypto_comp * __percpu *cc;
 	const char *name;
 	const char *capi_name;
 };
@@ -1456,6 +1456,7 @@ extern struct list_head ubifs_infos;
 extern spinlock_t ubifs_infos_lock;
 extern atomic_long_t ubifs_clean_zn_cnt;
 extern struct kmem_cache *ubifs_inode_slab;
+extern struct workqueue_struct *ubifs_bu_wq;
 extern const struct super_operations ubifs_super_operations;
 extern const struct address_space_operations ubifs_file_address_operations;
 extern const struct file_operations ubifs_file_operations;
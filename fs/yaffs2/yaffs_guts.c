@@ -2918,8 +2918,13 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 		if (dev->n_erased_blocks < min_erased)
 			aggressive = 1;
 		else {
-			if (!background
-			    && erased_chunks > (dev->n_free_chunks / 4))
+			/*
+			 * Leave passive gc to the background thread if there
+			 * is one, so that writes do not stall on it.
+			 */
+			if (!background &&
+			    (dev->bg_gc ||
+			     erased_chunks > (dev->n_free_chunks / 4)))
 				break;
 
 			if (dev->gc_skip > 20)
@@ -2950,6 +2955,8 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 		}
 
 		if (dev->gc_block > 0) {
+			u64 gc_start, gc_ns;
+
 			dev->all_gcs++;
 			if (!aggressive)
 				dev->passive_gc_count++;
@@ -2958,7 +2965,18 @@ static int yaffs_check_gc(struct yaffs_dev *dev, int background)
 				"yaffs: GC n_erased_blocks %d aggressive %d",
 				dev->n_erased_blocks, aggressive);
 
+			gc_start = Y_CLOCK_NS();
 			gc_ok = yaffs_gc_block(dev, dev->gc_block, aggressive);
+			gc_ns = Y_CLOCK_NS() - gc_start;
+
+			if (background) {
+				dev->bg_gc_ns += gc_ns;
+			} else {
+				dev->fg_gc_passes++;
+				dev->fg_gc_ns += gc_ns;
+				if (gc_ns > dev->fg_gc_max_ns)
+					dev->fg_gc_max_ns = gc_ns;
+			}
 		}
 
 		if (dev->n_erased_blocks < (dev->param.n_reserved_blocks)
@@ -4916,6 +4934,10 @@ int yaffs_guts_initialise(struct yaffs_dev *dev)
 	dev->passive_gc_count = 0;
 	dev->oldest_dirty_gc_count = 0;
 	dev->bg_gcs = 0;
+	dev->fg_gc_passes = 0;
+	dev->fg_gc_ns = 0;
+	dev->fg_gc_max_ns = 0;
+	dev->bg_gc_ns = 0;
 	dev->gc_block_finder = 0;
 	dev->buffered_block = -1;
 	dev->doing_buffered_block_rewrite = 0;
@@ -671,6 +671,7 @@ struct yaffs_dev {
 	unsigned gc_block;
 	unsigned gc_chunk;
 	unsigned gc_skip;
+	unsigned bg_gc;		/* A background thread does the passive gc */
 
 	/* Special directories */
 	struct yaffs_obj *root_dir;
@@ -724,6 +725,10 @@ struct yaffs_dev {
 	u32 oldest_dirty_gc_count;
 	u32 n_gc_blocks;
 	u32 bg_gcs;
+	u32 fg_gc_passes;	/* gc passes done inside foreground operations */
+	u64 fg_gc_ns;		/* time spent in foreground gc */
+	u64 fg_gc_max_ns;	/* longest foreground gc pass */
+	u64 bg_gc_ns;		/* time spent in background gc */
 	u32 n_retired_writes;
 	u32 n_retired_blocks;
 	u32 n_ecc_fixed;
@@ -24,7 +24,12 @@ struct yaffs_linux_context {
 	struct super_block *super;
 	struct task_struct *bg_thread;	/* Background thread for this device */
 	int bg_running;
+	unsigned long last_fg_op;	/* jiffies of the last foreground operation */
 	struct mutex gross_lock;	/* Gross locking mutex*/
+	u64 lock_taken_ns;	/* When gross_lock was last taken */
+	u32 lock_waits;		/* Times gross_lock was contended */
+	u64 lock_wait_ns;
+	u64 lock_max_hold_ns;
 	u8 *spare_buffer;	/* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
 				 */
@@ -56,6 +56,7 @@
 #include <linux/freezer.h>
 
 #include <asm/div64.h>
+#include <linux/math64.h>
 
 #include <linux/statfs.h>
 
@@ -98,12 +99,28 @@ unsigned int yaffs_auto_checkpoint = 1;
 unsigned int yaffs_gc_control = 1;
 unsigned int yaffs_bg_enable = 1;
 
+/*
+ * Background gc tuning. The background thread keeps at least
+ * yaffs_bg_gc_target percent of the free space erased, and hurries when less
+ * than yaffs_bg_gc_urgent percent is. Once the device has been idle for
+ * yaffs_bg_gc_idle_ms, it collects up to yaffs_bg_gc_batch blocks per
+ * wake-up instead of one.
+ */
+unsigned int yaffs_bg_gc_target = 50;
+unsigned int yaffs_bg_gc_urgent = 25;
+unsigned int yaffs_bg_gc_idle_ms = 500;
+unsigned int yaffs_bg_gc_batch = 8;
+
 /* Module Parameters */
 module_param(yaffs_trace_mask, uint, 0644);
 module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
 module_param(yaffs_gc_control, uint, 0644);
 module_param(yaffs_bg_enable, uint, 0644);
+module_param(yaffs_bg_gc_target, uint, 0644);
+module_param(yaffs_bg_gc_urgent, uint, 0644);
+module_param(yaffs_bg_gc_idle_ms, uint, 0644);
+module_param(yaffs_bg_gc_batch, uint, 0644);
 
 
 #define yaffs_inode_to_obj_lv(iptr) ((iptr)->i_private)
@@ -121,17 +138,67 @@ static unsigned yaffs_gc_control_callback(struct yaffs_dev *dev)
 	return yaffs_gc_control;
 }
 
+/*
+ * Locking.
+ *
+ * The yaffs core is not reentrant: the chunk cache, the temporary buffers,
+ * the block allocator and the NAND error handling are all per device, so
+ * every call into yaffs_guts has to be made holding gross_lock. What we
+ * keep short is how long it is held:
+ *
+ * - Per object state is left to the VFS. The inode's i_mutex serialises
+ *   writes, truncates and attribute changes of an object and the page lock
+ *   covers a page being read or written back, so gross_lock is only taken
+ *   around the yaffs_guts calls themselves and not across a whole VFS
+ *   operation. Inode fields are updated outside it.
+ *
+ * - This is as narrow as it gets without a reentrant core. A write takes
+ *   the lock for the one page handed over by yaffs_write_end(), readpage
+ *   for the yaffs_file_rd() of one page, lookup for the name search and
+ *   readdir for each entry, dropping it around filldir. Readers of
+ *   different files still take turns inside yaffs_guts, and wait for a
+ *   foreground gc started by a write. Page cache hits take no lock at all.
+ *   mtd_fsspeedtest measures how readers fare during a write.
+ *
+ * - There is no per object lock and no lock of its own for gc or the
+ *   allocator: they live in yaffs_guts too. The background thread takes
+ *   gross_lock for one gc pass at a time and gives up a batch as soon as a
+ *   foreground operation comes along, so that operation never waits for
+ *   more than a single block to be collected.
+ *
+ * Lock order is i_mutex, page lock, gross_lock.
+ */
+
 static void yaffs_gross_lock(struct yaffs_dev *dev)
 {
+	struct yaffs_linux_context *lc = yaffs_dev_to_lc(dev);
+	u64 start;
+
+	/* Tells the background thread to stop idle-time gc */
+	if (current != lc->bg_thread)
+		lc->last_fg_op = jiffies;
+
 	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs locking %p", current);
-	mutex_lock(&(yaffs_dev_to_lc(dev)->gross_lock));
+	if (!mutex_trylock(&lc->gross_lock)) {
+		start = Y_CLOCK_NS();
+		mutex_lock(&lc->gross_lock);
+		lc->lock_waits++;
+		lc->lock_wait_ns += Y_CLOCK_NS() - start;
+	}
+	lc->lock_taken_ns = Y_CLOCK_NS();
 	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs locked %p", current);
 }
 
 static void yaffs_gross_unlock(struct yaffs_dev *dev)
 {
+	struct yaffs_linux_context *lc = yaffs_dev_to_lc(dev);
+	u64 held = Y_CLOCK_NS() - lc->lock_taken_ns;
+
+	if (held > lc->lock_max_hold_ns)
+		lc->lock_max_hold_ns = held;
+
 	yaffs_trace(YAFFS_TRACE_LOCK, "yaffs unlocking %p", current);
-	mutex_unlock(&(yaffs_dev_to_lc(dev)->gross_lock));
+	mutex_unlock(&lc->gross_lock);
 }
 
 static void yaffs_fill_inode_from_obj(struct inode *inode,
@@ -1302,16 +1369,7 @@ static ssize_t yaffs_hold_space(struct file *f)
 
 static void yaffs_release_space(struct file *f)
 {
-	struct yaffs_obj *obj;
-	struct yaffs_dev *dev;
-
-	obj = yaffs_dentry_to_obj(f->f_dentry);
-
-	dev = obj->my_dev;
-
-	yaffs_gross_lock(dev);
-
-	yaffs_gross_unlock(dev);
+	/* Nothing is reserved by yaffs_hold_space() yet */
 }
 
 static int yaffs_write_begin(struct file *filp, struct address_space *mapping,
@@ -1381,8 +1439,6 @@ static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 
 	dev = obj->my_dev;
 
-	yaffs_gross_lock(dev);
-
 	inode = f->f_dentry->d_inode;
 
 	if (!S_ISBLK(inode->i_mode) && f->f_flags & O_APPEND)
@@ -1398,7 +1454,9 @@ static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 			"yaffs_file_write about to write writing %u(%x) bytes to object %d at %d(%x)",
 			(unsigned)n, (unsigned)n, obj->obj_id, ipos, ipos);
 
+	yaffs_gross_lock(dev);
 	n_written = yaffs_wr_file(obj, buf, ipos, n, 0);
+	yaffs_gross_unlock(dev);
 
 	yaffs_touch_super(dev);
 
@@ -1419,7 +1477,6 @@ static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 		}
 
 	}
-	yaffs_gross_unlock(dev);
 	return (n_written == 0) && (n > 0) ? -ENOSPC : n_written;
 }
 
@@ -1459,10 +1516,13 @@ static int yaffs_statfs(struct dentry *dentry, struct kstatfs *buf)
 {
 	struct yaffs_dev *dev = yaffs_dentry_to_obj(dentry)->my_dev;
 	struct super_block *sb = dentry->d_sb;
+	int n_free_chunks;
 
 	yaffs_trace(YAFFS_TRACE_OS, "yaffs_statfs");
 
 	yaffs_gross_lock(dev);
+	n_free_chunks = yaffs_get_n_free_chunks(dev);
+	yaffs_gross_unlock(dev);
 
 	buf->f_type = YAFFS_MAGIC;
 	buf->f_bsize = sb->s_blocksize;
@@ -1483,7 +1543,7 @@ static int yaffs_statfs(struct dentry *dentry, struct kstatfs *buf)
 		do_div(bytes_in_dev, sb->s_blocksize);	/* bytes_in_dev becomes the number of blocks */
 		buf->f_blocks = bytes_in_dev;
 
-		bytes_free = ((uint64_t) (yaffs_get_n_free_chunks(dev))) *
+		bytes_free = ((uint64_t) n_free_chunks) *
 		    ((uint64_t) (dev->data_bytes_per_chunk));
 
 		do_div(bytes_free, sb->s_blocksize);
@@ -1497,7 +1557,7 @@ static int yaffs_statfs(struct dentry *dentry, struct kstatfs *buf)
 		    dev->param.chunks_per_block /
 		    (sb->s_blocksize / dev->data_bytes_per_chunk);
 		buf->f_bfree =
-		    yaffs_get_n_free_chunks(dev) /
+		    n_free_chunks /
 		    (sb->s_blocksize / dev->data_bytes_per_chunk);
 	} else {
 		buf->f_blocks =
@@ -1506,7 +1566,7 @@ static int yaffs_statfs(struct dentry *dentry, struct kstatfs *buf)
 		    (dev->data_bytes_per_chunk / sb->s_blocksize);
 
 		buf->f_bfree =
-		    yaffs_get_n_free_chunks(dev) *
+		    n_free_chunks *
 		    (dev->data_bytes_per_chunk / sb->s_blocksize);
 	}
 
@@ -1514,7 +1574,6 @@ static int yaffs_statfs(struct dentry *dentry, struct kstatfs *buf)
 	buf->f_ffree = 0;
 	buf->f_bavail = buf->f_bfree;
 
-	yaffs_gross_unlock(dev);
 	return 0;
 }
 
@@ -1560,14 +1619,20 @@ static unsigned yaffs_bg_gc_urgency(struct yaffs_dev *dev)
 		return 0;
 	else if (scattered < (dev->param.chunks_per_block * 2))
 		return 0;
-	else if (erased_chunks > dev->n_free_chunks / 2)
+	else if (erased_chunks * 100 > dev->n_free_chunks * yaffs_bg_gc_target)
 		return 0;
-	else if (erased_chunks > dev->n_free_chunks / 4)
+	else if (erased_chunks * 100 > dev->n_free_chunks * yaffs_bg_gc_urgent)
 		return 1;
 	else
 		return 2;
 }
 
+static int yaffs_bg_idle(struct yaffs_linux_context *context)
+{
+	return time_after(jiffies, context->last_fg_op +
+			  msecs_to_jiffies(yaffs_bg_gc_idle_ms));
+}
+
 static int yaffs_do_sync_fs(struct super_block *sb, int request_checkpoint)
 {
 
@@ -1624,6 +1689,7 @@ static int yaffs_bg_thread_fn(void *data)
 	unsigned long next_gc = now;
 	unsigned long expires;
 	unsigned int urgency;
+	unsigned int n_gcs;
 
 	int gc_result;
 	struct timer_list timer;
@@ -1644,6 +1710,7 @@ static int yaffs_bg_thread_fn(void *data)
 		yaffs_gross_lock(dev);
 
 		now = jiffies;
+		dev->bg_gc = yaffs_bg_enable ? 1 : 0;
 
 		if (time_after(now, next_dir_update) && yaffs_bg_enable) {
 			yaffs_update_dirty_dirs(dev);
@@ -1654,7 +1721,30 @@ static int yaffs_bg_thread_fn(void *data)
 			if (!dev->is_checkpointed) {
 				urgency = yaffs_bg_gc_urgency(dev);
 				gc_result = yaffs_bg_gc(dev, urgency);
-				if (urgency > 1)
+
+				/*
+				 * Nobody is using the device, so make the most
+				 * of it until somebody wants it. Drop the lock
+				 * between passes so that a foreground operation
+				 * only ever waits for the pass in progress.
+				 */
+				for (n_gcs = 1; urgency > 0 &&
+				     n_gcs < yaffs_bg_gc_batch &&
+				     yaffs_bg_idle(context); n_gcs++) {
+					yaffs_gross_unlock(dev);
+					cond_resched();
+					yaffs_gross_lock(dev);
+					if (dev->is_checkpointed)
+						break;
+					urgency = yaffs_bg_gc_urgency(dev);
+					if (urgency)
+						gc_result = yaffs_bg_gc(dev,
+								urgency);
+				}
+
+				if (urgency > 0 && yaffs_bg_idle(context))
+					next_gc = now;
+				else if (urgency > 1)
 					next_gc = now + HZ / 20 + 1;
 				else if (urgency > 0)
 					next_gc = now + HZ / 10 + 1;
@@ -1721,6 +1811,9 @@ static void yaffs_bg_stop(struct yaffs_dev *dev)
 		kthread_stop(ctxt->bg_thread);
 		ctxt->bg_thread = NULL;
 	}
+
+	/* From now on writes have to collect garbage themselves */
+	dev->bg_gc = 0;
 }
 
 static void yaffs_write_super(struct super_block *sb)
@@ -2474,6 +2567,21 @@ static char *yaffs_dump_dev_part1(char *buf, struct yaffs_dev *dev)
 		    dev->oldest_dirty_gc_count);
 	buf += sprintf(buf, "n_gc_blocks........... %u\n", dev->n_gc_blocks);
 	buf += sprintf(buf, "bg_gcs................ %u\n", dev->bg_gcs);
+	buf += sprintf(buf, "bg_gc_us.............. %llu\n",
+		       div_u64(dev->bg_gc_ns, NSEC_PER_USEC));
+	buf += sprintf(buf, "fg_gc_passes.......... %u\n", dev->fg_gc_passes);
+	buf += sprintf(buf, "fg_gc_us.............. %llu\n",
+		       div_u64(dev->fg_gc_ns, NSEC_PER_USEC));
+	buf += sprintf(buf, "fg_gc_max_us.......... %llu\n",
+		       div_u64(dev->fg_gc_max_ns, NSEC_PER_USEC));
+	buf += sprintf(buf, "lock_waits............ %u\n",
+		       yaffs_dev_to_lc(dev)->lock_waits);
+	buf += sprintf(buf, "lock_wait_us.......... %llu\n",
+		       div_u64(yaffs_dev_to_lc(dev)->lock_wait_ns,
+			       NSEC_PER_USEC));
+	buf += sprintf(buf, "lock_max_hold_us...... %llu\n",
+		       div_u64(yaffs_dev_to_lc(dev)->lock_max_hold_ns,
+			       NSEC_PER_USEC));
 	buf +=
 	    sprintf(buf, "n_retired_writes...... %u\n", dev->n_retired_writes);
 	buf +=
@@ -45,6 +45,9 @@
 #define Y_CURRENT_TIME CURRENT_TIME.tv_sec
 #define Y_TIME_CONVERT(x) (x).tv_sec
 
+/* Monotonic clock in nanoseconds, for statistics */
+#define Y_CLOCK_NS() local_clock()
+
 #define compile_time_assertion(assertion) \
 	({ int x = __builtin_choose_expr(assertion, 0, (void)0); (void) x; })
 
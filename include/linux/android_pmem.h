@@ -50,6 +50,9 @@ struct android_pmem_platform_data
 	unsigned cached;
 	/* The MSM7k has bits to enable a write buffer in the bus controller*/
 	unsigned buffered;
+	/* set to indicate the region is part of a contiguous pool lent to the
+	 * page allocator, allocations claim their pages back from it */
+	unsigned movable;
 };
 
 struct pmem_region {
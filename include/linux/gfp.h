@@ -362,6 +362,15 @@ extern void free_hot_cold_page(struct page *page, int cold);
 #define __free_page(page) __free_pages((page), 0)
 #define free_page(addr) free_pages((addr), 0)
 
+#ifdef CONFIG_CMA
+/* Contiguous allocations out of MIGRATE_CMA pageblocks */
+extern int init_cma_reserved_range(unsigned long start_pfn,
+				   unsigned long nr_pages);
+extern int alloc_contig_range(unsigned long start, unsigned long end,
+			      unsigned long *migrated);
+extern void free_contig_range(unsigned long pfn, unsigned long nr_pages);
+#endif
+
 void page_alloc_init(void);
 void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp);
 void drain_all_pages(void);
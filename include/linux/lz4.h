@@ -0,0 +1,47 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Kernel Interface
+ *
+ *  LZ4 is a byte-oriented LZ77 compressor that trades some ratio for
+ *  speed: it compresses faster than LZO and decompresses much faster.
+ *  Only the raw block format is implemented here, one call per buffer,
+ *  with no framing or checksums.
+ *
+ *  The format is described at:
+ *  http://code.google.com/p/lz4/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#define LZ4_HASHLOG		12
+#define LZ4_MEM_COMPRESS	((1 << LZ4_HASHLOG) * sizeof(u32))
+
+#define lz4_compressbound(isize)	((isize) + ((isize) / 255) + 16)
+
+/*
+ * This requires 'wrkmem' of size LZ4_MEM_COMPRESS. *dst_len is the size
+ * of dst on entry and the compressed length on return.
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * Safe decompression with overrun testing: src_len must be the exact
+ * compressed length, *dest_len is the room in dest on entry and the
+ * decompressed length on return.
+ */
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len);
+
+/*
+ * Return values (< 0 = Error)
+ */
+#define LZ4_E_OK		0
+#define LZ4_E_OUTPUT_OVERRUN	(-1)
+#define LZ4_E_INPUT_OVERRUN	(-2)
+#define LZ4_E_LOOKBEHIND_OVERRUN (-3)
+
+#endif
@@ -63,6 +63,8 @@ struct onenand_bufferram {
  * @unlock_all:		[REPLACEABLE] hardware specific function for unlock all
  * @read_bufferram:	[REPLACEABLE] hardware specific function for BufferRAM Area
  * @write_bufferram:	[REPLACEABLE] hardware specific function for BufferRAM Area
+ * @read_ahead:		[OPTIONAL] hardware specific function to announce the
+ *			pages of a sequential read within one block
  * @read_word:		[REPLACEABLE] hardware specific function for read
  *			register of OneNAND
  * @write_word:		[REPLACEABLE] hardware specific function for write
@@ -112,6 +114,7 @@ struct onenand_chip {
 			unsigned char *buffer, int offset, size_t count);
 	int (*write_bufferram)(struct mtd_info *mtd, int area,
 			const unsigned char *buffer, int offset, size_t count);
+	void (*read_ahead)(struct mtd_info *mtd, loff_t from, int pages);
 	unsigned short (*read_word)(void __iomem *addr);
 	void (*write_word)(unsigned short value, void __iomem *addr);
 	void (*mmcontrol)(struct mtd_info *mtd, int sync_read);
@@ -184,6 +187,9 @@ struct onenand_chip {
 #define ONENAND_IS_CACHE_PROGRAM(this)					\
 	(this->options & ONENAND_HAS_CACHE_PROGRAM)
 
+#define ONENAND_IS_PIPELINE_READ(this)					\
+	(this->options & ONENAND_HAS_PIPELINE_READ)
+
 /* Check byte access in OneNAND */
 #define ONENAND_CHECK_BYTE_ACCESS(addr)		(addr & 0x1)
 
@@ -195,6 +201,7 @@ struct onenand_chip {
 #define ONENAND_HAS_2PLANE		(0x0004)
 #define ONENAND_HAS_4KB_PAGE		(0x0008)
 #define ONENAND_HAS_CACHE_PROGRAM	(0x0010)
+#define ONENAND_HAS_PIPELINE_READ	(0x0020)
 #define ONENAND_SKIP_UNLOCK_CHECK	(0x0100)
 #define ONENAND_PAGEBUF_ALLOC		(0x1000)
 #define ONENAND_OOBBUF_ALLOC		(0x2000)
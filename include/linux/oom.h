@@ -70,6 +70,36 @@ extern unsigned long badness(struct task_struct *p, struct mem_cgroup *mem,
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+/*
+ * The Android low memory killer keeps thread group leaders indexed by
+ * oom_adj so that it does not have to walk every process to find a victim.
+ * The index is protected by tasklist_lock.
+ */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_adj_add(struct task_struct *p);
+extern void lowmem_adj_del(struct task_struct *p);
+extern void lowmem_adj_replace(struct task_struct *old,
+			       struct task_struct *new);
+extern void lowmem_adj_update(struct task_struct *p);
+#else
+static inline void lowmem_adj_add(struct task_struct *p)
+{
+}
+
+static inline void lowmem_adj_del(struct task_struct *p)
+{
+}
+
+static inline void lowmem_adj_replace(struct task_struct *old,
+				      struct task_struct *new)
+{
+}
+
+static inline void lowmem_adj_update(struct task_struct *p)
+{
+}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
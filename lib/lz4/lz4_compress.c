@@ -0,0 +1,140 @@
+/*
+ *  LZ4 - Fast LZ compression algorithm, block compressor
+ *
+ *  A greedy single-pass matcher: every position is hashed on its next
+ *  four bytes into a table of the last position seen with that hash,
+ *  and a candidate is taken as soon as those four bytes really match.
+ *  The search steps faster through data that keeps failing to match,
+ *  which is what makes incompressible input cheap.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(u32 seq)
+{
+	return (seq * 2654435761U) >> (32 - LZ4_HASHLOG);
+}
+
+static inline u8 *lz4_put_length(u8 *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+/*
+ * Room needed for a sequence of litlen literals and a match of matchlen
+ * bytes: token, length bytes on both sides, literals and offset.
+ */
+static inline size_t lz4_seq_bound(size_t litlen, size_t matchlen)
+{
+	return 1 + litlen / 255 + 1 + litlen + 2 + matchlen / 255 + 1;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 *table = wrkmem;
+	const u8 *ip = src, *anchor = src, *ref;
+	const u8 *const iend = src + src_len;
+	const u8 *const mflimit = iend - MFLIMIT;
+	const u8 *const matchlimit = iend - LASTLITERALS;
+	u8 *op = dst, *token;
+	u8 *const oend = dst + *dst_len;
+	size_t litlen, len;
+	u32 seq, h;
+
+	memset(table, 0, LZ4_MEM_COMPRESS);
+
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	while (ip < mflimit) {
+		seq = get_unaligned((const u32 *)ip);
+		h = lz4_hash(seq);
+		ref = src + table[h];
+		table[h] = ip - src;
+
+		if (ref >= ip || ip - ref > MAX_DISTANCE ||
+		    get_unaligned((const u32 *)ref) != seq) {
+			/* Skip ahead faster the longer nothing matched */
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+
+		/* Catch up on bytes before the match the search stepped over */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		len = MINMATCH;
+		while (ip + len < matchlimit && ip[len] == ref[len])
+			len++;
+
+		litlen = ip - anchor;
+		if (unlikely(op + lz4_seq_bound(litlen, len - MINMATCH) > oend))
+			return LZ4_E_OUTPUT_OVERRUN;
+
+		token = op++;
+		if (litlen >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, litlen - RUN_MASK);
+		} else {
+			*token = litlen << ML_BITS;
+		}
+		memcpy(op, anchor, litlen);
+		op += litlen;
+
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		len -= MINMATCH;
+		if (len >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_put_length(op, len - ML_MASK);
+		} else {
+			*token |= len;
+		}
+
+		ip += len + MINMATCH;
+		anchor = ip;
+
+		/* Index a position inside the match for the next search */
+		if (ip < mflimit)
+			table[lz4_hash(get_unaligned((const u32 *)(ip - 2)))] =
+				ip - 2 - src;
+	}
+
+last_literals:
+	litlen = iend - anchor;
+	if (unlikely(op + 1 + litlen / 255 + 1 + litlen > oend))
+		return LZ4_E_OUTPUT_OVERRUN;
+
+	token = op++;
+	if (litlen >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, litlen - RUN_MASK);
+	} else {
+		*token = litlen << ML_BITS;
+	}
+	memcpy(op, anchor, litlen);
+	op += litlen;
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
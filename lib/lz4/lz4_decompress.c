@@ -0,0 +1,102 @@
+/*
+ *  LZ4 - Fast LZ compression algorithm, block decompressor
+ *
+ *  Every length and offset read from the input is checked against both
+ *  buffers, so corrupt or hostile data can fail but never overrun.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+/* Returns the extended length, or (size_t)-1 if the input ran out */
+static inline size_t lz4_get_length(const u8 **ipp, const u8 *iend,
+				size_t len)
+{
+	const u8 *ip = *ipp;
+	u8 s;
+
+	do {
+		if (unlikely(ip >= iend))
+			return (size_t)-1;
+		s = *ip++;
+		len += s;
+	} while (s == 255);
+
+	*ipp = ip;
+	return len;
+}
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len)
+{
+	const u8 *ip = src, *ref;
+	const u8 *const iend = src + src_len;
+	u8 *op = dest;
+	u8 *const oend = dest + *dest_len;
+	size_t len, offset;
+	u8 token;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		len = token >> ML_BITS;
+		if (len == RUN_MASK) {
+			len = lz4_get_length(&ip, iend, len);
+			if (unlikely(len == (size_t)-1))
+				return LZ4_E_INPUT_OVERRUN;
+		}
+		if (unlikely(len > iend - ip))
+			return LZ4_E_INPUT_OVERRUN;
+		if (unlikely(len > oend - op))
+			return LZ4_E_OUTPUT_OVERRUN;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		/* The last sequence has literals only */
+		if (ip == iend)
+			break;
+
+		if (unlikely(iend - ip < 2))
+			return LZ4_E_INPUT_OVERRUN;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(!offset || offset > op - dest))
+			return LZ4_E_LOOKBEHIND_OVERRUN;
+		ref = op - offset;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK) {
+			len = lz4_get_length(&ip, iend, len);
+			if (unlikely(len == (size_t)-1))
+				return LZ4_E_INPUT_OVERRUN;
+		}
+		len += MINMATCH;
+		if (unlikely(len > oend - op))
+			return LZ4_E_OUTPUT_OVERRUN;
+
+		if (offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else {
+			/* Overlapping copy repeats the last offset bytes */
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dest_len = op - dest;
+	return LZ4_E_OK;
+}
+EXPORT_SYMBOL_GPL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
@@ -0,0 +1,28 @@
+/*
+ * lz4defs.h -- constants of the LZ4 block format, shared by the compressor
+ * and the decompressor
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define MINMATCH	4
+
+/* The last match must start at least this far from the end of the block */
+#define MFLIMIT		12
+
+/* ... and the block always ends with at least this many literals */
+#define LASTLITERALS	5
+
+#define MAX_DISTANCE	65535
+
+/*
+ * Each sequence starts with a token: the literal run length in its high
+ * RUN_BITS, the match length minus MINMATCH in its low ML_BITS.  A field
+ * at its mask value is continued in the following bytes.
+ */
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
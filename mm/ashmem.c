@@ -27,6 +27,12 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/rbtree.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/ktime.h>
+#include <linux/moduleparam.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
 
@@ -37,12 +43,13 @@
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its own `mutex'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN];/* optional name for /proc/pid/maps */
-	struct list_head unpinned_list;	/* list of all ashmem areas */
+	struct mutex mutex;		/* protects this area and its ranges */
+	struct rb_root unpinned;	/* unpinned ranges, by starting page */
 	struct file *file;		/* the shmem-based backing file */
 	size_t size;			/* size of the mapping, in bytes */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
@@ -51,29 +58,69 @@ struct ashmem_area {
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's `mutex', and `ashmem_lru_lock' for `lru'
+ *
+ * The ranges of an area never overlap, so ordering them by starting page
+ * also orders them by ending page, and the tree doubles as an interval tree.
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
-	struct list_head unpinned;	/* entry in its area's unpinned list */
+	struct rb_node node;		/* entry in its area's unpinned tree */
 	struct ashmem_area *asma;	/* associated area */
 	size_t pgstart;			/* starting page, inclusive */
 	size_t pgend;			/* ending page, inclusive */
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
+	unsigned int queued;		/* on ashmem_purge_list, not the LRU */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/* LRU list of unpinned pages, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/* Count of pages on our LRU list, protected by ashmem_lru_lock */
 static unsigned long lru_count;
 
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * Ranges the shrinker took off the LRU for ashmemd to purge, and their
+ * count of pages, protected by ashmem_lru_lock. Pinning a queued range
+ * before ashmemd gets to it simply cancels its purge.
+ */
+static LIST_HEAD(ashmem_purge_list);
+static unsigned long purge_count;
+
+static DECLARE_WAIT_QUEUE_HEAD(ashmem_purge_wait);
+static struct task_struct *ashmem_purge_task;
+
+/* hand purging over to ashmemd instead of doing it in the shrinker */
+static int async_purge;
+module_param(async_purge, bool, S_IRUGO | S_IWUSR);
+
+/* ranges ashmemd purges before it lets others run */
+#define ASHMEM_PURGE_BATCH	16
+
+/*
+ * Time spent purging, per shrinker call and per ashmemd batch, protected
+ * by ashmem_lru_lock
+ */
+struct ashmem_purge_stats {
+	unsigned long calls;
+	unsigned long pages;
+	u64 total_ns;
+	u64 max_ns;
+};
+
+static struct ashmem_purge_stats shrink_stats;
+static struct ashmem_purge_stats purged_stats;
+
+/*
+ * ashmem_lru_lock - protects the LRU and purge lists and counts
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * Lock Ordering: asma->mutex -> ashmem_lru_lock
+ *                asma->mutex -> i_mutex -> i_alloc_sem
+ *
+ * The shrinker walks the LRU under ashmem_lru_lock and so can only trylock
+ * the areas it finds there; it skips the ones that are busy.
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -104,31 +151,83 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 static inline void lru_add(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
-static inline void lru_del(struct ashmem_range *range)
+static inline void __lru_del(struct ashmem_range *range)
 {
 	list_del(&range->lru);
-	lru_count -= range_size(range);
+	if (range->queued) {
+		purge_count -= range_size(range);
+		range->queued = 0;
+	} else
+		lru_count -= range_size(range);
+}
+
+static inline void lru_del(struct ashmem_range *range)
+{
+	spin_lock(&ashmem_lru_lock);
+	__lru_del(range);
+	spin_unlock(&ashmem_lru_lock);
+}
+
+/*
+ * range_first - returns the lowest range of 'asma' that overlaps the pages
+ * from 'start' to 'end', inclusive, or NULL if there is none
+ *
+ * Caller must hold asma->mutex.
+ */
+static struct ashmem_range *range_first(struct ashmem_area *asma,
+					size_t start, size_t end)
+{
+	struct rb_node *node = asma->unpinned.rb_node;
+	struct ashmem_range *range, *first = NULL;
+
+	while (node) {
+		range = rb_entry(node, struct ashmem_range, node);
+		if (range_before_page(range, start)) {
+			node = node->rb_right;
+		} else {
+			first = range;
+			node = node->rb_left;
+		}
+	}
+
+	if (first && first->pgstart > end)
+		return NULL;
+	return first;
+}
+
+/*
+ * range_next - returns the range following 'range' in its area, or NULL
+ */
+static inline struct ashmem_range *range_next(struct ashmem_range *range)
+{
+	struct rb_node *node = rb_next(&range->node);
+
+	return node ? rb_entry(node, struct ashmem_range, node) : NULL;
 }
 
 /*
  * range_alloc - allocate and initialize a new ashmem_range structure
  *
  * 'asma' - associated ashmem_area
- * 'prev_range' - the previous ashmem_range in the sorted asma->unpinned list
  * 'purged' - initial purge value (ASMEM_NOT_PURGED or ASHMEM_WAS_PURGED)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
  *
- * Caller must hold ashmem_mutex.
+ * The new range must not overlap any existing range of 'asma'.
+ *
+ * Caller must hold asma->mutex.
  */
-static int range_alloc(struct ashmem_area *asma,
-		       struct ashmem_range *prev_range, unsigned int purged,
+static int range_alloc(struct ashmem_area *asma, unsigned int purged,
 		       size_t start, size_t end)
 {
+	struct rb_node **p = &asma->unpinned.rb_node;
+	struct rb_node *parent = NULL;
 	struct ashmem_range *range;
 
 	range = kmem_cache_zalloc(ashmem_range_cachep, GFP_KERNEL);
@@ -140,7 +239,16 @@ static int range_alloc(struct ashmem_area *asma,
 	range->pgend = end;
 	range->purged = purged;
 
-	list_add_tail(&range->unpinned, &prev_range->unpinned);
+	while (*p) {
+		parent = *p;
+		if (start < rb_entry(parent, struct ashmem_range,
+				     node)->pgstart)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&range->node, parent, p);
+	rb_insert_color(&range->node, &asma->unpinned);
 
 	if (range_on_lru(range))
 		lru_add(range);
@@ -150,7 +258,7 @@ static int range_alloc(struct ashmem_area *asma,
 
 static void range_del(struct ashmem_range *range)
 {
-	list_del(&range->unpinned);
+	rb_erase(&range->node, &range->asma->unpinned);
 	if (range_on_lru(range))
 		lru_del(range);
 	kmem_cache_free(ashmem_range_cachep, range);
@@ -159,7 +267,10 @@ static void range_del(struct ashmem_range *range)
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * Shrinking keeps the range's place in the tree, as it cannot move past
+ * its neighbours.
+ *
+ * Caller must hold asma->mutex.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
@@ -169,8 +280,14 @@ static inline void range_shrink(struct ashmem_range *range,
 	range->pgstart = start;
 	range->pgend = end;
 
-	if (range_on_lru(range))
-		lru_count -= pre - range_size(range);
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
+		if (range->queued)
+			purge_count -= pre - range_size(range);
+		else
+			lru_count -= pre - range_size(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -186,7 +303,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	if (unlikely(!asma))
 		return -ENOMEM;
 
-	INIT_LIST_HEAD(&asma->unpinned_list);
+	mutex_init(&asma->mutex);
+	asma->unpinned = RB_ROOT;
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -194,20 +312,23 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	return 0;
 }
 
-static int ashmem_release(struct inode *ignored, struct file *file)
+static void ashmem_area_free(struct ashmem_area *asma)
 {
-	struct ashmem_area *asma = file->private_data;
-	struct ashmem_range *range, *next;
+	struct rb_node *node;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
-		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
+	while ((node = rb_first(&asma->unpinned)))
+		range_del(rb_entry(node, struct ashmem_range, node));
+	mutex_unlock(&asma->mutex);
 
 	if (asma->file)
 		fput(asma->file);
 	kmem_cache_free(ashmem_area_cachep, asma);
+}
 
+static int ashmem_release(struct inode *ignored, struct file *file)
+{
+	ashmem_area_free(file->private_data);
 	return 0;
 }
 
@@ -217,7 +338,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0) {
@@ -238,7 +359,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -247,7 +368,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -268,7 +389,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -285,7 +406,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -328,10 +449,44 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
+static void ashmem_purge_account(struct ashmem_purge_stats *stats,
+				 ktime_t start, unsigned long pages)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock(&ashmem_lru_lock);
+	stats->calls++;
+	stats->pages += pages;
+	stats->total_ns += ns;
+	if (ns > stats->max_ns)
+		stats->max_ns = ns;
+	spin_unlock(&ashmem_lru_lock);
+}
+
+/*
+ * ashmem_purge_range - purge 'range' and unlock its area
+ *
+ * Caller must hold the area's mutex and ashmem_lru_lock, and have taken
+ * the range off the LRU or purge list; ashmem_lru_lock is dropped.
+ */
+static void ashmem_purge_range(struct ashmem_range *range)
+{
+	struct ashmem_area *asma = range->asma;
+	struct inode *inode = asma->file->f_dentry->d_inode;
+	loff_t start = range->pgstart * PAGE_SIZE;
+	loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+
+	range->purged = ASHMEM_WAS_PURGED;
+	spin_unlock(&ashmem_lru_lock);
+
+	vmtruncate_range(inode, start, end);
+	mutex_unlock(&asma->mutex);
+}
+
 /*
  * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
  *
@@ -345,11 +500,20 @@ out:
  *
  * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
  * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
+ * pages freed. Areas that are busy are skipped rather than waited for, so
+ * the shrinker never stalls pin and unpin: their ranges are set aside on a
+ * list of ours for the rest of the call, so each range is tried at most
+ * once, and go back to the tail of the LRU at the end.
+ *
+ * With async_purge set, the ranges are only moved to the purge list and
+ * ashmemd truncates them, keeping the truncation out of direct reclaim.
  */
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
 	struct ashmem_range *range, *next;
+	unsigned long pages = 0;
+	LIST_HEAD(busy);
+	ktime_t start;
 
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
@@ -357,25 +521,109 @@ static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	if (!sc->nr_to_scan)
 		return lru_count;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
-
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
+	start = ktime_get();
+
+	if (async_purge && ashmem_purge_task) {
+		spin_lock(&ashmem_lru_lock);
+		list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
+			list_move_tail(&range->lru, &ashmem_purge_list);
+			range->queued = 1;
+			lru_count -= range_size(range);
+			purge_count += range_size(range);
+			pages += range_size(range);
+			if (pages >= sc->nr_to_scan)
+				break;
+		}
+		spin_unlock(&ashmem_lru_lock);
+		if (pages)
+			wake_up(&ashmem_purge_wait);
+		goto out;
+	}
 
-		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
+	while (pages < sc->nr_to_scan) {
+		spin_lock(&ashmem_lru_lock);
+		range = NULL;
+		while (!list_empty(&ashmem_lru_list)) {
+			range = list_first_entry(&ashmem_lru_list,
+						 struct ashmem_range, lru);
+			/*
+			 * Holding the area's mutex keeps it from being
+			 * released under us once we drop ashmem_lru_lock.
+			 */
+			if (mutex_trylock(&range->asma->mutex))
+				break;
+			/* still counted in lru_count, lru_del() works too */
+			list_move_tail(&range->lru, &busy);
+			range = NULL;
+		}
+		if (!range) {
+			spin_unlock(&ashmem_lru_lock);
 			break;
+		}
+		__lru_del(range);
+		pages += range_size(range);
+		ashmem_purge_range(range);
 	}
-	mutex_unlock(&ashmem_mutex);
 
+	spin_lock(&ashmem_lru_lock);
+	list_splice_tail(&busy, &ashmem_lru_list);
+	spin_unlock(&ashmem_lru_lock);
+
+out:
+	ashmem_purge_account(&shrink_stats, start, pages);
 	return lru_count;
 }
 
+/*
+ * ashmem_purge_thread - ashmemd, purges the ranges queued by the shrinker
+ */
+static int ashmem_purge_thread(void *unused)
+{
+	struct ashmem_range *range;
+	unsigned long pages;
+	ktime_t start;
+	int n, busy;
+
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(ashmem_purge_wait,
+				     !list_empty(&ashmem_purge_list) ||
+				     kthread_should_stop());
+
+		start = ktime_get();
+		pages = 0;
+		busy = 0;
+		for (n = 0; n < ASHMEM_PURGE_BATCH; n++) {
+			spin_lock(&ashmem_lru_lock);
+			if (list_empty(&ashmem_purge_list)) {
+				spin_unlock(&ashmem_lru_lock);
+				break;
+			}
+			range = list_first_entry(&ashmem_purge_list,
+						 struct ashmem_range, lru);
+			if (!mutex_trylock(&range->asma->mutex)) {
+				/* in use, come back to it later */
+				list_move_tail(&range->lru, &ashmem_purge_list);
+				spin_unlock(&ashmem_lru_lock);
+				busy++;
+				continue;
+			}
+			__lru_del(range);
+			pages += range_size(range);
+			ashmem_purge_range(range);
+		}
+		if (pages)
+			ashmem_purge_account(&purged_stats, start, pages);
+
+		/* every range we looked at was busy, give them a moment */
+		if (busy && busy == n)
+			schedule_timeout_interruptible(1);
+		cond_resched();
+	}
+
+	return 0;
+}
 static struct shrinker ashmem_shrinker = {
 	.shrink = ashmem_shrink,
 	.seeks = DEFAULT_SEEKS * 4,
@@ -385,7 +633,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -400,7 +648,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -408,7 +656,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file)) {
@@ -422,7 +670,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -431,7 +679,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -448,26 +696,27 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
 
 /*
  * ashmem_pin - pin the given ashmem region, returning whether it was
- * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
+ * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED), or
+ * -ENOMEM if it could not split an unpinned range.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	int ret = ASHMEM_NOT_PURGED;
+	size_t end;
 
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* moved past last applicable page; we can short circuit */
-		if (range_before_page(range, pgstart))
-			break;
+	for (range = range_first(asma, pgstart, pgend);
+	     range && range->pgstart <= pgend; range = next) {
+		next = range_next(range);
 
 		/*
 		 * The user can ask us to pin pages that span multiple ranges,
@@ -508,10 +757,14 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 			/*
 			 * Case #4: We eat a chunk out of the middle. A bit
 			 * more complicated, we allocate a new range for the
-			 * second half and adjust the first chunk's endpoint.
+			 * second half and then adjust the first chunk's
+			 * endpoint. This is the only range the request
+			 * touches, so if the allocation fails nothing has
+			 * changed yet.
 			 */
-			range_alloc(asma, range, range->purged,
-				    pgend + 1, range->pgend);
+			end = range->pgend;
+			if (range_alloc(asma, range->purged, pgend + 1, end))
+				return -ENOMEM;
 			range_shrink(range, range->pgstart, pgstart - 1);
 			break;
 		}
@@ -523,59 +776,42 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_range *range;
 	unsigned int purged = ASHMEM_NOT_PURGED;
 
-restart:
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* short circuit: this is our insertion point */
-		if (range_before_page(range, pgstart))
-			break;
-
-		/*
-		 * The user can ask us to unpin pages that are already entirely
-		 * or partially pinned. We handle those two cases here.
-		 */
+	/*
+	 * The user can ask us to unpin pages that are already entirely
+	 * or partially unpinned. We handle those two cases here.
+	 */
+	while ((range = range_first(asma, pgstart, pgend))) {
 		if (page_range_subsumed_by_range(range, pgstart, pgend))
 			return 0;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			pgstart = min_t(size_t, range->pgstart, pgstart),
-			pgend = max_t(size_t, range->pgend, pgend);
-			purged |= range->purged;
-			range_del(range);
-			goto restart;
-		}
+		pgstart = min_t(size_t, range->pgstart, pgstart),
+		pgend = max_t(size_t, range->pgend, pgend);
+		purged |= range->purged;
+		range_del(range);
 	}
 
-	return range_alloc(asma, range, purged, pgstart, pgend);
+	return range_alloc(asma, purged, pgstart, pgend);
 }
 
 /*
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
 {
-	struct ashmem_range *range;
-	int ret = ASHMEM_IS_PINNED;
-
-	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
-		if (range_before_page(range, pgstart))
-			break;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret = ASHMEM_IS_UNPINNED;
-			break;
-		}
-	}
+	if (range_first(asma, pgstart, pgend))
+		return ASHMEM_IS_UNPINNED;
 
-	return ret;
+	return ASHMEM_IS_PINNED;
 }
 
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
@@ -607,7 +843,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -621,7 +857,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -676,6 +912,226 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return ret;
 }
 
+static int ashmem_purge_stats_show(char *buf,
+				   struct ashmem_purge_stats *stats,
+				   const char *name)
+{
+	struct ashmem_purge_stats st;
+
+	spin_lock(&ashmem_lru_lock);
+	st = *stats;
+	spin_unlock(&ashmem_lru_lock);
+
+	return sprintf(buf, "%-7s %10lu %10lu %12llu %12llu %10llu\n",
+		       name, st.calls, st.pages, st.total_ns, st.max_ns,
+		       st.calls ? div64_u64(st.total_ns, st.calls) : 0ULL);
+}
+
+static int get_purge_stats(char *buf, const struct kernel_param *kp)
+{
+	int len;
+
+	len = sprintf(buf, "%-7s %10s %10s %12s %12s %10s\n", "", "calls",
+		      "pages", "total_ns", "max_ns", "avg_ns");
+	len += ashmem_purge_stats_show(buf + len, &shrink_stats, "shrink");
+	len += ashmem_purge_stats_show(buf + len, &purged_stats, "ashmemd");
+	len += sprintf(buf + len, "lru %lu pages, queued %lu pages\n",
+		       lru_count, purge_count);
+
+	return len;
+}
+
+static int set_purge_stats(const char *val, const struct kernel_param *kp)
+{
+	return -EPERM;
+}
+
+static struct kernel_param_ops purge_stats_ops = {
+	.set = set_purge_stats,
+	.get = get_purge_stats,
+};
+module_param_cb(purge_stats, &purge_stats_ops, NULL, S_IRUGO);
+
+#ifdef CONFIG_ASHMEM_BENCH
+/*
+ * pin_bench - pin/unpin throughput. Writing "<threads> <loops>" runs that
+ * many threads, each on an area of its own, through 'loops' rounds of
+ * unpinning every other page of the area one page at a time, checking
+ * their pin status and pinning them back. The shrinker is free to purge
+ * the ranges meanwhile. Reading gives the result of the last run.
+ */
+#define ASHMEM_BENCH_PAGES	256
+#define ASHMEM_BENCH_THREADS	16
+
+struct ashmem_bench_thread {
+	struct ashmem_area *asma;
+	unsigned int loops;
+	unsigned long ops;
+	int err;
+	struct completion done;
+};
+
+static DEFINE_MUTEX(ashmem_bench_mutex);
+
+static struct ashmem_bench_result {
+	unsigned int threads;
+	unsigned int loops;
+	unsigned long ops;
+	u64 ns;
+	int err;
+} ashmem_bench_result;
+
+static struct ashmem_area *ashmem_bench_area(void)
+{
+	struct ashmem_area *asma;
+	struct file *file;
+
+	asma = kmem_cache_zalloc(ashmem_area_cachep, GFP_KERNEL);
+	if (unlikely(!asma))
+		return ERR_PTR(-ENOMEM);
+
+	mutex_init(&asma->mutex);
+	asma->unpinned = RB_ROOT;
+	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
+	asma->prot_mask = PROT_MASK;
+	asma->size = ASHMEM_BENCH_PAGES * PAGE_SIZE;
+
+	/* the shrinker truncates purged ranges, so a backing file is needed */
+	file = shmem_file_setup("ashmem_bench", asma->size, 0);
+	if (IS_ERR(file)) {
+		kmem_cache_free(ashmem_area_cachep, asma);
+		return ERR_CAST(file);
+	}
+	asma->file = file;
+
+	return asma;
+}
+
+static int ashmem_bench_fn(void *data)
+{
+	struct ashmem_bench_thread *t = data;
+	struct ashmem_area *asma = t->asma;
+	unsigned int i;
+	size_t pg;
+	int ret = 0;
+
+	for (i = 0; i < t->loops && ret >= 0; i++) {
+		for (pg = 0; pg < ASHMEM_BENCH_PAGES && ret >= 0; pg += 2) {
+			mutex_lock(&asma->mutex);
+			ret = ashmem_unpin(asma, pg, pg);
+			mutex_unlock(&asma->mutex);
+			t->ops++;
+		}
+		for (pg = 0; pg < ASHMEM_BENCH_PAGES && ret >= 0; pg += 2) {
+			mutex_lock(&asma->mutex);
+			if (ashmem_get_pin_status(asma, pg, pg) !=
+			    ASHMEM_IS_UNPINNED)
+				ret = -EINVAL;
+			mutex_unlock(&asma->mutex);
+			t->ops++;
+		}
+		for (pg = 0; pg < ASHMEM_BENCH_PAGES && ret >= 0; pg += 2) {
+			mutex_lock(&asma->mutex);
+			ret = ashmem_pin(asma, pg, pg);
+			mutex_unlock(&asma->mutex);
+			t->ops++;
+		}
+	}
+
+	t->err = ret < 0 ? ret : 0;
+	complete(&t->done);
+	return 0;
+}
+
+static int ashmem_bench_run(unsigned int threads, unsigned int loops)
+{
+	struct ashmem_bench_thread *thr;
+	struct task_struct *task;
+	struct ashmem_bench_result res = {
+		.threads = threads,
+		.loops = loops,
+	};
+	ktime_t start;
+	int i, started = 0, ret = 0;
+
+	thr = kcalloc(threads, sizeof(*thr), GFP_KERNEL);
+	if (!thr)
+		return -ENOMEM;
+
+	for (i = 0; i < threads; i++) {
+		thr[i].asma = ashmem_bench_area();
+		if (IS_ERR(thr[i].asma)) {
+			ret = PTR_ERR(thr[i].asma);
+			thr[i].asma = NULL;
+			goto out;
+		}
+		thr[i].loops = loops;
+		init_completion(&thr[i].done);
+	}
+
+	start = ktime_get();
+	for (i = 0; i < threads; i++) {
+		task = kthread_run(ashmem_bench_fn, &thr[i],
+				   "ashmem_bench/%d", i);
+		if (IS_ERR(task)) {
+			ret = PTR_ERR(task);
+			break;
+		}
+		started++;
+	}
+	for (i = 0; i < started; i++) {
+		wait_for_completion(&thr[i].done);
+		res.ops += thr[i].ops;
+		if (thr[i].err)
+			res.err = thr[i].err;
+	}
+	res.ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (!ret) {
+		mutex_lock(&ashmem_bench_mutex);
+		ashmem_bench_result = res;
+		mutex_unlock(&ashmem_bench_mutex);
+	}
+out:
+	for (i = 0; i < threads; i++)
+		if (thr[i].asma)
+			ashmem_area_free(thr[i].asma);
+	kfree(thr);
+	return ret;
+}
+
+static int set_pin_bench(const char *val, const struct kernel_param *kp)
+{
+	unsigned int threads, loops;
+
+	if (sscanf(val, "%u %u", &threads, &loops) != 2 || !threads ||
+	    threads > ASHMEM_BENCH_THREADS || !loops)
+		return -EINVAL;
+
+	return ashmem_bench_run(threads, loops);
+}
+
+static int get_pin_bench(char *buf, const struct kernel_param *kp)
+{
+	struct ashmem_bench_result res;
+
+	mutex_lock(&ashmem_bench_mutex);
+	res = ashmem_bench_result;
+	mutex_unlock(&ashmem_bench_mutex);
+
+	return sprintf(buf, "threads %u loops %u ops %lu ns %llu ops/s %llu "
+		       "err %d\n", res.threads, res.loops, res.ops, res.ns,
+		       res.ns ? div64_u64((u64)res.ops * NSEC_PER_SEC, res.ns) :
+		       0ULL, res.err);
+}
+
+static struct kernel_param_ops pin_bench_ops = {
+	.set = set_pin_bench,
+	.get = get_pin_bench,
+};
+module_param_cb(pin_bench, &pin_bench_ops, NULL, S_IRUGO | S_IWUSR);
+#endif /* CONFIG_ASHMEM_BENCH */
+
 static struct file_operations ashmem_fops = {
 	.owner = THIS_MODULE,
 	.open = ashmem_open,
@@ -719,6 +1175,13 @@ static int __init ashmem_init(void)
 		return ret;
 	}
 
+	ashmem_purge_task = kthread_run(ashmem_purge_thread, NULL, "ashmemd");
+	if (IS_ERR(ashmem_purge_task)) {
+		printk(KERN_ERR "ashmem: failed to start ashmemd, purging "
+		       "synchronously\n");
+		ashmem_purge_task = NULL;
+	}
+
 	register_shrinker(&ashmem_shrinker);
 
 	printk(KERN_INFO "ashmem: initialized\n");
@@ -731,6 +1194,8 @@ static void __exit ashmem_exit(void)
 	int ret;
 
 	unregister_shrinker(&ashmem_shrinker);
+	if (ashmem_purge_task)
+		kthread_stop(ashmem_purge_task);
 
 	ret = misc_deregister(&ashmem_misc);
 	if (unlikely(ret))
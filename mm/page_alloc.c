@@ -57,6 +57,8 @@
 #include <linux/ftrace_event.h>
 #include <linux/memcontrol.h>
 #include <linux/prefetch.h>
+#include <linux/migrate.h>
+#include <linux/mm_inline.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -826,13 +828,19 @@ struct page *__rmqueue_smallest(struct zone *zone, unsigned int order,
 
 /*
  * This array describes the order lists are fallen back to when
- * the free lists for the desirable migrate type are depleted
+ * the free lists for the desirable migrate type are depleted.
+ * Each row is terminated by MIGRATE_RESERVE.
  */
-static int fallbacks[MIGRATE_TYPES][MIGRATE_TYPES-1] = {
+static int fallbacks[MIGRATE_TYPES][4] = {
 	[MIGRATE_UNMOVABLE]   = { MIGRATE_RECLAIMABLE, MIGRATE_MOVABLE,   MIGRATE_RESERVE },
 	[MIGRATE_RECLAIMABLE] = { MIGRATE_UNMOVABLE,   MIGRATE_MOVABLE,   MIGRATE_RESERVE },
+#ifdef CONFIG_CMA
+	[MIGRATE_MOVABLE]     = { MIGRATE_CMA,         MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE, MIGRATE_RESERVE },
+	[MIGRATE_CMA]         = { MIGRATE_RESERVE }, /* Never used */
+#else
 	[MIGRATE_MOVABLE]     = { MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE, MIGRATE_RESERVE },
-	[MIGRATE_RESERVE]     = { MIGRATE_RESERVE,     MIGRATE_RESERVE,   MIGRATE_RESERVE }, /* Never used */
+#endif
+	[MIGRATE_RESERVE]     = { MIGRATE_RESERVE }, /* Never used */
 };
 
 /*
@@ -927,12 +935,12 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 	/* Find the largest possible block of pages in the other list */
 	for (current_order = MAX_ORDER-1; current_order >= order;
 						--current_order) {
-		for (i = 0; i < MIGRATE_TYPES - 1; i++) {
+		for (i = 0;; i++) {
 			migratetype = fallbacks[start_migratetype][i];
 
 			/* MIGRATE_RESERVE handled later if necessary */
 			if (migratetype == MIGRATE_RESERVE)
-				continue;
+				break;
 
 			area = &(zone->free_area[current_order]);
 			if (list_empty(&area->free_list[migratetype]))
@@ -946,11 +954,14 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 			 * If breaking a large block of pages, move all free
 			 * pages to the preferred allocation list. If falling
 			 * back for a reclaimable kernel allocation, be more
-			 * aggressive about taking ownership of free pages
+			 * aggressive about taking ownership of free pages.
+			 * CMA blocks are only ever borrowed from, never
+			 * taken over.
 			 */
-			if (unlikely(current_order >= (pageblock_order >> 1)) ||
+			if (!is_migrate_cma(migratetype) &&
+			    (unlikely(current_order >= (pageblock_order >> 1)) ||
 					start_migratetype == MIGRATE_RECLAIMABLE ||
-					page_group_by_mobility_disabled) {
+					page_group_by_mobility_disabled)) {
 				unsigned long pages;
 				pages = move_freepages_block(zone, page,
 								start_migratetype);
@@ -969,7 +980,8 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 			rmv_page_order(page);
 
 			/* Take ownership for orders >= pageblock_order */
-			if (current_order >= pageblock_order)
+			if (current_order >= pageblock_order &&
+			    !is_migrate_cma(migratetype))
 				change_pageblock_range(page, current_order,
 							start_migratetype);
 
@@ -1046,6 +1058,11 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
 		else
 			list_add_tail(&page->lru, list);
 		set_page_private(page, migratetype);
+#ifdef CONFIG_CMA
+		/* Pages borrowed from a CMA block must be freed back to it */
+		if (is_migrate_cma(get_pageblock_migratetype(page)))
+			set_page_private(page, MIGRATE_CMA);
+#endif
 		list = &page->lru;
 	}
 	__mod_zone_page_state(zone, NR_FREE_PAGES, -(i << order));
@@ -1274,7 +1291,8 @@ int split_free_page(struct page *page)
 	set_page_refcounted(page);
 	split_page(page, order);
 
-	if (order >= pageblock_order - 1) {
+	if (order >= pageblock_order - 1 &&
+	    !is_migrate_cma(get_pageblock_migratetype(page))) {
 		struct page *endpage = page + (1 << order) - 1;
 		for (; page < endpage; page += pageblock_nr_pages)
 			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
@@ -5488,7 +5506,8 @@ __count_immobile_pages(struct zone *zone, struct page *page, int count)
 	if (zone_idx(zone) == ZONE_MOVABLE)
 		return true;
 
-	if (get_pageblock_migratetype(page) == MIGRATE_MOVABLE)
+	if (get_pageblock_migratetype(page) == MIGRATE_MOVABLE ||
+	    is_migrate_cma(get_pageblock_migratetype(page)))
 		return true;
 
 	pfn = page_to_pfn(page);
@@ -5587,7 +5606,7 @@ out:
 	return ret;
 }
 
-void unset_migratetype_isolate(struct page *page)
+void unset_migratetype_isolate(struct page *page, unsigned migratetype)
 {
 	struct zone *zone;
 	unsigned long flags;
@@ -5595,12 +5614,218 @@ void unset_migratetype_isolate(struct page *page)
 	spin_lock_irqsave(&zone->lock, flags);
 	if (get_pageblock_migratetype(page) != MIGRATE_ISOLATE)
 		goto out;
-	set_pageblock_migratetype(page, MIGRATE_MOVABLE);
-	move_freepages_block(zone, page, MIGRATE_MOVABLE);
+	set_pageblock_migratetype(page, migratetype);
+	move_freepages_block(zone, page, migratetype);
 out:
 	spin_unlock_irqrestore(&zone->lock, flags);
 }
 
+#ifdef CONFIG_CMA
+/*
+ * Hand a range of boot-time reserved pageblocks over to the buddy allocator
+ * as MIGRATE_CMA. The pages can then back movable allocations until
+ * alloc_contig_range() takes them back.
+ */
+int __init init_cma_reserved_range(unsigned long start_pfn,
+				   unsigned long nr_pages)
+{
+	unsigned long pfn, end_pfn = start_pfn + nr_pages;
+	struct zone *zone;
+
+	if ((start_pfn | nr_pages) & (pageblock_nr_pages - 1))
+		return -EINVAL;
+
+	zone = page_zone(pfn_to_page(start_pfn));
+	for (pfn = start_pfn; pfn < end_pfn; pfn++) {
+		if (!pfn_valid(pfn) || page_zone(pfn_to_page(pfn)) != zone)
+			return -EINVAL;
+	}
+
+	for (pfn = start_pfn; pfn < end_pfn; pfn += pageblock_nr_pages) {
+		struct page *page = pfn_to_page(pfn);
+		unsigned long i;
+
+		for (i = 0; i < pageblock_nr_pages; i++) {
+			__ClearPageReserved(page + i);
+			set_page_count(page + i, 0);
+		}
+		set_page_refcounted(page);
+		set_pageblock_migratetype(page, MIGRATE_CMA);
+		__free_pages(page, pageblock_order);
+		totalram_pages += pageblock_nr_pages;
+	}
+	return 0;
+}
+
+/* Serializes alloc_contig_range() callers, as pageblocks can be shared */
+static DEFINE_MUTEX(cma_mutex);
+
+#define CMA_MIGRATE_BATCH	32
+#define CMA_MIGRATE_RETRIES	5
+
+static struct page *
+cma_migrate_alloc(struct page *page, unsigned long private, int **result)
+{
+	return alloc_page(GFP_HIGHUSER_MOVABLE);
+}
+
+/*
+ * Move every in-use page of [start, end) somewhere else. Pages that cannot
+ * be isolated right now (held in a pagevec, under I/O, ...) are simply
+ * skipped; the caller notices and retries.
+ */
+static void cma_migrate_range(unsigned long start, unsigned long end,
+			      unsigned long *migrated)
+{
+	unsigned long pfn = start;
+	LIST_HEAD(source);
+
+	while (pfn < end) {
+		int nr = 0, failed;
+
+		for (; pfn < end && nr < CMA_MIGRATE_BATCH; pfn++) {
+			struct page *page = pfn_to_page(pfn);
+
+			if (!get_page_unless_zero(page))
+				continue;
+			if (!isolate_lru_page(page)) {
+				list_add_tail(&page->lru, &source);
+				inc_zone_page_state(page, NR_ISOLATED_ANON +
+						    page_is_file_cache(page));
+				nr++;
+			}
+			put_page(page);
+		}
+		if (!nr)
+			continue;
+
+		/* this returns the number of pages not migrated */
+		failed = migrate_pages(&source, cma_migrate_alloc, 0,
+				       false, true);
+		if (failed) {
+			putback_lru_pages(&source);
+			if (failed < 0)
+				failed = nr;
+		}
+		*migrated += nr - failed;
+	}
+}
+
+/*
+ * Check that [start, end) is entirely free and take it out of the buddy
+ * allocator. The first and last free blocks may stick out of the range;
+ * the excess is freed again once the zone lock is dropped. Returns the
+ * pfn where the taken pages end, or 0 if part of the range is in use.
+ */
+static unsigned long
+cma_take_free_range(unsigned long start, unsigned long end,
+		    unsigned long *outer_start)
+{
+	struct zone *zone = page_zone(pfn_to_page(start));
+	unsigned long flags, pfn;
+	unsigned int order;
+
+	spin_lock_irqsave(&zone->lock, flags);
+
+	/* find the free block that covers start */
+	for (order = 0, pfn = start; order < MAX_ORDER; order++) {
+		pfn = start & ~((1UL << order) - 1);
+		if (PageBuddy(pfn_to_page(pfn)) &&
+		    page_order(pfn_to_page(pfn)) >= order)
+			break;
+	}
+	if (order == MAX_ORDER)
+		goto busy;
+	*outer_start = pfn;
+
+	while (pfn < end) {
+		if (!PageBuddy(pfn_to_page(pfn)))
+			goto busy;
+		pfn += 1UL << page_order(pfn_to_page(pfn));
+	}
+
+	for (pfn = *outer_start; pfn < end; pfn += 1UL << order) {
+		struct page *page = pfn_to_page(pfn);
+
+		order = page_order(page);
+		list_del(&page->lru);
+		zone->free_area[order].nr_free--;
+		rmv_page_order(page);
+		__mod_zone_page_state(zone, NR_FREE_PAGES, -(1UL << order));
+		set_page_refcounted(page);
+		split_page(page, order);
+	}
+
+	spin_unlock_irqrestore(&zone->lock, flags);
+	return pfn;
+busy:
+	spin_unlock_irqrestore(&zone->lock, flags);
+	return 0;
+}
+
+/**
+ * alloc_contig_range() -- take [start, end) out of a MIGRATE_CMA area
+ * @start:	first pfn of the range
+ * @end:	pfn after the last one of the range
+ * @migrated:	incremented by the number of pages moved out of the way
+ *
+ * The pageblocks covering the range are isolated, the pages currently
+ * using the range are migrated elsewhere and the then free range is
+ * removed from the buddy allocator. Each page of the range comes back
+ * with a reference count of one and must be released with
+ * free_contig_range(). The range does not need to be pageblock aligned
+ * but has to lie within a single zone.
+ *
+ * Returns 0 on success, -EBUSY if some page could not be moved.
+ */
+int alloc_contig_range(unsigned long start, unsigned long end,
+		       unsigned long *migrated)
+{
+	unsigned long block_start = start & ~(pageblock_nr_pages - 1);
+	unsigned long block_end = ALIGN(end, pageblock_nr_pages);
+	unsigned long outer_start, outer_end = 0;
+	int tries, ret;
+
+	mutex_lock(&cma_mutex);
+
+	ret = start_isolate_page_range(block_start, block_end, MIGRATE_CMA);
+	if (ret)
+		goto out;
+
+	for (tries = 0; tries < CMA_MIGRATE_RETRIES; tries++) {
+		lru_add_drain_all();
+		cma_migrate_range(start, end, migrated);
+		lru_add_drain_all();
+		drain_all_pages();
+
+		outer_end = cma_take_free_range(start, end, &outer_start);
+		if (outer_end)
+			break;
+		cond_resched();
+	}
+
+	if (outer_end) {
+		if (outer_start != start)
+			free_contig_range(outer_start, start - outer_start);
+		if (outer_end != end)
+			free_contig_range(end, outer_end - end);
+	} else {
+		ret = -EBUSY;
+	}
+
+	undo_isolate_page_range(block_start, block_end, MIGRATE_CMA);
+out:
+	mutex_unlock(&cma_mutex);
+	return ret;
+}
+
+void free_contig_range(unsigned long pfn, unsigned long nr_pages)
+{
+	for (; nr_pages--; pfn++)
+		__free_page(pfn_to_page(pfn));
+}
+#endif /* CONFIG_CMA */
+
 #ifdef CONFIG_MEMORY_HOTREMOVE
 /*
  * All pages in the range must be isolated before calling this.
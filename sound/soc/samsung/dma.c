@@ -16,6 +16,8 @@
 
 #include <linux/slab.h>
 #include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
+#include <linux/moduleparam.h>
 
 #include <sound/soc.h>
 #include <sound/pcm_params.h>
@@ -29,6 +31,40 @@
 #define ST_RUNNING		(1<<0)
 #define ST_OPENED		(1<<1)
 
+#ifdef CONFIG_S3C64XX_DMAENGINE
+/* The buffer is played as one cyclic LLI ring that only interrupts at
+ * period ends, so allow deep buffers with large periods to keep the CPU
+ * asleep during long playback. */
+#define DMA_BUFFER_BYTES_MAX	(512*1024)
+#define DMA_PERIOD_BYTES_MAX	(256*1024)
+#else
+#define DMA_BUFFER_BYTES_MAX	(128*1024)
+#define DMA_PERIOD_BYTES_MAX	(PAGE_SIZE*2)
+#endif
+
+/* period interrupts taken by all streams, to see what a given period
+ * size costs in wakeups */
+static atomic_t period_irqs = ATOMIC_INIT(0);
+
+static int period_irqs_get(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%u", atomic_read(&period_irqs));
+}
+
+static int period_irqs_set(const char *val, const struct kernel_param *kp)
+{
+	atomic_set(&period_irqs, 0);
+	return 0;
+}
+
+static struct kernel_param_ops period_irqs_ops = {
+	.set	= period_irqs_set,
+	.get	= period_irqs_get,
+};
+
+module_param_cb(period_irqs, &period_irqs_ops, NULL, 0644);
+MODULE_PARM_DESC(period_irqs, "Period interrupts taken, write to reset");
+
 static const struct snd_pcm_hardware dma_hardware = {
 	.info			= SNDRV_PCM_INFO_INTERLEAVED |
 				    SNDRV_PCM_INFO_BLOCK_TRANSFER |
@@ -42,9 +78,9 @@ static const struct snd_pcm_hardware dma_hardware = {
 				    SNDRV_PCM_FMTBIT_S8,
 	.channels_min		= 2,
 	.channels_max		= 2,
-	.buffer_bytes_max	= 128*1024,
+	.buffer_bytes_max	= DMA_BUFFER_BYTES_MAX,
 	.period_bytes_min	= PAGE_SIZE,
-	.period_bytes_max	= PAGE_SIZE*2,
+	.period_bytes_max	= DMA_PERIOD_BYTES_MAX,
 	.periods_min		= 2,
 	.periods_max		= 128,
 	.fifo_size		= 32,
@@ -60,8 +96,151 @@ struct runtime_data {
 	dma_addr_t dma_pos;
 	dma_addr_t dma_end;
 	struct s3c_dma_params *params;
+#ifdef CONFIG_S3C64XX_DMAENGINE
+	struct dma_chan *chan;		/* cyclic dmaengine channel, if any */
+	dma_cookie_t cookie;
+#endif
 };
 
+#ifdef CONFIG_S3C64XX_DMAENGINE
+
+static void dma_cyclic_done(void *data)
+{
+	struct snd_pcm_substream *substream = data;
+	struct runtime_data *prtd = substream->runtime->private_data;
+
+	atomic_inc(&period_irqs);
+
+	if (prtd->state & ST_RUNNING)
+		snd_pcm_period_elapsed(substream);
+}
+
+static bool dma_cyclic_request(struct runtime_data *prtd)
+{
+	dma_cap_mask_t mask;
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_SLAVE, mask);
+	dma_cap_set(DMA_CYCLIC, mask);
+
+	prtd->chan = dma_request_channel(mask, s3c64xx_dma_filter,
+			(void *)(unsigned long)prtd->params->channel);
+
+	return prtd->chan != NULL;
+}
+
+static void dma_cyclic_release(struct runtime_data *prtd)
+{
+	dma_release_channel(prtd->chan);
+	prtd->chan = NULL;
+}
+
+/* build the ring over the whole buffer, started by the trigger */
+static int dma_cyclic_prepare(struct snd_pcm_substream *substream)
+{
+	struct runtime_data *prtd = substream->runtime->private_data;
+	struct dma_async_tx_descriptor *desc;
+	struct dma_slave_config config = { 0 };
+	int ret;
+
+	dmaengine_terminate_all(prtd->chan);
+
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
+		config.direction = DMA_TO_DEVICE;
+		config.dst_addr = prtd->params->dma_addr;
+		config.dst_addr_width = prtd->params->dma_size;
+		config.dst_maxburst = 1;
+	} else {
+		config.direction = DMA_FROM_DEVICE;
+		config.src_addr = prtd->params->dma_addr;
+		config.src_addr_width = prtd->params->dma_size;
+		config.src_maxburst = 1;
+	}
+
+	ret = dmaengine_slave_config(prtd->chan, &config);
+	if (ret)
+		return ret;
+
+	desc = prtd->chan->device->device_prep_dma_cyclic(prtd->chan,
+			prtd->dma_start, prtd->dma_end - prtd->dma_start,
+			prtd->dma_period, config.direction);
+	if (!desc)
+		return -ENOMEM;
+
+	desc->callback = dma_cyclic_done;
+	desc->callback_param = substream;
+	prtd->cookie = dmaengine_submit(desc);
+
+	return 0;
+}
+
+static void dma_cyclic_trigger(struct runtime_data *prtd, int cmd)
+{
+	switch (cmd) {
+	case SNDRV_PCM_TRIGGER_START:
+		dma_async_issue_pending(prtd->chan);
+		break;
+
+	case SNDRV_PCM_TRIGGER_RESUME:
+	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
+		dmaengine_resume(prtd->chan);
+		break;
+
+	case SNDRV_PCM_TRIGGER_STOP:
+		dmaengine_terminate_all(prtd->chan);
+		break;
+
+	case SNDRV_PCM_TRIGGER_SUSPEND:
+	case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
+		dmaengine_pause(prtd->chan);
+		break;
+	}
+}
+
+/* the residue counts down to the end of the ring */
+static unsigned long dma_cyclic_pointer(struct runtime_data *prtd)
+{
+	struct dma_tx_state state;
+
+	prtd->chan->device->device_tx_status(prtd->chan, prtd->cookie,
+					     &state);
+
+	return prtd->dma_end - prtd->dma_start - state.residue;
+}
+
+static inline bool dma_is_cyclic(struct runtime_data *prtd)
+{
+	return prtd->chan != NULL;
+}
+
+#else
+
+static inline bool dma_cyclic_request(struct runtime_data *prtd)
+{
+	return false;
+}
+
+static inline void dma_cyclic_release(struct runtime_data *prtd) { }
+
+static inline int dma_cyclic_prepare(struct snd_pcm_substream *substream)
+{
+	return 0;
+}
+
+static inline void dma_cyclic_trigger(struct runtime_data *prtd, int cmd) { }
+
+static inline unsigned long dma_cyclic_pointer(struct runtime_data *prtd)
+{
+	return 0;
+}
+
+static inline bool dma_is_cyclic(struct runtime_data *prtd)
+{
+	return false;
+}
+
+#endif /* CONFIG_S3C64XX_DMAENGINE */
+
 /* dma_enqueue
  *
  * place a dma buffer onto the queue for the dma system
@@ -121,6 +300,8 @@ static void audio_buffdone(struct s3c2410_dma_chan *channel,
 	if (result == S3C2410_RES_ABORT || result == S3C2410_RES_ERR)
 		return;
 
+	atomic_inc(&period_irqs);
+
 	prtd = substream->runtime->private_data;
 
 	if (substream)
@@ -163,22 +344,27 @@ static int dma_hw_params(struct snd_pcm_substream *substream,
 		pr_debug("params %p, client %p, channel %d\n", prtd->params,
 			prtd->params->client, prtd->params->channel);
 
-		ret = s3c2410_dma_request(prtd->params->channel,
-					  prtd->params->client, NULL);
-
-		if (ret < 0) {
-			printk(KERN_ERR "failed to get dma channel\n");
-			return ret;
+		/* prefer a cyclic dmaengine transfer, else queue buffers */
+		if (!dma_cyclic_request(prtd)) {
+			ret = s3c2410_dma_request(prtd->params->channel,
+						  prtd->params->client, NULL);
+
+			if (ret < 0) {
+				printk(KERN_ERR "failed to get dma channel\n");
+				prtd->params = NULL;
+				return ret;
+			}
+
+			/* use the circular buffering if we have it available. */
+			if (s3c_dma_has_circular())
+				s3c2410_dma_setflags(prtd->params->channel,
+						     S3C2410_DMAF_CIRCULAR);
 		}
-
-		/* use the circular buffering if we have it available. */
-		if (s3c_dma_has_circular())
-			s3c2410_dma_setflags(prtd->params->channel,
-					     S3C2410_DMAF_CIRCULAR);
 	}
 
-	s3c2410_dma_set_buffdone_fn(prtd->params->channel,
-				    audio_buffdone);
+	if (!dma_is_cyclic(prtd))
+		s3c2410_dma_set_buffdone_fn(prtd->params->channel,
+					    audio_buffdone);
 
 	snd_pcm_set_runtime_buffer(substream, &substream->dma_buffer);
 
@@ -206,7 +392,11 @@ static int dma_hw_free(struct snd_pcm_substream *substream)
 	snd_pcm_set_runtime_buffer(substream, NULL);
 
 	if (prtd->params) {
-		s3c2410_dma_free(prtd->params->channel, prtd->params->client);
+		if (dma_is_cyclic(prtd))
+			dma_cyclic_release(prtd);
+		else
+			s3c2410_dma_free(prtd->params->channel,
+					 prtd->params->client);
 		prtd->params = NULL;
 	}
 
@@ -225,6 +415,9 @@ static int dma_prepare(struct snd_pcm_substream *substream)
 	if (!prtd->params)
 		return 0;
 
+	if (dma_is_cyclic(prtd))
+		return dma_cyclic_prepare(substream);
+
 	/* channel needs configuring for mem=>device, increment memory addr,
 	 * sync to pclk, half-word transfers to the IIS-FIFO. */
 	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
@@ -265,14 +458,22 @@ static int dma_trigger(struct snd_pcm_substream *substream, int cmd)
 	case SNDRV_PCM_TRIGGER_RESUME:
 	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
 		prtd->state |= ST_RUNNING;
-		s3c2410_dma_ctrl(prtd->params->channel, S3C2410_DMAOP_START);
+		if (dma_is_cyclic(prtd))
+			dma_cyclic_trigger(prtd, cmd);
+		else
+			s3c2410_dma_ctrl(prtd->params->channel,
+					 S3C2410_DMAOP_START);
 		break;
 
 	case SNDRV_PCM_TRIGGER_STOP:
 	case SNDRV_PCM_TRIGGER_SUSPEND:
 	case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
 		prtd->state &= ~ST_RUNNING;
-		s3c2410_dma_ctrl(prtd->params->channel, S3C2410_DMAOP_STOP);
+		if (dma_is_cyclic(prtd))
+			dma_cyclic_trigger(prtd, cmd);
+		else
+			s3c2410_dma_ctrl(prtd->params->channel,
+					 S3C2410_DMAOP_STOP);
 		break;
 
 	default:
@@ -296,16 +497,21 @@ dma_pointer(struct snd_pcm_substream *substream)
 	pr_debug("Entered %s\n", __func__);
 
 	spin_lock(&prtd->lock);
-	s3c2410_dma_getposition(prtd->params->channel, &src, &dst);
 
-	if (substream->stream == SNDRV_PCM_STREAM_CAPTURE)
-		res = dst - prtd->dma_start;
-	else
-		res = src - prtd->dma_start;
+	if (dma_is_cyclic(prtd)) {
+		res = dma_cyclic_pointer(prtd);
+	} else {
+		s3c2410_dma_getposition(prtd->params->channel, &src, &dst);
 
-	spin_unlock(&prtd->lock);
+		if (substream->stream == SNDRV_PCM_STREAM_CAPTURE)
+			res = dst - prtd->dma_start;
+		else
+			res = src - prtd->dma_start;
 
-	pr_debug("Pointer %x %x\n", src, dst);
+		pr_debug("Pointer %x %x\n", src, dst);
+	}
+
+	spin_unlock(&prtd->lock);
 
 	/* we seem to be getting the odd error from the pcm library due
 	 * to out-of-bounds pointers. this is maybe due to the dma engine
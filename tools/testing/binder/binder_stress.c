@@ -0,0 +1,690 @@
+/*
+ * binder_stress.c -- binder transaction throughput test
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Runs a number of client/server process pairs. Each server registers
+ * with the context manager, each client looks its server up and then
+ * sends it synchronous transactions, all clients at once, with every
+ * reply as large as the request. The transactions per second of each
+ * pair and of all of them together are printed, so runs with one pair
+ * and with one pair per CPU show how binder scales.
+ *
+ * The context manager is the one already running (servicemanager on
+ * Android, which has to let root register services), or else a minimal
+ * one started by the test that speaks the same protocol.
+ *
+ * $(CROSS_COMPILE)cc -Wall -Wextra -O2 -static -o binder_stress \
+ *	binder_stress.c
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../../drivers/staging/android/binder.h"
+
+#define MAP_SIZE	(128 * 1024)
+#define MAX_PAIRS	64
+#define MAX_SIZE	4096
+
+/* servicemanager's transaction codes */
+#define SVC_MGR_CHECK_SERVICE	2
+#define SVC_MGR_ADD_SERVICE	3
+
+/* codes understood by the test servers */
+#define STRESS_PING	1
+#define STRESS_QUIT	2
+
+static const char *device = "/dev/binder";
+static const char svcmgr_id[] = "android.os.IServiceManager";
+
+struct binder_state {
+	int fd;
+	void *map;
+	/* commands to hand to the driver with the next read */
+	unsigned char wbuf[256];
+	size_t wlen;
+	/* returns from the driver not consumed yet */
+	unsigned char rbuf[256];
+	size_t rpos, rlen;
+};
+
+/* Transaction payload, with room for one binder object */
+struct parcel {
+	unsigned char data[MAX_SIZE + 256];
+	size_t len;
+	size_t offs[1];
+	size_t n_offs;
+	size_t pos;	/* read position */
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void binder_open(struct binder_state *bs)
+{
+	struct binder_version vers;
+
+	memset(bs, 0, sizeof(*bs));
+	bs->fd = open(device, O_RDWR);
+	if (bs->fd < 0)
+		die(device);
+	if (ioctl(bs->fd, BINDER_VERSION, &vers) < 0)
+		die("BINDER_VERSION");
+	if (vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol %ld, expected %d\n",
+			(long)vers.protocol_version,
+			BINDER_CURRENT_PROTOCOL_VERSION);
+		exit(1);
+	}
+	bs->map = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, bs->fd, 0);
+	if (bs->map == MAP_FAILED)
+		die("mmap");
+}
+
+static void put_cmd(struct binder_state *bs, uint32_t cmd, const void *arg,
+		    size_t size)
+{
+	if (bs->wlen + sizeof(cmd) + size > sizeof(bs->wbuf)) {
+		fprintf(stderr, "command buffer overflow\n");
+		exit(1);
+	}
+	memcpy(bs->wbuf + bs->wlen, &cmd, sizeof(cmd));
+	if (size)
+		memcpy(bs->wbuf + bs->wlen + sizeof(cmd), arg, size);
+	bs->wlen += sizeof(cmd) + size;
+}
+
+/*
+ * Hand the pending commands to the driver and, if 'wait' is set, wait for
+ * returns from it.
+ */
+static void binder_io(struct binder_state *bs, int wait)
+{
+	struct binder_write_read bwr;
+	int ret;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_buffer = (unsigned long)bs->wbuf;
+	bwr.write_size = bs->wlen;
+	if (wait) {
+		bwr.read_buffer = (unsigned long)bs->rbuf;
+		bwr.read_size = sizeof(bs->rbuf);
+	}
+
+	for (;;) {
+		ret = ioctl(bs->fd, BINDER_WRITE_READ, &bwr);
+		if (ret >= 0 || errno != EINTR)
+			break;
+		/* do not hand over the commands taken already again */
+		bwr.write_buffer += bwr.write_consumed;
+		bwr.write_size -= bwr.write_consumed;
+		bwr.write_consumed = 0;
+	}
+	if (ret < 0)
+		die("BINDER_WRITE_READ");
+
+	bs->wlen = 0;
+	bs->rpos = 0;
+	bs->rlen = bwr.read_consumed;
+}
+
+static void get_ret(struct binder_state *bs, void *arg, size_t size)
+{
+	if (bs->rpos + size > bs->rlen) {
+		fprintf(stderr, "short return from the driver\n");
+		exit(1);
+	}
+	memcpy(arg, bs->rbuf + bs->rpos, size);
+	bs->rpos += size;
+}
+
+/*
+ * Return the next BR_TRANSACTION or BR_REPLY, taking care of the reference
+ * counting the driver asks for on the way.
+ */
+static uint32_t binder_next(struct binder_state *bs,
+			    struct binder_transaction_data *txn)
+{
+	struct binder_ptr_cookie pc;
+	uint32_t cmd;
+
+	for (;;) {
+		if (bs->rpos == bs->rlen)
+			binder_io(bs, 1);
+		get_ret(bs, &cmd, sizeof(cmd));
+
+		switch (cmd) {
+		case BR_NOOP:
+		case BR_TRANSACTION_COMPLETE:
+		case BR_SPAWN_LOOPER:
+			break;
+		case BR_INCREFS:
+			get_ret(bs, &pc, sizeof(pc));
+			put_cmd(bs, BC_INCREFS_DONE, &pc, sizeof(pc));
+			break;
+		case BR_ACQUIRE:
+			get_ret(bs, &pc, sizeof(pc));
+			put_cmd(bs, BC_ACQUIRE_DONE, &pc, sizeof(pc));
+			break;
+		case BR_RELEASE:
+		case BR_DECREFS:
+			get_ret(bs, &pc, sizeof(pc));
+			break;
+		case BR_TRANSACTION:
+		case BR_REPLY:
+			get_ret(bs, txn, sizeof(*txn));
+			return cmd;
+		case BR_DEAD_REPLY:
+			fprintf(stderr, "%d: dead reply\n", getpid());
+			exit(1);
+		case BR_FAILED_REPLY:
+			fprintf(stderr, "%d: failed reply\n", getpid());
+			exit(1);
+		default:
+			fprintf(stderr, "%d: unexpected return %#x\n",
+				getpid(), cmd);
+			exit(1);
+		}
+	}
+}
+
+static void free_buffer(struct binder_state *bs,
+			struct binder_transaction_data *txn)
+{
+	const void *buffer = txn->data.ptr.buffer;
+
+	put_cmd(bs, BC_FREE_BUFFER, &buffer, sizeof(buffer));
+}
+
+static void fill_txn(struct binder_transaction_data *txn, struct parcel *p)
+{
+	txn->data_size = p->len;
+	txn->offsets_size = p->n_offs * sizeof(p->offs[0]);
+	txn->data.ptr.buffer = p->data;
+	txn->data.ptr.offsets = p->offs;
+}
+
+/* Send 'p' to 'handle' and wait for the reply, which the caller frees */
+static void binder_call(struct binder_state *bs, uint32_t handle,
+			uint32_t code, struct parcel *p,
+			struct binder_transaction_data *reply)
+{
+	struct binder_transaction_data txn;
+
+	memset(&txn, 0, sizeof(txn));
+	txn.target.handle = handle;
+	txn.code = code;
+	fill_txn(&txn, p);
+	put_cmd(bs, BC_TRANSACTION, &txn, sizeof(txn));
+
+	if (binder_next(bs, reply) != BR_REPLY) {
+		fprintf(stderr, "%d: transaction instead of reply\n",
+			getpid());
+		exit(1);
+	}
+	if (reply->flags & TF_STATUS_CODE) {
+		fprintf(stderr, "%d: call %u to %u failed\n", getpid(), code,
+			handle);
+		exit(1);
+	}
+}
+
+static void binder_reply(struct binder_state *bs, struct parcel *p)
+{
+	struct binder_transaction_data txn;
+
+	memset(&txn, 0, sizeof(txn));
+	fill_txn(&txn, p);
+	put_cmd(bs, BC_REPLY, &txn, sizeof(txn));
+}
+
+static void parcel_init(struct parcel *p)
+{
+	p->len = 0;
+	p->n_offs = 0;
+}
+
+static void *parcel_alloc(struct parcel *p, size_t size)
+{
+	void *ptr = p->data + p->len;
+
+	size = (size + 3) & ~3;
+	if (p->len + size > sizeof(p->data)) {
+		fprintf(stderr, "parcel overflow\n");
+		exit(1);
+	}
+	memset(ptr, 0, size);
+	p->len += size;
+	return ptr;
+}
+
+static void parcel_put32(struct parcel *p, uint32_t val)
+{
+	memcpy(parcel_alloc(p, sizeof(val)), &val, sizeof(val));
+}
+
+/* Strings are UTF-16, preceded by their length and NUL-terminated */
+static void parcel_put_string16(struct parcel *p, const char *s)
+{
+	size_t i, n = strlen(s);
+	uint16_t *str;
+
+	parcel_put32(p, n);
+	str = parcel_alloc(p, (n + 1) * sizeof(*str));
+	for (i = 0; i < n; i++)
+		str[i] = (unsigned char)s[i];
+}
+
+static void parcel_put_obj(struct parcel *p, unsigned long type, void *ptr,
+			   unsigned long handle)
+{
+	struct flat_binder_object *obj;
+
+	p->offs[p->n_offs++] = p->len;
+	obj = parcel_alloc(p, sizeof(*obj));
+	obj->type = type;
+	obj->flags = 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS;
+	if (type == BINDER_TYPE_BINDER) {
+		obj->binder = ptr;
+		obj->cookie = ptr;
+	} else
+		obj->handle = handle;
+}
+
+/* Wrap a received buffer for reading */
+static void parcel_from_txn(struct parcel *p,
+			    struct binder_transaction_data *txn)
+{
+	size_t len = txn->data_size;
+
+	if (len > sizeof(p->data))
+		len = sizeof(p->data);
+	memcpy(p->data, txn->data.ptr.buffer, len);
+	p->len = len;
+	p->n_offs = txn->offsets_size / sizeof(p->offs[0]);
+	if (p->n_offs > 1)
+		p->n_offs = 1;
+	memcpy(p->offs, txn->data.ptr.offsets,
+	       p->n_offs * sizeof(p->offs[0]));
+	p->pos = 0;
+}
+
+static int parcel_get32(struct parcel *p, uint32_t *val)
+{
+	if (p->pos + sizeof(*val) > p->len)
+		return -1;
+	memcpy(val, p->data + p->pos, sizeof(*val));
+	p->pos += sizeof(*val);
+	return 0;
+}
+
+/* Compare the next string with 's', and skip it */
+static int parcel_match_string16(struct parcel *p, const char *s)
+{
+	uint32_t n;
+	size_t i, size;
+	uint16_t c;
+
+	if (parcel_get32(p, &n) || n != strlen(s))
+		return -1;
+	size = ((n + 1) * sizeof(c) + 3) & ~3;
+	if (p->pos + size > p->len)
+		return -1;
+	for (i = 0; i < n; i++) {
+		memcpy(&c, p->data + p->pos + i * sizeof(c), sizeof(c));
+		if (c != (unsigned char)s[i])
+			return -1;
+	}
+	p->pos += size;
+	return 0;
+}
+
+/* Read the next string into 's', which holds 'size' chars */
+static int parcel_get_string16(struct parcel *p, char *s, size_t size)
+{
+	uint32_t n;
+	size_t i, len;
+	uint16_t c;
+
+	if (parcel_get32(p, &n) || n >= size)
+		return -1;
+	len = ((n + 1) * sizeof(c) + 3) & ~3;
+	if (p->pos + len > p->len)
+		return -1;
+	for (i = 0; i < n; i++) {
+		memcpy(&c, p->data + p->pos + i * sizeof(c), sizeof(c));
+		s[i] = c;
+	}
+	s[n] = '\0';
+	p->pos += len;
+	return 0;
+}
+
+/* The handle of the object at the read position, if there is one */
+static int parcel_get_handle(struct parcel *p, uint32_t *handle)
+{
+	struct flat_binder_object obj;
+
+	if (!p->n_offs || p->offs[0] != p->pos ||
+	    p->pos + sizeof(obj) > p->len)
+		return -1;
+	memcpy(&obj, p->data + p->pos, sizeof(obj));
+	if (obj.type != BINDER_TYPE_HANDLE)
+		return -1;
+	*handle = obj.handle;
+	p->pos += sizeof(obj);
+	return 0;
+}
+
+static void service_name(char *name, size_t size, int pair)
+{
+	snprintf(name, size, "binder_stress.%d", pair);
+}
+
+/*
+ * Minimal context manager, for when none is running: keeps the names
+ * servers add and hands out their handles to clients checking for them.
+ */
+static void run_manager(int ready_fd)
+{
+	static struct parcel in, out;
+	struct binder_state bs;
+	struct binder_transaction_data txn;
+	struct {
+		char name[32];
+		uint32_t handle;
+	} services[MAX_PAIRS];
+	int i, n_services = 0;
+	uint32_t strict, handle;
+	char name[32], ok = 'y';
+
+	binder_open(&bs);
+	if (ioctl(bs.fd, BINDER_SET_CONTEXT_MGR, 0) < 0)
+		ok = 'n';
+	if (write(ready_fd, &ok, 1) != 1 || ok == 'n')
+		exit(0);
+	close(ready_fd);
+
+	put_cmd(&bs, BC_ENTER_LOOPER, NULL, 0);
+	for (;;) {
+		if (binder_next(&bs, &txn) != BR_TRANSACTION)
+			continue;
+		parcel_from_txn(&in, &txn);
+		parcel_init(&out);
+
+		if (parcel_get32(&in, &strict) ||
+		    parcel_match_string16(&in, svcmgr_id) ||
+		    parcel_get_string16(&in, name, sizeof(name))) {
+			free_buffer(&bs, &txn);
+			parcel_put32(&out, (uint32_t)-EINVAL);
+			binder_reply(&bs, &out);
+			continue;
+		}
+
+		if (txn.code == SVC_MGR_ADD_SERVICE &&
+		    n_services < MAX_PAIRS &&
+		    !parcel_get_handle(&in, &handle)) {
+			/* keep the handle once the buffer is gone */
+			put_cmd(&bs, BC_ACQUIRE, &handle, sizeof(handle));
+			strcpy(services[n_services].name, name);
+			services[n_services++].handle = handle;
+			parcel_put32(&out, 0);
+		} else if (txn.code == SVC_MGR_CHECK_SERVICE) {
+			for (i = 0; i < n_services; i++)
+				if (!strcmp(services[i].name, name))
+					break;
+			if (i < n_services)
+				parcel_put_obj(&out, BINDER_TYPE_HANDLE, NULL,
+					       services[i].handle);
+			else
+				parcel_put32(&out, 0);
+		} else
+			parcel_put32(&out, (uint32_t)-EINVAL);
+
+		free_buffer(&bs, &txn);
+		binder_reply(&bs, &out);
+	}
+}
+
+static void svcmgr_header(struct parcel *p, const char *name)
+{
+	parcel_init(p);
+	parcel_put32(p, 0);	/* strict mode policy */
+	parcel_put_string16(p, svcmgr_id);
+	parcel_put_string16(p, name);
+}
+
+static void run_server(int pair, int size, int ready_fd)
+{
+	static struct parcel p;
+	static int cookie;
+	struct binder_state bs;
+	struct binder_transaction_data txn;
+	char name[32], ok = 'y';
+	uint32_t code;
+
+	binder_open(&bs);
+	service_name(name, sizeof(name), pair);
+	svcmgr_header(&p, name);
+	parcel_put_obj(&p, BINDER_TYPE_BINDER, &cookie, 0);
+	binder_call(&bs, 0, SVC_MGR_ADD_SERVICE, &p, &txn);
+	free_buffer(&bs, &txn);
+
+	if (write(ready_fd, &ok, 1) != 1)
+		die("write");
+	close(ready_fd);
+
+	parcel_init(&p);
+	parcel_alloc(&p, size);
+
+	put_cmd(&bs, BC_ENTER_LOOPER, NULL, 0);
+	for (;;) {
+		if (binder_next(&bs, &txn) != BR_TRANSACTION)
+			continue;
+		code = txn.code;
+		free_buffer(&bs, &txn);
+		binder_reply(&bs, &p);
+		if (code == STRESS_QUIT)
+			break;
+	}
+	/* let the driver have the reply before the process goes */
+	binder_io(&bs, 0);
+	exit(0);
+}
+
+struct result {
+	long count;
+	long long ns;
+};
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void run_client(int pair, long count, int size, int start_fd,
+		       int result_fd)
+{
+	static struct parcel p;
+	struct binder_state bs;
+	struct binder_transaction_data txn;
+	struct parcel reply;
+	struct result res;
+	uint32_t handle;
+	char name[32], c;
+	long i;
+
+	binder_open(&bs);
+	service_name(name, sizeof(name), pair);
+	svcmgr_header(&p, name);
+	binder_call(&bs, 0, SVC_MGR_CHECK_SERVICE, &p, &txn);
+	parcel_from_txn(&reply, &txn);
+	if (parcel_get_handle(&reply, &handle)) {
+		fprintf(stderr, "%s not found\n", name);
+		exit(1);
+	}
+	put_cmd(&bs, BC_ACQUIRE, &handle, sizeof(handle));
+	free_buffer(&bs, &txn);
+
+	parcel_init(&p);
+	parcel_alloc(&p, size);
+
+	/* all clients start when the parent closes the pipe */
+	if (read(start_fd, &c, 1) < 0)
+		die("read");
+
+	res.count = count;
+	res.ns = now_ns();
+	for (i = 0; i < count; i++) {
+		binder_call(&bs, handle, STRESS_PING, &p, &txn);
+		free_buffer(&bs, &txn);
+	}
+	res.ns = now_ns() - res.ns;
+
+	binder_call(&bs, handle, STRESS_QUIT, &p, &txn);
+	free_buffer(&bs, &txn);
+	binder_io(&bs, 0);
+
+	if (write(result_fd, &res, sizeof(res)) != sizeof(res))
+		die("write");
+	exit(0);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-p pairs] [-n transactions] "
+		"[-s bytes] [-d device]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	pid_t manager, pids[2 * MAX_PAIRS];
+	int ready[2], start[2], results[2];
+	int pairs = 1, size = 128, opt, i, n_pids = 0, failed = 0;
+	long count = 10000, total = 0;
+	long long max_ns = 0;
+	struct result res;
+	char c;
+
+	while ((opt = getopt(argc, argv, "p:n:s:d:")) != -1) {
+		switch (opt) {
+		case 'p':
+			pairs = atoi(optarg);
+			break;
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (pairs < 1 || pairs > MAX_PAIRS || count < 1 || size < 0 ||
+	    size > MAX_SIZE)
+		usage(argv[0]);
+
+	if (pipe(ready))
+		die("pipe");
+
+	manager = fork();
+	if (manager < 0)
+		die("fork");
+	if (!manager)
+		run_manager(ready[1]);
+	if (read(ready[0], &c, 1) != 1)
+		die("context manager");
+	if (c == 'n') {
+		waitpid(manager, NULL, 0);
+		manager = 0;
+		printf("using the running context manager\n");
+	}
+
+	for (i = 0; i < pairs; i++) {
+		pids[n_pids] = fork();
+		if (pids[n_pids] < 0)
+			die("fork");
+		if (!pids[n_pids])
+			run_server(i, size, ready[1]);
+		n_pids++;
+		if (read(ready[0], &c, 1) != 1)
+			die("server");
+	}
+
+	/* only the clients may hold these, so that EOF means they are done */
+	if (pipe(start) || pipe(results))
+		die("pipe");
+	for (i = 0; i < pairs; i++) {
+		pids[n_pids] = fork();
+		if (pids[n_pids] < 0)
+			die("fork");
+		if (!pids[n_pids]) {
+			close(start[1]);
+			close(results[0]);
+			run_client(i, count, size, start[0], results[1]);
+		}
+		n_pids++;
+	}
+	close(start[1]);
+	close(results[1]);
+
+	printf("pairs %d transactions %ld bytes %d\n", pairs, count, size);
+	for (i = 0; i < pairs; i++) {
+		if (read(results[0], &res, sizeof(res)) != sizeof(res)) {
+			fprintf(stderr, "a client failed\n");
+			failed = 1;
+			break;
+		}
+		printf("client: %lld transactions/s, %lld us each\n",
+		       res.count * 1000000000LL / res.ns,
+		       res.ns / 1000 / res.count);
+		total += res.count;
+		if (res.ns > max_ns)
+			max_ns = res.ns;
+	}
+	if (!failed)
+		printf("total: %lld transactions/s\n",
+		       total * 1000000000LL / max_ns);
+
+	for (i = 0; i < n_pids; i++) {
+		if (failed)
+			kill(pids[i], SIGTERM);
+		waitpid(pids[i], NULL, 0);
+	}
+	if (manager) {
+		kill(manager, SIGTERM);
+		waitpid(manager, NULL, 0);
+	}
+
+	return failed;
+}